@@ -30,6 +30,7 @@ struct ffaudio_buf {
 	ffuint nonblock :1;
 	int dev_error;
 	ffuint period_ms;
+	_ffau_wbuf wbuf;
 
 	void (*on_event)(void*);
 	void *udata;
@@ -53,6 +54,7 @@ static void ffaaudio_free(ffaudio_buf *b)
 
 	AAudioStream_close(b->as);
 	ffring_free(b->ring);
+	_ffau_wbuf_free(&b->wbuf);
 	ffmem_free(b->errmsg);
 	ffmem_free(b);
 }
@@ -131,6 +133,12 @@ static int ffaaudio_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 {
 	int rc = FFAUDIO_ERROR, r;
 	AAudioStreamBuilder *asb;
+	if (flags & FFAUDIO_O_NONINTERLEAVED) {
+		b->err = "non-interleaved access is not supported";
+		b->errcode = 0;
+		return FFAUDIO_ERROR;
+	}
+
 	if (0 != (r = AAudio_createStreamBuilder(&asb))) {
 		b->err = "AAudio_createStreamBuilder()";
 		b->errcode = r;
@@ -240,6 +248,7 @@ static int ffaaudio_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 		goto end;
 	}
 
+	b->wbuf.frame_size = b->frame_size;
 	rc = 0;
 
 end:
@@ -419,9 +428,22 @@ static int ffaaudio_write(ffaudio_buf *b, const void *data, ffsize len)
 	}
 }
 
+static int ffaaudio_write_begin(ffaudio_buf *b, void **ptr, ffsize *frames)
+{
+	return _ffau_wbuf_begin(&b->wbuf, b, ffaaudio_write, ptr, frames);
+}
+
+static int ffaaudio_write_commit(ffaudio_buf *b, ffsize frames)
+{
+	return _ffau_wbuf_commit(&b->wbuf, b, ffaaudio_write, frames);
+}
+
 static int ffaaudio_drain(ffaudio_buf *b)
 {
 	int r;
+	if (0 != (r = _ffau_wbuf_flush(&b->wbuf, b, ffaaudio_write)))
+		return (r > 0) ? 0 : r;
+
 	for (;;) {
 
 		if (b->dev_error != 0) {
@@ -500,4 +522,6 @@ const struct ffaudio_interface ffaaudio = {
 	ffaaudio_write, ffaaudio_drain,
 	ffaaudio_read,
 	NULL,
+	NULL,
+	ffaaudio_write_begin, ffaaudio_write_commit,
 };
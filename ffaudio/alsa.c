@@ -8,6 +8,7 @@
 #include <ffbase/stringz.h>
 
 #include <alsa/asoundlib.h>
+#include <poll.h>
 #include <time.h>
 
 
@@ -152,16 +153,25 @@ const char* ffalsa_dev_error(ffaudio_dev *d)
 }
 
 
+#define ALSA_CHAN_MAX  64
+
 struct ffaudio_buf {
 	snd_pcm_t *pcm;
 	ffuint frame_size;
-	ffuint period_ms;
+	ffuint sample_size;
+	ffuint noninterleaved;
+	ffuint buffer_ms;
+	ffuint rate;
 	ffuint bufsize;
 	ffuint channels;
 	ffuint nonblock;
+	ffuint drain_wake; // avail_min is set to the buffer size by non-blocking drain()
+	snd_pcm_uframes_t avail_min;
 
+	const snd_pcm_channel_area_t *mmap_areas;
 	snd_pcm_uframes_t mmap_frames;
 	snd_pcm_uframes_t mmap_off;
+	void *chan_ptrs[ALSA_CHAN_MAX]; // non-interleaved read(), write_begin()
 
 	int retcode;
 	const char *errfunc; // libALSA function name
@@ -188,11 +198,15 @@ void ffalsa_free(ffaudio_buf *b)
 	ffmem_free(b);
 }
 
+/* int24 in 32-bit container (the sample is in the high 3 bytes) is S32_LE for ALSA:
+ drivers of 24-bit hardware report S32_LE with 24 significant bits.
+The list is searched from the end by alsa_find_best_format():  S32_LE is reported as int32. */
 static const ffushort fmts[] = {
 	FFAUDIO_F_INT8,
 	FFAUDIO_F_UINT8,
 	FFAUDIO_F_INT16,
 	FFAUDIO_F_INT24,
+	FFAUDIO_F_INT24_4,
 	FFAUDIO_F_INT32,
 	FFAUDIO_F_FLOAT32,
 	FFAUDIO_F_FLOAT64,
@@ -203,6 +217,7 @@ static const ffuint alsa_fmts[] = {
 	SND_PCM_FORMAT_S16_LE,
 	SND_PCM_FORMAT_S24_3LE,
 	SND_PCM_FORMAT_S32_LE,
+	SND_PCM_FORMAT_S32_LE,
 	SND_PCM_FORMAT_FLOAT_LE,
 	SND_PCM_FORMAT_FLOAT64_LE,
 };
@@ -245,6 +260,11 @@ static int alsa_apply_format(ffaudio_buf *b, snd_pcm_hw_params_t *params, ffaudi
 		change = 1;
 	}
 
+	if (conf->channels > ALSA_CHAN_MAX) {
+		b->errfunc = "channels >64 are not supported";
+		return FFAUDIO_ERROR;
+	}
+
 	ffuint ch = conf->channels;
 	if (0 != (e = snd_pcm_hw_params_set_channels_near(b->pcm, params, &ch))) {
 		b->errfunc = "snd_pcm_hw_params_set_channels_near";
@@ -252,8 +272,8 @@ static int alsa_apply_format(ffaudio_buf *b, snd_pcm_hw_params_t *params, ffaudi
 		return FFAUDIO_ERROR;
 	}
 	if (ch != conf->channels) {
-		if (ch > 2) {
-			b->errfunc = "channels >2 are not supported";
+		if (ch > ALSA_CHAN_MAX) {
+			b->errfunc = "channels >64 are not supported";
 			return FFAUDIO_ERROR;
 		}
 		conf->channels = ch;
@@ -277,10 +297,108 @@ static int alsa_apply_format(ffaudio_buf *b, snd_pcm_hw_params_t *params, ffaudi
 	return 0;
 }
 
-/** usec -> bytes */
-static ffuint buffer_usec_to_size(const ffaudio_conf *conf, ffuint usec)
+/** Set buffer and period sizes */
+static int alsa_apply_geometry(ffaudio_buf *b, snd_pcm_hw_params_t *params, ffaudio_conf *conf, ffuint flags)
+{
+	int e;
+	snd_pcm_uframes_t frames;
+
+	if (conf->buffer_frames != 0) {
+		frames = conf->buffer_frames;
+		if (0 != (e = snd_pcm_hw_params_set_buffer_size_near(b->pcm, params, &frames))) {
+			b->errfunc = "snd_pcm_hw_params_set_buffer_size_near";
+			b->err = e;
+			return FFAUDIO_ERROR;
+		}
+
+	} else {
+		if (conf->buffer_length_msec == 0) {
+			conf->buffer_length_msec = 500;
+			if (flags & FFAUDIO_O_LOW_LATENCY)
+				conf->buffer_length_msec = 10;
+			else if (flags & FFAUDIO_O_POWER_SAVE)
+				conf->buffer_length_msec = 1000;
+		}
+		ffuint bufsize_usec = conf->buffer_length_msec * 1000;
+		if (0 != (e = snd_pcm_hw_params_set_buffer_time_near(b->pcm, params, &bufsize_usec, NULL))) {
+			b->errfunc = "snd_pcm_hw_params_set_buffer_time_near";
+			b->err = e;
+			return FFAUDIO_ERROR;
+		}
+	}
+
+	frames = conf->period_frames;
+	if (frames == 0 && (flags & (FFAUDIO_O_LOW_LATENCY | FFAUDIO_O_POWER_SAVE))) {
+		// 2 periods:  the lowest latency for this buffer size, or the least wakeups
+		snd_pcm_hw_params_get_buffer_size(params, &frames);
+		frames /= 2;
+	}
+	if (frames != 0
+		&& 0 != (e = snd_pcm_hw_params_set_period_size_near(b->pcm, params, &frames, NULL))) {
+		b->errfunc = "snd_pcm_hw_params_set_period_size_near";
+		b->err = e;
+		return FFAUDIO_ERROR;
+	}
+	return 0;
+}
+
+/** Set software parameters */
+static int alsa_apply_swparams(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags, snd_pcm_uframes_t period_size)
 {
-	return (unsigned long long)conf->sample_rate * _ffau_f_bits(conf->format)/8 * conf->channels * usec / 1000000;
+	snd_pcm_sw_params_t *sw;
+	snd_pcm_uframes_t boundary;
+	int e;
+	snd_pcm_sw_params_alloca(&sw);
+
+	if (0 != (e = snd_pcm_sw_params_current(b->pcm, sw))) {
+		b->errfunc = "snd_pcm_sw_params_current";
+		goto end;
+	}
+	snd_pcm_sw_params_get_boundary(sw, &boundary);
+
+	b->avail_min = (conf->avail_min != 0) ? conf->avail_min : period_size;
+	if (0 != (e = snd_pcm_sw_params_set_avail_min(b->pcm, sw, b->avail_min))) {
+		b->errfunc = "snd_pcm_sw_params_set_avail_min";
+		goto end;
+	}
+
+	snd_pcm_uframes_t start = conf->start_threshold;
+	if (start == 0 && (flags & FFAUDIO_O_LOW_LATENCY)
+		&& (flags & 0x0f) == FFAUDIO_DEV_PLAYBACK)
+		start = period_size; // don't wait until the buffer is full
+	if (start != 0
+		&& 0 != (e = snd_pcm_sw_params_set_start_threshold(b->pcm, sw, start))) {
+		b->errfunc = "snd_pcm_sw_params_set_start_threshold";
+		goto end;
+	}
+
+	if (conf->stop_threshold != 0) {
+		snd_pcm_uframes_t stop = (conf->stop_threshold != ~0U) ? conf->stop_threshold : boundary;
+		if (0 != (e = snd_pcm_sw_params_set_stop_threshold(b->pcm, sw, stop))) {
+			b->errfunc = "snd_pcm_sw_params_set_stop_threshold";
+			goto end;
+		}
+	}
+
+	if (conf->silence_threshold != 0) {
+		if (0 != (e = snd_pcm_sw_params_set_silence_threshold(b->pcm, sw, conf->silence_threshold))
+			|| 0 != (e = snd_pcm_sw_params_set_silence_size(b->pcm, sw, conf->silence_threshold))) {
+			b->errfunc = "snd_pcm_sw_params_set_silence_threshold";
+			goto end;
+		}
+	}
+
+	if (0 != (e = snd_pcm_sw_params(b->pcm, sw))) {
+		b->errfunc = "snd_pcm_sw_params";
+		goto end;
+	}
+
+	conf->avail_min = b->avail_min;
+	return 0;
+
+end:
+	b->err = e;
+	return FFAUDIO_ERROR;
 }
 
 int ffalsa_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
@@ -289,6 +407,7 @@ int ffalsa_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 	int rc = FFAUDIO_ERROR;
 	int e;
 	b->nonblock = !!(flags & FFAUDIO_O_NONBLOCK);
+	b->noninterleaved = !!(flags & FFAUDIO_O_NONINTERLEAVED);
 
 	b->errfunc = NULL;
 
@@ -314,7 +433,7 @@ int ffalsa_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 		goto end;
 	}
 
-	int access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+	int access = (b->noninterleaved) ? SND_PCM_ACCESS_MMAP_NONINTERLEAVED : SND_PCM_ACCESS_MMAP_INTERLEAVED;
 	if (0 != (e = snd_pcm_hw_params_set_access(b->pcm, params, access))) {
 		b->errfunc = "snd_pcm_hw_params_set_access";
 		b->err = e;
@@ -326,12 +445,8 @@ int ffalsa_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 		goto end;
 	}
 
-	if (conf->buffer_length_msec == 0)
-		conf->buffer_length_msec = 500;
-	ffuint bufsize_usec = conf->buffer_length_msec * 1000;
-	if (0 != (e = snd_pcm_hw_params_set_buffer_time_near(b->pcm, params, &bufsize_usec, NULL))) {
-		b->errfunc = "snd_pcm_hw_params_set_buffer_time_near";
-		b->err = e;
+	if (0 != (e = alsa_apply_geometry(b, params, conf, flags))) {
+		rc = e;
 		goto end;
 	}
 
@@ -341,10 +456,26 @@ int ffalsa_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 		goto end;
 	}
 
-	b->frame_size = _ffau_f_bits(conf->format)/8 * conf->channels;
-	conf->buffer_length_msec = bufsize_usec / 1000;
-	b->period_ms = conf->buffer_length_msec / 3;
-	b->bufsize = buffer_usec_to_size(conf, bufsize_usec);
+	snd_pcm_uframes_t buffer_size, period_size;
+	if (0 != (e = snd_pcm_get_params(b->pcm, &buffer_size, &period_size))) {
+		b->errfunc = "snd_pcm_get_params";
+		b->err = e;
+		goto end;
+	}
+
+	if (0 != (e = alsa_apply_swparams(b, conf, flags, period_size))) {
+		rc = e;
+		goto end;
+	}
+
+	b->sample_size = _ffau_f_bits(conf->format)/8;
+	b->frame_size = b->sample_size * conf->channels;
+	conf->buffer_frames = buffer_size;
+	conf->period_frames = period_size;
+	conf->buffer_length_msec = (ffuint64)buffer_size * 1000 / conf->sample_rate;
+	b->buffer_ms = ffmax(conf->buffer_length_msec, 1);
+	b->rate = conf->sample_rate;
+	b->bufsize = buffer_size * b->frame_size;
 	b->channels = conf->channels;
 
 	return 0;
@@ -358,15 +489,62 @@ end:
 	return rc;
 }
 
-static int _ff_sleep(ffuint msec)
+static int _ff_sleep_usec(ffuint64 usec)
 {
 	struct timespec ts = {
-		.tv_sec = msec / 1000,
-		.tv_nsec = (msec % 1000) * 1000000,
+		.tv_sec = usec / 1000000,
+		.tv_nsec = (usec % 1000000) * 1000,
 	};
 	return nanosleep(&ts, NULL);
 }
 
+/** Wait until the device is ready for I/O (avail >= avail_min) or the buffer time passes
+Return 0 on success or timeout */
+static int alsa_wait(ffaudio_buf *b)
+{
+	int r;
+	if (0 > (r = snd_pcm_wait(b->pcm, b->buffer_ms))) {
+		b->errfunc = "snd_pcm_wait";
+		b->err = r;
+		return r;
+	}
+	return 0;
+}
+
+#define ALSA_POLLFDS_MAX  8
+
+/** Check the device's descriptors without blocking.
+Also clears the pending events of plugins (e.g. dmix timer),
+ so the user's poll() on these descriptors doesn't spin.
+Return 1 if the device is ready for I/O */
+static int alsa_ready(ffaudio_buf *b)
+{
+	struct pollfd fds[ALSA_POLLFDS_MAX];
+	unsigned short revents;
+	int n = snd_pcm_poll_descriptors(b->pcm, fds, ALSA_POLLFDS_MAX);
+	if (n <= 0
+		|| 0 >= poll(fds, n, 0)
+		|| 0 != snd_pcm_poll_descriptors_revents(b->pcm, fds, n, &revents))
+		return 0;
+	return !!(revents & (POLLIN | POLLOUT | POLLERR));
+}
+
+/** Set the number of available frames at which the device signals its descriptors */
+static int alsa_avail_min(ffaudio_buf *b, snd_pcm_uframes_t frames)
+{
+	snd_pcm_sw_params_t *sw;
+	int e;
+	snd_pcm_sw_params_alloca(&sw);
+	if (0 != (e = snd_pcm_sw_params_current(b->pcm, sw))
+		|| 0 != (e = snd_pcm_sw_params_set_avail_min(b->pcm, sw, frames))
+		|| 0 != (e = snd_pcm_sw_params(b->pcm, sw))) {
+		b->errfunc = "snd_pcm_sw_params";
+		b->err = e;
+		return e;
+	}
+	return 0;
+}
+
 static int alsa_handle_error(ffaudio_buf *b, int r)
 {
 	switch (r) {
@@ -375,8 +553,9 @@ static int alsa_handle_error(ffaudio_buf *b, int r)
 		return 0;
 
 	case -ESTRPIPE:
+		// there's no event for the end of resume:  poll the device
 		while (-EAGAIN == (r = snd_pcm_resume(b->pcm))) {
-			_ff_sleep(b->period_ms);
+			_ff_sleep_usec(10000);
 		}
 		if (r == 0)
 			return 0;
@@ -462,13 +641,24 @@ int ffalsa_clear(ffaudio_buf *b)
 	return 0;
 }
 
-static int alsa_writeonce(ffaudio_buf *b, const void *data, ffsize len)
+/** Address of the frame within the mmap area of a channel */
+static inline char* alsa_area_ptr(const snd_pcm_channel_area_t *a, snd_pcm_uframes_t off)
+{
+	return (char*)a->addr + (a->first + off * a->step) / 8;
+}
+
+/** Bytes per frame in user's buffer:  per channel in non-interleaved mode */
+static inline ffuint alsa_user_frame(ffaudio_buf *b)
+{
+	return (b->noninterleaved) ? b->sample_size : b->frame_size;
+}
+
+/** Get the writable mmap region
+Return the number of frames in the region;  0: buffer is full */
+static int alsa_write_beginonce(ffaudio_buf *b, snd_pcm_uframes_t frames)
 {
 	int e;
-	const snd_pcm_channel_area_t *areas;
 	snd_pcm_sframes_t r;
-	snd_pcm_uframes_t frames;
-	snd_pcm_uframes_t off;
 
 	if (0 > (r = snd_pcm_avail_update(b->pcm))) { // needed for snd_pcm_mmap_begin()
 		b->errfunc = "snd_pcm_avail_update";
@@ -476,22 +666,21 @@ static int alsa_writeonce(ffaudio_buf *b, const void *data, ffsize len)
 		return -FFAUDIO_ERROR;
 	}
 
-	frames = len / b->frame_size;
-	if (0 != (e = snd_pcm_mmap_begin(b->pcm, &areas, &off, &frames))) {
+	b->mmap_frames = frames;
+	if (0 != (e = snd_pcm_mmap_begin(b->pcm, &b->mmap_areas, &b->mmap_off, &b->mmap_frames))) {
+		b->mmap_frames = 0;
 		b->errfunc = "snd_pcm_mmap_begin";
 		b->err = e;
 		return -FFAUDIO_ERROR;
 	}
 
-	if (frames == 0) {
-		return 0;
-	}
-
-	ffmem_copy((char*)areas[0].addr + off * areas[0].step/8
-		, (char*)data
-		, frames * b->frame_size);
+	return b->mmap_frames;
+}
 
-	r = snd_pcm_mmap_commit(b->pcm, off, frames);
+static int alsa_write_commitonce(ffaudio_buf *b, snd_pcm_uframes_t frames)
+{
+	snd_pcm_sframes_t r = snd_pcm_mmap_commit(b->pcm, b->mmap_off, frames);
+	b->mmap_frames = 0;
 	if (r >= 0 && (snd_pcm_uframes_t)r != frames)
 		r = -EPIPE;
 	if (r < 0) {
@@ -499,8 +688,7 @@ static int alsa_writeonce(ffaudio_buf *b, const void *data, ffsize len)
 		b->err = r;
 		return -FFAUDIO_ERROR;
 	}
-
-	return frames * b->frame_size;
+	return 0;
 }
 
 static int alsa_readonce(ffaudio_buf *b, const void **data)
@@ -537,15 +725,37 @@ static int alsa_readonce(ffaudio_buf *b, const void **data)
 	if (b->mmap_frames == 0)
 		return 0;
 
-	*data = (char*)areas[0].addr + b->mmap_off * areas[0].step/8;
+	if (b->noninterleaved) {
+		for (ffuint c = 0;  c != b->channels;  c++) {
+			b->chan_ptrs[c] = alsa_area_ptr(&areas[c], b->mmap_off);
+		}
+		*data = b->chan_ptrs;
+	} else {
+		*data = alsa_area_ptr(&areas[0], b->mmap_off);
+	}
+
+	return b->mmap_frames * alsa_user_frame(b);
+}
 
-	return b->mmap_frames * b->frame_size;
+static int alsa_io_error(ffaudio_buf *b)
+{
+	if (b->err == -ENODEV)
+		return -FFAUDIO_EDEV_OFFLINE;
+	return -FFAUDIO_ERROR;
 }
 
-int ffalsa_write(ffaudio_buf *b, const void *data, ffsize len)
+/** Get the writable mmap region;  wait or start the stream if the buffer is full
+Return the number of frames in the region;  0: buffer is full (FFAUDIO_O_NONBLOCK) */
+static int alsa_write_begin(ffaudio_buf *b, snd_pcm_uframes_t frames)
 {
+	if (b->drain_wake) {
+		if (0 != alsa_avail_min(b, b->avail_min))
+			return -FFAUDIO_ERROR;
+		b->drain_wake = 0;
+	}
+
 	for (;;) {
-		int r = alsa_writeonce(b, data, len);
+		int r = alsa_write_beginonce(b, frames);
 		if (r > 0) {
 			return r;
 		} else if (r == 0) {
@@ -558,31 +768,105 @@ int ffalsa_write(ffaudio_buf *b, const void *data, ffsize len)
 			continue;
 		}
 
-		if (b->nonblock)
+		if (b->nonblock) {
+			if (alsa_ready(b))
+				continue;
 			return 0;
+		}
 
-		_ff_sleep(b->period_ms);
+		if (0 != alsa_wait(b)
+			&& 0 != alsa_handle_error(b, b->err))
+			break;
 	}
 
-	if (b->err == -ENODEV)
-		return -FFAUDIO_EDEV_OFFLINE;
-	return -FFAUDIO_ERROR;
+	return alsa_io_error(b);
 }
 
-int ffalsa_drain(ffaudio_buf *b)
+int ffalsa_write(ffaudio_buf *b, const void *data, ffsize len)
 {
 	for (;;) {
-		snd_pcm_sframes_t r = snd_pcm_avail_update(b->pcm);
+		int r = alsa_write_begin(b, len / alsa_user_frame(b));
 		if (r <= 0)
+			return r;
+
+		const snd_pcm_channel_area_t *areas = b->mmap_areas;
+		if (b->noninterleaved) {
+			const void *const *chans = data;
+			for (ffuint c = 0;  c != b->channels;  c++) {
+				ffmem_copy(alsa_area_ptr(&areas[c], b->mmap_off), chans[c], r * b->sample_size);
+			}
+		} else {
+			ffmem_copy(alsa_area_ptr(&areas[0], b->mmap_off), data, r * b->frame_size);
+		}
+
+		if (0 == alsa_write_commitonce(b, r))
+			return r * alsa_user_frame(b);
+		if (0 != alsa_handle_error(b, b->err))
+			return alsa_io_error(b);
+	}
+}
+
+int ffalsa_write_begin(ffaudio_buf *b, void **ptr, ffsize *frames)
+{
+	int r = alsa_write_begin(b, *frames);
+	if (r <= 0)
+		return r;
+
+	if (b->noninterleaved) {
+		for (ffuint c = 0;  c != b->channels;  c++) {
+			b->chan_ptrs[c] = alsa_area_ptr(&b->mmap_areas[c], b->mmap_off);
+		}
+		*ptr = b->chan_ptrs;
+	} else {
+		*ptr = alsa_area_ptr(&b->mmap_areas[0], b->mmap_off);
+	}
+	*frames = r;
+	return r;
+}
+
+/** Note: the data is lost if the underrun has occurred meanwhile */
+int ffalsa_write_commit(ffaudio_buf *b, ffsize frames)
+{
+	if (0 != alsa_write_commitonce(b, frames)
+		&& 0 != alsa_handle_error(b, b->err))
+		return alsa_io_error(b);
+	return 0;
+}
+
+int ffalsa_drain(ffaudio_buf *b)
+{
+	for (;;) {
+		snd_pcm_sframes_t delay;
+		int r = snd_pcm_delay(b->pcm, &delay);
+		if (r == -EPIPE)
+			return 1; // underrun:  all data has been played
+		if (r != 0) {
+			b->errfunc = "snd_pcm_delay";
+			b->err = r;
+			if (0 != alsa_handle_error(b, r))
+				return alsa_io_error(b);
+			continue;
+		}
+		if (delay <= 0)
 			return 1;
 
 		if (0 != ffalsa_start(b))
 			return -FFAUDIO_ERROR;
 
-		if (b->nonblock)
+		if (b->nonblock) {
+			if (!b->drain_wake) {
+				// signal the descriptors only when the buffer is empty
+				if (0 != alsa_avail_min(b, b->bufsize / b->frame_size))
+					return -FFAUDIO_ERROR;
+				b->drain_wake = 1;
+			}
+			if (alsa_ready(b))
+				continue;
 			return 0;
+		}
 
-		_ff_sleep(b->period_ms);
+		// sleep until the last written frame is played
+		_ff_sleep_usec((ffuint64)delay * 1000000 / b->rate);
 	}
 }
 
@@ -601,10 +885,15 @@ int ffalsa_read(ffaudio_buf *b, const void **data)
 		if (0 != ffalsa_start(b))
 			break;
 
-		if (b->nonblock)
+		if (b->nonblock) {
+			if (alsa_ready(b))
+				continue;
 			return 0;
+		}
 
-		_ff_sleep(b->period_ms);
+		if (0 != alsa_wait(b)
+			&& 0 != alsa_handle_error(b, b->err))
+			break;
 	}
 
 	if (b->err == -ENODEV)
@@ -612,6 +901,19 @@ int ffalsa_read(ffaudio_buf *b, const void **data)
 	return -FFAUDIO_ERROR;
 }
 
+int ffalsa_poll_fds(ffaudio_buf *b, struct pollfd *fds, ffuint cap)
+{
+	int n = snd_pcm_poll_descriptors_count(b->pcm);
+	if (n >= 0 && (ffuint)n > cap)
+		return n;
+	if (n < 0 || 0 > (n = snd_pcm_poll_descriptors(b->pcm, fds, n))) {
+		b->errfunc = "snd_pcm_poll_descriptors";
+		b->err = n;
+		return -FFAUDIO_ERROR;
+	}
+	return n;
+}
+
 const char* ffalsa_error(ffaudio_buf *b)
 {
 	ffmem_free(b->errmsg);
@@ -642,4 +944,7 @@ const struct ffaudio_interface ffalsa = {
 	ffalsa_drain,
 	ffalsa_read,
 	NULL,
+	ffalsa_poll_fds,
+	ffalsa_write_begin,
+	ffalsa_write_commit,
 };
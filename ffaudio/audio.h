@@ -55,10 +55,15 @@ enum FFAUDIO_F {
 	FFAUDIO_F_UINT8 = 8 | 0x0400,
 	FFAUDIO_F_INT16 = 16,
 	FFAUDIO_F_INT24 = 24,
-	FFAUDIO_F_INT24_4 = 32 | 0x0200,
+	FFAUDIO_F_INT24_4 = 32 | 0x0200, // 24-bit sample in the high 3 bytes of 32-bit container
 	FFAUDIO_F_INT32 = 32,
 	FFAUDIO_F_FLOAT32 = 32 | 0x0100,
 	FFAUDIO_F_FLOAT64 = 64 | 0x0100,
+
+	/** Half precision (IEEE 754 binary16) and bfloat16 (the upper half of float32).
+	Not supported by audio devices:  use pcm_convert() */
+	FFAUDIO_F_FLOAT16 = 16 | 0x0100,
+	FFAUDIO_F_BFLOAT16 = 16 | 0x0900,
 };
 
 enum FFAUDIO_OPEN {
@@ -74,7 +79,8 @@ enum FFAUDIO_OPEN {
 	/** Use non-blocking I/O
 	ffaudio_write(), ffaudio_drain(), ffaudio_read() won't block but will return 0
 	 if the operation can't be completed immediately.
-	'ffaudio_conf.on_event()' will be called to notify user */
+	'ffaudio_conf.on_event()' will be called to notify user (AAudio, PulseAudio, JACK),
+	 or the user polls the descriptors from ffaudio_interface.poll_fds() (Linux) */
 	FFAUDIO_O_NONBLOCK = 0x10,
 
 	/** Open device in exclusive mode (AAudio, WASAPI) */
@@ -86,13 +92,24 @@ enum FFAUDIO_OPEN {
 	/** Return FFAUDIO_ESYNC when underrun/overrun is detected */
 	FFAUDIO_O_UNSYNC_NOTIFY = 0x80,
 
-	/** Perfomance mode (AAudio) */
+	/** Perfomance mode (AAudio, ALSA)
+	ALSA, unless set explicitly in ffaudio_conf:
+	  * POWER_SAVE: 1000ms buffer of 2 periods
+	  * LOW_LATENCY: 10ms buffer of 2 periods;  playback starts after the first period is written */
 	FFAUDIO_O_POWER_SAVE = 0x0100,
 	FFAUDIO_O_LOW_LATENCY = 0x0200,
 
 	/** WASAPI will set 'ffaudio_conf.event_h'
 	 and let the user perform the signal-delivering work via signal() */
 	FFAUDIO_O_USER_EVENTS = 0x0400,
+
+	/** Non-interleaved (planar) data (ALSA;  other APIs: open() returns FFAUDIO_ERROR)
+	Maps the channels directly onto the device's per-channel mmap areas:
+	  * write(): 'data' is an array of pointers to the channels' data (const void*[channels]);
+	     'len' and the return value are the sizes per channel
+	  * read(): '*buffer' is set to an array of pointers to the channels' data (const void*[channels]);
+	     the return value is the size per channel */
+	FFAUDIO_O_NONINTERLEAVED = 0x0800,
 };
 
 typedef struct ffaudio_init_conf {
@@ -133,7 +150,7 @@ typedef struct ffaudio_conf {
 	On return from open(), this is the actual buffer length from audio subsystem */
 	unsigned buffer_length_msec;
 
-	/** In a non-blocking mode AAudio calls this function when:
+	/** In a non-blocking mode AAudio, PulseAudio, JACK call this function when:
 	* some data becomes available in audio buffer for reading (recording);
 	* free space is available in audio buffer for writing (playback).
 	WARNING: usually this is just for sending a wakeup signal to the main thread;
@@ -147,9 +164,23 @@ typedef struct ffaudio_conf {
 	The handle is closed by ffaudio_interface.free(). */
 	HANDLE event_h;
 #endif
+
+	/** ALSA: buffer and period size (frames)
+	0: use buffer_length_msec and the default period
+	On return from open(), these are the actual values */
+	unsigned buffer_frames;
+	unsigned period_frames;
+
+	/** ALSA software parameters (frames)
+	0: default */
+	unsigned avail_min; // wake up when this many frames can be written/read;  default: period
+	unsigned start_threshold; // start automatically when this many frames are written;  default: ffaudio starts it when the buffer is full
+	unsigned stop_threshold; // stop (xrun) when this many frames are available;  default: buffer size;  ~0: never stop
+	unsigned silence_threshold; // fill up with silence when less than this many frames are left to play
 } ffaudio_conf;
 
 typedef struct ffaudio_dev ffaudio_dev;
+struct pollfd;
 typedef struct ffaudio_buf ffaudio_buf;
 
 typedef struct ffaudio_interface {
@@ -232,7 +263,8 @@ typedef struct ffaudio_interface {
 	If audio buffer is full:
 	  * the function blocks the thread until it can make progress
 	  * or returns 0 (FFAUDIO_O_NONBLOCK)
-	data: input data (interleaved, consistent with ffaudio_conf.format and ffaudio_conf.channels)
+	data: input data (interleaved, consistent with ffaudio_conf.format and ffaudio_conf.channels;
+	  see also FFAUDIO_O_NONINTERLEAVED)
 	len: input data size (bytes)
 	Return
 	  * number of bytes written
@@ -246,7 +278,8 @@ typedef struct ffaudio_interface {
 	Return
 	  * 1: done
 	  * 0: buffer is not yet empty (FFAUDIO_O_NONBLOCK)
-	  * -FFAUDIO_ERROR: Error */
+	  * -FFAUDIO_ERROR: Error
+	  * -FFAUDIO_EDEV_OFFLINE: Device went offline */
 	int (*drain)(ffaudio_buf *b);
 
 	/** Read data from audio capture device
@@ -267,6 +300,36 @@ typedef struct ffaudio_interface {
 	/** WASAPI: user calls this function when 'event_h' signals.
 	This is required for ffaudio to keep track on the buffer's filled data. */
 	void (*signal)(ffaudio_buf *b);
+
+	/** Get the descriptors to poll for the buffer's events in a non-blocking mode (Linux).
+	User adds them to its event loop (poll(), epoll)
+	 and calls write()/drain()/read() again when any of them signals.
+	ALSA, OSS: device descriptors with the requested 'events';
+	  on_event() isn't called (there's no notification thread).
+	PulseAudio, JACK: eventfd (POLLIN) signalled along with on_event().
+	fds: output array
+	Return the number of descriptors;  >cap: 'fds' is too small
+	  * -FFAUDIO_ERROR: the buffer isn't opened in a non-blocking mode (PulseAudio, JACK) */
+	int (*poll_fds)(ffaudio_buf *b, struct pollfd *fds, unsigned cap);
+
+	/** Get the region to render playback data into (write() without a copy)
+	ALSA: the device's mmap area;  PulseAudio: the buffer from pa_stream_begin_write();
+	 other backends: an internal buffer which write_commit() passes to write().
+	The stream must be opened with open(FFAUDIO_PLAYBACK)
+	If audio buffer is full:
+	  * the function blocks the thread until it can make progress
+	  * or returns 0 (FFAUDIO_O_NONBLOCK)
+	ptr: the region (interleaved;  FFAUDIO_O_NONINTERLEAVED: array of pointers to the channels' regions)
+	frames: [in] the number of frames to write;  [out] the number of frames in the region
+	Return
+	  * number of frames in the region
+	  * <0: error (see write()) */
+	int (*write_begin)(ffaudio_buf *b, void **ptr, size_t *frames);
+
+	/** Pass the data rendered into the region from write_begin() to the device
+	frames: the number of frames rendered
+	Return 0 on success;  <0: error (see write()) */
+	int (*write_commit)(ffaudio_buf *b, size_t frames);
 } ffaudio_interface;
 
 #ifdef __cplusplus
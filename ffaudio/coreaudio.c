@@ -216,6 +216,7 @@ struct ffaudio_buf {
 	ffuint nonblock;
 	ffstr buf_locked;
 	ffring_head rhead;
+	_ffau_wbuf wbuf;
 
 	const char *errfunc;
 };
@@ -235,6 +236,7 @@ void ffcoreaudio_free(ffaudio_buf *b)
 
 	ffring_free(b->ring);
 	AudioDeviceDestroyIOProcID(b->dev, b->aprocid);
+	_ffau_wbuf_free(&b->wbuf);
 	ffmem_free(b);
 }
 
@@ -281,6 +283,11 @@ int ffcoreaudio_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 	ffuint capture = (flags & 0x0f) == FFAUDIO_DEV_CAPTURE;
 	b->nonblock = !!(flags & FFAUDIO_O_NONBLOCK);
 
+	if (flags & FFAUDIO_O_NONINTERLEAVED) {
+		b->errfunc = "non-interleaved access is not supported";
+		return FFAUDIO_ERROR;
+	}
+
 	int dev = -1;
 	if (conf->device_id != NULL)
 		dev = *(int*)conf->device_id;
@@ -336,6 +343,7 @@ int ffcoreaudio_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 	b->period_ms = conf->buffer_length_msec / 4;
 
 	b->dev = dev;
+	b->wbuf.frame_size = _ffau_f_bits(conf->format)/8 * conf->channels;
 	rc = 0;
 
 end:
@@ -457,9 +465,22 @@ int ffcoreaudio_write(ffaudio_buf *b, const void *data, ffsize len)
 	}
 }
 
+int ffcoreaudio_write_begin(ffaudio_buf *b, void **ptr, ffsize *frames)
+{
+	return _ffau_wbuf_begin(&b->wbuf, b, ffcoreaudio_write, ptr, frames);
+}
+
+int ffcoreaudio_write_commit(ffaudio_buf *b, ffsize frames)
+{
+	return _ffau_wbuf_commit(&b->wbuf, b, ffcoreaudio_write, frames);
+}
+
 int ffcoreaudio_drain(ffaudio_buf *b)
 {
 	int r;
+	if (0 != (r = _ffau_wbuf_flush(&b->wbuf, b, ffcoreaudio_write)))
+		return (r > 0) ? 0 : r;
+
 	for (;;) {
 		ffstr s;
 		ffsize free;
@@ -519,4 +540,7 @@ const struct ffaudio_interface ffcoreaudio = {
 	ffcoreaudio_drain,
 	ffcoreaudio_read,
 	NULL,
+	NULL,
+	ffcoreaudio_write_begin,
+	ffcoreaudio_write_commit,
 };
@@ -176,6 +176,7 @@ struct ffaudio_buf {
 	ffuint last_filled;
 	ffuint drained;
 	ffuint nonblock;
+	_ffau_wbuf wbuf;
 
 	const char *errfunc;
 	ffuint err;
@@ -204,6 +205,7 @@ void ffdsound_free(ffaudio_buf *b)
 		IDirectSoundCaptureBuffer_Release(b->capt_buf);
 	if (b->capt_dev != NULL)
 		IDirectSoundCapture_Release(b->capt_dev);
+	_ffau_wbuf_free(&b->wbuf);
 	ffmem_free(b->errmsg);
 	ffmem_free(b);
 }
@@ -328,10 +330,19 @@ end:
 
 int ffdsound_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 {
+	if (flags & FFAUDIO_O_NONINTERLEAVED) {
+		b->errfunc = "non-interleaved access is not supported";
+		b->err = 0;
+		return FFAUDIO_ERROR;
+	}
+
 	b->nonblock = !!(flags & FFAUDIO_O_NONBLOCK);
-	if ((flags & 0x0f) == FFAUDIO_DEV_PLAYBACK)
-		return dsound_open_play(b, conf, flags);
-	return dsound_open_capt(b, conf, flags);
+	if ((flags & 0x0f) != FFAUDIO_DEV_PLAYBACK)
+		return dsound_open_capt(b, conf, flags);
+
+	int r = dsound_open_play(b, conf, flags);
+	b->wbuf.frame_size = _ffau_f_bits(conf->format)/8 * conf->channels;
+	return r;
 }
 
 int ffdsound_start(ffaudio_buf *b)
@@ -528,12 +539,25 @@ int ffdsound_write(ffaudio_buf *b, const void *data, ffsize len)
 	}
 }
 
+int ffdsound_write_begin(ffaudio_buf *b, void **ptr, ffsize *frames)
+{
+	return _ffau_wbuf_begin(&b->wbuf, b, ffdsound_write, ptr, frames);
+}
+
+int ffdsound_write_commit(ffaudio_buf *b, ffsize frames)
+{
+	return _ffau_wbuf_commit(&b->wbuf, b, ffdsound_write, frames);
+}
+
 int ffdsound_drain(ffaudio_buf *b)
 {
+	int r;
+	if (0 != (r = _ffau_wbuf_flush(&b->wbuf, b, ffdsound_write)))
+		return (r > 0) ? 0 : r;
+
 	if (b->drained)
 		return 1;
 
-	int r;
 	for (;;) {
 		r = dsound_filled(b);
 		if (r < 0)
@@ -596,4 +620,7 @@ const struct ffaudio_interface ffdsound = {
 	ffdsound_drain,
 	ffdsound_read,
 	NULL,
+	NULL,
+	ffdsound_write_begin,
+	ffdsound_write_commit,
 };
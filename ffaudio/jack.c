@@ -8,6 +8,9 @@
 #include <ffbase/ring.h>
 
 #include <jack/jack.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
 #include <time.h>
 
 
@@ -113,6 +116,10 @@ struct ffaudio_buf {
 	ffuint overrun;
 	ffuint nonblock;
 
+	int evfd; // non-blocking mode:  eventfd for poll_fds();  -1: none
+	void (*on_event)(void*);
+	void *udata;
+
 	const char *err;
 };
 
@@ -121,6 +128,7 @@ ffaudio_buf* ffjack_alloc()
 	ffaudio_buf *b = ffmem_new(ffaudio_buf);
 	if (b == NULL)
 		return NULL;
+	b->evfd = -1;
 	return b;
 }
 
@@ -137,6 +145,8 @@ void ffjack_free(ffaudio_buf *b)
 		return;
 
 	_jack_close(b);
+	if (b->evfd >= 0)
+		close(b->evfd);
 	ffmem_free(b);
 }
 
@@ -147,6 +157,10 @@ int ffjack_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 {
 	int rc = FFAUDIO_ERROR;
 	const char **portnames = NULL;
+	if (flags & FFAUDIO_O_NONINTERLEAVED) {
+		b->err = "non-interleaved access is not supported";
+		return FFAUDIO_ERROR;
+	}
 	b->nonblock = !!(flags & FFAUDIO_O_NONBLOCK);
 
 	ffuint rate = jack_get_sample_rate(gclient);
@@ -160,6 +174,14 @@ int ffjack_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 		return FFAUDIO_EFORMAT;
 	}
 
+	if (b->nonblock && b->evfd < 0
+		&& 0 > (b->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+		b->err = "eventfd";
+		return FFAUDIO_ERROR;
+	}
+	b->on_event = conf->on_event;
+	b->udata = conf->udata;
+
 	jack_set_process_callback(gclient, &_jack_process, b);
 	jack_on_shutdown(gclient, &_jack_shut, b);
 	if (0 != jack_activate(gclient)) {
@@ -246,6 +268,12 @@ static int _jack_process(jack_nframes_t nframes, void *arg)
 			b->overrun = 1;
 	}
 
+	if (b->evfd >= 0) {
+		ffuint64 v = 1;
+		write(b->evfd, &v, sizeof(v));
+		if (b->on_event != NULL)
+			b->on_event(b->udata);
+	}
 	return 0;
 }
 
@@ -296,13 +324,31 @@ int ffjack_read(ffaudio_buf *b, const void **data)
 		if (r != 0)
 			return r;
 
-		if (b->nonblock)
-			return 0;
+		if (b->nonblock) {
+			// reset the eventfd, then check again:  the data might have arrived in between
+			ffuint64 v;
+			read(b->evfd, &v, sizeof(v));
+			return _jack_readonce(b, data);
+		}
 
 		_ff_sleep(b->period_ms);
 	}
 }
 
+int ffjack_poll_fds(ffaudio_buf *b, struct pollfd *fds, ffuint cap)
+{
+	if (b->evfd < 0) {
+		b->err = "not a non-blocking buffer";
+		return -FFAUDIO_ERROR;
+	}
+	if (cap != 0) {
+		fds[0].fd = b->evfd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+	}
+	return 1;
+}
+
 const char* ffjack_error(ffaudio_buf *b)
 {
 	return b->err;
@@ -329,4 +375,7 @@ const struct ffaudio_interface ffjack = {
 	ffjack_drain,
 	ffjack_read,
 	NULL,
+	ffjack_poll_fds,
+	NULL,
+	NULL,
 };
@@ -8,6 +8,7 @@
 
 #include <sys/soundcard.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <errno.h>
 #include <math.h>
 
@@ -112,6 +113,8 @@ struct ffaudio_buf {
 	void *data;
 	ffsize data_cap;
 	int nonblock;
+	int capture;
+	_ffau_wbuf wbuf;
 
 	int err;
 	const char *errfunc;
@@ -136,6 +139,7 @@ void ffoss_free(ffaudio_buf *b)
 		close(b->fd);
 	ffmem_free(b->errmsg);
 	ffmem_free(b->data);
+	_ffau_wbuf_free(&b->wbuf);
 	ffmem_free(b);
 }
 
@@ -153,6 +157,7 @@ static int oss_fmt_from_ff(ffuint fmt)
 		return AFMT_S8;
 	case FFAUDIO_F_INT16:
 		return AFMT_S16_LE;
+	case FFAUDIO_F_INT24_4: // the sample is in the high 3 bytes
 	case FFAUDIO_F_INT32:
 		return AFMT_S32_LE;
 	}
@@ -223,7 +228,13 @@ int ffoss_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 	int r, rc = FFAUDIO_ERROR;
 	ffuint f;
 	int capture = (flags & 0x0f) == FFAUDIO_DEV_CAPTURE;
+	if (flags & FFAUDIO_O_NONINTERLEAVED) {
+		b->errfunc = "non-interleaved access is not supported";
+		b->err = 0;
+		return FFAUDIO_ERROR;
+	}
 	b->nonblock = !!(flags & FFAUDIO_O_NONBLOCK);
+	b->capture = capture;
 	f = (!capture) ? O_WRONLY : O_RDONLY;
 	f |= O_EXCL;
 	f |= (b->nonblock) ? O_NONBLOCK : 0;
@@ -279,6 +290,7 @@ int ffoss_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 		goto end;
 	}
 	b->data_cap = bufsize;
+	b->wbuf.frame_size = _ffau_f_bits(conf->format)/8 * conf->channels;
 
 	return 0;
 
@@ -327,6 +339,10 @@ int ffoss_write(ffaudio_buf *b, const void *data, ffsize len)
 
 int ffoss_drain(ffaudio_buf *b)
 {
+	int r;
+	if (0 != (r = _ffau_wbuf_flush(&b->wbuf, b, ffoss_write)))
+		return (r > 0) ? 0 : r;
+
 	if (0 > ioctl(b->fd, SNDCTL_DSP_SYNC, 0)) {
 		b->errfunc = "ioctl(SNDCTL_DSP_SYNC)";
 		b->err = errno;
@@ -354,6 +370,26 @@ int ffoss_read(ffaudio_buf *b, const void **buffer)
 	return oss_readonce(b, buffer);
 }
 
+int ffoss_write_begin(ffaudio_buf *b, void **ptr, ffsize *frames)
+{
+	return _ffau_wbuf_begin(&b->wbuf, b, ffoss_write, ptr, frames);
+}
+
+int ffoss_write_commit(ffaudio_buf *b, ffsize frames)
+{
+	return _ffau_wbuf_commit(&b->wbuf, b, ffoss_write, frames);
+}
+
+int ffoss_poll_fds(ffaudio_buf *b, struct pollfd *fds, ffuint cap)
+{
+	if (cap != 0) {
+		fds[0].fd = b->fd;
+		fds[0].events = (b->capture) ? POLLIN : POLLOUT;
+		fds[0].revents = 0;
+	}
+	return 1;
+}
+
 
 const struct ffaudio_interface ffoss = {
 	ffoss_init,
@@ -376,4 +412,7 @@ const struct ffaudio_interface ffoss = {
 	ffoss_drain,
 	ffoss_read,
 	NULL,
+	ffoss_poll_fds,
+	ffoss_write_begin,
+	ffoss_write_commit,
 };
@@ -1,310 +1,16 @@
 /** ffaudio: PCM conversion.
 2015, Simon Zolin */
 
+#pragma once
 #include <ffaudio/audio.h>
 #include <ffaudio/pcm.h>
+#include <ffaudio/pcm-simd.h>
+#include <ffaudio/pcm-mix.h>
+#include <ffaudio/pcm-resample.h>
+#include <ffaudio/pcm-stats.h>
+#include <ffaudio/pcm-limiter.h>
 #include <ffbase/base.h>
 
-enum CHAN_MASK {
-	CHAN_FL = 1,
-	CHAN_FR = 2,
-	CHAN_FC = 4,
-	CHAN_LFE = 8,
-	CHAN_BL = 0x10,
-	CHAN_BR = 0x20,
-	CHAN_SL = 0x40,
-	CHAN_SR = 0x80,
-};
-
-/** Get channel mask by channels number. */
-static uint chan_mask(uint channels)
-{
-	switch (channels) {
-	case 1:
-		return CHAN_FC;
-	case 2:
-		return CHAN_FL | CHAN_FR;
-	case 6:
-		return CHAN_FL | CHAN_FR | CHAN_FC | CHAN_LFE | CHAN_BL | CHAN_BR;
-	case 8:
-		return CHAN_FL | CHAN_FR | CHAN_FC | CHAN_LFE | CHAN_BL | CHAN_BR | CHAN_SL | CHAN_SR;
-	}
-	return -1;
-}
-
-#define BIT32(bit)  (1U << (bit))
-
-/** Set gain level for all used channels. */
-static int chan_fill_gain_levels(double level[8][8], uint imask, uint omask)
-{
-	enum {
-		FL,
-		FR,
-		FC,
-		LFE,
-		BL,
-		BR,
-		SL,
-		SR,
-	};
-
-	const double sqrt1_2 = 0.70710678118654752440; // =1/sqrt(2)
-
-	uint equal = imask & omask;
-	for (uint c = 0;  c != 8;  c++) {
-		if (equal & BIT32(c))
-			level[c][c] = 1;
-	}
-
-	uint unused = imask & ~omask;
-
-	if (unused & CHAN_FL) {
-
-		if (omask & CHAN_FC) {
-			// front stereo -> front center
-			level[FC][FL] = sqrt1_2;
-			level[FC][FR] = sqrt1_2;
-
-		} else
-			return -1;
-	}
-
-	if (unused & CHAN_FC) {
-
-		if (omask & CHAN_FL) {
-			// front center -> front stereo
-			level[FL][FC] = sqrt1_2;
-			level[FR][FC] = sqrt1_2;
-
-		} else
-			return -1;
-	}
-
-	if (unused & CHAN_LFE) {
-	}
-
-	if (unused & CHAN_BL) {
-
-		if (omask & CHAN_FL) {
-			// back stereo -> front stereo
-			level[FL][BL] = sqrt1_2;
-			level[FR][BR] = sqrt1_2;
-
-		} else if (omask & CHAN_FC) {
-			// back stereo -> front center
-			level[FC][BL] = sqrt1_2*sqrt1_2;
-			level[FC][BR] = sqrt1_2*sqrt1_2;
-
-		} else
-			return -1;
-	}
-
-	if (unused & CHAN_SL) {
-
-		if (omask & CHAN_FL) {
-			// side stereo -> front stereo
-			level[FL][SL] = sqrt1_2;
-			level[FR][SR] = sqrt1_2;
-
-		} else if (omask & CHAN_FC) {
-			// side stereo -> front center
-			level[FC][SL] = sqrt1_2*sqrt1_2;
-			level[FC][SR] = sqrt1_2*sqrt1_2;
-
-		} else
-			return -1;
-	}
-
-	// now gain level can be >1.0, so we normalize it
-	for (uint oc = 0;  oc != 8;  oc++) {
-		if (!ffbit_test32(&omask, oc))
-			continue;
-
-		double sum = 0;
-		for (uint ic = 0;  ic != 8;  ic++) {
-			sum += level[oc][ic];
-		}
-		if (sum != 0) {
-			for (uint ic = 0;  ic != 8;  ic++) {
-				level[oc][ic] /= sum;
-			}
-		}
-	}
-
-	return 0;
-}
-
-/** Mix (upmix, downmix) channels.
-ochan: Output channels number
-odata: Output data; float, interleaved
-
-Supported layouts:
-1: FC
-2: FL+FR
-5.1: FL+FR+FC+LFE+BL+BR
-7.1: FL+FR+FC+LFE+BL+BR+SL+SR
-
-Examples:
-
-5.1 -> 1:
-	FC = FL*0.7 + FR*0.7 + FC*1 + BL*0.5 + BR*0.5
-
-5.1 -> 2:
-	FL = FL*1 + FC*0.7 + BL*0.7
-	FR = FR*1 + FC*0.7 + BR*0.7
-*/
-static int _pcm_chan_mix(uint ochan, void *odata, const struct pcm_af *inpcm, const void *idata, size_t samples)
-{
-	union pcm_data in, out;
-	double level[8][8] = {}; // gain level [OUT] <- [IN]
-	void *ini[8];
-	uint istep, ostep; // intervals between samples of the same channel
-	uint ic, oc, ocstm; // channel counters
-	uint imask, omask; // channel masks
-	size_t i;
-
-	imask = chan_mask(inpcm->channels);
-	omask = chan_mask(ochan);
-	if (imask == 0 || omask == 0)
-		return -1;
-
-	if (0 != chan_fill_gain_levels(level, imask, omask))
-		return -1;
-
-	// set non-interleaved input array
-	istep = 1;
-	in.pi8 = (char**)idata;
-	if (inpcm->interleaved) {
-		pcm_setni(ini, (void*)idata, inpcm->format, inpcm->channels);
-		in.pi8 = (char**)ini;
-		istep = inpcm->channels;
-	}
-
-	// set interleaved output array
-	out.f32 = (float*)odata;
-	ostep = ochan;
-
-	ocstm = 0;
-	switch (inpcm->format) {
-	case FFAUDIO_F_INT16:
-		for (oc = 0;  oc != 8;  oc++) {
-
-			if (!ffbit_test32(&omask, oc))
-				continue;
-
-			for (i = 0;  i != samples;  i++) {
-				double sum = 0;
-				uint icstm = 0;
-				for (ic = 0;  ic != 8;  ic++) {
-					if (!ffbit_test32(&imask, ic))
-						continue;
-					sum += pcm_flt_i16(in.pi16[icstm][i * istep]) * level[oc][ic];
-					icstm++;
-				}
-				out.f32[ocstm + i * ostep] = pcm_limf(sum);
-			}
-
-			if (++ocstm == ochan)
-				break;
-		}
-		break;
-
-	case FFAUDIO_F_INT24:
-		for (uint oc = 0;  oc != 8;  oc++) {
-			if (ffbit_test32(&omask, oc)) {
-				for (uint i = 0;  i != samples;  i++) {
-					double sum = 0;
-					uint icstm = 0;
-					for (uint ic = 0;  ic != 8;  ic++) {
-						if (ffbit_test32(&imask, ic)) {
-							sum += pcm_flt_i24(pcm_i32_i24(&in.pi8[icstm++][i * istep * 3])) * level[oc][ic];
-						}
-					}
-					out.f32[ocstm + i * ostep] = pcm_limf(sum);
-				}
-			}
-
-			if (++ocstm == ochan)
-				break;
-		}
-		break;
-
-	case FFAUDIO_F_INT32:
-		for (oc = 0;  oc != 8;  oc++) {
-
-			if (!ffbit_test32(&omask, oc))
-				continue;
-
-			for (i = 0;  i != samples;  i++) {
-				double sum = 0;
-				uint icstm = 0;
-				for (ic = 0;  ic != 8;  ic++) {
-					if (!ffbit_test32(&imask, ic))
-						continue;
-					sum += pcm_flt_i32(in.pi32[icstm][i * istep]) * level[oc][ic];
-					icstm++;
-				}
-				out.f32[ocstm + i * ostep] = pcm_limf(sum);
-			}
-
-			if (++ocstm == ochan)
-				break;
-		}
-		break;
-
-	case FFAUDIO_F_FLOAT32:
-		for (oc = 0;  oc != 8;  oc++) {
-
-			if (!ffbit_test32(&omask, oc))
-				continue;
-
-			for (i = 0;  i != samples;  i++) {
-				double sum = 0;
-				uint icstm = 0;
-				for (ic = 0;  ic != 8;  ic++) {
-					if (!ffbit_test32(&imask, ic))
-						continue;
-					sum += in.pf32[icstm][i * istep] * level[oc][ic];
-					icstm++;
-				}
-				out.f32[ocstm + i * ostep] = pcm_limf(sum);
-			}
-
-			if (++ocstm == ochan)
-				break;
-		}
-		break;
-
-	case FFAUDIO_F_FLOAT64:
-		for (oc = 0;  oc != 8;  oc++) {
-
-			if (!ffbit_test32(&omask, oc))
-				continue;
-
-			for (i = 0;  i != samples;  i++) {
-				double sum = 0;
-				uint icstm = 0;
-				for (ic = 0;  ic != 8;  ic++) {
-					if (!ffbit_test32(&imask, ic))
-						continue;
-					sum += in.pf64[icstm][i * istep] * level[oc][ic];
-					icstm++;
-				}
-				out.f64[ocstm + i * ostep] = pcm_limf(sum);
-			}
-
-			if (++ocstm == ochan)
-				break;
-		}
-		break;
-
-	default:
-		return -1;
-	}
-
-	return 0;
-}
-
 #define X(f1, f2) \
 	(f1 << 16) | (f2 & 0xffff)
 
@@ -362,8 +68,8 @@ static int _pcm_convert_stereo(unsigned format_hash, void *out, const void *in,
 
 	case X4(FFAUDIO_F_INT16, 1, FFAUDIO_F_INT32, 1):
 		for (i = 0;  i < samples;  i++) {
-			*o.i16++ = *iL.i32++;
-			*o.i16++ = *iL.i32++;
+			*o.i16++ = *iL.i32++ / 0x10000;
+			*o.i16++ = *iL.i32++ / 0x10000;
 		}
 		break;
 
@@ -464,121 +170,789 @@ static int _pcm_convert_stereo(unsigned format_hash, void *out, const void *in,
 	return 0;
 }
 
-/** Convert PCM samples
-Note: sample rate conversion isn't supported. */
-/* Algorithm:
-If channels don't match, do channel conversion:
-  . upmix/downmix: mix appropriate channels with each other.  Requires additional memory buffer.
-  . mono: copy data for 1 channel only, skip other channels
+#define PCM_CONVERT_BUF  2048
+
+/** Conversion plan: everything that depends only on the input and output formats,
+ resolved once and reused for each block of data */
+struct pcm_convert_plan {
+	struct pcm_af in, out;
+	uint nch; // number of channels after mixing or channel selection
+	uint ifmt; // input format after mixing
+	int ich; // input channel to copy to mono output;  -1: none
+	uint istep; // interval between input samples of the same channel (after channel selection)
+	uint ileaved :1; // input is interleaved (after mixing or channel selection)
+	uint mix :1; // upmix/downmix into float buffer (int32 buffer in fixed-point mode)
+	uint fixed :1; // integer-only mixing and gain (pcm_convert_plan_init_fixed())
+	uint copy :1; // formats are equal:  just copy the data
+	uint inplace :1; // 'out' may be the same buffer as 'in' (pcm_convert_plan_run())
+	uint transpose :1; // interleaved <-> non-interleaved:  convert (with 'conv') and transpose block by block
+	uint stereo_hash; // format hash for _pcm_convert_stereo()
+	pcm_conv_func conv; // vectorized kernel;  NULL: use scalar code
+
+	uint mix_block; // frames mixed at once
+	float *mbuf; // mixed data + mixer's scratch memory:  'buf' or allocated for many channels
+
+	// sample rate conversion:  input -> pre -> float -> resampler -> float -> post -> output
+	struct pcm_resample rs;
+	struct pcm_convert_plan *pre, *post;
+	float *rsbuf; // [nch][PCM_RESAMPLE_BLOCK] + [nch][rs_omax]
+	uint rs_omax; // output frames per block of input
+
+	// incomplete input frame for pcm_convert_plan_bytes()
+	u_char partial[PCM_CHAN_MAX * 8];
+	uint partial_len;
+
+	struct pcm_stats *stats; // optional: statistics of the input signal;  set by user after the plan is prepared
+	struct pcm_limiter *limiter; // optional: limiter between mixing and the output conversion (pcm_convert_plan_limit())
+
+	// large members, initialized only if 'mix' is set
+	struct pcm_mix mixer;
+	float buf[PCM_CONVERT_BUF];
+};
 
-If format and "interleaved" flags match for both input and output, just copy the data.
-Otherwise, process each channel and sample in a loop.
+static inline int pcm_convert_plan_run(struct pcm_convert_plan *p, void *out, const void *in, size_t samples);
 
-non-interleaved: data[0][..] - left,  data[1][..] - right
-interleaved: data[0,2..] - left */
-static inline int pcm_convert(const struct pcm_af *outpcm, void *out, const struct pcm_af *inpcm, const void *in, size_t samples)
+static inline int _pcm_convert_core(const struct pcm_convert_plan *p, void *out, const void *in, size_t samples);
+
+static inline void pcm_convert_plan_destroy(struct pcm_convert_plan *p)
 {
-	size_t i;
-	uint ich, nch = inpcm->channels, in_ileaved = inpcm->interleaved;
-	union pcm_data from, to;
-	void *tmpptr = NULL;
-	int r = -1;
-	void *ini[PCM_CHAN_MAX], *oni[PCM_CHAN_MAX];
-	uint istep = 1, ostep = 1;
-	uint ifmt;
+	if (p->limiter != NULL) {
+		pcm_limiter_destroy(p->limiter);
+		ffmem_free(p->limiter);
+		p->limiter = NULL;
+	}
+	if (p->mix)
+		pcm_mix_destroy(&p->mixer);
+	if (p->mbuf != p->buf)
+		ffmem_free(p->mbuf);
+	p->mbuf = NULL;
+
+	if (p->pre != NULL) {
+		pcm_convert_plan_destroy(p->pre);
+		pcm_convert_plan_destroy(p->post);
+	}
+	ffmem_free(p->pre);
+	ffmem_free(p->rsbuf);
+	pcm_resample_destroy(&p->rs);
+	p->pre = NULL;
+	p->rsbuf = NULL;
+}
+
+static inline int pcm_convert_plan_init_mix(struct pcm_convert_plan *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm, const float *level, float gain);
+
+/** Prepare conversion with the sample rate conversion stage */
+static inline int _pcm_convert_plan_init_rate(struct pcm_convert_plan *p, const float *level, float gain, uint quality)
+{
+	uint nch = p->out.channels;
+	struct pcm_af fin = { FFAUDIO_F_FLOAT32, nch, 0, 0, p->in.rate };
+	struct pcm_af fout = { FFAUDIO_F_FLOAT32, nch, 0, 0, p->out.rate };
+	struct pcm_af out = p->out;
+	out.chan_sel = 0;
+
+	p->nch = nch;
+	if (NULL == (p->pre = (struct pcm_convert_plan*)ffmem_calloc(2, sizeof(struct pcm_convert_plan))))
+		goto err;
+	p->post = p->pre + 1;
+
+	fin.chan_sel = p->out.chan_sel; // channel selection is done by 'pre'
+	if (0 != pcm_convert_plan_init_mix(p->pre, &fin, &p->in, level, gain))
+		goto err;
+	if (0 != pcm_convert_plan_init_mix(p->post, &out, &fout, NULL, 1))
+		goto err;
+
+	if (0 != pcm_resample_init(&p->rs, nch, p->in.rate, p->out.rate, quality))
+		goto err;
+
+	p->rs_omax = pcm_resample_out_max(&p->rs, PCM_RESAMPLE_BLOCK);
+	if (NULL == (p->rsbuf = (float*)ffmem_alloc(nch * (PCM_RESAMPLE_BLOCK + p->rs_omax) * sizeof(float))))
+		goto err;
+	return 0;
+
+err:
+	pcm_convert_plan_destroy(p);
+	return -1;
+}
+
+enum _PCM_PLAN {
+	_PCM_PLAN_MIX = 1, // process via mixer even if it's not required
+	_PCM_PLAN_FIXED = 2, // fixed-point mixer
+};
+
+/** float16 and bfloat16 are converted to and from formats other than float32 via float buffer */
+static inline int _pcm_convert_via_float(uint ifmt, uint ofmt)
+{
+	return (ifmt != ofmt
+		&& ((_pcm_f_half(ifmt) && ofmt != FFAUDIO_F_FLOAT32)
+			|| (_pcm_f_half(ofmt) && ifmt != FFAUDIO_F_FLOAT32)));
+}
+
+/** Set the formats and select the input channel for mono output
+Return 0 on success;  <0: this channel conversion is not supported */
+static inline int _pcm_convert_plan_init_input(struct pcm_convert_plan *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm)
+{
+	p->in = *inpcm;
+	p->out = *outpcm;
+	p->nch = inpcm->channels;
+	p->ifmt = inpcm->format;
+	p->ich = -1;
+	p->istep = 1;
+	p->ileaved = inpcm->interleaved;
+
+	if (outpcm->chan_sel != 0) {
+		uint ch = outpcm->chan_sel - 1;
+		if (outpcm->channels != 1 || ch >= inpcm->channels)
+			return -1;
+
+		p->nch = 1;
+		p->ich = ch;
+		if (inpcm->interleaved) {
+			p->istep = inpcm->channels;
+			p->ileaved = 0;
+		}
+	}
+	return 0;
+}
+
+/** Choose the conversion method of _pcm_convert_core() */
+static inline void _pcm_convert_plan_init_core(struct pcm_convert_plan *p)
+{
+	const struct pcm_af *inpcm = &p->in, *outpcm = &p->out;
+
+	p->copy = (p->ifmt == outpcm->format && p->istep == 1
+		&& (p->ileaved == outpcm->interleaved || p->nch == 1));
+
+	p->conv = NULL;
+	p->transpose = 0;
+	if (!p->copy && p->istep == 1) {
+		p->conv = pcm_conv_find(p->ifmt, outpcm->format);
+		if (p->ileaved != outpcm->interleaved && p->nch != 1
+			&& (p->ifmt == outpcm->format || p->conv != NULL))
+			p->transpose = 1;
+	}
+
+	p->stereo_hash = X4(outpcm->format, outpcm->interleaved, p->ifmt, p->ileaved);
+
+	// The output is written not faster than the input is read
+	p->inplace = (!p->mix
+		&& inpcm->interleaved == outpcm->interleaved
+		&& pcm_f_bits(outpcm->format) * p->nch <= pcm_f_bits(inpcm->format) * inpcm->channels
+		&& pcm_f_bits(outpcm->format) <= pcm_f_bits(inpcm->format));
+}
+
+/** Prepare a plan for the conversion that needs no mixing and no buffers:
+ only the fields used by _pcm_convert_plan_run() are set;  the plan must not be destroyed.
+Return 0 on success;  !=0: a complete plan is required */
+static inline int _pcm_convert_plan_init_light(struct pcm_convert_plan *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm)
+{
+	struct pcm_af sel;
+	outpcm = _pcm_af_chan_sel_compat(&sel, outpcm, inpcm);
+
+	if (inpcm->rate != outpcm->rate
+		|| inpcm->channels > PCM_CHAN_MAX
+		|| (outpcm->chan_sel == 0 && inpcm->channels != outpcm->channels)
+		|| _pcm_convert_via_float(inpcm->format, outpcm->format))
+		return 1;
+
+	if (0 != _pcm_convert_plan_init_input(p, outpcm, inpcm))
+		return -1;
+	p->mix = 0;
+	p->fixed = 0;
+	p->stats = NULL;
+	p->limiter = NULL;
+	_pcm_convert_plan_init_core(p);
+	return 0;
+}
+
+static inline int _pcm_convert_plan_init(struct pcm_convert_plan *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm, const float *level, float gain, uint quality, uint flags)
+{
+	struct pcm_af sel;
+	if (level == NULL)
+		outpcm = _pcm_af_chan_sel_compat(&sel, outpcm, inpcm);
+
+	ffmem_zero(p, FF_OFF(struct pcm_convert_plan, mixer));
+	p->in = *inpcm;
+	p->out = *outpcm;
+
+	if (inpcm->channels > PCM_CHAN_MAX || outpcm->channels > PCM_CHAN_MAX)
+		return -1;
+
+	if ((flags & _PCM_PLAN_FIXED)
+		&& (!_pcm_f_int(inpcm->format) || !_pcm_f_int(outpcm->format)
+			|| inpcm->rate != outpcm->rate)) // the resampler works with float
+		return -1;
+
+	if (inpcm->rate != outpcm->rate || (quality & PCM_RESAMPLE_ADAPTIVE))
+		return _pcm_convert_plan_init_rate(p, level, gain, quality & ~PCM_RESAMPLE_ADAPTIVE);
+
+	if (0 != _pcm_convert_plan_init_input(p, outpcm, inpcm)
+		|| (outpcm->chan_sel != 0 && level != NULL))
+		return -1; // this channel conversion is not supported
+
+	if (outpcm->chan_sel == 0 && inpcm->channels != outpcm->channels) {
+		p->nch = outpcm->channels;
+		p->mix = 1;
+	}
+
+	if (level != NULL || gain != 1 || (flags & _PCM_PLAN_MIX))
+		p->mix = 1;
+	p->fixed = !!(flags & _PCM_PLAN_FIXED);
+	if (p->fixed && _pcm_f_int_bits(outpcm->format) < _pcm_f_int_bits(inpcm->format))
+		p->mix = 1; // round to nearest rather than truncate
+
+	uint via_float = 0;
+	if (!p->mix && _pcm_convert_via_float(inpcm->format, outpcm->format)) {
+		p->mix = 1;
+		via_float = 1;
+	}
+
+	if (p->mix) {
+		int r;
+		if (level != NULL) {
+			r = pcm_mix_init(&p->mixer, inpcm, p->nch, level);
+
+		} else if (p->ich >= 0 || p->nch == inpcm->channels) {
+			// select 1 channel or pass all channels through
+			r = pcm_mix_init_pass(&p->mixer, inpcm, p->nch, p->ich);
+
+		} else {
+			r = pcm_mix_init_std(&p->mixer, inpcm, p->nch);
+		}
+		if (r != 0)
+			return -1;
+
+		pcm_mix_scale(&p->mixer, gain);
+		if (via_float)
+			p->mixer.nolimit = 1; // just a format conversion:  don't limit the values to -1.0..1.0
+		if (p->fixed) {
+			// int32 samples rounded at the output precision:  the conversion to the output format is exact
+			if (0 != pcm_mix_fixed(&p->mixer, _pcm_f_int_bits(outpcm->format))) {
+				pcm_convert_plan_destroy(p);
+				return -1;
+			}
+		}
+		uint frame = p->nch + pcm_mix_scratch(&p->mixer, 1);
+		p->mix_block = PCM_CONVERT_BUF / frame;
+		p->mbuf = p->buf;
+		if (p->mix_block < 64) {
+			// many channels:  keep the blocks long enough for the vectorized kernels
+			p->mix_block = 256;
+			if (NULL == (p->mbuf = (float*)ffmem_alloc(p->mix_block * frame * sizeof(float)))) {
+				pcm_convert_plan_destroy(p);
+				return -1;
+			}
+		}
+		p->ich = -1;
+		p->istep = 1;
+		p->ileaved = outpcm->interleaved;
+		p->ifmt = (p->fixed) ? FFAUDIO_F_INT32 : FFAUDIO_F_FLOAT32;
+	}
+
+	_pcm_convert_plan_init_core(p);
+
+	// check that the format pair is supported
+	void *dummy[PCM_CHAN_MAX] = {};
+	if (0 != _pcm_convert_core(p, dummy, dummy, 0)) {
+		pcm_convert_plan_destroy(p);
+		return -1;
+	}
+	return 0;
+}
+
+/** Prepare conversion with channel mixing and gain applied in the same pass over the data
+level: gain levels [OUT][IN] (see pcm_mix_init(), pcm_mix_levels());  NULL: standard mixing or channel selection
+gain: linear volume level
+The mixed samples are limited to -1.0..1.0 (or see pcm_convert_plan_limit()).
+If sample rates differ, the data is resampled (use pcm_convert_plan_process()).
+quality: resampling quality: enum PCM_RESAMPLE_Q;  PCM_RESAMPLE_ADAPTIVE flag
+Return 0 on success;  <0: conversion isn't supported */
+static inline int pcm_convert_plan_init_resample(struct pcm_convert_plan *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm, const float *level, float gain, uint quality)
+{
+	return _pcm_convert_plan_init(p, outpcm, inpcm, level, gain, quality, 0);
+}
+
+/** Prepare conversion with channel mixing and gain in fixed-point arithmetic (see pcm_mix_fixed()):
+ no floating point operations are performed on the data.
+The mixed samples are rounded to nearest at the output precision and saturated.
+Only integer formats and equal sample rates are supported;  the limiter isn't supported.
+Other parameters: see pcm_convert_plan_init_mix()
+Return 0 on success;  <0: conversion isn't supported */
+static inline int pcm_convert_plan_init_fixed(struct pcm_convert_plan *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm, const float *level, float gain)
+{
+	return _pcm_convert_plan_init(p, outpcm, inpcm, level, gain, 0, _PCM_PLAN_FIXED);
+}
+
+static inline int pcm_convert_plan_init_mix(struct pcm_convert_plan *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm, const float *level, float gain)
+{
+	return pcm_convert_plan_init_resample(p, outpcm, inpcm, level, gain, PCM_RESAMPLE_MEDIUM);
+}
+
+/** Prepare conversion
+Return 0 on success;  <0: conversion isn't supported */
+static inline int pcm_convert_plan_init(struct pcm_convert_plan *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm)
+{
+	return pcm_convert_plan_init_mix(p, outpcm, inpcm, NULL, 1);
+}
+
+/** Insert a lookahead limiter between mixing (and gain) and the conversion to the output format,
+ instead of hard-limiting the mixed samples to -1.0..1.0.
+The limiter works in-place on the plan's float buffer:
+ the plan is switched to processing via float buffer if it doesn't use it yet.
+Call right after the plan is prepared.
+The output is delayed by pcm_limiter_latency(p->limiter) frames.
+Parameters: see pcm_limiter_init()
+Return 0 on success */
+static inline int pcm_convert_plan_limit(struct pcm_convert_plan *p, float ceiling, float knee, uint lookahead_ms, uint release_ms)
+{
+	struct pcm_af af = { FFAUDIO_F_FLOAT32, p->nch, 0, 0, p->out.rate };
+	struct pcm_mix *m = &p->mixer;
+
+	if (p->limiter != NULL || p->fixed)
+		return -1;
+
+	if (p->pre != NULL) {
+		// limit the resampled data (non-interleaved float)
+		m = &p->pre->mixer;
+
+	} else {
+		if (!p->mix) {
+			struct pcm_af in = p->in, out = p->out;
+			struct pcm_stats *st = p->stats;
+			pcm_convert_plan_destroy(p);
+			if (0 != _pcm_convert_plan_init(p, &out, &in, NULL, 1, 0, _PCM_PLAN_MIX))
+				return -1;
+			p->stats = st;
+		}
+		af.interleaved = p->out.interleaved;
+	}
+
+	if (NULL == (p->limiter = ffmem_new(struct pcm_limiter)))
+		return -1;
+	if (0 != pcm_limiter_init(p->limiter, &af, ceiling, knee, lookahead_ms, release_ms)) {
+		ffmem_free(p->limiter);
+		p->limiter = NULL;
+		return -1;
+	}
+	m->nolimit = 1;
+	return 0;
+}
+
+/** Get the data at 'offset' bytes of each channel
+ptrs: storage for the pointers to non-interleaved data */
+static inline void* _pcm_offset(void **ptrs, const void *data, uint ileaved, uint nch, size_t offset)
+{
+	if (ileaved)
+		return (char*)data + offset;
+
+	for (uint c = 0;  c != nch;  c++) {
+		ptrs[c] = ((char**)data)[c] + offset;
+	}
+	return ptrs;
+}
+
+/** Size (in floats) of the memory for mixed data and mixer's scratch memory */
+static inline size_t _pcm_convert_mbuf_size(const struct pcm_convert_plan *p)
+{
+	return p->mix_block * (p->nch + pcm_mix_scratch(&p->mixer, 1));
+}
+
+/** Mix channels and convert the result block by block
+mbuf: memory of _pcm_convert_mbuf_size() floats */
+static inline int _pcm_convert_mix(const struct pcm_convert_plan *p, float *mbuf, void *out, const void *in, size_t samples)
+{
+	void *ip[PCM_CHAN_MAX], *op[PCM_CHAN_MAX], *mp[PCM_CHAN_MAX];
+	uint c, nch = p->nch, ich = p->in.channels;
+	uint isize = pcm_f_bits(p->in.format)/8 * ((p->in.interleaved) ? ich : 1);
+	uint osize = pcm_f_bits(p->out.format)/8 * ((p->out.interleaved) ? nch : 1);
+	float *scratch = mbuf + p->mix_block * nch;
+	const void *ib;
+	void *ob, *mb;
+	size_t off, n;
+
+	for (off = 0;  off != samples;  off += n) {
+		n = ffmin(p->mix_block, samples - off);
+		ib = _pcm_offset(ip, in, p->in.interleaved, ich, off * isize);
+		ob = _pcm_offset(op, out, p->out.interleaved, nch, off * osize);
+
+		if (p->copy) {
+			mb = ob; // float output: mix directly into it
+		} else if (p->out.interleaved) {
+			mb = mbuf;
+		} else {
+			for (c = 0;  c != nch;  c++) {
+				mp[c] = mbuf + c * n;
+			}
+			mb = mp;
+		}
+
+		pcm_mix_run(&p->mixer, mb, p->out.interleaved, ib, n, scratch);
+		if (p->limiter != NULL)
+			pcm_limiter_process(p->limiter, mb, n);
+
+		if (!p->copy && 0 != _pcm_convert_core(p, ob, mb, n))
+			return -1;
+	}
 
+	return 0;
+}
+
+/** Convert without statistics
+The plan is not modified (except the limiter state):
+ the conversion may run in several threads if each of them has its own 'mbuf' (see _pcm_convert_mix()). */
+static inline int _pcm_convert_plan_run_buf(const struct pcm_convert_plan *p, float *mbuf, void *out, const void *in, size_t samples)
+{
+	union pcm_data from;
+	void *ini[1];
 	from.p = (void*)in;
-	ifmt = inpcm->format;
 
-	to.p = out;
+	if (p->ich >= 0) {
+		if (!p->in.interleaved) {
+			from.pi8 = from.pi8 + p->ich;
 
-	if (inpcm->channels > PCM_CHAN_MAX || (outpcm->channels & PCM_CHAN_MASK) > PCM_CHAN_MAX)
-		goto done;
+		} else {
+			ini[0] = from.i8 + p->ich * pcm_f_bits(p->in.format) / 8;
+			from.pi8 = (char**)ini;
+		}
 
-	if (inpcm->rate != outpcm->rate)
-		goto done;
+	} else if (p->mix) {
+		return _pcm_convert_mix(p, mbuf, out, in, samples);
+	}
+
+	return _pcm_convert_core(p, out, from.p, samples);
+}
+
+static inline int _pcm_convert_plan_run(struct pcm_convert_plan *p, void *out, const void *in, size_t samples)
+{
+	return _pcm_convert_plan_run_buf(p, p->mbuf, out, in, samples);
+}
+
+#define _PCM_STATS_CONVERT_BLOCK  1024 // samples
 
-	if (inpcm->channels != outpcm->channels) {
+/** Convert and measure the input in the same pass:  int16 and float32 without mixing or channel selection
+Return 0 on success;  1: not supported */
+static inline int _pcm_convert_plan_run_fused(struct pcm_convert_plan *p, void *out, const void *in, size_t samples)
+{
+	_pcm_stats_fused_func f;
+	uint c, lanes, nch = p->nch;
+	if (p->mix || p->ich >= 0
+		|| (p->in.interleaved != p->out.interleaved && nch != 1)
+		|| NULL == (f = _pcm_stats_conv_find(p->in.format, p->out.format, (p->in.interleaved) ? nch : 1, &lanes)))
+		return 1;
 
-		nch = outpcm->channels & PCM_CHAN_MASK;
+	uint wi = pcm_f_bits(p->in.format) / 8, wo = pcm_f_bits(p->out.format) / 8;
+	const void *i0 = (p->in.interleaved) ? in : ((void**)in)[0];
+	void *o0 = (p->out.interleaved) ? out : ((void**)out)[0];
+	if (wo < wi && (const void*)o0 == i0)
+		return 1; // in-place:  the kernel processes a block column by column and would overwrite the input
+
+	size_t done = 0;
+	if (p->in.interleaved) {
+		done = _pcm_stats_fused_run(p->stats, f, lanes, NULL, p->in.format, o0, wo, i0, wi, NULL, samples * nch, nch, 0) / nch;
+	} else {
+		// the output is non-interleaved too (or mono)
+		for (c = 0;  c != nch;  c++) {
+			void *o = (p->out.interleaved) ? out : ((void**)out)[c];
+			done = _pcm_stats_fused_run(p->stats, f, lanes, NULL, p->in.format, o, wo, ((void**)in)[c], wi, NULL, samples, 1, c);
+		}
+	}
+	p->stats->channels = nch;
+	p->stats->frames += done;
+
+	if (done != samples) {
+		// an incomplete accumulator period is left
+		void *ip[PCM_CHAN_MAX], *op[PCM_CHAN_MAX];
+		uint isize = wi * ((p->in.interleaved) ? nch : 1);
+		uint osize = wo * ((p->out.interleaved) ? nch : 1);
+		const void *ib = _pcm_offset(ip, in, p->in.interleaved, nch, done * isize);
+		void *ob = _pcm_offset(op, out, p->out.interleaved, nch, done * osize);
+		pcm_stats_update(p->stats, &p->in, ib, samples - done);
+		return _pcm_convert_plan_run(p, ob, ib, samples - done);
+	}
+	return 0;
+}
 
-		if (nch == 1 && (outpcm->channels & ~PCM_CHAN_MASK) != 0) {
-			uint ch = ((outpcm->channels & ~PCM_CHAN_MASK) >> 4) - 1;
-			if (ch > 1)
-				goto done;
+/** Convert PCM samples using the prepared plan
+Sample rate conversion isn't performed here:  use pcm_convert_plan_process().
+Return 0 on success */
+static inline int pcm_convert_plan_run(struct pcm_convert_plan *p, void *out, const void *in, size_t samples)
+{
+	if (p->pre != NULL)
+		return -1;
 
-			if (!inpcm->interleaved) {
-				from.pi16 = from.pi16 + ch;
+	if (p->stats == NULL)
+		return _pcm_convert_plan_run(p, out, in, samples);
+
+	if (0 == _pcm_convert_plan_run_fused(p, out, in, samples))
+		return 0;
+
+	// measure each block before converting it:  the input is still valid if the conversion is in-place,
+	//  and the block is in L1 cache when the conversion reads it
+	void *ip[PCM_CHAN_MAX], *op[PCM_CHAN_MAX];
+	uint ich = p->in.channels, och = p->out.channels;
+	uint isize = pcm_f_bits(p->in.format)/8 * ((p->in.interleaved) ? ich : 1);
+	uint osize = pcm_f_bits(p->out.format)/8 * ((p->out.interleaved) ? och : 1);
+	size_t off, n, block = ffmax(_PCM_STATS_CONVERT_BLOCK / ich, 1);
+
+	for (off = 0;  off != samples;  off += n) {
+		n = ffmin(block, samples - off);
+		const void *ib = _pcm_offset(ip, in, p->in.interleaved, ich, off * isize);
+		void *ob = _pcm_offset(op, out, p->out.interleaved, och, off * osize);
+		pcm_stats_update(p->stats, &p->in, ib, n);
+		if (0 != _pcm_convert_plan_run(p, ob, ib, n))
+			return -1;
+	}
+	return 0;
+}
+
+/** Maximum number of output frames for 'samples' input frames */
+static inline size_t pcm_convert_plan_out_max(const struct pcm_convert_plan *p, size_t samples)
+{
+	if (p->pre == NULL)
+		return samples;
+	return pcm_resample_out_max(&p->rs, samples);
+}
+
+/** Correct the resampling ratio, e.g. to compensate clock drift (see pcm_drift_update()).
+Return 0 on success;  <0: the plan has no resampler */
+static inline int pcm_convert_plan_adjust(struct pcm_convert_plan *p, double factor)
+{
+	if (p->pre == NULL)
+		return -1;
+	pcm_resample_adjust(&p->rs, factor);
+	return 0;
+}
+
+/** Convert PCM samples, including sample rate conversion
+out: must have space for pcm_convert_plan_out_max() frames
+Return the number of output frames;  <0: error */
+static inline ffssize pcm_convert_plan_process(struct pcm_convert_plan *p, void *out, const void *in, size_t samples)
+{
+	if (p->pre == NULL) {
+		if (0 != pcm_convert_plan_run(p, out, in, samples))
+			return -1;
+		return samples;
+	}
 
+	void *ip[PCM_CHAN_MAX], *op[PCM_CHAN_MAX];
+	float *fi[PCM_CHAN_MAX], *fo[PCM_CHAN_MAX];
+	uint c, nch = p->nch, ich = p->in.channels;
+	uint isize = pcm_f_bits(p->in.format)/8 * ((p->in.interleaved) ? ich : 1);
+	uint osize = pcm_f_bits(p->out.format)/8 * ((p->out.interleaved) ? nch : 1);
+	const void *ib;
+	void *ob;
+	float **src, **dst;
+	size_t off, n, nout = 0;
+
+	for (c = 0;  c != nch;  c++) {
+		fi[c] = p->rsbuf + c * PCM_RESAMPLE_BLOCK;
+		fo[c] = p->rsbuf + nch * PCM_RESAMPLE_BLOCK + c * p->rs_omax;
+	}
+
+	for (off = 0;  off != samples;  off += n) {
+		n = ffmin(samples - off, PCM_RESAMPLE_BLOCK);
+		ib = _pcm_offset(ip, in, p->in.interleaved, ich, off * isize);
+		ob = _pcm_offset(op, out, p->out.interleaved, nch, nout * osize);
+
+		if (p->stats != NULL)
+			pcm_stats_update(p->stats, &p->in, ib, n);
+
+		// non-interleaved (or mono) float input or output is used directly
+		src = fi;
+		if (!(p->pre->copy && !p->pre->mix)) {
+			if (0 != pcm_convert_plan_run(p->pre, fi, ib, n))
+				return -1;
+		} else if (p->in.interleaved) {
+			ip[0] = (void*)ib;
+			src = (float**)ip;
+		} else {
+			src = (float**)ib;
+		}
+
+		dst = fo;
+		if (p->post->copy) {
+			if (p->out.interleaved) {
+				op[0] = ob;
+				dst = (float**)op;
 			} else {
-				ini[0] = from.i8 + ch * pcm_f_bits(inpcm->format) / 8;
-				from.pi8 = (char**)ini;
-				istep = inpcm->channels;
-				in_ileaved = 0;
+				dst = (float**)ob;
 			}
+		}
+		size_t k = pcm_resample_process(&p->rs, dst, (const float**)src, n);
+		if (p->limiter != NULL)
+			pcm_limiter_process(p->limiter, dst, k);
 
-		} else if ((outpcm->channels & ~PCM_CHAN_MASK) == 0) {
-			if (NULL == (tmpptr = ffmem_alloc(samples * nch * sizeof(float))))
-				goto done;
+		if (!p->post->copy && 0 != pcm_convert_plan_run(p->post, ob, fo, k))
+			return -1;
+		nout += k;
+	}
 
-			if (0 != _pcm_chan_mix(nch, tmpptr, inpcm, in, samples))
-				goto done;
+	return nout;
+}
 
-			if (outpcm->interleaved) {
-				from.i8 = (char*)tmpptr;
-				in_ileaved = 1;
+/** Convert interleaved data of any length.
+An incomplete frame at the end of input is stored inside the plan and is completed by the next call.
+out: must have space for pcm_convert_plan_out_max() of all the complete frames: (stored_bytes + len) / input_frame_size
+Return the number of output frames;  <0: error */
+static inline ffssize pcm_convert_plan_bytes(struct pcm_convert_plan *p, void *out, const void *in, size_t len)
+{
+	if (!p->in.interleaved || !p->out.interleaved)
+		return -1;
 
-			} else {
-				pcm_setni(ini, tmpptr, FFAUDIO_F_FLOAT32, nch);
-				from.pi8 = (char**)ini;
-				istep = nch;
-				in_ileaved = 0;
+	uint ifr = pcm_f_bits(p->in.format)/8 * p->in.channels;
+	uint ofr = pcm_f_bits(p->out.format)/8 * p->nch;
+	const char *d = (char*)in;
+	ffssize r, frames = 0;
+
+	if (p->partial_len != 0) {
+		size_t n = ffmin(len, ifr - p->partial_len);
+		memcpy(p->partial + p->partial_len, d, n);
+		p->partial_len += n;
+		d += n;
+		len -= n;
+		if (p->partial_len != ifr)
+			return 0;
+
+		p->partial_len = 0;
+		if (0 > (frames = pcm_convert_plan_process(p, out, p->partial, 1)))
+			return -1;
+		out = (char*)out + frames * ofr;
+	}
+
+	size_t n = len / ifr;
+	if (n != 0) {
+		if (0 > (r = pcm_convert_plan_process(p, out, d, n)))
+			return -1;
+		frames += r;
+	}
+
+	p->partial_len = len % ifr;
+	memcpy(p->partial, d + n * ifr, p->partial_len);
+	return frames;
+}
+
+#define _PCM_TRANSPOSE_BUF  8192 // bytes
+
+/** Convert between interleaved and non-interleaved layouts:
+ the samples are converted in a temporary buffer by 'conv' kernel and transposed block by block */
+static inline void _pcm_convert_transpose(const struct pcm_convert_plan *p, void *out, const void *in, size_t samples)
+{
+	uint nch = p->nch;
+	uint iw = pcm_f_bits(p->ifmt) / 8, ow = pcm_f_bits(p->out.format) / 8;
+
+	if (p->conv == NULL) {
+		if (p->ileaved)
+			pcm_deinterleave((void**)out, in, iw, nch, samples);
+		else
+			pcm_interleave(out, (const void**)in, iw, nch, samples);
+		return;
+	}
+
+	union {
+		char b[_PCM_TRANSPOSE_BUF];
+		double align;
+	} tmp;
+	void *tp[PCM_CHAN_MAX];
+	size_t block = _PCM_TRANSPOSE_BUF / (nch * ffmax(iw, ow));
+	size_t off, n;
+	uint c;
+
+	for (off = 0;  off != samples;  off += n) {
+		n = ffmin(samples - off, block);
+
+		if (p->ileaved) {
+			// deinterleave, then convert each channel
+			for (c = 0;  c != nch;  c++) {
+				tp[c] = tmp.b + c * n * iw;
+			}
+			pcm_deinterleave(tp, (char*)in + off * nch * iw, iw, nch, n);
+			for (c = 0;  c != nch;  c++) {
+				p->conv(((char**)out)[c] + off * ow, tp[c], n);
 			}
-			ifmt = FFAUDIO_F_FLOAT32;
 
 		} else {
-			goto done; // this channel conversion is not supported
+			// convert each channel, then interleave
+			for (c = 0;  c != nch;  c++) {
+				tp[c] = tmp.b + c * n * ow;
+				p->conv(tp[c], ((char**)in)[c] + off * iw, n);
+			}
+			pcm_interleave((char*)out + off * nch * ow, (const void**)tp, ow, nch, n);
 		}
 	}
+}
 
-	if (ifmt == outpcm->format && istep == 1) {
-		// input & output formats are the same, try to copy data directly
+/* Algorithm:
+If channels don't match, do channel conversion:
+  . upmix/downmix: mix appropriate channels with each other (see pcm_mix_run()), block by block.
+  . mono: copy data for 1 channel only, skip other channels
 
-		if (in_ileaved != outpcm->interleaved && nch == 1) {
-			if (samples == 0)
-			{}
-			else if (!in_ileaved) {
-				// non-interleaved input mono -> interleaved input mono
-				from.i8 = from.pi8[0];
-			} else {
-				// interleaved input mono -> non-interleaved input mono
-				ini[0] = from.i8;
-				from.pi8 = (char**)ini;
+If format and "interleaved" flags match for both input and output, just copy the data.
+If only "interleaved" flags differ, transpose the data (see pcm_interleave()),
+ converting the format with a vectorized kernel if there is one.
+Otherwise, process each channel and sample in a loop.
+
+non-interleaved: data[0][..] - left,  data[1][..] - right
+interleaved: data[0,2..] - left */
+static inline int _pcm_convert_core(const struct pcm_convert_plan *p, void *out, const void *in, size_t samples)
+{
+	size_t i;
+	uint ich, nch = p->nch, in_ileaved = p->ileaved;
+	const struct pcm_af *outpcm = &p->out;
+	union pcm_data from, to;
+	void *ini[PCM_CHAN_MAX], *oni[PCM_CHAN_MAX];
+	uint istep = p->istep, ostep = 1;
+	uint ifmt = p->ifmt;
+
+	from.p = (void*)in;
+	to.p = out;
+
+	if (p->copy) {
+		// input & output formats are the same, copy data directly
+		if (samples == 0)
+			;
+		else if (nch == 1) {
+			void *o = (outpcm->interleaved) ? to.p : to.pi8[0];
+			const void *i = (in_ileaved) ? from.p : from.pi8[0];
+			if (o != i)
+				memmove(o, i, samples * pcm_f_bits(ifmt)/8);
+		} else if (in_ileaved) {
+			// interleaved input -> interleaved output
+			if (to.i8 != from.i8)
+				memmove(to.i8, from.i8, samples * pcm_f_bits(ifmt)/8 * nch);
+		} else {
+			// non-interleaved input -> non-interleaved output
+			for (ich = 0;  ich != nch;  ich++) {
+				if (to.pi8[ich] != from.pi8[ich])
+					memmove(to.pi8[ich], from.pi8[ich], samples * pcm_f_bits(ifmt)/8);
 			}
-			in_ileaved = outpcm->interleaved;
 		}
+		return 0;
+	}
 
-		if (in_ileaved == outpcm->interleaved) {
-			if (samples == 0)
-				;
-			else if (in_ileaved) {
-				// interleaved input -> interleaved output
-				memcpy(to.i8, from.i8, samples * pcm_f_bits(ifmt)/8 * nch);
-			} else {
-				// non-interleaved input -> non-interleaved output
-				for (ich = 0;  ich != nch;  ich++) {
-					memcpy(to.pi8[ich], from.pi8[ich], samples * pcm_f_bits(ifmt)/8);
-				}
+	if (p->transpose) {
+		_pcm_convert_transpose(p, out, in, samples);
+		return 0;
+	}
+
+	if (p->conv != NULL) {
+		// contiguous data: use vectorized kernel
+		if (samples == 0)
+			;
+		else if (nch == 1) {
+			void *o = (outpcm->interleaved) ? to.p : to.pi8[0];
+			const void *i = (in_ileaved) ? from.p : from.pi8[0];
+			p->conv(o, i, samples);
+		} else if (in_ileaved) {
+			p->conv(to.p, from.p, samples * nch);
+		} else {
+			for (ich = 0;  ich != nch;  ich++) {
+				p->conv(to.pi8[ich], from.pi8[ich], samples);
 			}
-			r = 0;
-			goto done;
 		}
+		return 0;
 	}
 
-	r = 0;
 	if (nch == 2) {
-		if (!_pcm_convert_stereo(X4(outpcm->format, outpcm->interleaved, ifmt, in_ileaved), to.i8, from.i8, in_ileaved, samples))
-			goto done;
+		if (!_pcm_convert_stereo(p->stereo_hash, to.i8, from.i8, in_ileaved, samples))
+			return 0;
 	}
 
 	if (in_ileaved) {
@@ -760,7 +1134,64 @@ static inline int pcm_convert(const struct pcm_af *outpcm, void *out, const stru
 		}
 		break;
 
+// int24 in 32-bit container:  the sample is in the high 3 bytes, the low byte is ignored
+	case X(FFAUDIO_F_INT24_4, FFAUDIO_F_INT16):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pi16[ich][i * ostep] = from.pi32[ich][i * istep] >> 16; // the same as int24 -> int16
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_INT24_4, FFAUDIO_F_INT24):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				memcpy(&to.pi8[ich][i * ostep * 3], &from.pi8[ich][i * istep * 4 + 1], 3);
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_INT24_4, FFAUDIO_F_INT24_4):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pi32[ich][i * ostep] = from.pi32[ich][i * istep];
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_INT24_4, FFAUDIO_F_INT32):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pi32[ich][i * ostep] = from.pi32[ich][i * istep] & ~0xff;
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_INT24_4, FFAUDIO_F_FLOAT32):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pf32[ich][i * ostep] = pcm_flt_i24(from.pi32[ich][i * istep] >> 8);
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_INT24_4, FFAUDIO_F_FLOAT64):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pf64[ich][i * ostep] = pcm_flt_i24(from.pi32[ich][i * istep] >> 8);
+			}
+		}
+		break;
+
 // int32
+	case X(FFAUDIO_F_INT32, FFAUDIO_F_INT8):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pi8[ich][i * ostep] = from.pi32[ich][i * istep] / 0x1000000;
+			}
+		}
+		break;
+
 	case X(FFAUDIO_F_INT32, FFAUDIO_F_INT16):
 		for (i = 0;  i != samples;  i++) {
 			for (ich = 0;  ich != nch;  ich++) {
@@ -802,6 +1233,14 @@ static inline int pcm_convert(const struct pcm_af *outpcm, void *out, const stru
 		}
 		break;
 
+	case X(FFAUDIO_F_INT32, FFAUDIO_F_FLOAT64):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pf64[ich][i * ostep] = pcm_flt_i32(from.pi32[ich][i * istep]);
+			}
+		}
+		break;
+
 // float32
 	case X(FFAUDIO_F_FLOAT32, FFAUDIO_F_INT16):
 		for (i = 0;  i != samples;  i++) {
@@ -869,6 +1308,15 @@ static inline int pcm_convert(const struct pcm_af *outpcm, void *out, const stru
 		}
 		break;
 
+	case X(FFAUDIO_F_FLOAT64, FFAUDIO_F_INT24_4):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pi8[ich][i * ostep * 4 + 0] = 0;
+				pcm_i24_i32(&to.pi8[ich][i * ostep * 4 + 1], pcm_i24_flt(from.pf64[ich][i * istep]));
+			}
+		}
+		break;
+
 	case X(FFAUDIO_F_FLOAT64, FFAUDIO_F_INT32):
 		for (i = 0;  i != samples;  i++) {
 			for (ich = 0;  ich != nch;  ich++) {
@@ -893,13 +1341,92 @@ static inline int pcm_convert(const struct pcm_af *outpcm, void *out, const stru
 		}
 		break;
 
+// float16, bfloat16 <-> float32;  other formats are converted via float buffer
+	case X(FFAUDIO_F_FLOAT16, FFAUDIO_F_FLOAT16):
+	case X(FFAUDIO_F_BFLOAT16, FFAUDIO_F_BFLOAT16):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pu16[ich][i * ostep] = from.pu16[ich][i * istep];
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_FLOAT16, FFAUDIO_F_FLOAT32):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pf32[ich][i * ostep] = pcm_flt_f16(from.pu16[ich][i * istep]);
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_FLOAT32, FFAUDIO_F_FLOAT16):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pu16[ich][i * ostep] = pcm_f16_flt(from.pf32[ich][i * istep]);
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_BFLOAT16, FFAUDIO_F_FLOAT32):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pf32[ich][i * ostep] = pcm_flt_bf16(from.pu16[ich][i * istep]);
+			}
+		}
+		break;
+
+	case X(FFAUDIO_F_FLOAT32, FFAUDIO_F_BFLOAT16):
+		for (i = 0;  i != samples;  i++) {
+			for (ich = 0;  ich != nch;  ich++) {
+				to.pu16[ich][i * ostep] = pcm_bf16_flt(from.pf32[ich][i * istep]);
+			}
+		}
+		break;
+
 	default:
-		r = -1;
-		goto done;
+		return -1;
 	}
 
-done:
-	ffmem_free(tmpptr);
+	return 0;
+}
+
+/** Convert PCM samples
+Copying, a plain format conversion and channel selection are dispatched directly;
+ otherwise a temporary plan is prepared on each call:
+ use pcm_convert_plan_*() functions to convert a stream of data.
+Sample rate conversion isn't supported here:  use pcm_convert_plan_process(). */
+static inline int pcm_convert(const struct pcm_af *outpcm, void *out, const struct pcm_af *inpcm, const void *in, size_t samples)
+{
+	if (inpcm->rate != outpcm->rate)
+		return -1;
+
+	struct pcm_convert_plan p;
+	int r = _pcm_convert_plan_init_light(&p, outpcm, inpcm);
+	if (r < 0)
+		return -1;
+	else if (r == 0)
+		return _pcm_convert_plan_run(&p, out, in, samples);
+
+	if (0 != pcm_convert_plan_init(&p, outpcm, inpcm))
+		return -1;
+	r = pcm_convert_plan_run(&p, out, in, samples);
+	pcm_convert_plan_destroy(&p);
+	return r;
+}
+
+/** Convert PCM samples, mix channels and apply gain in one pass
+level: gain levels [OUT][IN];  NULL: standard mixing
+Replaces the sequence pcm_convert() + pcm_gain(). */
+static inline int pcm_convert_mix(const struct pcm_af *outpcm, void *out, const struct pcm_af *inpcm, const void *in, size_t samples, const float *level, float gain)
+{
+	if (inpcm->rate != outpcm->rate)
+		return -1;
+
+	struct pcm_convert_plan p;
+	if (0 != pcm_convert_plan_init_mix(&p, outpcm, inpcm, level, gain))
+		return -1;
+	int r = pcm_convert_plan_run(&p, out, in, samples);
+	pcm_convert_plan_destroy(&p);
 	return r;
 }
 
@@ -0,0 +1,301 @@
+/** ffaudio: delivery of the same captured stream at several sample rates and formats.
+2026, Simon Zolin */
+
+/*
+pcm_fanout_init pcm_fanout_destroy
+pcm_fanout_add
+pcm_fanout_out_max
+pcm_fanout_process
+*/
+
+/* The input is converted to non-interleaved float once per channel layout, e.g. stereo and mono downmix
+ (root nodes of the tree);  the outputs with fewer channels are downmixed before resampling.
+Each output rate is a node of the tree that is resampled from its parent node with the same layout:
+ the parent is the node with the lowest rate that isn't lower than the output's rate
+ and has a simple ratio with it (e.g. 48->24->16, 16->8);  otherwise it's the root.
+Every node is computed once per block, no matter how many outputs read it.
+Then each output converts the float data of its node to its format (and upmixes if needed)
+ with pcm_convert_plan at equal rates.
+Example:  48000/stereo -> 48000/stereo/int16 (archive), 16000/mono/int16 (speech recognition), 8000/mono/int16 (telephony):
+	48000/stereo float -> 48000/stereo/int16
+	48000/mono float
+	  `-> 16000/mono float -> 16000/mono/int16
+	        `-> 8000/mono float -> 8000/mono/int16 */
+
+#pragma once
+#include <ffaudio/pcm-convert.h>
+
+#define PCM_FANOUT_MAX  8 // outputs
+#define _PCM_FANOUT_RATIO  8 // a node may be resampled from a node with the ratio up to 8:N
+
+struct _pcm_fanout_node {
+	uint rate;
+	u_char nch, chan_sel; // channel layout (see struct pcm_af)
+	uint parent; // index of the parent node;  itself for a root node
+	struct pcm_convert_plan *plan; // root node:  input -> this node
+	struct pcm_resample rs; // parent -> this node
+	float *buf; // [nch][cap]
+	uint cap;
+	size_t n; // frames in 'buf'
+};
+
+struct _pcm_fanout_out {
+	struct pcm_af af;
+	uint node;
+	struct pcm_convert_plan plan; // node's float data -> output
+};
+
+struct pcm_fanout {
+	struct pcm_af in;
+	uint quality;
+	uint nnodes, nouts;
+	struct _pcm_fanout_node node[PCM_FANOUT_MAX * 2]; // a parent goes before its children
+	struct _pcm_fanout_out *out[PCM_FANOUT_MAX];
+};
+
+static inline void _pcm_fanout_nodes_destroy(struct pcm_fanout *f)
+{
+	for (uint i = 0;  i != f->nnodes;  i++) {
+		struct _pcm_fanout_node *nd = &f->node[i];
+		if (nd->plan != NULL) {
+			pcm_convert_plan_destroy(nd->plan);
+			ffmem_free(nd->plan);
+		}
+		pcm_resample_destroy(&nd->rs);
+		ffmem_free(nd->buf);
+	}
+	ffmem_zero(f->node, sizeof(f->node));
+	f->nnodes = 0;
+}
+
+static inline void pcm_fanout_destroy(struct pcm_fanout *f)
+{
+	_pcm_fanout_nodes_destroy(f);
+	for (uint i = 0;  i != f->nouts;  i++) {
+		pcm_convert_plan_destroy(&f->out[i]->plan);
+		ffmem_free(f->out[i]);
+	}
+	f->nouts = 0;
+}
+
+/** Prepare the input stage.
+quality: resampling quality: enum PCM_RESAMPLE_Q
+Return 0 on success */
+static inline int pcm_fanout_init(struct pcm_fanout *f, const struct pcm_af *inpcm, uint quality)
+{
+	ffmem_zero(f, sizeof(*f));
+	if (inpcm->channels == 0 || inpcm->channels > PCM_CHAN_MAX || inpcm->rate == 0
+		|| quality > PCM_RESAMPLE_HIGH)
+		return -1;
+	f->in = *inpcm;
+	f->quality = quality;
+	return 0;
+}
+
+/** Channel layout of the node for the output:  downmix or channel selection is done by the root node */
+static inline void _pcm_fanout_layout(const struct pcm_fanout *f, const struct pcm_af *outpcm, struct pcm_af *af)
+{
+	af->format = FFAUDIO_F_FLOAT32;
+	af->channels = ffmin(outpcm->channels, f->in.channels);
+	af->interleaved = 0;
+	af->chan_sel = outpcm->chan_sel;
+	af->rate = outpcm->rate;
+}
+
+static inline int _pcm_fanout_find(const struct pcm_fanout *f, const struct pcm_af *af)
+{
+	for (uint i = 0;  i != f->nnodes;  i++) {
+		const struct _pcm_fanout_node *nd = &f->node[i];
+		if (nd->rate == af->rate && nd->nch == af->channels && nd->chan_sel == af->chan_sel)
+			return i;
+	}
+	return -1;
+}
+
+/** Find the parent for a new node */
+static uint _pcm_fanout_parent(const struct pcm_fanout *f, uint root, const struct pcm_af *af)
+{
+	uint parent = root;
+	for (uint i = 0;  i != f->nnodes;  i++) {
+		const struct _pcm_fanout_node *nd = &f->node[i];
+		uint r = nd->rate;
+		if (nd->nch == af->channels && nd->chan_sel == af->chan_sel
+			&& r >= af->rate && r < f->node[parent].rate
+			&& r / _pcm_gcd(r, af->rate) <= _PCM_FANOUT_RATIO)
+			parent = i;
+	}
+	return parent;
+}
+
+/** Add a node
+parent: -1: root node */
+static inline int _pcm_fanout_node_add(struct pcm_fanout *f, const struct pcm_af *af, int parent)
+{
+	struct _pcm_fanout_node *nd = &f->node[f->nnodes];
+	nd->rate = af->rate;
+	nd->nch = af->channels;
+	nd->chan_sel = af->chan_sel;
+	nd->parent = f->nnodes;
+
+	if (parent < 0) {
+		nd->cap = PCM_RESAMPLE_BLOCK;
+		if (NULL == (nd->plan = ffmem_new(struct pcm_convert_plan)))
+			return -1;
+		if (0 != pcm_convert_plan_init(nd->plan, af, &f->in)) {
+			ffmem_free(nd->plan);
+			nd->plan = NULL;
+			return -1;
+		}
+
+	} else {
+		const struct _pcm_fanout_node *pn = &f->node[parent];
+		nd->parent = parent;
+		if (0 != pcm_resample_init(&nd->rs, nd->nch, pn->rate, nd->rate, f->quality))
+			return -1;
+		nd->cap = pcm_resample_out_max(&nd->rs, pn->cap);
+	}
+
+	f->nnodes++;
+	if (NULL == (nd->buf = (float*)ffmem_alloc(nd->nch * nd->cap * sizeof(float))))
+		return -1;
+	return f->nnodes - 1;
+}
+
+/** Build the tree for the rates and layouts of all outputs */
+static inline int _pcm_fanout_build(struct pcm_fanout *f)
+{
+	struct pcm_af af, root_af;
+	int root, k;
+
+	_pcm_fanout_nodes_destroy(f);
+
+	for (;;) {
+		// the highest rate that doesn't have a node yet:  the possible parents are created first
+		int next = -1;
+		for (uint i = 0;  i != f->nouts;  i++) {
+			_pcm_fanout_layout(f, &f->out[i]->af, &af);
+			if (_pcm_fanout_find(f, &af) < 0
+				&& (next < 0 || af.rate > f->out[next]->af.rate))
+				next = i;
+		}
+		if (next < 0)
+			break;
+
+		_pcm_fanout_layout(f, &f->out[next]->af, &af);
+		root_af = af;
+		root_af.rate = f->in.rate;
+		if ((root = _pcm_fanout_find(f, &root_af)) < 0
+			&& (root = _pcm_fanout_node_add(f, &root_af, -1)) < 0)
+			return -1;
+
+		if (af.rate != f->in.rate
+			&& 0 > _pcm_fanout_node_add(f, &af, _pcm_fanout_parent(f, root, &af)))
+			return -1;
+	}
+
+	for (uint i = 0;  i != f->nouts;  i++) {
+		_pcm_fanout_layout(f, &f->out[i]->af, &af);
+		k = _pcm_fanout_find(f, &af);
+		f->out[i]->node = k;
+	}
+	return 0;
+}
+
+/** Add output.
+All outputs must be added before the data is processed.
+Return output index;  <0: error */
+static inline int pcm_fanout_add(struct pcm_fanout *f, const struct pcm_af *outpcm)
+{
+	struct _pcm_fanout_out *o;
+	struct pcm_af af, out = *outpcm;
+
+	if (f->nouts == PCM_FANOUT_MAX || outpcm->rate == 0
+		|| NULL == (o = ffmem_new(struct _pcm_fanout_out)))
+		return -1;
+	_pcm_fanout_layout(f, outpcm, &af);
+	af.chan_sel = 0;
+	out.chan_sel = 0;
+	if (0 != pcm_convert_plan_init(&o->plan, &out, &af)) {
+		ffmem_free(o);
+		return -1;
+	}
+	o->af = *outpcm;
+	f->out[f->nouts++] = o;
+
+	if (0 != _pcm_fanout_build(f)) {
+		f->nouts--;
+		pcm_convert_plan_destroy(&o->plan);
+		ffmem_free(o);
+		_pcm_fanout_build(f);
+		return -1;
+	}
+	return f->nouts - 1;
+}
+
+/** Maximum number of frames of output 'i' produced from 'frames' input frames */
+static inline size_t pcm_fanout_out_max(const struct pcm_fanout *f, uint i, size_t frames)
+{
+	uint path[PCM_FANOUT_MAX * 2], n = 0;
+	for (uint k = f->out[i]->node;  f->node[k].parent != k;  k = f->node[k].parent) {
+		path[n++] = k;
+	}
+	while (n != 0) {
+		frames = pcm_resample_out_max(&f->node[path[--n]].rs, frames);
+	}
+	return frames;
+}
+
+/** Get pointers to the channels of the node's data */
+static inline float** _pcm_fanout_ptrs(const struct _pcm_fanout_node *nd, float **ptrs)
+{
+	for (uint c = 0;  c != nd->nch;  c++) {
+		ptrs[c] = nd->buf + c * nd->cap;
+	}
+	return ptrs;
+}
+
+/** Deliver input data to all outputs.
+out: [outputs] output data (interleaved: void*, non-interleaved: void**);
+ each has space for pcm_fanout_out_max() frames
+nout: [outputs] the number of frames written
+Return 0 on success */
+static inline int pcm_fanout_process(struct pcm_fanout *f, void **out, size_t *nout, const void *in, size_t frames)
+{
+	void *ip[PCM_CHAN_MAX], *op[PCM_CHAN_MAX];
+	float *src[PCM_CHAN_MAX], *dst[PCM_CHAN_MAX];
+	uint i, k, nch = f->in.channels;
+	uint isize = pcm_f_bits(f->in.format)/8 * ((f->in.interleaved) ? nch : 1);
+	size_t off, n;
+
+	for (i = 0;  i != f->nouts;  i++) {
+		nout[i] = 0;
+	}
+
+	for (off = 0;  off != frames;  off += n) {
+		n = ffmin(frames - off, PCM_RESAMPLE_BLOCK);
+		const void *ib = _pcm_offset(ip, in, f->in.interleaved, nch, off * isize);
+
+		for (k = 0;  k != f->nnodes;  k++) {
+			struct _pcm_fanout_node *nd = &f->node[k], *pn = &f->node[nd->parent];
+			if (nd->plan != NULL) {
+				if (0 != pcm_convert_plan_run(nd->plan, _pcm_fanout_ptrs(nd, dst), ib, n))
+					return -1;
+				nd->n = n;
+			} else {
+				_pcm_fanout_ptrs(pn, src);
+				nd->n = pcm_resample_process(&nd->rs, _pcm_fanout_ptrs(nd, dst), (const float**)src, pn->n);
+			}
+		}
+
+		for (i = 0;  i != f->nouts;  i++) {
+			struct _pcm_fanout_out *o = f->out[i];
+			const struct _pcm_fanout_node *nd = &f->node[o->node];
+			uint osize = pcm_f_bits(o->af.format)/8 * ((o->af.interleaved) ? o->af.channels : 1);
+			void *ob = _pcm_offset(op, out[i], o->af.interleaved, o->af.channels, nout[i] * osize);
+			if (0 != pcm_convert_plan_run(&o->plan, ob, _pcm_fanout_ptrs(nd, src), nd->n))
+				return -1;
+			nout[i] += nd->n;
+		}
+	}
+	return 0;
+}
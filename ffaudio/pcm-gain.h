@@ -1,95 +1,1099 @@
 /** ffaudio: volume change.
 2015, Simon Zolin */
 
+/*
+pcm_gain
+pcm_gain_state_init pcm_gain_set pcm_gain_process
+*/
+
+/* Gain is applied by vectorized kernels (SSE2, AVX2) to contiguous arrays of samples:
+ interleaved data is processed as 1 channel of (frames * channels) samples,
+ non-interleaved data - channel by channel.
+int8, int16: fixed-point multiply by a Q15 mantissa followed by an arithmetic shift,
+ rounding half up, saturating.
+ The result may differ by 1 LSB from the exact product because the gain is rounded to 15 bits.
+int24, int24_4, int32: the product is computed in double precision: the results are the same as with the scalar code.
+float32: single precision multiply.
+float16, bfloat16: blocks are converted to float32 (vectorized), multiplied and converted back.
+The scalar code (the tails of the vector loops and non-x86 CPUs) uses the same arithmetic,
+ so the result doesn't depend on the CPU. */
+
+#pragma once
 #include <ffaudio/audio.h>
 #include <ffaudio/pcm.h>
+#include <ffaudio/pcm-simd.h>
+#include <ffaudio/pcm-stats.h>
+#include <ffbase/atomic.h>
+#include <math.h>
 
-static inline int pcm_gain(const struct pcm_af *af, double gain, const void *in, void *out, uint samples)
+/** Gain prepared for the kernels */
+struct _pcm_gain {
+	double g;
+	float gf;
+	int q; // Q15 mantissa:  gain = q * 2^-shift
+	uint shift; // 1..30
+};
+
+static inline void _pcm_gain_prep(struct _pcm_gain *k, double gain)
+{
+	k->g = gain;
+	k->gf = gain;
+
+	// 4096 (+72dB) saturates any non-zero int16 sample;  the limit keeps 'shift' >= 1
+	int e;
+	double f = frexp(ffmax(ffmin(gain, 4096), -4096), &e); // gain = f * 2^e, 0.5 <= |f| < 1
+	int q = (int)floor(f * 32768 + 0.5);
+	if (q == 32768) {
+		q = 16384;
+		e++;
+	}
+	k->q = q;
+	k->shift = 15 - e;
+	if (15 - e > 30) {
+		// |gain| < 2^-16:  the result is 0
+		k->q = 0;
+		k->shift = 15;
+	}
+}
+
+/** Multiply a sample by the Q15 gain, round */
+static inline int _pcm_gain_q15(int s, const struct _pcm_gain *k)
+{
+	return (s * k->q + (1 << (k->shift - 1))) >> k->shift;
+}
+
+/** Apply gain to 'n' contiguous samples */
+typedef void (*_pcm_gain_func)(void *out, const void *in, const struct _pcm_gain *k, size_t n);
+
+static void _pcm_gain_i8(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const char *s = (char*)in;
+	char *d = (char*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		int v = _pcm_gain_q15(s[i], k);
+		d[i] = ffmax(ffmin(v, 0x7f), -0x80);
+	}
+}
+
+static void _pcm_gain_i16(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const short *s = (short*)in;
+	short *d = (short*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		int v = _pcm_gain_q15(s[i], k);
+		d[i] = ffmax(ffmin(v, 0x7fff), -0x8000);
+	}
+}
+
+static void _pcm_gain_i24(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const char *s = (char*)in;
+	char *d = (char*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		int v = pcm_i32_i24(s + i * 3);
+		pcm_i24_i32(d + i * 3, pcm_i24_flt(pcm_flt_i24(v) * k->g));
+	}
+}
+
+static void _pcm_gain_i24_4(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = pcm_i24_flt(pcm_flt_i24(s[i] >> 8) * k->g) * 0x100;
+	}
+}
+
+static void _pcm_gain_i32(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = pcm_i32_flt(pcm_flt_i32(s[i]) * k->g);
+	}
+}
+
+static void _pcm_gain_f32(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const float *s = (float*)in;
+	float *d = (float*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = s[i] * k->gf;
+	}
+}
+
+static void _pcm_gain_f64(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const double *s = (double*)in;
+	double *d = (double*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = s[i] * k->g;
+	}
+}
+
+/** float16, bfloat16:  convert blocks of samples to float32, multiply, convert back
+g: per-sample gain;  NULL: use 'gf' */
+static inline void _pcm_gain_half(uint fmt, void *out, const void *in, float gf, const float *g, size_t n)
+{
+	float buf[256];
+	pcm_conv_func load = _pcm_conv_half(fmt, FFAUDIO_F_FLOAT32)
+		, store = _pcm_conv_half(FFAUDIO_F_FLOAT32, fmt);
+	size_t i, j, k;
+	for (i = 0;  i != n;  i += k) {
+		k = ffmin(n - i, FF_COUNT(buf));
+		load(buf, (ushort*)in + i, k);
+		if (g != NULL) {
+			for (j = 0;  j != k;  j++) {
+				buf[j] *= g[i + j];
+			}
+		} else {
+			for (j = 0;  j != k;  j++) {
+				buf[j] *= gf;
+			}
+		}
+		store((ushort*)out + i, buf, k);
+	}
+}
+
+static void _pcm_gain_f16(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	_pcm_gain_half(FFAUDIO_F_FLOAT16, out, in, k->gf, NULL, n);
+}
+
+static void _pcm_gain_bf16(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	_pcm_gain_half(FFAUDIO_F_BFLOAT16, out, in, k->gf, NULL, n);
+}
+
+#ifdef FF_SSE2
+
+/** Multiply 8 int16 by the Q15 gain, round, saturate to int16 */
+static inline __m128i _pcm_sse2_gain_q15(__m128i v, __m128i q, __m128i rnd, __m128i sh)
+{
+	__m128i lo = _mm_mullo_epi16(v, q);
+	__m128i hi = _mm_mulhi_epi16(v, q);
+	__m128i a = _mm_sra_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), rnd), sh);
+	__m128i b = _mm_sra_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), rnd), sh);
+	return _mm_packs_epi32(a, b);
+}
+
+/** Multiply 4 int32 by the gain in double precision, clamp, round */
+static inline __m128i _pcm_sse2_gain_pd(__m128i v, __m128d g, __m128d lo, __m128d hi)
+{
+	__m128d a = _mm_mul_pd(_mm_cvtepi32_pd(v), g);
+	__m128d b = _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), g);
+	a = _mm_min_pd(_mm_max_pd(a, lo), hi);
+	b = _mm_min_pd(_mm_max_pd(b, lo), hi);
+	return _mm_unpacklo_epi64(_mm_cvtpd_epi32(a), _mm_cvtpd_epi32(b));
+}
+
+static void _pcm_sse2_gain_i8(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const char *s = (char*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128i q = _mm_set1_epi16(k->q)
+		, rnd = _mm_set1_epi32(1 << (k->shift - 1))
+		, sh = _mm_cvtsi32_si128(k->shift);
+	for (;  i + 16 <= n;  i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		__m128i a = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+		__m128i b = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+		a = _pcm_sse2_gain_q15(a, q, rnd, sh);
+		b = _pcm_sse2_gain_q15(b, q, rnd, sh);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi16(a, b));
+	}
+	_pcm_gain_i8(d + i, s + i, k, n - i);
+}
+
+static void _pcm_sse2_gain_i16(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const short *s = (short*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	const __m128i q = _mm_set1_epi16(k->q)
+		, rnd = _mm_set1_epi32(1 << (k->shift - 1))
+		, sh = _mm_cvtsi32_si128(k->shift);
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_si128((__m128i*)(d + i), _pcm_sse2_gain_q15(v, q, rnd, sh));
+	}
+	_pcm_gain_i16(d + i, s + i, k, n - i);
+}
+
+static void _pcm_sse2_gain_i24(void *out, const void *in, const struct _pcm_gain *k, size_t n)
 {
-	uint i, ich, step = 1, nch = af->channels;
-	void *ini[PCM_CHAN_MAX], *oni[PCM_CHAN_MAX];
-	union pcm_data from, to;
+	const char *s = (char*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128d g = _mm_set1_pd(k->g)
+		, lo = _mm_set1_pd(-pcm_max24)
+		, hi = _mm_set1_pd(pcm_max24 - 1);
+	for (;  i + 4 < n;  i += 4) {
+		__m128i v = _pcm_sse2_i24_load4(s + i * 3);
+		_pcm_sse2_i24_store4(d + i * 3, _pcm_sse2_gain_pd(v, g, lo, hi));
+	}
+	_pcm_gain_i24(d + i * 3, s + i * 3, k, n - i);
+}
+
+static void _pcm_sse2_gain_i24_4(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128d g = _mm_set1_pd(k->g)
+		, lo = _mm_set1_pd(-pcm_max24)
+		, hi = _mm_set1_pd(pcm_max24 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(s + i)), 8);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_slli_epi32(_pcm_sse2_gain_pd(v, g, lo, hi), 8));
+	}
+	_pcm_gain_i24_4(d + i, s + i, k, n - i);
+}
+
+static void _pcm_sse2_gain_i32(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128d g = _mm_set1_pd(k->g)
+		, lo = _mm_set1_pd(-pcm_max32)
+		, hi = _mm_set1_pd(pcm_max32 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_si128((__m128i*)(d + i), _pcm_sse2_gain_pd(v, g, lo, hi));
+	}
+	_pcm_gain_i32(d + i, s + i, k, n - i);
+}
 
+static void _pcm_sse2_gain_f32(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const float *s = (float*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m128 g = _mm_set1_ps(k->gf);
+	for (;  i + 8 <= n;  i += 8) {
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_loadu_ps(s + i), g));
+		_mm_storeu_ps(d + i + 4, _mm_mul_ps(_mm_loadu_ps(s + i + 4), g));
+	}
+	_pcm_gain_f32(d + i, s + i, k, n - i);
+}
+
+static void _pcm_sse2_gain_f64(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const double *s = (double*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	const __m128d g = _mm_set1_pd(k->g);
+	for (;  i + 4 <= n;  i += 4) {
+		_mm_storeu_pd(d + i, _mm_mul_pd(_mm_loadu_pd(s + i), g));
+		_mm_storeu_pd(d + i + 2, _mm_mul_pd(_mm_loadu_pd(s + i + 2), g));
+	}
+	_pcm_gain_f64(d + i, s + i, k, n - i);
+}
+
+#endif // FF_SSE2
+
+#ifdef PCM_AVX2
+
+/* Unpack and pack instructions work within 128-bit lanes and cancel each other out,
+ so the sample order is preserved without cross-lane permutes */
+
+static inline PCM_TARGET_AVX2 __m256i _pcm_avx2_gain_q15(__m256i v, __m256i q, __m256i rnd, __m128i sh)
+{
+	__m256i lo = _mm256_mullo_epi16(v, q);
+	__m256i hi = _mm256_mulhi_epi16(v, q);
+	__m256i a = _mm256_sra_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), rnd), sh);
+	__m256i b = _mm256_sra_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), rnd), sh);
+	return _mm256_packs_epi32(a, b);
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_gain_i8(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const char *s = (char*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m256i q = _mm256_set1_epi16(k->q)
+		, rnd = _mm256_set1_epi32(1 << (k->shift - 1));
+	const __m128i sh = _mm_cvtsi32_si128(k->shift);
+	for (;  i + 32 <= n;  i += 32) {
+		__m256i v = _mm256_loadu_si256((__m256i*)(s + i));
+		__m256i a = _mm256_srai_epi16(_mm256_unpacklo_epi8(v, v), 8);
+		__m256i b = _mm256_srai_epi16(_mm256_unpackhi_epi8(v, v), 8);
+		a = _pcm_avx2_gain_q15(a, q, rnd, sh);
+		b = _pcm_avx2_gain_q15(b, q, rnd, sh);
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_packs_epi16(a, b));
+	}
+	_pcm_gain_i8(d + i, s + i, k, n - i);
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_gain_i16(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const short *s = (short*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	const __m256i q = _mm256_set1_epi16(k->q)
+		, rnd = _mm256_set1_epi32(1 << (k->shift - 1));
+	const __m128i sh = _mm_cvtsi32_si128(k->shift);
+	for (;  i + 16 <= n;  i += 16) {
+		__m256i v = _mm256_loadu_si256((__m256i*)(s + i));
+		_mm256_storeu_si256((__m256i*)(d + i), _pcm_avx2_gain_q15(v, q, rnd, sh));
+	}
+	_pcm_gain_i16(d + i, s + i, k, n - i);
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_gain_i32(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m256d g = _mm256_set1_pd(k->g)
+		, lo = _mm256_set1_pd(-pcm_max32)
+		, hi = _mm256_set1_pd(pcm_max32 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		__m256d f = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128((__m128i*)(s + i))), g);
+		f = _mm256_min_pd(_mm256_max_pd(f, lo), hi);
+		_mm_storeu_si128((__m128i*)(d + i), _mm256_cvtpd_epi32(f));
+	}
+	_pcm_gain_i32(d + i, s + i, k, n - i);
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_gain_f32(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const float *s = (float*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m256 g = _mm256_set1_ps(k->gf);
+	for (;  i + 16 <= n;  i += 16) {
+		_mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_loadu_ps(s + i), g));
+		_mm256_storeu_ps(d + i + 8, _mm256_mul_ps(_mm256_loadu_ps(s + i + 8), g));
+	}
+	_pcm_gain_f32(d + i, s + i, k, n - i);
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_gain_f64(void *out, const void *in, const struct _pcm_gain *k, size_t n)
+{
+	const double *s = (double*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	const __m256d g = _mm256_set1_pd(k->g);
+	for (;  i + 8 <= n;  i += 8) {
+		_mm256_storeu_pd(d + i, _mm256_mul_pd(_mm256_loadu_pd(s + i), g));
+		_mm256_storeu_pd(d + i + 4, _mm256_mul_pd(_mm256_loadu_pd(s + i + 4), g));
+	}
+	_pcm_gain_f64(d + i, s + i, k, n - i);
+}
+
+#endif // PCM_AVX2
+
+#ifdef FF_SSE2
+	#define _PCM_SSE2_K(name)  name
+#else
+	#define _PCM_SSE2_K(name)  NULL
+#endif
+#ifdef PCM_AVX2
+	#define _PCM_AVX2_K(name)  name
+#else
+	#define _PCM_AVX2_K(name)  NULL
+#endif
+
+struct _pcm_gain_kernel {
+	ushort fmt;
+	_pcm_gain_func scalar, sse2, avx2;
+};
+
+static const struct _pcm_gain_kernel _pcm_gain_kernels[] = {
+	{ FFAUDIO_F_INT8, _pcm_gain_i8, _PCM_SSE2_K(_pcm_sse2_gain_i8), _PCM_AVX2_K(_pcm_avx2_gain_i8) },
+	{ FFAUDIO_F_INT16, _pcm_gain_i16, _PCM_SSE2_K(_pcm_sse2_gain_i16), _PCM_AVX2_K(_pcm_avx2_gain_i16) },
+	{ FFAUDIO_F_INT24, _pcm_gain_i24, _PCM_SSE2_K(_pcm_sse2_gain_i24), NULL },
+	{ FFAUDIO_F_INT24_4, _pcm_gain_i24_4, _PCM_SSE2_K(_pcm_sse2_gain_i24_4), NULL },
+	{ FFAUDIO_F_INT32, _pcm_gain_i32, _PCM_SSE2_K(_pcm_sse2_gain_i32), _PCM_AVX2_K(_pcm_avx2_gain_i32) },
+	{ FFAUDIO_F_FLOAT32, _pcm_gain_f32, _PCM_SSE2_K(_pcm_sse2_gain_f32), _PCM_AVX2_K(_pcm_avx2_gain_f32) },
+	{ FFAUDIO_F_FLOAT64, _pcm_gain_f64, _PCM_SSE2_K(_pcm_sse2_gain_f64), _PCM_AVX2_K(_pcm_avx2_gain_f64) },
+	{ FFAUDIO_F_FLOAT16, _pcm_gain_f16, NULL, NULL }, // the conversion is vectorized
+	{ FFAUDIO_F_BFLOAT16, _pcm_gain_bf16, NULL, NULL },
+};
+
+#undef _PCM_SSE2_K
+#undef _PCM_AVX2_K
+
+/** Get the fastest gain kernel for the format supported by CPU.
+Return NULL if the format isn't supported. */
+static inline _pcm_gain_func _pcm_gain_find(uint format)
+{
+	uint cpu = pcm_cpu_features();
+	for (uint i = 0;  i != FF_COUNT(_pcm_gain_kernels);  i++) {
+		const struct _pcm_gain_kernel *k = &_pcm_gain_kernels[i];
+		if (k->fmt == format) {
+			if ((cpu & PCM_CPU_AVX2) && k->avx2 != NULL)
+				return k->avx2;
+			if ((cpu & PCM_CPU_SSE2) && k->sse2 != NULL)
+				return k->sse2;
+			return k->scalar;
+		}
+	}
+	return NULL;
+}
+
+/** Change volume.
+'in' and 'out' may be the same buffer.
+Return 0 on success */
+static inline int pcm_gain(const struct pcm_af *af, double gain, const void *in, void *out, uint samples)
+{
 	if (gain == 1)
 		return 0;
 
 	if (af->channels > PCM_CHAN_MAX)
 		return -1;
 
-	from.p = (void*)in;
-	to.p = out;
+	_pcm_gain_func f;
+	if (NULL == (f = _pcm_gain_find(af->format)))
+		return -1;
+
+	struct _pcm_gain k;
+	_pcm_gain_prep(&k, gain);
 
 	if (af->interleaved) {
+		// the gain is the same for all channels:  process the frames as 1 contiguous channel
+		f(out, in, &k, (size_t)samples * af->channels);
+		return 0;
+	}
 
-		if (af->channels == 2) {
-			switch (af->format) {
-			case FFAUDIO_F_FLOAT32:
-				for (i = 0;  i < samples;  i++) {
-					*to.f32++ = *from.f32++ * gain;
-					*to.f32++ = *from.f32++ * gain;
-				}
-				return 0;
-			}
-		}
+	for (uint ich = 0;  ich != af->channels;  ich++) {
+		f(((void**)out)[ich], ((void**)in)[ich], &k, samples);
+	}
+	return 0;
+}
+
+
+/* Per-channel gain with ramps.
+The gain of each channel moves linearly from the current value to the target
+ during the specified number of frames, the value is updated for each frame.
+Ramp blocks: the per-sample gains are written to a small float array (in L1),
+ then a vectorized kernel multiplies the samples by the array.
+Samples are multiplied in single precision (int24, int32 - in double precision),
+ rounded to nearest-even and saturated.
+Constant gain is applied by the same kernels as pcm_gain(). */
+
+#define _PCM_GAIN_BLOCK  1024 // samples
+
+/** Apply per-sample gain 'g' to 'n' contiguous samples */
+typedef void (*_pcm_gainv_func)(void *out, const void *in, const float *g, size_t n);
 
-		from.pi8 = pcm_setni(ini, from.i8, af->format, nch);
-		to.pi8 = pcm_setni(oni, to.i8, af->format, nch);
-		step = nch;
+static void _pcm_gainv_i8(void *out, const void *in, const float *g, size_t n)
+{
+	const char *s = (char*)in;
+	char *d = (char*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		int v = int_ftoi(s[i] * g[i]);
+		d[i] = ffmax(ffmin(v, 0x7f), -0x80);
 	}
+}
 
-	switch (af->format) {
-	case FFAUDIO_F_INT8:
-		for (ich = 0;  ich != nch;  ich++) {
-			for (i = 0;  i != samples;  i++) {
-				to.pi8[ich][i * step] = pcm_i8_flt(pcm_flt_i8(from.pi8[ich][i * step]) * gain);
-			}
+static void _pcm_gainv_i16(void *out, const void *in, const float *g, size_t n)
+{
+	const short *s = (short*)in;
+	short *d = (short*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		int v = int_ftoi(s[i] * g[i]);
+		d[i] = ffmax(ffmin(v, 0x7fff), -0x8000);
+	}
+}
+
+static void _pcm_gainv_i24(void *out, const void *in, const float *g, size_t n)
+{
+	const char *s = (char*)in;
+	char *d = (char*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		double f = (double)pcm_i32_i24(s + i * 3) * g[i];
+		f = ffmin(ffmax(f, -pcm_max24), pcm_max24 - 1);
+		pcm_i24_i32(d + i * 3, int_ftoi(f));
+	}
+}
+
+static void _pcm_gainv_i24_4(void *out, const void *in, const float *g, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		double f = (double)(s[i] >> 8) * g[i];
+		f = ffmin(ffmax(f, -pcm_max24), pcm_max24 - 1);
+		d[i] = int_ftoi(f) * 0x100;
+	}
+}
+
+static void _pcm_gainv_i32(void *out, const void *in, const float *g, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		double f = (double)s[i] * g[i];
+		f = ffmin(ffmax(f, -pcm_max32), pcm_max32 - 1);
+		d[i] = int_ftoi(f);
+	}
+}
+
+static void _pcm_gainv_f32(void *out, const void *in, const float *g, size_t n)
+{
+	const float *s = (float*)in;
+	float *d = (float*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = s[i] * g[i];
+	}
+}
+
+static void _pcm_gainv_f64(void *out, const void *in, const float *g, size_t n)
+{
+	const double *s = (double*)in;
+	double *d = (double*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = s[i] * g[i];
+	}
+}
+
+static void _pcm_gainv_f16(void *out, const void *in, const float *g, size_t n)
+{
+	_pcm_gain_half(FFAUDIO_F_FLOAT16, out, in, 1, g, n);
+}
+
+static void _pcm_gainv_bf16(void *out, const void *in, const float *g, size_t n)
+{
+	_pcm_gain_half(FFAUDIO_F_BFLOAT16, out, in, 1, g, n);
+}
+
+#ifdef FF_SSE2
+
+static void _pcm_sse2_gainv_i16(void *out, const void *in, const float *g, size_t n)
+{
+	const short *s = (short*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		__m128i a = _mm_cvtps_epi32(_mm_mul_ps(_pcm_sse2_i16lo_ps(v), _mm_loadu_ps(g + i)));
+		__m128i b = _mm_cvtps_epi32(_mm_mul_ps(_pcm_sse2_i16hi_ps(v), _mm_loadu_ps(g + i + 4)));
+		_mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(a, b));
+	}
+	_pcm_gainv_i16(d + i, s + i, g + i, n - i);
+}
+
+/** Multiply 4 int32 by 4 gains in double precision, clamp, round */
+static inline __m128i _pcm_sse2_gainv_pd(__m128i v, __m128 g, __m128d lo, __m128d hi)
+{
+	__m128d a = _mm_mul_pd(_mm_cvtepi32_pd(v), _mm_cvtps_pd(g));
+	__m128d b = _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), _mm_cvtps_pd(_mm_movehl_ps(g, g)));
+	a = _mm_min_pd(_mm_max_pd(a, lo), hi);
+	b = _mm_min_pd(_mm_max_pd(b, lo), hi);
+	return _mm_unpacklo_epi64(_mm_cvtpd_epi32(a), _mm_cvtpd_epi32(b));
+}
+
+static void _pcm_sse2_gainv_i24(void *out, const void *in, const float *g, size_t n)
+{
+	const char *s = (char*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128d lo = _mm_set1_pd(-pcm_max24)
+		, hi = _mm_set1_pd(pcm_max24 - 1);
+	for (;  i + 4 < n;  i += 4) {
+		__m128i v = _pcm_sse2_i24_load4(s + i * 3);
+		_pcm_sse2_i24_store4(d + i * 3, _pcm_sse2_gainv_pd(v, _mm_loadu_ps(g + i), lo, hi));
+	}
+	_pcm_gainv_i24(d + i * 3, s + i * 3, g + i, n - i);
+}
+
+static void _pcm_sse2_gainv_i24_4(void *out, const void *in, const float *g, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128d lo = _mm_set1_pd(-pcm_max24)
+		, hi = _mm_set1_pd(pcm_max24 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(s + i)), 8);
+		v = _pcm_sse2_gainv_pd(v, _mm_loadu_ps(g + i), lo, hi);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_slli_epi32(v, 8));
+	}
+	_pcm_gainv_i24_4(d + i, s + i, g + i, n - i);
+}
+
+static void _pcm_sse2_gainv_i32(void *out, const void *in, const float *g, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128d lo = _mm_set1_pd(-pcm_max32)
+		, hi = _mm_set1_pd(pcm_max32 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_si128((__m128i*)(d + i), _pcm_sse2_gainv_pd(v, _mm_loadu_ps(g + i), lo, hi));
+	}
+	_pcm_gainv_i32(d + i, s + i, g + i, n - i);
+}
+
+static void _pcm_sse2_gainv_f32(void *out, const void *in, const float *g, size_t n)
+{
+	const float *s = (float*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	for (;  i + 4 <= n;  i += 4) {
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_loadu_ps(s + i), _mm_loadu_ps(g + i)));
+	}
+	_pcm_gainv_f32(d + i, s + i, g + i, n - i);
+}
+
+static void _pcm_sse2_gainv_f64(void *out, const void *in, const float *g, size_t n)
+{
+	const double *s = (double*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 gf = _mm_loadu_ps(g + i);
+		_mm_storeu_pd(d + i, _mm_mul_pd(_mm_loadu_pd(s + i), _mm_cvtps_pd(gf)));
+		_mm_storeu_pd(d + i + 2, _mm_mul_pd(_mm_loadu_pd(s + i + 2), _mm_cvtps_pd(_mm_movehl_ps(gf, gf))));
+	}
+	_pcm_gainv_f64(d + i, s + i, g + i, n - i);
+}
+
+#endif // FF_SSE2
+
+#ifdef PCM_AVX2
+
+static PCM_TARGET_AVX2 void _pcm_avx2_gainv_i16(void *out, const void *in, const float *g, size_t n)
+{
+	const short *s = (short*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	for (;  i + 16 <= n;  i += 16) {
+		__m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)(s + i))));
+		__m256 b = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)(s + i + 8))));
+		__m256i ia = _mm256_cvtps_epi32(_mm256_mul_ps(a, _mm256_loadu_ps(g + i)));
+		__m256i ib = _mm256_cvtps_epi32(_mm256_mul_ps(b, _mm256_loadu_ps(g + i + 8)));
+		__m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi32(ia, ib), 0xd8);
+		_mm256_storeu_si256((__m256i*)(d + i), r);
+	}
+	_pcm_gainv_i16(d + i, s + i, g + i, n - i);
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_gainv_f32(void *out, const void *in, const float *g, size_t n)
+{
+	const float *s = (float*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		_mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_loadu_ps(s + i), _mm256_loadu_ps(g + i)));
+	}
+	_pcm_gainv_f32(d + i, s + i, g + i, n - i);
+}
+
+#endif // PCM_AVX2
+
+/* Fused kernels:  apply gain and measure the output in the same pass (see pcm-stats.h).
+Constant gain ('ctx': struct _pcm_gain) or per-sample gain ('g').
+The arithmetic is the same as in the kernels above. */
+
+#ifdef FF_SSE2
+
+static inline __m128 _pcm_sse2_fused_gain_i16(short *d, const short *s, const float *g, size_t i, const void *ctx)
+{
+	const struct _pcm_gain *k = (struct _pcm_gain*)ctx;
+	__m128i v = _pcm_sse2_gain_q15(_mm_loadl_epi64((__m128i*)(s + i))
+		, _mm_set1_epi16(k->q), _mm_set1_epi32(1 << (k->shift - 1)), _mm_cvtsi32_si128(k->shift));
+	_mm_storel_epi64((__m128i*)(d + i), v);
+	return _mm_mul_ps(_pcm_sse2_i16lo_ps(v), _mm_set1_ps(1 / pcm_max16));
+}
+
+static inline __m128 _pcm_sse2_fused_gainv_i16(short *d, const short *s, const float *g, size_t i, const void *ctx)
+{
+	__m128i v = _mm_loadl_epi64((__m128i*)(s + i));
+	v = _mm_cvtps_epi32(_mm_mul_ps(_pcm_sse2_i16lo_ps(v), _mm_loadu_ps(g + i)));
+	v = _mm_packs_epi32(v, v);
+	_mm_storel_epi64((__m128i*)(d + i), v);
+	return _mm_mul_ps(_pcm_sse2_i16lo_ps(v), _mm_set1_ps(1 / pcm_max16));
+}
+
+static inline __m128 _pcm_sse2_fused_gain_f32(float *d, const float *s, const float *g, size_t i, const void *ctx)
+{
+	const struct _pcm_gain *k = (struct _pcm_gain*)ctx;
+	__m128 f = _mm_mul_ps(_mm_loadu_ps(s + i), _mm_set1_ps(k->gf));
+	_mm_storeu_ps(d + i, f);
+	return f;
+}
+
+static inline __m128 _pcm_sse2_fused_gainv_f32(float *d, const float *s, const float *g, size_t i, const void *ctx)
+{
+	__m128 f = _mm_mul_ps(_mm_loadu_ps(s + i), _mm_loadu_ps(g + i));
+	_mm_storeu_ps(d + i, f);
+	return f;
+}
+
+_PCM_SSE2_FUSED_K(_pcm_sse2_fused_k_gain_i16, short, short, _pcm_sse2_fused_gain_i16, i16, d)
+_PCM_SSE2_FUSED_K(_pcm_sse2_fused_k_gainv_i16, short, short, _pcm_sse2_fused_gainv_i16, i16, d)
+_PCM_SSE2_FUSED_K(_pcm_sse2_fused_k_gain_f32, float, float, _pcm_sse2_fused_gain_f32, f32, d)
+_PCM_SSE2_FUSED_K(_pcm_sse2_fused_k_gainv_f32, float, float, _pcm_sse2_fused_gainv_f32, f32, d)
+
+#endif // FF_SSE2
+
+#ifdef PCM_AVX2
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_fused_gain_i16(short *d, const short *s, const float *g, size_t i, const void *ctx)
+{
+	const struct _pcm_gain *k = (struct _pcm_gain*)ctx;
+	__m128i v = _pcm_sse2_gain_q15(_mm_loadu_si128((__m128i*)(s + i))
+		, _mm_set1_epi16(k->q), _mm_set1_epi32(1 << (k->shift - 1)), _mm_cvtsi32_si128(k->shift));
+	_mm_storeu_si128((__m128i*)(d + i), v);
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)), _mm256_set1_ps(1 / pcm_max16));
+}
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_fused_gainv_i16(short *d, const short *s, const float *g, size_t i, const void *ctx)
+{
+	__m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)(s + i))));
+	__m128i v = _pcm_avx2_epi32_epi16(_mm256_cvtps_epi32(_mm256_mul_ps(f, _mm256_loadu_ps(g + i))));
+	_mm_storeu_si128((__m128i*)(d + i), v);
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)), _mm256_set1_ps(1 / pcm_max16));
+}
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_fused_gain_f32(float *d, const float *s, const float *g, size_t i, const void *ctx)
+{
+	const struct _pcm_gain *k = (struct _pcm_gain*)ctx;
+	__m256 f = _mm256_mul_ps(_mm256_loadu_ps(s + i), _mm256_set1_ps(k->gf));
+	_mm256_storeu_ps(d + i, f);
+	return f;
+}
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_fused_gainv_f32(float *d, const float *s, const float *g, size_t i, const void *ctx)
+{
+	__m256 f = _mm256_mul_ps(_mm256_loadu_ps(s + i), _mm256_loadu_ps(g + i));
+	_mm256_storeu_ps(d + i, f);
+	return f;
+}
+
+_PCM_AVX2_FUSED_K(_pcm_avx2_fused_k_gain_i16, short, short, _pcm_avx2_fused_gain_i16, i16, d)
+_PCM_AVX2_FUSED_K(_pcm_avx2_fused_k_gainv_i16, short, short, _pcm_avx2_fused_gainv_i16, i16, d)
+_PCM_AVX2_FUSED_K(_pcm_avx2_fused_k_gain_f32, float, float, _pcm_avx2_fused_gain_f32, f32, d)
+_PCM_AVX2_FUSED_K(_pcm_avx2_fused_k_gainv_f32, float, float, _pcm_avx2_fused_gainv_f32, f32, d)
+
+#endif // PCM_AVX2
+
+#ifdef FF_SSE2
+
+#ifdef PCM_AVX2
+	#define _PCM_AVX2_K(name)  name
+#else
+	#define _PCM_AVX2_K(name)  NULL
+#endif
+
+// ifmt: 0: constant gain;  1: per-sample gain
+static const struct _pcm_fused_kernel _pcm_gain_fused_kernels[] = {
+	{ 0, FFAUDIO_F_INT16, _pcm_sse2_fused_k_gain_i16, _PCM_AVX2_K(_pcm_avx2_fused_k_gain_i16) },
+	{ 1, FFAUDIO_F_INT16, _pcm_sse2_fused_k_gainv_i16, _PCM_AVX2_K(_pcm_avx2_fused_k_gainv_i16) },
+	{ 0, FFAUDIO_F_FLOAT32, _pcm_sse2_fused_k_gain_f32, _PCM_AVX2_K(_pcm_avx2_fused_k_gain_f32) },
+	{ 1, FFAUDIO_F_FLOAT32, _pcm_sse2_fused_k_gainv_f32, _PCM_AVX2_K(_pcm_avx2_fused_k_gainv_f32) },
+};
+
+#undef _PCM_AVX2_K
+
+/** Get the fused kernel that applies gain to 'nch' interleaved channels and measures the output
+vec: per-sample gain
+lanes: (output) samples per vector */
+static inline _pcm_stats_fused_func _pcm_gain_fused_find(uint format, uint vec, uint nch, uint *lanes)
+{
+	for (uint i = 0;  i != FF_COUNT(_pcm_gain_fused_kernels);  i++) {
+		const struct _pcm_fused_kernel *k = &_pcm_gain_fused_kernels[i];
+		if (k->ifmt == vec && k->ofmt == format)
+			return _pcm_stats_fused_select(k, nch, lanes);
+	}
+	return NULL;
+}
+
+#else // FF_SSE2
+
+static inline _pcm_stats_fused_func _pcm_gain_fused_find(uint format, uint vec, uint nch, uint *lanes)
+{
+	return NULL;
+}
+
+#endif // FF_SSE2
+
+#ifdef FF_SSE2
+	#define _PCM_SSE2_K(name)  name
+#else
+	#define _PCM_SSE2_K(name)  NULL
+#endif
+#ifdef PCM_AVX2
+	#define _PCM_AVX2_K(name)  name
+#else
+	#define _PCM_AVX2_K(name)  NULL
+#endif
+
+struct _pcm_gainv_kernel {
+	ushort fmt;
+	_pcm_gainv_func scalar, sse2, avx2;
+};
+
+static const struct _pcm_gainv_kernel _pcm_gainv_kernels[] = {
+	{ FFAUDIO_F_INT8, _pcm_gainv_i8, NULL, NULL },
+	{ FFAUDIO_F_INT16, _pcm_gainv_i16, _PCM_SSE2_K(_pcm_sse2_gainv_i16), _PCM_AVX2_K(_pcm_avx2_gainv_i16) },
+	{ FFAUDIO_F_INT24, _pcm_gainv_i24, _PCM_SSE2_K(_pcm_sse2_gainv_i24), NULL },
+	{ FFAUDIO_F_INT24_4, _pcm_gainv_i24_4, _PCM_SSE2_K(_pcm_sse2_gainv_i24_4), NULL },
+	{ FFAUDIO_F_INT32, _pcm_gainv_i32, _PCM_SSE2_K(_pcm_sse2_gainv_i32), NULL },
+	{ FFAUDIO_F_FLOAT32, _pcm_gainv_f32, _PCM_SSE2_K(_pcm_sse2_gainv_f32), _PCM_AVX2_K(_pcm_avx2_gainv_f32) },
+	{ FFAUDIO_F_FLOAT64, _pcm_gainv_f64, _PCM_SSE2_K(_pcm_sse2_gainv_f64), NULL },
+	{ FFAUDIO_F_FLOAT16, _pcm_gainv_f16, NULL, NULL },
+	{ FFAUDIO_F_BFLOAT16, _pcm_gainv_bf16, NULL, NULL },
+};
+
+#undef _PCM_SSE2_K
+#undef _PCM_AVX2_K
+
+static inline _pcm_gainv_func _pcm_gainv_find(uint format)
+{
+	uint cpu = pcm_cpu_features();
+	for (uint i = 0;  i != FF_COUNT(_pcm_gainv_kernels);  i++) {
+		const struct _pcm_gainv_kernel *k = &_pcm_gainv_kernels[i];
+		if (k->fmt == format) {
+			if ((cpu & PCM_CPU_AVX2) && k->avx2 != NULL)
+				return k->avx2;
+			if ((cpu & PCM_CPU_SSE2) && k->sse2 != NULL)
+				return k->sse2;
+			return k->scalar;
 		}
-		break;
+	}
+	return NULL;
+}
 
-	case FFAUDIO_F_INT16:
-		for (ich = 0;  ich != nch;  ich++) {
-			for (i = 0;  i != samples;  i++) {
-				to.pi16[ich][i * step] = pcm_i16_flt(pcm_flt_i16(from.pi16[ich][i * step]) * gain);
+struct pcm_gain_state {
+	double cur[PCM_CHAN_MAX]; // current gain
+	double step[PCM_CHAN_MAX]; // gain increment per frame
+	double target[PCM_CHAN_MAX];
+	uint left; // frames until the ramp reaches the target
+	struct pcm_stats *stats; // optional: statistics of the output signal;  set by user
+
+	// written by pcm_gain_set()
+	uint seq; // odd: the writer is updating 'next'
+	uint seq_used;
+	uint next_frames;
+	double next[PCM_CHAN_MAX];
+};
+
+/** Initialize state:  gain 1.0 for all channels */
+static inline void pcm_gain_state_init(struct pcm_gain_state *s)
+{
+	ffmem_zero(s, sizeof(*s));
+	for (uint i = 0;  i != PCM_CHAN_MAX;  i++) {
+		s->cur[i] = s->target[i] = s->next[i] = 1;
+	}
+}
+
+/** Set new target gain.
+May be called from another thread while pcm_gain_process() is running (1 writer only):
+ the new target is picked up at the start of the next pcm_gain_process() call.
+gain: per-channel gain
+channels: number of elements in 'gain';  1: the same gain for all channels
+frames: ramp length;  0: change the gain immediately */
+static inline void pcm_gain_set(struct pcm_gain_state *s, const double *gain, uint channels, uint frames)
+{
+	uint seq = s->seq;
+	FFINT_WRITEONCE(s->seq, seq + 1);
+	ffcpu_fence_release();
+
+	for (uint i = 0;  i != PCM_CHAN_MAX;  i++) {
+		if (channels == 1)
+			s->next[i] = ffmax(ffmin(gain[0], 4096), -4096);
+		else if (i < channels)
+			s->next[i] = ffmax(ffmin(gain[i], 4096), -4096);
+	}
+	s->next_frames = frames;
+
+	ffcpu_fence_release();
+	FFINT_WRITEONCE(s->seq, seq + 2);
+}
+
+/** Start a new ramp if pcm_gain_set() was called */
+static inline void _pcm_gain_state_update(struct pcm_gain_state *s)
+{
+	double next[PCM_CHAN_MAX];
+	uint seq = FFINT_READONCE(s->seq);
+	if (seq == s->seq_used || (seq & 1))
+		return;
+	ffcpu_fence_acquire();
+
+	ffmem_copy(next, s->next, sizeof(next));
+	uint frames = s->next_frames;
+
+	ffcpu_fence_acquire();
+	if (FFINT_READONCE(s->seq) != seq)
+		return; // the writer is updating the data:  try again next time
+	s->seq_used = seq;
+
+	// the ramp starts from the current gain, even if the previous ramp isn't finished
+	ffmem_copy(s->target, next, sizeof(next));
+	s->left = frames;
+	for (uint i = 0;  i != PCM_CHAN_MAX;  i++) {
+		if (frames == 0)
+			s->cur[i] = s->target[i];
+		s->step[i] = (frames != 0) ? (s->target[i] - s->cur[i]) / frames : 0;
+	}
+}
+
+static inline void* _pcm_gain_ptr(const struct pcm_af *af, const void *data, uint ich, size_t off)
+{
+	uint w = pcm_f_bits(af->format) / 8;
+	if (af->interleaved)
+		return (char*)data + off * w * af->channels;
+	return ((char**)data)[ich] + off * w;
+}
+
+/** Apply gain to 'len' contiguous samples ('nch' interleaved channels starting with channel 'ch0')
+ and update the statistics with the output.
+k: constant gain;  NULL: per-sample gain 'g'
+Complete periods of samples are processed by a fused kernel if there's one for this format;
+ the rest is processed by the usual kernels and then measured. */
+static inline void _pcm_gain_run_stats(struct pcm_stats *st, uint format, _pcm_gain_func f, _pcm_gainv_func fv, void *out, const void *in, const struct _pcm_gain *k, const float *g, size_t len, uint nch, uint ch0)
+{
+	uint lanes, w = pcm_f_bits(format) / 8;
+	size_t done = 0;
+	_pcm_stats_fused_func fk;
+	if (k != NULL && k->g == 1)
+		fk = _pcm_stats_conv_find(format, format, nch, &lanes); // just copy
+	else
+		fk = _pcm_gain_fused_find(format, (k == NULL), nch, &lanes);
+	if (fk != NULL)
+		done = _pcm_stats_fused_run(st, fk, lanes, k, format, out, w, in, w, g, len, nch, ch0);
+
+	// measure each block right after it's written
+	size_t block = _PCM_GAIN_BLOCK / nch * nch;
+	while (done != len) {
+		size_t n = ffmin(len - done, block);
+		void *o = (char*)out + done * w;
+		const void *i = (char*)in + done * w;
+		if (k == NULL)
+			fv(o, i, g + done, n);
+		else if (k->g != 1)
+			f(o, i, k, n);
+		else if (i != o)
+			ffmem_move(o, i, n * w);
+		_pcm_stats_run(st, format, o, n, nch, ch0);
+		done += n;
+	}
+}
+
+/** Apply constant gain to 'n' frames starting at frame 'off' */
+static inline void _pcm_gain_steady(struct pcm_gain_state *s, const struct pcm_af *af, _pcm_gain_func f, _pcm_gainv_func fv, float *g, const void *in, void *out, size_t off, size_t n)
+{
+	uint nch = af->channels, w = pcm_f_bits(af->format) / 8;
+	uint ich, same = 1;
+	for (ich = 1;  ich != nch;  ich++) {
+		if (s->cur[ich] != s->cur[0])
+			same = 0;
+	}
+
+	if (!af->interleaved || same) {
+		uint n_ch = (af->interleaved) ? 1 : nch;
+		size_t len = (af->interleaved) ? n * nch : n;
+		for (ich = 0;  ich != n_ch;  ich++) {
+			const void *i = _pcm_gain_ptr(af, in, ich, off);
+			void *o = _pcm_gain_ptr(af, out, ich, off);
+			struct _pcm_gain k;
+			_pcm_gain_prep(&k, s->cur[ich]);
+			if (s->stats != NULL) {
+				_pcm_gain_run_stats(s->stats, af->format, f, fv, o, i, &k, NULL, len
+					, (af->interleaved) ? nch : 1, (af->interleaved) ? 0 : ich);
+				continue;
+			}
+			if (s->cur[ich] == 1) {
+				if (i != o)
+					ffmem_move(o, i, len * w);
+				continue;
 			}
+			f(o, i, &k, len);
 		}
-		break;
+		return;
+	}
 
-	case FFAUDIO_F_INT24:
+	// interleaved, different gains:  the same gain pattern for each block
+	uint block = _PCM_GAIN_BLOCK / nch;
+	for (size_t fr = 0;  fr != block;  fr++) {
 		for (ich = 0;  ich != nch;  ich++) {
-			for (i = 0;  i != samples;  i++) {
-				int n = pcm_i32_i24(&from.pi8[ich][i * step * 3]);
-				pcm_i24_i32(&to.pi8[ich][i * step * 3], pcm_i24_flt(pcm_flt_i24(n) * gain));
-			}
+			g[fr * nch + ich] = s->cur[ich];
 		}
-		break;
+	}
+	while (n != 0) {
+		size_t k = ffmin(n, block);
+		void *o = _pcm_gain_ptr(af, out, 0, off);
+		const void *i = _pcm_gain_ptr(af, in, 0, off);
+		if (s->stats != NULL)
+			_pcm_gain_run_stats(s->stats, af->format, f, fv, o, i, NULL, g, k * nch, nch, 0);
+		else
+			fv(o, i, g, k * nch);
+		off += k;
+		n -= k;
+	}
+}
 
-	case FFAUDIO_F_INT32:
-		for (ich = 0;  ich != nch;  ich++) {
-			for (i = 0;  i != samples;  i++) {
-				to.pi32[ich][i * step] = pcm_i32_flt(pcm_flt_i32(from.pi32[ich][i * step]) * gain);
-			}
+/** Apply per-channel gain, continue the current ramp.
+'in' and 'out' may be the same buffer.
+Return 0 on success */
+static inline int pcm_gain_process(struct pcm_gain_state *s, const struct pcm_af *af, const void *in, void *out, uint samples)
+{
+	uint nch = af->channels;
+	if (nch > PCM_CHAN_MAX)
+		return -1;
+
+	_pcm_gain_func f;
+	_pcm_gainv_func fv;
+	if (NULL == (f = _pcm_gain_find(af->format))
+		|| NULL == (fv = _pcm_gainv_find(af->format)))
+		return -1;
+
+	_pcm_gain_state_update(s);
+
+	float g[_PCM_GAIN_BLOCK];
+	uint block = (af->interleaved) ? _PCM_GAIN_BLOCK / nch : _PCM_GAIN_BLOCK;
+	size_t off = 0;
+	if (s->stats != NULL) {
+		s->stats->channels = nch;
+		s->stats->frames += samples;
+	}
+	while (off != samples) {
+		if (s->left == 0) {
+			_pcm_gain_steady(s, af, f, fv, g, in, out, off, samples - off);
+			break;
 		}
-		break;
 
-	case FFAUDIO_F_FLOAT32:
-		for (ich = 0;  ich != nch;  ich++) {
-			for (i = 0;  i != samples;  i++) {
-				to.pf32[ich][i * step] = from.pf32[ich][i * step] * gain;
+		size_t n = ffmin(samples - off, ffmin(s->left, block));
+		uint ich, fr;
+		if (af->interleaved) {
+			for (fr = 0;  fr != n;  fr++) {
+				for (ich = 0;  ich != nch;  ich++) {
+					g[fr * nch + ich] = s->cur[ich] + s->step[ich] * fr;
+				}
 			}
-		}
-		break;
+			void *o = _pcm_gain_ptr(af, out, 0, off);
+			const void *i = _pcm_gain_ptr(af, in, 0, off);
+			if (s->stats != NULL)
+				_pcm_gain_run_stats(s->stats, af->format, f, fv, o, i, NULL, g, n * nch, nch, 0);
+			else
+				fv(o, i, g, n * nch);
 
-	case FFAUDIO_F_FLOAT64:
-		for (ich = 0;  ich != nch;  ich++) {
-			for (i = 0;  i != samples;  i++) {
-				to.pf64[ich][i * step] = from.pf64[ich][i * step] * gain;
+		} else {
+			for (ich = 0;  ich != nch;  ich++) {
+				for (fr = 0;  fr != n;  fr++) {
+					g[fr] = s->cur[ich] + s->step[ich] * fr;
+				}
+				void *o = _pcm_gain_ptr(af, out, ich, off);
+				const void *i = _pcm_gain_ptr(af, in, ich, off);
+				if (s->stats != NULL)
+					_pcm_gain_run_stats(s->stats, af->format, f, fv, o, i, NULL, g, n, 1, ich);
+				else
+					fv(o, i, g, n);
 			}
 		}
-		break;
 
-	default:
-		return -1;
+		s->left -= n;
+		for (ich = 0;  ich != PCM_CHAN_MAX;  ich++) {
+			s->cur[ich] = (s->left != 0) ? s->cur[ich] + s->step[ich] * n : s->target[ich];
+		}
+		off += n;
 	}
-
 	return 0;
 }
@@ -0,0 +1,310 @@
+/** ffaudio: lookahead limiter.
+2026, Simon Zolin */
+
+/*
+pcm_limiter_init pcm_limiter_destroy
+pcm_limiter_process
+pcm_limiter_latency
+*/
+
+/* Float32 samples are processed in-place, the output is delayed by (lookahead - 1) frames.
+Gain computer (per frame, all channels are linked):
+ peak = max(|sample|) of all channels
+ soft knee:  the output level approaches 'ceiling' asymptotically, starting at 'ceiling * (1 - knee)':
+  y = min(peak, a) + u / (1 + u / (ceiling - a)),  u = max(peak - a, 0)
+  greq = y / peak
+Gain smoothing:
+ hold = minimum of 'greq' over the last 'lookahead' frames
+ gain = average of 'hold' over the last 'lookahead' frames (linear attack),
+  then released exponentially:  gain <= greq of each sample when this sample is output,
+  so the output level never exceeds 'ceiling'.
+The knee and the gain application are vectorized;  the sliding minimum is O(1) per frame. */
+
+#pragma once
+#include <ffaudio/audio.h>
+#include <ffaudio/pcm.h>
+#include <ffaudio/pcm-simd.h>
+#include <float.h>
+#include <math.h>
+
+#define _PCM_LIM_BLOCK  1024 // samples
+
+struct pcm_limiter {
+	uint channels;
+	uint interleaved :1;
+	uint cur :1; // active delay line
+	uint la; // lookahead (frames)
+	uint delay; // la - 1
+	float a, inv_w; // knee start, 1 / knee width
+	double inv_la; // 1 / la
+	double rel; // release coefficient
+	double gain; // current gain;  double: the release must converge to exactly 1.0
+
+	// sliding minimum:  ring of (value, frame index)
+	float *qv;
+	uint *qi;
+	uint qhead, qn;
+	uint t; // frame counter
+
+	// moving average
+	float *box;
+	uint box_pos;
+	double box_sum;
+
+	float *dl[2]; // delay lines:  [delay frames][channels] or [channels][delay frames]
+	float *mem;
+};
+
+static inline void pcm_limiter_destroy(struct pcm_limiter *l)
+{
+	ffmem_free(l->mem);
+	l->mem = NULL;
+}
+
+/** Prepare limiter
+af: float32 format
+ceiling: maximum absolute output value, e.g. 0.99
+knee: width of the soft knee as a fraction of 'ceiling' (0..1);  0: hard knee
+lookahead_ms: 0: no lookahead (the output isn't delayed, but the attack is immediate)
+release_ms: time to recover 63% of the gain reduction
+Return 0 on success */
+static inline int pcm_limiter_init(struct pcm_limiter *l, const struct pcm_af *af, float ceiling, float knee, uint lookahead_ms, uint release_ms)
+{
+	ffmem_zero(l, sizeof(*l));
+	if (af->format != FFAUDIO_F_FLOAT32 || af->channels == 0 || af->channels > PCM_CHAN_MAX
+		|| !(ceiling > 0) || !(knee >= 0 && knee < 1))
+		return -1;
+
+	l->channels = af->channels;
+	l->interleaved = af->interleaved;
+	l->la = ffmax((ffuint64)af->rate * lookahead_ms / 1000, 1);
+	l->delay = l->la - 1;
+	l->inv_la = 1.0 / l->la;
+	l->a = ceiling * (1 - knee);
+	l->inv_w = (knee != 0) ? 1 / (ceiling - l->a) : FLT_MAX;
+	l->rel = (release_ms != 0) ? exp(-1000.0 / ((double)af->rate * release_ms)) : 0;
+	l->gain = 1;
+
+	size_t dl = (size_t)l->delay * l->channels;
+	if (NULL == (l->mem = (float*)ffmem_calloc(l->la * 3 + dl * 2, sizeof(float))))
+		return -1;
+	l->qv = l->mem;
+	l->qi = (uint*)(l->qv + l->la); // sizeof(uint) == sizeof(float)
+	l->box = l->qv + l->la * 2;
+	l->dl[0] = l->qv + l->la * 3;
+	l->dl[1] = l->dl[0] + dl;
+
+	for (uint i = 0;  i != l->la;  i++) {
+		l->box[i] = 1;
+	}
+	l->box_sum = l->la;
+	return 0;
+}
+
+/** Get the delay of the output (frames) */
+static inline uint pcm_limiter_latency(const struct pcm_limiter *l)
+{
+	return l->delay;
+}
+
+/** Compute the required gain from the peak level
+Return 0 if no gain reduction is required */
+static inline uint _pcm_lim_knee(const struct pcm_limiter *l, float *g, const float *peak, size_t n)
+{
+	size_t i = 0;
+	uint over_any = 0;
+#ifdef FF_SSE2
+	const __m128 a = _mm_set1_ps(l->a)
+		, inv_w = _mm_set1_ps(l->inv_w)
+		, one = _mm_set1_ps(1)
+		, zero = _mm_setzero_ps();
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 p = _mm_loadu_ps(peak + i);
+		__m128 u = _mm_max_ps(_mm_sub_ps(p, a), zero);
+		__m128 y = _mm_add_ps(_mm_min_ps(p, a), _mm_div_ps(u, _mm_add_ps(one, _mm_mul_ps(u, inv_w))));
+		__m128 over = _mm_cmpgt_ps(p, a);
+		over_any |= _mm_movemask_ps(over);
+		__m128 r = _mm_div_ps(y, _mm_or_ps(_mm_and_ps(over, p), _mm_andnot_ps(over, one)));
+		_mm_storeu_ps(g + i, _mm_or_ps(_mm_and_ps(over, r), _mm_andnot_ps(over, one)));
+	}
+#endif
+	for (;  i != n;  i++) {
+		float p = peak[i];
+		if (!(p > l->a)) {
+			g[i] = 1;
+			continue;
+		}
+		float u = p - l->a;
+		g[i] = (l->a + u / (1 + u * l->inv_w)) / p;
+		over_any = 1;
+	}
+	return over_any;
+}
+
+/** Get the maximum absolute value of all channels in each frame */
+static inline void _pcm_lim_peak(const struct pcm_limiter *l, float *peak, const void *data, size_t off, size_t n)
+{
+	uint c, nch = l->channels;
+	size_t i;
+
+	if (!l->interleaved) {
+		for (c = 0;  c != nch;  c++) {
+			const float *s = ((float**)data)[c] + off;
+			i = 0;
+#ifdef FF_SSE2
+			const __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+			for (;  i + 4 <= n;  i += 4) {
+				__m128 v = _mm_and_ps(_mm_loadu_ps(s + i), abs);
+				if (c != 0)
+					v = _mm_max_ps(v, _mm_loadu_ps(peak + i));
+				_mm_storeu_ps(peak + i, v);
+			}
+#endif
+			for (;  i != n;  i++) {
+				float v = fabsf(s[i]);
+				peak[i] = (c != 0) ? ffmax(peak[i], v) : v;
+			}
+		}
+		return;
+	}
+
+	const float *s = (float*)data + off * nch;
+	for (i = 0;  i != n;  i++) {
+		float v = 0;
+		for (c = 0;  c != nch;  c++) {
+			v = ffmax(v, fabsf(s[i * nch + c]));
+		}
+		peak[i] = v;
+	}
+}
+
+/** Smooth the required gain
+over: gain reduction is required for some of the frames */
+static inline void _pcm_lim_gain(struct pcm_limiter *l, float *g, size_t n, uint over)
+{
+	if (!over && l->gain == 1 && l->box_sum == l->la && l->qv[l->qhead] == 1) {
+		// the gain stays at 1.0:  the window contains just the last frame
+		l->t += n;
+		l->qhead = 0;
+		l->qn = 1;
+		l->qv[0] = 1;
+		l->qi[0] = l->t - 1;
+		return;
+	}
+
+	uint la = l->la, head = l->qhead, tail = l->qhead + l->qn;
+	if (tail >= la)
+		tail -= la;
+
+	for (size_t i = 0;  i != n;  i++) {
+		float v = g[i];
+		uint t = l->t++;
+
+		// sliding minimum:  drop the expired value, then the values that are not smaller than the new one.
+		// The ring holds at most 'la' frames only if the head expires before the new value is pushed.
+		if (l->qn != 0 && t - l->qi[head] >= la) {
+			if (++head == la)
+				head = 0;
+			l->qn--;
+		}
+		while (l->qn != 0) {
+			uint k = (tail != 0) ? tail - 1 : la - 1;
+			if (l->qv[k] < v)
+				break;
+			tail = k;
+			l->qn--;
+		}
+		l->qv[tail] = v;
+		l->qi[tail] = t;
+		if (++tail == la)
+			tail = 0;
+		l->qn++;
+		float hold = l->qv[head];
+
+		// moving average
+		l->box_sum += (double)hold - l->box[l->box_pos];
+		l->box[l->box_pos] = hold;
+		if (++l->box_pos == la) {
+			// don't let rounding errors accumulate
+			l->box_pos = 0;
+			l->box_sum = 0;
+			for (uint j = 0;  j != la;  j++) {
+				l->box_sum += l->box[j];
+			}
+		}
+		double s = l->box_sum * l->inv_la;
+
+		// release
+		l->gain = (s < l->gain) ? s : s + (l->gain - s) * l->rel;
+		g[i] = l->gain;
+	}
+	l->qhead = head;
+}
+
+/** d[i] = s[i] * g[i]
+Processed from the end to the start:  'd' may overlap 's' at a higher address. */
+static inline void _pcm_lim_mul_rev(float *d, const float *s, const float *g, size_t n)
+{
+	size_t i = n;
+#ifdef FF_SSE2
+	for (;  i >= 4;  i -= 4) {
+		_mm_storeu_ps(d + i - 4, _mm_mul_ps(_mm_loadu_ps(s + i - 4), _mm_loadu_ps(g + i - 4)));
+	}
+#endif
+	for (;  i != 0;  i--) {
+		d[i - 1] = s[i - 1] * g[i - 1];
+	}
+}
+
+/** Delay 'n' samples of 1 channel by 'delay' samples and apply gain
+x: data, in-place
+dl: the last 'delay' input samples
+dl_next: the new delay line */
+static inline void _pcm_lim_apply(float *x, const float *dl, float *dl_next, size_t delay, const float *g, size_t n)
+{
+	if (n >= delay) {
+		ffmem_copy(dl_next, x + n - delay, delay * sizeof(float));
+		_pcm_lim_mul_rev(x + delay, x, g + delay, n - delay);
+		_pcm_lim_mul_rev(x, dl, g, delay);
+	} else {
+		ffmem_copy(dl_next, dl + n, (delay - n) * sizeof(float));
+		ffmem_copy(dl_next + delay - n, x, n * sizeof(float));
+		_pcm_lim_mul_rev(x, dl, g, n);
+	}
+}
+
+/** Limit the level of float32 samples in-place
+data: interleaved (float*) or non-interleaved (float**) as set by pcm_limiter_init()
+The output is delayed by pcm_limiter_latency() frames. */
+static inline void pcm_limiter_process(struct pcm_limiter *l, void *data, size_t frames)
+{
+	float peak[_PCM_LIM_BLOCK], g[_PCM_LIM_BLOCK];
+	uint c, nch = l->channels;
+	size_t n, block = (l->interleaved) ? _PCM_LIM_BLOCK / nch : _PCM_LIM_BLOCK;
+
+	for (size_t off = 0;  off != frames;  off += n) {
+		n = ffmin(frames - off, block);
+		_pcm_lim_peak(l, peak, data, off, n);
+		uint over = _pcm_lim_knee(l, g, peak, n);
+		_pcm_lim_gain(l, g, n, over);
+
+		float *dl = l->dl[l->cur], *dl_next = l->dl[!l->cur];
+		if (!l->interleaved) {
+			for (c = 0;  c != nch;  c++) {
+				float *x = ((float**)data)[c] + off;
+				_pcm_lim_apply(x, dl + c * l->delay, dl_next + c * l->delay, l->delay, g, n);
+			}
+
+		} else {
+			// per-sample gain
+			for (size_t i = n;  i != 0;  i--) {
+				for (c = 0;  c != nch;  c++) {
+					peak[(i - 1) * nch + c] = g[i - 1];
+				}
+			}
+			float *x = (float*)data + off * nch;
+			_pcm_lim_apply(x, dl, dl_next, l->delay * nch, peak, n * nch);
+		}
+		l->cur = !l->cur;
+	}
+}
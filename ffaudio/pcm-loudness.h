@@ -0,0 +1,424 @@
+/** ffaudio: loudness meter (EBU R128, ITU-R BS.1770).
+2026, Simon Zolin */
+
+/*
+pcm_loudness_init pcm_loudness_destroy
+pcm_loudness_process
+pcm_loudness_momentary pcm_loudness_shortterm pcm_loudness_integrated
+pcm_loudness_truepeak
+pcm_loudness_replaygain
+*/
+
+/* The input of any format is converted to interleaved float32 block by block
+ into a small buffer that stays in L1 cache (there's no separate pass over the whole data).
+K-weighting:  2 biquad filters (high shelf, then high pass) per channel.
+ The filters are computed for 4 channels at once:  vector lane = channel;
+ channel groups of an interleaved frame are loaded with unaligned loads,
+ lanes after the last channel are ignored.
+Mean square values of the K-weighted signal are collected for each 100ms sub-block.
+ Momentary loudness: the last 4 sub-blocks (400ms);  short-term loudness: the last 30 sub-blocks (3s).
+Integrated loudness:  400ms blocks with 75% overlap are gated at -70 LUFS (absolute)
+ and at -10 LU below the loudness of the blocks above the absolute gate (relative).
+ The blocks are kept in a histogram with 0.1 LU bins (count and sum of energy for each bin),
+ so memory usage doesn't grow with stream length;
+ the relative gate is applied with 0.1 LU resolution.
+True peak:  the signal is upsampled x4 (x2 for 96kHz, none for higher rates)
+ by a polyphase windowed-sinc interpolator, 12 taps per phase;
+ the output includes the original samples. */
+
+#pragma once
+#include <ffaudio/pcm-convert.h>
+#include <math.h>
+
+enum PCM_LOUDNESS_F {
+	PCM_LOUDNESS_TRUEPEAK = 1, // measure true peak level
+};
+
+#define _PCM_LOUD_BLOCK  2048 // samples converted at once
+#define _PCM_LOUD_TAPS  12 // taps per phase of the true-peak interpolator
+#define _PCM_LOUD_SHORT  30 // sub-blocks in short-term window
+#define _PCM_LOUD_BINS  800 // histogram: -70..+10 LUFS
+#define _PCM_LOUD_GATE  -70
+
+struct pcm_loudness {
+	uint channels, nch4; // nch4: channels rounded up to 4
+	uint flags; // enum PCM_LOUDNESS_F
+	struct pcm_af af;
+	uint block; // frames converted at once
+	float k[5 * 2]; // filter coefficients:  b0 b1 b2 a1 a2, for each stage
+	float w[PCM_CHAN_MAX]; // channel weights
+
+	float *z; // filter state:  [4][nch4]
+	double *e; // sum of squares of the current sub-block:  [nch4]
+	uint sub_len, sub_pos; // 100ms sub-block length;  frames collected
+
+	double sub[_PCM_LOUD_SHORT]; // mean square values of the last sub-blocks
+	uint nsub; // total sub-blocks
+	ffuint64 hist_n[_PCM_LOUD_BINS];
+	double hist_e[_PCM_LOUD_BINS];
+
+	uint tp_factor;
+	float tp_k[4][_PCM_LOUD_TAPS]; // [phase][tap]
+	float *tp; // maximum absolute value:  [nch4]
+
+	float *buf; // [TAPS - 1 frames of history + block][channels] + padding
+	void *mem;
+};
+
+static inline void pcm_loudness_destroy(struct pcm_loudness *m)
+{
+	ffmem_free(m->mem);
+	m->mem = NULL;
+}
+
+/** Compute K-weighting filter coefficients for the sample rate */
+static inline void _pcm_loud_kweight(float *k, uint rate)
+{
+	// high shelf
+	double f0 = 1681.974450955533, g = 3.999843853973347, q = 0.7071752369554196;
+	double K = tan(M_PI * f0 / rate);
+	double vh = pow(10, g / 20), vb = pow(vh, 0.4996667741545416);
+	double a0 = 1 + K / q + K * K;
+	k[0] = (vh + vb * K / q + K * K) / a0;
+	k[1] = 2 * (K * K - vh) / a0;
+	k[2] = (vh - vb * K / q + K * K) / a0;
+	k[3] = 2 * (K * K - 1) / a0;
+	k[4] = (1 - K / q + K * K) / a0;
+
+	// high pass
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	K = tan(M_PI * f0 / rate);
+	a0 = 1 + K / q + K * K;
+	k[5] = 1;
+	k[6] = -2;
+	k[7] = 1;
+	k[8] = 2 * (K * K - 1) / a0;
+	k[9] = (1 - K / q + K * K) / a0;
+}
+
+/** Compute the coefficients of the true-peak interpolator */
+static inline void _pcm_loud_tp_init(struct pcm_loudness *m, uint rate)
+{
+	m->tp_factor = (rate < 96000) ? 4 : (rate < 192000) ? 2 : 1;
+	uint taps = _PCM_LOUD_TAPS * m->tp_factor;
+	for (uint j = 0;  j != taps;  j++) {
+		// phase 0 is the original sample (delayed by TAPS/2);  the other phases are between samples
+		double x = (double)((int)j - (int)taps / 2) / m->tp_factor;
+		double h = (x != 0) ? sin(M_PI * x) / (M_PI * x) : 1;
+		h *= 0.5 * (1 - cos(2 * M_PI * j / taps)); // Hann window
+		m->tp_k[j % m->tp_factor][j / m->tp_factor] = h;
+	}
+}
+
+/** Prepare loudness meter
+order: channel order (enum PCM_CHMAP) to find the surround channels and LFE;
+ channel weights are 1.0 if the layout isn't known
+flags: enum PCM_LOUDNESS_F
+Return 0 on success */
+static inline int pcm_loudness_init(struct pcm_loudness *m, const struct pcm_af *af, uint order, uint flags)
+{
+	ffmem_zero(m, sizeof(*m));
+	uint nch = af->channels;
+	if (nch == 0 || nch > PCM_CHAN_MAX || af->rate < 10 || pcm_f_bits(af->format) == 0)
+		return -1;
+
+	m->channels = nch;
+	m->nch4 = (nch + 3) & ~3U;
+	m->flags = flags;
+	m->af = *af;
+	m->block = ffmax(_PCM_LOUD_BLOCK / nch, 16);
+	m->sub_len = af->rate / 10;
+
+	u_char map[PCM_CHAN_MAX];
+	int have_map = (0 == pcm_chmap(order, nch, map));
+	for (uint c = 0;  c != nch;  c++) {
+		m->w[c] = 1;
+		if (have_map && nch > 3) {
+			if (map[c] == PCM_CH_LFE)
+				m->w[c] = 0;
+			else if (map[c] >= PCM_CH_BL)
+				m->w[c] = 1.41; // surround channels
+		}
+	}
+
+	_pcm_loud_kweight(m->k, af->rate);
+	_pcm_loud_tp_init(m, af->rate);
+
+	size_t nbuf = (size_t)(_PCM_LOUD_TAPS - 1 + m->block) * nch + 4;
+	if (NULL == (m->mem = ffmem_calloc(1, m->nch4 * (4 + 1) * sizeof(float) + m->nch4 * sizeof(double) + nbuf * sizeof(float))))
+		return -1;
+	m->e = (double*)m->mem;
+	m->z = (float*)(m->e + m->nch4);
+	m->tp = m->z + 4 * m->nch4;
+	m->buf = m->tp + m->nch4;
+	return 0;
+}
+
+/** Apply K-weighting filter and add the squares to the sub-block energy
+x: [n][channels] */
+static inline void _pcm_loud_filter(struct pcm_loudness *m, const float *x, size_t n)
+{
+	uint g, nch = m->channels, nch4 = m->nch4;
+	const float *k = m->k;
+	size_t i;
+
+#ifdef FF_SSE2
+	const __m128 b0 = _mm_set1_ps(k[0]), b1 = _mm_set1_ps(k[1]), b2 = _mm_set1_ps(k[2])
+		, a1 = _mm_set1_ps(k[3]), a2 = _mm_set1_ps(k[4])
+		, c1 = _mm_set1_ps(k[8]), c2 = _mm_set1_ps(k[9]);
+
+	for (g = 0;  g != nch4;  g += 4) {
+		__m128 s1 = _mm_loadu_ps(m->z + g)
+			, s2 = _mm_loadu_ps(m->z + nch4 + g)
+			, t1 = _mm_loadu_ps(m->z + nch4 * 2 + g)
+			, t2 = _mm_loadu_ps(m->z + nch4 * 3 + g)
+			, acc = _mm_setzero_ps();
+		const float *s = x + g;
+
+		for (i = 0;  i != n;  i++) {
+			// transposed direct form II
+			__m128 v = _mm_loadu_ps(s + i * nch);
+			__m128 y = _mm_add_ps(_mm_mul_ps(b0, v), s1);
+			s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, v), _mm_mul_ps(a1, y)), s2);
+			s2 = _mm_sub_ps(_mm_mul_ps(b2, v), _mm_mul_ps(a2, y));
+
+			// high pass:  b = {1, -2, 1}
+			__m128 u = _mm_add_ps(y, t1);
+			t1 = _mm_sub_ps(_mm_sub_ps(t2, _mm_add_ps(y, y)), _mm_mul_ps(c1, u));
+			t2 = _mm_sub_ps(y, _mm_mul_ps(c2, u));
+			acc = _mm_add_ps(acc, _mm_mul_ps(u, u));
+		}
+
+		_mm_storeu_ps(m->z + g, s1);
+		_mm_storeu_ps(m->z + nch4 + g, s2);
+		_mm_storeu_ps(m->z + nch4 * 2 + g, t1);
+		_mm_storeu_ps(m->z + nch4 * 3 + g, t2);
+		float a[4];
+		_mm_storeu_ps(a, acc);
+		for (uint c = 0;  c != 4;  c++) {
+			m->e[g + c] += a[c];
+		}
+	}
+
+#else
+	for (g = 0;  g != nch;  g++) {
+		float s1 = m->z[g], s2 = m->z[nch4 + g], t1 = m->z[nch4 * 2 + g], t2 = m->z[nch4 * 3 + g];
+		float acc = 0;
+		for (i = 0;  i != n;  i++) {
+			float v = x[i * nch + g];
+			float y = k[0] * v + s1;
+			s1 = k[1] * v - k[3] * y + s2;
+			s2 = k[2] * v - k[4] * y;
+
+			float u = y + t1;
+			t1 = t2 - 2 * y - k[8] * u;
+			t2 = y - k[9] * u;
+			acc += u * u;
+		}
+		m->z[g] = s1;
+		m->z[nch4 + g] = s2;
+		m->z[nch4 * 2 + g] = t1;
+		m->z[nch4 * 3 + g] = t2;
+		m->e[g] += acc;
+	}
+#endif
+}
+
+/** Update true peak level
+x: [n][channels], preceded by TAPS - 1 frames of history */
+static inline void _pcm_loud_truepeak(struct pcm_loudness *m, const float *x, size_t n)
+{
+	uint g, p, t, nch = m->channels, nph = m->tp_factor;
+	size_t i;
+
+#ifdef FF_SSE2
+	const __m128 abs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	for (g = 0;  g != m->nch4;  g += 4) {
+		__m128 mx = _mm_loadu_ps(m->tp + g);
+		for (i = 0;  i != n;  i++) {
+			const float *s = x + i * nch + g;
+			__m128 v = _mm_loadu_ps(s);
+			mx = _mm_max_ps(mx, _mm_and_ps(v, abs));
+			if (nph == 1)
+				continue;
+
+			// phase 0 is the original sample, so it's covered by sample peak
+
+			__m128 h[_PCM_LOUD_TAPS];
+			for (t = 0;  t != _PCM_LOUD_TAPS;  t++) {
+				h[t] = _mm_loadu_ps(s - (ffssize)t * nch);
+			}
+			for (p = 1;  p != nph;  p++) {
+				__m128 y = _mm_setzero_ps();
+				for (t = 0;  t != _PCM_LOUD_TAPS;  t++) {
+					y = _mm_add_ps(y, _mm_mul_ps(h[t], _mm_set1_ps(m->tp_k[p][t])));
+				}
+				mx = _mm_max_ps(mx, _mm_and_ps(y, abs));
+			}
+		}
+		_mm_storeu_ps(m->tp + g, mx);
+	}
+
+#else
+	for (g = 0;  g != nch;  g++) {
+		float mx = m->tp[g];
+		for (i = 0;  i != n;  i++) {
+			const float *s = x + i * nch + g;
+			mx = ffmax(mx, fabsf(*s));
+			for (p = 1;  p < nph;  p++) {
+				float y = 0;
+				for (t = 0;  t != _PCM_LOUD_TAPS;  t++) {
+					y += s[-(ffssize)t * nch] * m->tp_k[p][t];
+				}
+				mx = ffmax(mx, fabsf(y));
+			}
+		}
+		m->tp[g] = mx;
+	}
+#endif
+}
+
+static inline double _pcm_loud_lufs(double e)
+{
+	return -0.691 + 10 * log10(e);
+}
+
+/** Complete 100ms sub-block */
+static inline void _pcm_loud_subblock(struct pcm_loudness *m)
+{
+	uint c;
+	double e = 0;
+	for (c = 0;  c != m->channels;  c++) {
+		e += m->w[c] * m->e[c];
+	}
+	ffmem_zero(m->e, m->nch4 * sizeof(double));
+	if (!isfinite(e)) {
+		// NaN or Inf in input:  reset filters
+		ffmem_zero(m->z, 4 * m->nch4 * sizeof(float));
+		e = 0;
+	}
+	e /= m->sub_len;
+
+	m->sub[m->nsub % _PCM_LOUD_SHORT] = e;
+	m->nsub++;
+	m->sub_pos = 0;
+	if (m->nsub < 4)
+		return;
+
+	// 400ms gating block
+	e = 0;
+	for (c = 1;  c <= 4;  c++) {
+		e += m->sub[(m->nsub - c) % _PCM_LOUD_SHORT];
+	}
+	e /= 4;
+	double l = _pcm_loud_lufs(e);
+	if (!(l >= _PCM_LOUD_GATE))
+		return;
+	uint i = ffmin((uint)((l - _PCM_LOUD_GATE) * 10), _PCM_LOUD_BINS - 1);
+	m->hist_n[i]++;
+	m->hist_e[i] += e;
+}
+
+/** Measure loudness
+data: interleaved or non-interleaved data in the format set by pcm_loudness_init()
+Return 0 on success */
+static inline int pcm_loudness_process(struct pcm_loudness *m, const void *data, size_t frames)
+{
+	void *ip[PCM_CHAN_MAX];
+	uint nch = m->channels, hist = _PCM_LOUD_TAPS - 1;
+	uint isize = pcm_f_bits(m->af.format)/8 * ((m->af.interleaved) ? nch : 1);
+	struct pcm_af f = { FFAUDIO_F_FLOAT32, nch, 1, 0, m->af.rate };
+	float *x = m->buf + hist * nch;
+	size_t off, n;
+
+	for (off = 0;  off != frames;  off += n) {
+		n = ffmin(frames - off, ffmin(m->block, m->sub_len - m->sub_pos));
+		const void *ib = _pcm_offset(ip, data, m->af.interleaved, nch, off * isize);
+		if (0 != pcm_convert(&f, x, &m->af, ib, n))
+			return -1;
+
+		_pcm_loud_filter(m, x, n);
+		if (m->flags & PCM_LOUDNESS_TRUEPEAK) {
+			_pcm_loud_truepeak(m, x, n);
+			ffmem_move(m->buf, m->buf + n * nch, hist * nch * sizeof(float));
+		}
+
+		m->sub_pos += n;
+		if (m->sub_pos == m->sub_len)
+			_pcm_loud_subblock(m);
+	}
+	return 0;
+}
+
+/** Get loudness of the last sub-blocks (LUFS) */
+static inline double _pcm_loud_window(const struct pcm_loudness *m, uint nsub)
+{
+	nsub = ffmin(nsub, m->nsub);
+	if (nsub == 0)
+		return -HUGE_VAL;
+	double e = 0;
+	for (uint i = 1;  i <= nsub;  i++) {
+		e += m->sub[(m->nsub - i) % _PCM_LOUD_SHORT];
+	}
+	return _pcm_loud_lufs(e / nsub);
+}
+
+/** Get momentary loudness (400ms window) (LUFS)
+The data is measured by 100ms sub-blocks:  the incomplete sub-block isn't included.
+Return -HUGE_VAL if there's no data yet */
+static inline double pcm_loudness_momentary(const struct pcm_loudness *m)
+{
+	return _pcm_loud_window(m, 4);
+}
+
+/** Get short-term loudness (3s window) (LUFS) */
+static inline double pcm_loudness_shortterm(const struct pcm_loudness *m)
+{
+	return _pcm_loud_window(m, _PCM_LOUD_SHORT);
+}
+
+/** Get integrated (gated) loudness of the whole stream (LUFS)
+Return -HUGE_VAL if all blocks are below the absolute gate */
+static inline double pcm_loudness_integrated(const struct pcm_loudness *m)
+{
+	uint i;
+	ffuint64 n = 0;
+	double e = 0;
+	for (i = 0;  i != _PCM_LOUD_BINS;  i++) {
+		n += m->hist_n[i];
+		e += m->hist_e[i];
+	}
+	if (n == 0)
+		return -HUGE_VAL;
+
+	// relative gate:  include the bins with the center above it
+	double gate = _pcm_loud_lufs(e / n) - 10;
+	double first = ceil((gate - _PCM_LOUD_GATE) * 10 - 0.5);
+	n = 0;
+	e = 0;
+	for (i = ffmax(first, 0);  i < _PCM_LOUD_BINS;  i++) {
+		n += m->hist_n[i];
+		e += m->hist_e[i];
+	}
+	if (n == 0)
+		return -HUGE_VAL;
+	return _pcm_loud_lufs(e / n);
+}
+
+/** Get true peak level of a channel (linear:  1.0 = 0 dBTP)
+Return 0 if true peak isn't measured (PCM_LOUDNESS_TRUEPEAK) */
+static inline double pcm_loudness_truepeak(const struct pcm_loudness *m, uint ch)
+{
+	return m->tp[ch];
+}
+
+/** Get ReplayGain 2.0 track gain (dB):  the gain that brings integrated loudness to -18 LUFS
+Return 0 if there's no loud enough data */
+static inline double pcm_loudness_replaygain(const struct pcm_loudness *m)
+{
+	double l = pcm_loudness_integrated(m);
+	if (l == -HUGE_VAL)
+		return 0;
+	return -18 - l;
+}
@@ -0,0 +1,1016 @@
+/** ffaudio: channel mixing.
+2015, Simon Zolin */
+
+/*
+pcm_chmap
+pcm_mix_levels
+pcm_mix_init pcm_mix_init_std pcm_mix_init_chmap pcm_mix_init_pass pcm_mix_destroy
+pcm_mix_scale
+pcm_mix_fixed
+pcm_mix_scratch
+pcm_mix_run
+*/
+
+#pragma once
+#include <ffaudio/audio.h>
+#include <ffaudio/pcm.h>
+#include <ffaudio/pcm-simd.h>
+#include <ffbase/base.h>
+
+enum CHAN_MASK {
+	CHAN_FL = 1,
+	CHAN_FR = 2,
+	CHAN_FC = 4,
+	CHAN_LFE = 8,
+	CHAN_BL = 0x10,
+	CHAN_BR = 0x20,
+	CHAN_SL = 0x40,
+	CHAN_SR = 0x80,
+};
+
+/** Get channel mask by channels number. */
+static uint chan_mask(uint channels)
+{
+	switch (channels) {
+	case 1:
+		return CHAN_FC;
+	case 2:
+		return CHAN_FL | CHAN_FR;
+	case 3:
+		return CHAN_FL | CHAN_FR | CHAN_FC;
+	case 4:
+		return CHAN_FL | CHAN_FR | CHAN_BL | CHAN_BR;
+	case 5:
+		return CHAN_FL | CHAN_FR | CHAN_FC | CHAN_BL | CHAN_BR;
+	case 6:
+		return CHAN_FL | CHAN_FR | CHAN_FC | CHAN_LFE | CHAN_BL | CHAN_BR;
+	case 8:
+		return CHAN_FL | CHAN_FR | CHAN_FC | CHAN_LFE | CHAN_BL | CHAN_BR | CHAN_SL | CHAN_SR;
+	}
+	return -1;
+}
+
+/** Channel position: bit number in enum CHAN_MASK */
+enum PCM_CH {
+	PCM_CH_FL,
+	PCM_CH_FR,
+	PCM_CH_FC,
+	PCM_CH_LFE,
+	PCM_CH_BL,
+	PCM_CH_BR,
+	PCM_CH_SL,
+	PCM_CH_SR,
+};
+
+/** Channel order */
+enum PCM_CHMAP {
+	/** WAVE_FORMAT_EXTENSIBLE, FLAC, WASAPI, CoreAudio: channels are sorted by position
+	5.1: FL FR FC LFE BL BR */
+	PCM_CHMAP_WAV,
+
+	/** ALSA, OSS: back channels go before center
+	5.1: FL FR BL BR FC LFE */
+	PCM_CHMAP_ALSA,
+
+	/** SMPTE 2036-2, ITU-R BS.775: surround pair goes before back pair
+	7.1: FL FR FC LFE SL SR BL BR */
+	PCM_CHMAP_SMPTE,
+
+	/** Vorbis, Opus: center goes between front pair;  LFE is the last
+	5.1: FL FC FR BL BR LFE */
+	PCM_CHMAP_VORBIS,
+};
+
+/** Get channel positions in the stream with standard layout.
+order: enum PCM_CHMAP
+map: [channels] enum PCM_CH
+Return 0 on success;  <0: no such layout */
+static inline int pcm_chmap(uint order, uint channels, u_char *map)
+{
+	#define FL PCM_CH_FL
+	#define FR PCM_CH_FR
+	#define FC PCM_CH_FC
+	#define LFE PCM_CH_LFE
+	#define BL PCM_CH_BL
+	#define BR PCM_CH_BR
+	#define SL PCM_CH_SL
+	#define SR PCM_CH_SR
+	static const u_char alsa[][8] = {
+		{ FL, FR, BL, BR }, // 4
+		{ FL, FR, BL, BR, FC }, // 5
+		{ FL, FR, BL, BR, FC, LFE }, // 5.1
+		{ 0 },
+		{ FL, FR, BL, BR, FC, LFE, SL, SR }, // 7.1
+	};
+	static const u_char vorbis[][8] = {
+		{ FL, FC, FR }, // 3
+		{ FL, FR, BL, BR }, // 4
+		{ FL, FC, FR, BL, BR }, // 5
+		{ FL, FC, FR, BL, BR, LFE }, // 5.1
+		{ 0 },
+		{ FL, FC, FR, SL, SR, BL, BR, LFE }, // 7.1
+	};
+	static const u_char smpte_71[] = { FL, FR, FC, LFE, SL, SR, BL, BR };
+	#undef FL
+	#undef FR
+	#undef FC
+	#undef LFE
+	#undef BL
+	#undef BR
+	#undef SL
+	#undef SR
+
+	uint mask = chan_mask(channels);
+	if (mask == (uint)-1)
+		return -1;
+
+	switch (order) {
+	case PCM_CHMAP_ALSA:
+		if (channels < 4)
+			break;
+		memcpy(map, alsa[channels - 4], channels);
+		return 0;
+
+	case PCM_CHMAP_SMPTE:
+		if (channels != 8)
+			break;
+		memcpy(map, smpte_71, channels);
+		return 0;
+
+	case PCM_CHMAP_VORBIS:
+		if (channels < 3)
+			break;
+		memcpy(map, vorbis[channels - 3], channels);
+		return 0;
+
+	case PCM_CHMAP_WAV:
+		break;
+
+	default:
+		return -1;
+	}
+
+	// sorted by position
+	uint i = 0;
+	for (uint pos = 0;  pos != 8;  pos++) {
+		if (mask & (1U << pos))
+			map[i++] = pos;
+	}
+	return 0;
+}
+
+#define BIT32(bit)  (1U << (bit))
+
+/** Set gain level for all used channels. */
+static int chan_fill_gain_levels(double level[8][8], uint imask, uint omask)
+{
+	enum {
+		FL,
+		FR,
+		FC,
+		LFE,
+		BL,
+		BR,
+		SL,
+		SR,
+	};
+
+	const double sqrt1_2 = 0.70710678118654752440; // =1/sqrt(2)
+
+	uint equal = imask & omask;
+	for (uint c = 0;  c != 8;  c++) {
+		if (equal & BIT32(c))
+			level[c][c] = 1;
+	}
+
+	uint unused = imask & ~omask;
+
+	if (unused & CHAN_FL) {
+
+		if (omask & CHAN_FC) {
+			// front stereo -> front center
+			level[FC][FL] = sqrt1_2;
+			level[FC][FR] = sqrt1_2;
+
+		} else
+			return -1;
+	}
+
+	if (unused & CHAN_FC) {
+
+		if (omask & CHAN_FL) {
+			// front center -> front stereo
+			level[FL][FC] = sqrt1_2;
+			level[FR][FC] = sqrt1_2;
+
+		} else
+			return -1;
+	}
+
+	if (unused & CHAN_LFE) {
+	}
+
+	if (unused & CHAN_BL) {
+
+		if (omask & CHAN_FL) {
+			// back stereo -> front stereo
+			level[FL][BL] = sqrt1_2;
+			level[FR][BR] = sqrt1_2;
+
+		} else if (omask & CHAN_FC) {
+			// back stereo -> front center
+			level[FC][BL] = sqrt1_2*sqrt1_2;
+			level[FC][BR] = sqrt1_2*sqrt1_2;
+
+		} else
+			return -1;
+	}
+
+	if (unused & CHAN_SL) {
+
+		if (omask & CHAN_FL) {
+			// side stereo -> front stereo
+			level[FL][SL] = sqrt1_2;
+			level[FR][SR] = sqrt1_2;
+
+		} else if (omask & CHAN_FC) {
+			// side stereo -> front center
+			level[FC][SL] = sqrt1_2*sqrt1_2;
+			level[FC][SR] = sqrt1_2*sqrt1_2;
+
+		} else
+			return -1;
+	}
+
+	// now gain level can be >1.0, so we normalize it
+	for (uint oc = 0;  oc != 8;  oc++) {
+		if (!ffbit_test32(&omask, oc))
+			continue;
+
+		double sum = 0;
+		for (uint ic = 0;  ic != 8;  ic++) {
+			sum += level[oc][ic];
+		}
+		if (sum != 0) {
+			for (uint ic = 0;  ic != 8;  ic++) {
+				level[oc][ic] /= sum;
+			}
+		}
+	}
+
+	return 0;
+}
+
+#define PCM_MIX_COEF_BUF  64 // coefficients stored inside the mixer (up to 8x8 matrix)
+
+struct pcm_mix_coef {
+	ushort slot; // index of input channel in 'used'
+	float gain;
+	int q; // fixed-point mode:  gain * 2^qshift
+};
+
+/** Sparse mixing matrix.
+Only the non-zero coefficients are stored:
+ up to PCM_MIX_COEF_BUF of them inside the mixer, more are allocated. */
+struct pcm_mix {
+	ushort format; // input format
+	u_char ichan, ochan;
+	u_char interleaved; // input is interleaved
+	u_char nused; // number of input channels referenced by the matrix
+	u_char diag; // every output channel is its input channel multiplied by the same gain
+	u_char nolimit; // don't limit the output to -1.0..1.0 (e.g. a limiter follows)
+	u_char fixed; // int32 samples and integer gain levels (pcm_mix_fixed())
+	u_char qshift; // fixed-point mode:  fractional bits of 'q'
+	u_char obits; // fixed-point mode:  output precision
+	u_char used[PCM_CHAN_MAX]; // [slot] -> input channel
+	ushort off[PCM_CHAN_MAX + 1]; // [output channel] -> coefficients range
+	pcm_conv_func load; // vectorized conversion of contiguous input to float (int32 in fixed-point mode)
+	struct pcm_mix_coef *coef; // [off[oc]..off[oc+1]) for output channel 'oc':  'coef_buf' or allocated
+	struct pcm_mix_coef coef_buf[PCM_MIX_COEF_BUF];
+};
+
+static inline void pcm_mix_destroy(struct pcm_mix *m)
+{
+	if (m->coef != m->coef_buf)
+		ffmem_free(m->coef);
+	m->coef = NULL;
+}
+
+/** Check the parameters and reset the mixer (except the coefficients) */
+static inline int _pcm_mix_init_fmt(struct pcm_mix *m, const struct pcm_af *inpcm, uint ochan)
+{
+	uint ichan = inpcm->channels;
+	ffmem_zero(m, FF_OFF(struct pcm_mix, coef_buf));
+
+	if (ichan == 0 || ichan > PCM_CHAN_MAX || ochan == 0 || ochan > PCM_CHAN_MAX)
+		return -1;
+
+	switch (inpcm->format) {
+	case FFAUDIO_F_INT8:
+	case FFAUDIO_F_INT16:
+	case FFAUDIO_F_INT24:
+	case FFAUDIO_F_INT24_4:
+	case FFAUDIO_F_INT32:
+	case FFAUDIO_F_FLOAT32:
+	case FFAUDIO_F_FLOAT64:
+	case FFAUDIO_F_FLOAT16:
+	case FFAUDIO_F_BFLOAT16:
+		break;
+	default:
+		return -1;
+	}
+
+	m->format = inpcm->format;
+	m->ichan = ichan;
+	m->ochan = ochan;
+	m->interleaved = inpcm->interleaved;
+	return 0;
+}
+
+/** Get memory for 'n' coefficients */
+static inline int _pcm_mix_coef_alloc(struct pcm_mix *m, uint n)
+{
+	m->coef = m->coef_buf;
+	if (n > PCM_MIX_COEF_BUF
+		&& NULL == (m->coef = (struct pcm_mix_coef*)ffmem_alloc(n * sizeof(struct pcm_mix_coef))))
+		return -1;
+	return 0;
+}
+
+/** Detect the diagonal matrix, choose the kernel */
+static inline void _pcm_mix_init_finish(struct pcm_mix *m)
+{
+	uint ochan = m->ochan;
+	m->diag = (m->ichan == ochan && m->off[ochan] == ochan);
+	for (uint oc = 0;  m->diag && oc != ochan;  oc++) {
+		if (m->off[oc] != oc
+			|| m->used[m->coef[oc].slot] != oc
+			|| m->coef[oc].gain != m->coef[0].gain)
+			m->diag = 0;
+	}
+
+	m->load = pcm_conv_find(m->format, FFAUDIO_F_FLOAT32);
+}
+
+/** Prepare mixer from a gain matrix.
+inpcm: input format;  'rate' is not used
+level: gain levels [OUT][IN]:  level[oc * inpcm->channels + ic]
+Return 0 on success;  <0: the parameters aren't supported */
+static inline int pcm_mix_init(struct pcm_mix *m, const struct pcm_af *inpcm, uint ochan, const float *level)
+{
+	uint ichan = inpcm->channels;
+	if (0 != _pcm_mix_init_fmt(m, inpcm, ochan))
+		return -1;
+
+	uint n = 0;
+	int slot[PCM_CHAN_MAX];
+	for (uint ic = 0;  ic != ichan;  ic++) {
+		slot[ic] = -1;
+		for (uint oc = 0;  oc != ochan;  oc++) {
+			if (level[oc * ichan + ic] != 0) {
+				if (slot[ic] < 0) {
+					slot[ic] = m->nused;
+					m->used[m->nused++] = ic;
+				}
+				n++;
+			}
+		}
+	}
+
+	if (0 != _pcm_mix_coef_alloc(m, n))
+		return -1;
+
+	n = 0;
+	for (uint oc = 0;  oc != ochan;  oc++) {
+		m->off[oc] = n;
+		for (uint ic = 0;  ic != ichan;  ic++) {
+			float g = level[oc * ichan + ic];
+			if (g != 0) {
+				m->coef[n].slot = slot[ic];
+				m->coef[n].gain = g;
+				n++;
+			}
+		}
+	}
+	m->off[ochan] = n;
+
+	_pcm_mix_init_finish(m);
+	return 0;
+}
+
+/** Prepare mixer that passes input channels through with gain 1.0
+ich: input channel for the mono output;  -1: output channel N is input channel N
+Return 0 on success;  <0: the parameters aren't supported */
+static inline int pcm_mix_init_pass(struct pcm_mix *m, const struct pcm_af *inpcm, uint ochan, int ich)
+{
+	if (0 != _pcm_mix_init_fmt(m, inpcm, ochan)
+		|| (ich < 0 && ochan != inpcm->channels)
+		|| (ich >= 0 && (ochan != 1 || (uint)ich >= inpcm->channels)))
+		return -1;
+
+	_pcm_mix_coef_alloc(m, ochan); // never fails:  ochan <= PCM_MIX_COEF_BUF
+	m->nused = ochan;
+	for (uint oc = 0;  oc != ochan;  oc++) {
+		m->used[oc] = (ich >= 0) ? (uint)ich : oc;
+		m->off[oc] = oc;
+		m->coef[oc].slot = oc;
+		m->coef[oc].gain = 1;
+	}
+	m->off[ochan] = ochan;
+
+	_pcm_mix_init_finish(m);
+	return 0;
+}
+
+/** Compute the standard gain matrix for streams with arbitrary channel order.
+The result may be modified (e.g. to mix LFE in or to change the downmix levels)
+ and then passed to pcm_mix_init() or pcm_convert_plan_init_mix().
+level: [ochan * ichan] gain levels [OUT][IN]
+omap, imap: channel positions (enum PCM_CH), e.g. from pcm_chmap()
+Return 0 on success;  <0: the layouts aren't supported */
+static inline int pcm_mix_levels(float *level, const u_char *omap, uint ochan, const u_char *imap, uint ichan)
+{
+	double lv[8][8] = {}; // gain level [OUT] <- [IN]
+	uint imask = 0, omask = 0;
+
+	for (uint ic = 0;  ic != ichan;  ic++) {
+		if (imap[ic] > PCM_CH_SR || (imask & BIT32(imap[ic])))
+			return -1;
+		imask |= BIT32(imap[ic]);
+	}
+	for (uint oc = 0;  oc != ochan;  oc++) {
+		if (omap[oc] > PCM_CH_SR || (omask & BIT32(omap[oc])))
+			return -1;
+		omask |= BIT32(omap[oc]);
+	}
+
+	if (0 != chan_fill_gain_levels(lv, imask, omask))
+		return -1;
+
+	// channel position -> channel index within the stream
+	for (uint oc = 0;  oc != ochan;  oc++) {
+		for (uint ic = 0;  ic != ichan;  ic++) {
+			level[oc * ichan + ic] = lv[omap[oc]][imap[ic]];
+		}
+	}
+	return 0;
+}
+
+/** Prepare mixer for the standard channel layouts with the specified channel orders.
+Mixing and reordering are performed in the same pass.
+iorder, oorder: enum PCM_CHMAP */
+static inline int pcm_mix_init_chmap(struct pcm_mix *m, const struct pcm_af *inpcm, uint iorder, uint ochan, uint oorder)
+{
+	u_char imap[8], omap[8];
+	float lv[8 * 8];
+	if (0 != pcm_chmap(iorder, inpcm->channels, imap)
+		|| 0 != pcm_chmap(oorder, ochan, omap)
+		|| 0 != pcm_mix_levels(lv, omap, ochan, imap, inpcm->channels))
+		return -1;
+
+	return pcm_mix_init(m, inpcm, ochan, lv);
+}
+
+/** Prepare mixer for the standard channel layouts
+Supported layouts:
+1: FC
+2: FL+FR
+3: FL+FR+FC
+4: FL+FR+BL+BR
+5: FL+FR+FC+BL+BR
+5.1: FL+FR+FC+LFE+BL+BR
+7.1: FL+FR+FC+LFE+BL+BR+SL+SR
+
+Examples:
+
+5.1 -> 1:
+	FC = FL*0.7 + FR*0.7 + FC*1 + BL*0.5 + BR*0.5
+
+5.1 -> 2:
+	FL = FL*1 + FC*0.7 + BL*0.7
+	FR = FR*1 + FC*0.7 + BR*0.7
+*/
+static inline int pcm_mix_init_std(struct pcm_mix *m, const struct pcm_af *inpcm, uint ochan)
+{
+	return pcm_mix_init_chmap(m, inpcm, PCM_CHMAP_WAV, ochan, PCM_CHMAP_WAV);
+}
+
+/** Multiply all gain levels by 'gain' */
+static inline void pcm_mix_scale(struct pcm_mix *m, float gain)
+{
+	for (uint k = 0;  k != m->off[m->ochan];  k++) {
+		m->coef[k].gain *= gain;
+	}
+}
+
+/** Switch to fixed-point arithmetic:  no floating point operations are performed by pcm_mix_run().
+Input samples are converted to int32 (Q31), multiplied by integer gain levels and summed in 64 bits.
+Each output sample is rounded to nearest (half up) at 'obits' precision and saturated,
+ so the lower (32 - obits) bits of the int32 output are 0.
+Call after the gain levels are set (pcm_mix_scale()).
+obits: 8, 16, 24, 32
+Return 0 on success;  <0: the input format isn't integer or the gain is too large */
+static inline int pcm_mix_fixed(struct pcm_mix *m, uint obits)
+{
+	if (!_pcm_f_int(m->format) || obits == 0 || obits > 32 || obits % 8)
+		return -1;
+
+	// sum(|sample| * |q|) < 2^31 * 2^30:  the sum of an output channel can't overflow
+	double peak = 0;
+	for (uint oc = 0;  oc != m->ochan;  oc++) {
+		double sum = 0;
+		for (uint k = m->off[oc];  k != m->off[oc + 1];  k++) {
+			sum += fabs(m->coef[k].gain);
+		}
+		peak = ffmax(peak, sum);
+	}
+	int e = 0;
+	if (peak != 0)
+		frexp(peak, &e); // peak < 2^e
+	int shift = ffmin(30 - e, 30);
+	if (shift < 1)
+		return -1;
+
+	for (uint k = 0;  k != m->off[m->ochan];  k++) {
+		m->coef[k].q = (int)floor(ldexp(m->coef[k].gain, shift) + 0.5);
+	}
+	m->qshift = shift;
+	m->obits = obits;
+	m->fixed = 1;
+	m->load = pcm_conv_find(m->format, FFAUDIO_F_INT32);
+	return 0;
+}
+
+/** Size (in floats) of the scratch memory for pcm_mix_run() */
+static inline size_t pcm_mix_scratch(const struct pcm_mix *m, size_t frames)
+{
+	if (m->fixed)
+		return (3 + m->nused) * frames; // int64 sums (aligned) + int32 input
+	return (1 + m->nused) * frames;
+}
+
+/** Convert samples of 1 channel to float.
+step: interval between samples */
+static inline void _pcm_mix_load(const struct pcm_mix *m, float *dst, const void *src, uint step, size_t n)
+{
+	union pcm_data s;
+	s.p = (void*)src;
+	size_t i;
+
+	if (step == 1 && m->load != NULL) {
+		m->load(dst, src, n);
+		return;
+	}
+
+	switch (m->format) {
+	case FFAUDIO_F_INT8:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = pcm_flt_i8(s.i8[i * step]);
+		}
+		break;
+
+	case FFAUDIO_F_INT16:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = pcm_flt_i16(s.i16[i * step]);
+		}
+		break;
+
+	case FFAUDIO_F_INT24:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = pcm_flt_i24(pcm_i32_i24(&s.i8[i * step * 3]));
+		}
+		break;
+
+	case FFAUDIO_F_INT24_4:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = pcm_flt_i24(s.i32[i * step] >> 8);
+		}
+		break;
+
+	case FFAUDIO_F_INT32:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = pcm_flt_i32(s.i32[i * step]);
+		}
+		break;
+
+	case FFAUDIO_F_FLOAT32:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = s.f32[i * step];
+		}
+		break;
+
+	case FFAUDIO_F_FLOAT64:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = s.f64[i * step];
+		}
+		break;
+
+	case FFAUDIO_F_FLOAT16:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = pcm_flt_f16(s.u16[i * step]);
+		}
+		break;
+
+	case FFAUDIO_F_BFLOAT16:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = pcm_flt_bf16(s.u16[i * step]);
+		}
+		break;
+	}
+}
+
+/** dst = src * gain */
+static inline void _pcm_mix_mul(float *dst, const float *src, float gain, size_t n)
+{
+	size_t i = 0;
+#ifdef FF_SSE2
+	__m128 g = _mm_set1_ps(gain);
+	for (;  i + 4 <= n;  i += 4) {
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+	}
+#endif
+	for (;  i != n;  i++) {
+		dst[i] = src[i] * gain;
+	}
+}
+
+/** dst += src * gain */
+static inline void _pcm_mix_madd(float *dst, const float *src, float gain, size_t n)
+{
+	size_t i = 0;
+#ifdef FF_SSE2
+	__m128 g = _mm_set1_ps(gain);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+		_mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), v));
+	}
+#endif
+	for (;  i != n;  i++) {
+		dst[i] += src[i] * gain;
+	}
+}
+
+/** Limit to -1.0..1.0 (unless 'nolimit' is set) and write with interval 'step' */
+static inline void _pcm_mix_store(const struct pcm_mix *m, float *dst, uint step, float *src, size_t n)
+{
+	size_t i = 0;
+	if (!m->nolimit) {
+#ifdef FF_SSE2
+		const __m128 lo = _mm_set1_ps(-1), hi = _mm_set1_ps(1);
+		for (;  i + 4 <= n;  i += 4) {
+			__m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), lo), hi);
+			_mm_storeu_ps(src + i, v);
+		}
+#endif
+		for (;  i != n;  i++) {
+			src[i] = pcm_limf(src[i]);
+		}
+	}
+
+	if (dst == src)
+		return;
+	for (i = 0;  i != n;  i++) {
+		dst[i * step] = src[i];
+	}
+}
+
+/** Convert samples of 1 channel to int32.
+step: interval between samples */
+static inline void _pcm_mix_qload(const struct pcm_mix *m, int *dst, const void *src, uint step, size_t n)
+{
+	union pcm_data s;
+	s.p = (void*)src;
+	size_t i;
+
+	if (step == 1 && m->load != NULL) {
+		m->load(dst, src, n);
+		return;
+	}
+
+	switch (m->format) {
+	case FFAUDIO_F_INT8:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = (int)s.i8[i * step] * 0x1000000;
+		}
+		break;
+
+	case FFAUDIO_F_INT16:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = (int)s.i16[i * step] * 0x10000;
+		}
+		break;
+
+	case FFAUDIO_F_INT24:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = pcm_i32_i24(&s.i8[i * step * 3]) * 0x100;
+		}
+		break;
+
+	case FFAUDIO_F_INT24_4:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = s.i32[i * step] & ~0xff;
+		}
+		break;
+
+	case FFAUDIO_F_INT32:
+		for (i = 0;  i != n;  i++) {
+			dst[i] = s.i32[i * step];
+		}
+		break;
+	}
+}
+
+#ifdef FF_SSE2
+/** Multiply 4 int32 by 'q' (0 <= q < 2^31):  lo = v[0..1] * q;  hi = v[2..3] * q (int64)
+qhi: q * 2^32 in each int64 */
+static inline void _pcm_sse2_qmul(__m128i v, __m128i q, __m128i qhi, __m128i *lo, __m128i *hi)
+{
+	// unsigned product, then subtract q * 2^32 for negative samples
+	__m128i sign = _mm_srai_epi32(v, 31);
+	__m128i p02 = _mm_mul_epu32(v, q);
+	__m128i p13 = _mm_mul_epu32(_mm_srli_epi64(v, 32), q);
+	p02 = _mm_sub_epi64(p02, _mm_and_si128(_mm_shuffle_epi32(sign, _MM_SHUFFLE(2,2,0,0)), qhi));
+	p13 = _mm_sub_epi64(p13, _mm_and_si128(_mm_shuffle_epi32(sign, _MM_SHUFFLE(3,3,1,1)), qhi));
+	*lo = _mm_unpacklo_epi64(p02, p13);
+	*hi = _mm_unpackhi_epi64(p02, p13);
+}
+#endif
+
+#ifdef PCM_AVX2
+/** Return the number of processed samples */
+static PCM_TARGET_AVX2 size_t _pcm_avx2_qmadd(ffint64 *acc, const int *src, int q, uint add, size_t n)
+{
+	const __m256i vq = _mm256_set1_epi32(q);
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i*)(src + i));
+		__m256i p0 = _mm256_mul_epi32(v, vq); // 0 2 | 4 6
+		__m256i p1 = _mm256_mul_epi32(_mm256_srli_epi64(v, 32), vq); // 1 3 | 5 7
+		__m256i a = _mm256_unpacklo_epi64(p0, p1), b = _mm256_unpackhi_epi64(p0, p1); // 0 1 | 4 5,  2 3 | 6 7
+		__m256i lo = _mm256_permute2x128_si256(a, b, 0x20), hi = _mm256_permute2x128_si256(a, b, 0x31);
+		if (add) {
+			lo = _mm256_add_epi64(_mm256_loadu_si256((__m256i*)(acc + i)), lo);
+			hi = _mm256_add_epi64(_mm256_loadu_si256((__m256i*)(acc + i + 4)), hi);
+		}
+		_mm256_storeu_si256((__m256i*)(acc + i), lo);
+		_mm256_storeu_si256((__m256i*)(acc + i + 4), hi);
+	}
+	return i;
+}
+#endif
+
+/** acc = src * q  or  acc += src * q */
+static inline void _pcm_mix_qmadd(ffint64 *acc, const int *src, int q, uint add, size_t n)
+{
+	size_t i = 0;
+#ifdef PCM_AVX2
+	if (pcm_cpu_features() & PCM_CPU_AVX2)
+		i = _pcm_avx2_qmadd(acc, src, q, add, n);
+#endif
+#ifdef FF_SSE2
+	if (pcm_cpu_features() & PCM_CPU_SSE2) {
+		// the product is computed for |q| and then added or subtracted
+		__m128i neg = _mm_set1_epi32((q < 0) ? -1 : 0);
+		uint aq = (q < 0) ? -(uint)q : (uint)q;
+		__m128i vq = _mm_set1_epi32(aq), qhi = _mm_set_epi32(aq, 0, aq, 0);
+		for (;  i + 4 <= n;  i += 4) {
+			__m128i lo, hi;
+			_pcm_sse2_qmul(_mm_loadu_si128((__m128i*)(src + i)), vq, qhi, &lo, &hi);
+			lo = _mm_sub_epi64(_mm_xor_si128(lo, neg), neg);
+			hi = _mm_sub_epi64(_mm_xor_si128(hi, neg), neg);
+			if (add) {
+				lo = _mm_add_epi64(_mm_loadu_si128((__m128i*)(acc + i)), lo);
+				hi = _mm_add_epi64(_mm_loadu_si128((__m128i*)(acc + i + 2)), hi);
+			}
+			_mm_storeu_si128((__m128i*)(acc + i), lo);
+			_mm_storeu_si128((__m128i*)(acc + i + 2), hi);
+		}
+	}
+#endif
+	if (add) {
+		for (;  i != n;  i++) {
+			acc[i] += (ffint64)src[i] * q;
+		}
+	} else {
+		for (;  i != n;  i++) {
+			acc[i] = (ffint64)src[i] * q;
+		}
+	}
+}
+
+#ifdef PCM_AVX2
+/** Return the number of processed samples */
+static PCM_TARGET_AVX2 size_t _pcm_avx2_qstore(int *d, const ffint64 *acc, ffint64 rnd, uint shift, int lo, int hi, uint osh, size_t n)
+{
+	const __m256i vrnd = _mm256_set1_epi64x(rnd), vhi = _mm256_set1_epi64x(hi), vlo = _mm256_set1_epi64x(lo);
+	const __m256i zero = _mm256_setzero_si256(), even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	const __m128i sh = _mm_cvtsi32_si128(shift), vosh = _mm_cvtsi32_si128(osh);
+	size_t i = 0;
+	for (;  i + 4 <= n;  i += 4) {
+		__m256i a = _mm256_add_epi64(_mm256_loadu_si256((__m256i*)(acc + i)), vrnd);
+		__m256i sign = _mm256_cmpgt_epi64(zero, a);
+		a = _mm256_xor_si256(_mm256_srl_epi64(_mm256_xor_si256(a, sign), sh), sign);
+		a = _mm256_blendv_epi8(a, vhi, _mm256_cmpgt_epi64(a, vhi));
+		a = _mm256_blendv_epi8(a, vlo, _mm256_cmpgt_epi64(vlo, a));
+		__m128i v = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(a, even));
+		_mm_storeu_si128((__m128i*)(d + i), _mm_sll_epi32(v, vosh));
+	}
+	return i;
+}
+#endif
+
+/** Round the sums at 'obits' precision, saturate and write int32 with interval 'step' */
+static inline void _pcm_mix_qstore(const struct pcm_mix *m, int *dst, uint step, ffint64 *acc, size_t n)
+{
+	uint shift = m->qshift + 32 - m->obits; // sum -> output precision
+	ffint64 rnd = (ffint64)1 << (shift - 1);
+	int hi = (int)(0x7fffffffU >> (32 - m->obits)), lo = -hi - 1;
+	int *d = (step == 1) ? dst : (int*)acc; // in-place: the int32 result isn't written past the sums being read
+	size_t i = 0;
+
+#ifdef PCM_AVX2
+	if (pcm_cpu_features() & PCM_CPU_AVX2)
+		i = _pcm_avx2_qstore(d, acc, rnd, shift, lo, hi, 32 - m->obits, n);
+#endif
+#ifdef FF_SSE2
+	if (pcm_cpu_features() & PCM_CPU_SSE2) {
+		__m128i vrnd = _mm_set1_epi64x(rnd), sh = _mm_cvtsi32_si128(shift), osh = _mm_cvtsi32_si128(32 - m->obits);
+		__m128i vhi = _mm_set1_epi32(hi), vlo = _mm_set1_epi32(lo), max = _mm_set1_epi32(0x7fffffff);
+		for (;  i + 4 <= n;  i += 4) {
+			__m128i a0 = _mm_add_epi64(_mm_loadu_si128((__m128i*)(acc + i)), vrnd);
+			__m128i a1 = _mm_add_epi64(_mm_loadu_si128((__m128i*)(acc + i + 2)), vrnd);
+			// arithmetic shift:  shift the absolute value's complement for negative numbers
+			__m128i s0 = _mm_shuffle_epi32(_mm_srai_epi32(a0, 31), _MM_SHUFFLE(3,3,1,1));
+			__m128i s1 = _mm_shuffle_epi32(_mm_srai_epi32(a1, 31), _MM_SHUFFLE(3,3,1,1));
+			a0 = _mm_xor_si128(_mm_srl_epi64(_mm_xor_si128(a0, s0), sh), s0);
+			a1 = _mm_xor_si128(_mm_srl_epi64(_mm_xor_si128(a1, s1), sh), s1);
+
+			// saturate to int32:  the value fits if the high half is the sign extension of the low half
+			a0 = _mm_shuffle_epi32(a0, _MM_SHUFFLE(3,1,2,0));
+			a1 = _mm_shuffle_epi32(a1, _MM_SHUFFLE(3,1,2,0));
+			__m128i l = _mm_unpacklo_epi64(a0, a1), h = _mm_unpackhi_epi64(a0, a1);
+			__m128i fit = _mm_cmpeq_epi32(h, _mm_srai_epi32(l, 31));
+			__m128i v = _mm_or_si128(_mm_and_si128(fit, l)
+				, _mm_andnot_si128(fit, _mm_xor_si128(_mm_srai_epi32(h, 31), max)));
+
+			__m128i gt = _mm_cmpgt_epi32(v, vhi);
+			v = _mm_or_si128(_mm_and_si128(gt, vhi), _mm_andnot_si128(gt, v));
+			__m128i lt = _mm_cmpgt_epi32(vlo, v);
+			v = _mm_or_si128(_mm_and_si128(lt, vlo), _mm_andnot_si128(lt, v));
+			_mm_storeu_si128((__m128i*)(d + i), _mm_sll_epi32(v, osh));
+		}
+	}
+#endif
+
+	for (;  i != n;  i++) {
+		ffint64 v = (acc[i] + rnd) >> shift;
+		v = ffmax(ffmin(v, hi), lo);
+		d[i] = (int)((uint)v << (32 - m->obits));
+	}
+
+	if (step == 1)
+		return;
+	for (i = 0;  i != n;  i++) {
+		dst[i * step] = d[i];
+	}
+}
+
+/** pcm_mix_run() in fixed-point mode */
+static inline void _pcm_mix_run_fixed(const struct pcm_mix *m, void *out, uint out_ileaved, const void *in, size_t frames, float *scratch)
+{
+	union pcm_data d;
+	d.p = (void*)in;
+	const int *src[PCM_CHAN_MAX];
+	ffint64 *acc = (ffint64*)(((size_t)scratch + 7) & ~(size_t)7);
+	int *buf = (int*)(acc + frames);
+	uint isize = pcm_f_bits(m->format) / 8;
+
+	if (m->diag && m->interleaved == out_ileaved) {
+		// process each channel (or all interleaved samples) by blocks of 'frames' samples
+		uint nch = (out_ileaved) ? 1 : m->ichan;
+		size_t total = (out_ileaved) ? frames * m->ichan : frames;
+		for (uint c = 0;  c != nch;  c++) {
+			const char *s = (out_ileaved) ? d.i8 : d.pi8[c];
+			int *o = (out_ileaved) ? (int*)out : ((int**)out)[c];
+			for (size_t off = 0, n;  off != total;  off += n) {
+				n = ffmin(total - off, frames);
+				_pcm_mix_qload(m, buf, s + off * isize, 1, n);
+				_pcm_mix_qmadd(acc, buf, m->coef[0].q, 0, n);
+				_pcm_mix_qstore(m, o + off, 1, acc, n);
+			}
+		}
+		return;
+	}
+
+	// convert the used input channels to non-interleaved int32
+	for (uint s = 0;  s != m->nused;  s++) {
+		uint ic = m->used[s];
+
+		if (m->interleaved) {
+			_pcm_mix_qload(m, buf, d.i8 + ic * isize, m->ichan, frames);
+
+		} else if (m->format == FFAUDIO_F_INT32) {
+			src[s] = d.pi32[ic];
+			continue;
+
+		} else {
+			_pcm_mix_qload(m, buf, d.pi8[ic], 1, frames);
+		}
+
+		src[s] = buf;
+		buf += frames;
+	}
+
+	for (uint oc = 0;  oc != m->ochan;  oc++) {
+		uint k = m->off[oc], end = m->off[oc + 1];
+
+		if (k == end)
+			ffmem_zero(acc, frames * sizeof(ffint64));
+		for (;  k != end;  k++) {
+			_pcm_mix_qmadd(acc, src[m->coef[k].slot], m->coef[k].q, (k != m->off[oc]), frames);
+		}
+
+		if (out_ileaved)
+			_pcm_mix_qstore(m, (int*)out + oc, m->ochan, acc, frames);
+		else
+			_pcm_mix_qstore(m, ((int**)out)[oc], 1, acc, frames);
+	}
+}
+
+/** Mix (upmix, downmix) channels.
+Output channel = sum(input channel * gain), limited to -1.0..1.0 (unless 'nolimit' is set)
+in: input data as set by pcm_mix_init(): interleaved or non-interleaved
+out: float output: interleaved (float*) or non-interleaved (float**);
+ int32 in fixed-point mode (pcm_mix_fixed())
+scratch: memory of pcm_mix_scratch() floats */
+static inline void pcm_mix_run(const struct pcm_mix *m, void *out, uint out_ileaved, const void *in, size_t frames, float *scratch)
+{
+	if (m->fixed) {
+		_pcm_mix_run_fixed(m, out, out_ileaved, in, frames, scratch);
+		return;
+	}
+
+	union pcm_data d;
+	d.p = (void*)in;
+	const float *src[PCM_CHAN_MAX];
+	float *acc = scratch;
+	scratch += frames;
+	uint isize = pcm_f_bits(m->format) / 8;
+
+	if (m->diag && m->interleaved == out_ileaved) {
+		// convert to float in the output buffer, then apply gain
+		float g = m->coef[0].gain;
+		if (out_ileaved) {
+			_pcm_mix_load(m, (float*)out, in, 1, frames * m->ichan);
+			_pcm_mix_mul((float*)out, (float*)out, g, frames * m->ichan);
+			_pcm_mix_store(m, (float*)out, 1, (float*)out, frames * m->ichan);
+			return;
+		}
+
+		for (uint c = 0;  c != m->ichan;  c++) {
+			float *o = ((float**)out)[c];
+			_pcm_mix_load(m, o, d.pi8[c], 1, frames);
+			_pcm_mix_mul(o, o, g, frames);
+			_pcm_mix_store(m, o, 1, o, frames);
+		}
+		return;
+	}
+
+	// convert the used input channels to non-interleaved float
+	for (uint s = 0;  s != m->nused;  s++) {
+		uint ic = m->used[s];
+
+		if (m->interleaved) {
+			_pcm_mix_load(m, scratch, d.i8 + ic * isize, m->ichan, frames);
+
+		} else if (m->format == FFAUDIO_F_FLOAT32) {
+			src[s] = d.pf32[ic];
+			continue;
+
+		} else {
+			_pcm_mix_load(m, scratch, d.pi8[ic], 1, frames);
+		}
+
+		src[s] = scratch;
+		scratch += frames;
+	}
+
+	for (uint oc = 0;  oc != m->ochan;  oc++) {
+		float *o = (out_ileaved) ? acc : ((float**)out)[oc];
+		uint k = m->off[oc], end = m->off[oc + 1];
+
+		if (k == end) {
+			ffmem_zero(o, frames * sizeof(float));
+		} else {
+			_pcm_mix_mul(o, src[m->coef[k].slot], m->coef[k].gain, frames);
+			for (k++;  k != end;  k++) {
+				_pcm_mix_madd(o, src[m->coef[k].slot], m->coef[k].gain, frames);
+			}
+		}
+
+		if (out_ileaved)
+			_pcm_mix_store(m, (float*)out + oc, m->ochan, o, frames);
+		else
+			_pcm_mix_store(m, o, 1, o, frames);
+	}
+}
@@ -0,0 +1,325 @@
+/** ffaudio: multi-threaded PCM conversion of large buffers.
+2026, Simon Zolin */
+
+/*
+pcm_pool_init pcm_pool_destroy
+pcm_convert_parallel
+*/
+
+/* The conversion plan is prepared by the calling thread and kept until the formats change.
+The workers only read it:  each one has its own memory for mixing.
+The frames are independent, so the range is split into contiguous chunks, 1 per worker.
+Chunk boundaries are multiples of PCM_PARALLEL_ALIGN frames:
+ output chunks never share a memory page (or a cache line) with each other,
+ and each worker streams through its own pages from start to end
+ (with first-touch NUMA policy the pages stay local to the worker that writes them first).
+The calling thread processes the first chunk itself.
+Link with -lpthread on UNIX. */
+
+#pragma once
+#include <ffaudio/pcm-convert.h>
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#define PCM_PARALLEL_THREADS  64 // maximum number of workers
+#define PCM_PARALLEL_MIN  (64 * 1024) // minimum samples (frames * channels) per worker
+#define PCM_PARALLEL_ALIGN  4096 // frames
+
+struct _pcm_task {
+	const struct pcm_convert_plan *plan;
+	const void *in;
+	void *out;
+	size_t off, n; // frames
+	float *mbuf; // worker's memory for mixing
+	size_t mbuf_cap;
+	int r;
+};
+
+struct pcm_pool {
+	uint n; // workers, including the calling thread
+	uint gen; // incremented for each job
+	uint pending; // workers that haven't finished the current job yet
+	uint quit;
+	struct _pcm_task task[PCM_PARALLEL_THREADS];
+	struct pcm_convert_plan *plan; // the last used plan;  NULL: none
+
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+	CONDITION_VARIABLE cv_job, cv_done;
+	HANDLE th[PCM_PARALLEL_THREADS];
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t cv_job, cv_done;
+	pthread_t th[PCM_PARALLEL_THREADS];
+#endif
+};
+
+#ifdef _WIN32
+	#define _pcm_pool_lock(p)  EnterCriticalSection(&(p)->lock)
+	#define _pcm_pool_unlock(p)  LeaveCriticalSection(&(p)->lock)
+	#define _pcm_pool_wait(p, cv)  SleepConditionVariableCS(&(p)->cv, &(p)->lock, INFINITE)
+	#define _pcm_pool_wake_all(p, cv)  WakeAllConditionVariable(&(p)->cv)
+#else
+	#define _pcm_pool_lock(p)  pthread_mutex_lock(&(p)->lock)
+	#define _pcm_pool_unlock(p)  pthread_mutex_unlock(&(p)->lock)
+	#define _pcm_pool_wait(p, cv)  pthread_cond_wait(&(p)->cv, &(p)->lock)
+	#define _pcm_pool_wake_all(p, cv)  pthread_cond_broadcast(&(p)->cv)
+#endif
+
+/** Convert 1 chunk */
+static inline void _pcm_task_run(struct _pcm_task *t)
+{
+	const struct pcm_convert_plan *pl = t->plan;
+	void *ip[PCM_CHAN_MAX], *op[PCM_CHAN_MAX];
+	uint ich = pl->in.channels, och = pl->nch;
+	uint isize = pcm_f_bits(pl->in.format)/8 * ((pl->in.interleaved) ? ich : 1);
+	uint osize = pcm_f_bits(pl->out.format)/8 * ((pl->out.interleaved) ? och : 1);
+
+	const void *i = _pcm_offset(ip, t->in, pl->in.interleaved, ich, t->off * isize);
+	void *o = _pcm_offset(op, t->out, pl->out.interleaved, och, t->off * osize);
+	t->r = _pcm_convert_plan_run_buf(pl, t->mbuf, o, i, t->n);
+}
+
+struct _pcm_worker {
+	struct pcm_pool *pool;
+	uint idx;
+};
+
+#ifdef _WIN32
+static DWORD WINAPI _pcm_pool_worker(void *param)
+#else
+static void* _pcm_pool_worker(void *param)
+#endif
+{
+	struct pcm_pool *p = ((struct _pcm_worker*)param)->pool;
+	uint idx = ((struct _pcm_worker*)param)->idx;
+	ffmem_free(param);
+
+	uint gen = 0; // a job may be started before this thread runs:  don't read 'p->gen' here
+	_pcm_pool_lock(p);
+	for (;;) {
+		while (gen == p->gen && !p->quit) {
+			_pcm_pool_wait(p, cv_job);
+		}
+		if (p->quit)
+			break;
+		gen = p->gen;
+		_pcm_pool_unlock(p);
+
+		if (p->task[idx].n != 0)
+			_pcm_task_run(&p->task[idx]);
+
+		_pcm_pool_lock(p);
+		if (--p->pending == 0)
+			_pcm_pool_wake_all(p, cv_done);
+	}
+	_pcm_pool_unlock(p);
+	return 0;
+}
+
+static inline uint _pcm_cpus()
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? n : 1;
+#endif
+}
+
+static inline void pcm_pool_destroy(struct pcm_pool *p)
+{
+	if (p->n == 0)
+		return;
+
+	_pcm_pool_lock(p);
+	p->quit = 1;
+	_pcm_pool_wake_all(p, cv_job);
+	_pcm_pool_unlock(p);
+
+	for (uint i = 1;  i != p->n;  i++) {
+#ifdef _WIN32
+		WaitForSingleObject(p->th[i], INFINITE);
+		CloseHandle(p->th[i]);
+#else
+		pthread_join(p->th[i], NULL);
+#endif
+	}
+
+#ifdef _WIN32
+	DeleteCriticalSection(&p->lock);
+#else
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->cv_job);
+	pthread_cond_destroy(&p->cv_done);
+#endif
+
+	for (uint i = 0;  i != p->n;  i++) {
+		ffmem_free(p->task[i].mbuf);
+	}
+	if (p->plan != NULL) {
+		pcm_convert_plan_destroy(p->plan);
+		ffmem_free(p->plan);
+	}
+	p->plan = NULL;
+	p->n = 0;
+}
+
+/** Start worker threads.
+threads: total number of threads, including the calling thread;  0: number of CPUs
+Return 0 on success */
+static inline int pcm_pool_init(struct pcm_pool *p, uint threads)
+{
+	ffmem_zero(p, sizeof(*p));
+	if (threads == 0)
+		threads = _pcm_cpus();
+	threads = ffmin(threads, PCM_PARALLEL_THREADS);
+
+#ifdef _WIN32
+	InitializeCriticalSection(&p->lock);
+	InitializeConditionVariable(&p->cv_job);
+	InitializeConditionVariable(&p->cv_done);
+#else
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cv_job, NULL);
+	pthread_cond_init(&p->cv_done, NULL);
+#endif
+
+	for (p->n = 1;  p->n != threads;  p->n++) {
+		struct _pcm_worker *w;
+		if (NULL == (w = ffmem_new(struct _pcm_worker)))
+			goto err;
+		w->pool = p;
+		w->idx = p->n;
+
+#ifdef _WIN32
+		if (NULL == (p->th[p->n] = CreateThread(NULL, 0, _pcm_pool_worker, w, 0, NULL))) {
+#else
+		if (0 != pthread_create(&p->th[p->n], NULL, _pcm_pool_worker, w)) {
+#endif
+			ffmem_free(w);
+			goto err;
+		}
+	}
+	return 0;
+
+err:
+	pcm_pool_destroy(p);
+	return -1;
+}
+
+/** Get the plan for these formats:  reuse the last one or prepare a new one
+Return NULL on error */
+static inline const struct pcm_convert_plan* _pcm_pool_plan(struct pcm_pool *p, const struct pcm_af *outpcm, const struct pcm_af *inpcm)
+{
+	struct pcm_convert_plan *pl = p->plan;
+	if (pl != NULL) {
+		if (pcm_af_eq(&pl->in, inpcm) && pcm_af_eq(&pl->out, outpcm))
+			return pl;
+		pcm_convert_plan_destroy(pl);
+	} else if (NULL == (pl = ffmem_new(struct pcm_convert_plan))) {
+		return NULL;
+	}
+	p->plan = NULL;
+
+	if (0 != pcm_convert_plan_init(pl, outpcm, inpcm)) {
+		ffmem_free(pl);
+		return NULL;
+	}
+
+	// the workers can't allocate:  prepare their memory for mixing now
+	size_t cap = (pl->mix) ? _pcm_convert_mbuf_size(pl) : 0;
+	for (uint k = 0;  k != p->n;  k++) {
+		struct _pcm_task *t = &p->task[k];
+		if (t->mbuf_cap >= cap)
+			continue;
+		ffmem_free(t->mbuf);
+		t->mbuf_cap = 0;
+		if (NULL == (t->mbuf = (float*)ffmem_alloc(cap * sizeof(float)))) {
+			pcm_convert_plan_destroy(pl);
+			ffmem_free(pl);
+			return NULL;
+		}
+		t->mbuf_cap = cap;
+	}
+
+	p->plan = pl;
+	return pl;
+}
+
+/** Convert PCM samples using all workers of the pool.
+Buffers smaller than PCM_PARALLEL_MIN samples per worker are converted by the calling thread.
+The conversion plan is reused while the formats stay the same.
+Parameters and the result are the same as for pcm_convert():  sample rate conversion isn't supported.
+'out' may be the same buffer as 'in' only if the frame size doesn't change. */
+static inline int pcm_convert_parallel(struct pcm_pool *p, const struct pcm_af *outpcm, void *out, const struct pcm_af *inpcm, const void *in, size_t samples)
+{
+	if (inpcm->rate != outpcm->rate)
+		return -1;
+
+	// the plan keeps the decoded output format:  compare with it, not with the former encoding
+	struct pcm_af sel;
+	outpcm = _pcm_af_chan_sel_compat(&sel, outpcm, inpcm);
+
+	size_t total = samples * inpcm->channels;
+	uint n = ffmin(p->n, total / PCM_PARALLEL_MIN);
+
+	uint ifr = pcm_f_bits(inpcm->format)/8 * inpcm->channels;
+	uint ofr = pcm_f_bits(outpcm->format)/8 * outpcm->channels;
+	const void *i0 = (inpcm->interleaved) ? in : ((void**)in)[0];
+	const void *o0 = (outpcm->interleaved) ? out : ((void**)out)[0];
+	if (i0 == o0 && ifr != ofr)
+		n = 1; // one worker's output would overwrite another worker's input
+
+	if (n <= 1)
+		return pcm_convert(outpcm, out, inpcm, in, samples);
+
+	const struct pcm_convert_plan *pl;
+	if (NULL == (pl = _pcm_pool_plan(p, outpcm, inpcm)))
+		return -1;
+
+	// equal chunks rounded up to the alignment;  the last one gets the remainder
+	size_t chunk = (samples + n - 1) / n;
+	chunk = (chunk + PCM_PARALLEL_ALIGN - 1) / PCM_PARALLEL_ALIGN * PCM_PARALLEL_ALIGN;
+
+	_pcm_pool_lock(p);
+	for (uint k = 0;  k != p->n;  k++) {
+		// workers beyond 'n' get no frames
+		struct _pcm_task *t = &p->task[k];
+		t->plan = pl;
+		t->in = in;
+		t->out = out;
+		t->off = ffmin(k * chunk, samples);
+		t->n = ffmin(chunk, samples - t->off);
+		t->r = 0;
+	}
+	p->pending = p->n - 1;
+	p->gen++;
+	_pcm_pool_wake_all(p, cv_job);
+	_pcm_pool_unlock(p);
+
+	_pcm_task_run(&p->task[0]);
+
+	_pcm_pool_lock(p);
+	while (p->pending != 0) {
+		_pcm_pool_wait(p, cv_done);
+	}
+	_pcm_pool_unlock(p);
+
+	int r = 0;
+	for (uint k = 0;  k != p->n;  k++) {
+		r |= p->task[k].r;
+	}
+	return (r != 0) ? -1 : 0;
+}
+
+#undef _pcm_pool_lock
+#undef _pcm_pool_unlock
+#undef _pcm_pool_wait
+#undef _pcm_pool_wake_all
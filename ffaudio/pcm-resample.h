@@ -0,0 +1,495 @@
+/** ffaudio: sample rate conversion.
+2026, Simon Zolin */
+
+/*
+pcm_resample_init pcm_resample_destroy
+pcm_resample_reset
+pcm_resample_adjust
+pcm_resample_out_max
+pcm_resample_process
+pcm_drift_init
+pcm_drift_update
+*/
+
+/* Polyphase FIR resampler.
+The filter is a Kaiser-windowed sinc with 'taps' coefficients, sampled at 'phases' fractional positions.
+The coefficients for a fractional position between 2 phases are interpolated linearly,
+ so any ratio of rates is supported with a table of a fixed size.
+The read position is a 32.32 fixed-point number of input samples.
+If it falls exactly on a phase (e.g. integer decimation 48->16, or 3:2 ratio 24->16),
+ only 1 phase is computed.
+Filter tables depend only on the ratio of rates and the quality,
+ they are shared by all resamplers with the same parameters (from any thread). */
+
+#pragma once
+#include <ffaudio/audio.h>
+#include <ffaudio/pcm.h>
+#include <ffaudio/pcm-simd.h>
+#include <ffbase/base.h>
+#include <ffbase/lock.h>
+#include <math.h>
+
+enum PCM_RESAMPLE_Q {
+	PCM_RESAMPLE_LOW, // 16 taps, ~50dB stopband attenuation
+	PCM_RESAMPLE_MEDIUM, // 32 taps, ~75dB
+	PCM_RESAMPLE_HIGH, // 64 taps, ~100dB
+
+	/** pcm_convert_plan_init_resample(): use the resampler even if the rates are equal,
+	 so that the ratio can be steered with pcm_convert_plan_adjust() */
+	PCM_RESAMPLE_ADAPTIVE = 0x10,
+};
+
+#define PCM_RESAMPLE_BLOCK  1024 // input samples buffered per channel at once
+#define PCM_RESAMPLE_ADJ_MAX  0.005 // maximum deviation from the nominal ratio (pcm_resample_adjust())
+
+struct _pcm_rs_filter {
+	struct _pcm_rs_filter *next;
+	ffsize refs; // atomic
+	uint irate, orate; // reduced ratio
+	uint quality;
+	uint taps; // multiple of 8
+	uint phases_log2;
+	float *coef; // [phases + 1][taps]
+};
+
+/** Filter tables in use (see _PCM_SHARED) */
+_PCM_SHARED struct _pcm_rs_filter *_pcm_rs_filters;
+_PCM_SHARED fflock _pcm_rs_lock; // protects the list
+
+typedef float (*_pcm_rs_dot_func)(const float *x, const float *c0, const float *c1, float mu, uint taps);
+typedef float (*_pcm_rs_dot1_func)(const float *x, const float *c, uint taps);
+
+struct pcm_resample {
+	struct _pcm_rs_filter *f;
+	_pcm_rs_dot_func dot;
+	_pcm_rs_dot1_func dot1; // the position is on a phase
+	uint nch;
+	ffuint64 step; // input samples per output sample (32.32)
+	ffuint64 step0; // nominal 'step'
+	ffuint64 pos; // position of the next output sample in 'hist' (32.32)
+	uint len; // samples per channel in 'hist'
+	uint cap;
+	float *hist; // [nch][cap]
+};
+
+static double _pcm_bessel_i0(double x)
+{
+	double s = 1, t = 1;
+	for (uint k = 1;  k != 64;  k++) {
+		t *= (x / (2 * k)) * (x / (2 * k));
+		s += t;
+		if (t < s * 1e-14)
+			break;
+	}
+	return s;
+}
+
+/** Compute the coefficients.
+Output sample at fractional position 'frac' is the sum of x[k] * h(k - (taps/2-1) - frac), k=0..taps-1 */
+static void _pcm_rs_filter_fill(struct _pcm_rs_filter *f, double cutoff, double beta)
+{
+	uint taps = f->taps, phases = 1U << f->phases_log2;
+	double half = taps / 2, i0b = _pcm_bessel_i0(beta);
+
+	for (uint p = 0;  p <= phases;  p++) {
+		float *c = f->coef + p * taps;
+		double sum = 0;
+
+		for (uint k = 0;  k != taps;  k++) {
+			double x = (double)k - (half - 1) - (double)p / phases;
+			double r = x / half, h = 2 * cutoff;
+			if (x != 0)
+				h = sin(2 * M_PI * cutoff * x) / (M_PI * x);
+			h *= (r * r < 1) ? _pcm_bessel_i0(beta * sqrt(1 - r * r)) / i0b : 0;
+			c[k] = h;
+			sum += h;
+		}
+
+		// unity gain at DC for every phase
+		for (uint k = 0;  k != taps;  k++) {
+			c[k] /= sum;
+		}
+	}
+}
+
+static uint _pcm_gcd(uint a, uint b)
+{
+	while (b != 0) {
+		uint t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/** Find the filter table in the list and reference it */
+static struct _pcm_rs_filter* _pcm_rs_filter_find(uint irate, uint orate, uint quality)
+{
+	struct _pcm_rs_filter *f;
+	for (f = _pcm_rs_filters;  f != NULL;  f = f->next) {
+		if (f->irate == irate && f->orate == orate && f->quality == quality) {
+			ffint_fetch_add(&f->refs, 1);
+			break;
+		}
+	}
+	return f;
+}
+
+/** Get a shared filter table or create a new one */
+static struct _pcm_rs_filter* _pcm_rs_filter_get(uint irate, uint orate, uint quality)
+{
+	static const struct {
+		u_char taps, phases_log2;
+		float rolloff, beta;
+	} q[] = {
+		{ 16, 5, 0.80, 5 },
+		{ 32, 7, 0.90, 7.5 },
+		{ 64, 8, 0.94, 10 },
+	};
+
+	uint g = _pcm_gcd(irate, orate);
+	irate /= g;
+	orate /= g;
+
+	struct _pcm_rs_filter *f, *f2;
+	fflock_lock(&_pcm_rs_lock);
+	f = _pcm_rs_filter_find(irate, orate, quality);
+	fflock_unlock(&_pcm_rs_lock);
+	if (f != NULL)
+		return f;
+
+	// compute the coefficients without holding the lock
+	if (NULL == (f = ffmem_new(struct _pcm_rs_filter)))
+		return NULL;
+	f->refs = 1;
+	f->irate = irate;
+	f->orate = orate;
+	f->quality = quality;
+	f->phases_log2 = q[quality].phases_log2;
+
+	// when downsampling, the filter is stretched to keep the same transition band relative to the cutoff
+	double cutoff = 0.5 * q[quality].rolloff;
+	uint taps = q[quality].taps;
+	if (irate > orate) {
+		cutoff = cutoff * orate / irate;
+		taps = ffmin((ffuint64)taps * irate / orate, 1024);
+	}
+	f->taps = (taps + 7) & ~7U;
+
+	if (NULL == (f->coef = (float*)ffmem_alloc(((1U << f->phases_log2) + 1) * f->taps * sizeof(float)))) {
+		ffmem_free(f);
+		return NULL;
+	}
+	_pcm_rs_filter_fill(f, cutoff, q[quality].beta);
+
+	fflock_lock(&_pcm_rs_lock);
+	if (NULL == (f2 = _pcm_rs_filter_find(irate, orate, quality))) {
+		f->next = _pcm_rs_filters;
+		_pcm_rs_filters = f;
+	}
+	fflock_unlock(&_pcm_rs_lock);
+
+	if (f2 != NULL) {
+		// another thread has added the same table
+		ffmem_free(f->coef);
+		ffmem_free(f);
+		f = f2;
+	}
+	return f;
+}
+
+static void _pcm_rs_filter_release(struct _pcm_rs_filter *f)
+{
+	// drop a reference that isn't the last one without locking
+	for (;;) {
+		ffsize n = FFINT_READONCE(f->refs);
+		if (n == 1)
+			break;
+		if (n == ffint_cmpxchg(&f->refs, n, n - 1))
+			return;
+	}
+
+	// the last reference:  _pcm_rs_filter_find() may reference the table again until it's unlinked
+	fflock_lock(&_pcm_rs_lock);
+	if (1 != ffint_fetch_add(&f->refs, -1)) {
+		f = NULL;
+	} else {
+		struct _pcm_rs_filter **pf;
+		for (pf = &_pcm_rs_filters;  *pf != f;  pf = &(*pf)->next) {
+		}
+		*pf = f->next;
+	}
+	fflock_unlock(&_pcm_rs_lock);
+
+	if (f != NULL) {
+		ffmem_free(f->coef);
+		ffmem_free(f);
+	}
+}
+
+/** (1-mu) * sum(x*c0) + mu * sum(x*c1) */
+static float _pcm_rs_dot(const float *x, const float *c0, const float *c1, float mu, uint taps)
+{
+	float s0 = 0, s1 = 0;
+	for (uint k = 0;  k != taps;  k++) {
+		s0 += x[k] * c0[k];
+		s1 += x[k] * c1[k];
+	}
+	return s0 + (s1 - s0) * mu;
+}
+
+/** sum(x*c) */
+static float _pcm_rs_dot1(const float *x, const float *c, uint taps)
+{
+	float s = 0;
+	for (uint k = 0;  k != taps;  k++) {
+		s += x[k] * c[k];
+	}
+	return s;
+}
+
+#ifdef FF_SSE2
+static float _pcm_rs_dot_sse2(const float *x, const float *c0, const float *c1, float mu, uint taps)
+{
+	__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+	for (uint k = 0;  k != taps;  k += 4) {
+		__m128 v = _mm_loadu_ps(x + k);
+		s0 = _mm_add_ps(s0, _mm_mul_ps(v, _mm_loadu_ps(c0 + k)));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(v, _mm_loadu_ps(c1 + k)));
+	}
+	__m128 s = _mm_add_ps(s0, _mm_mul_ps(_mm_sub_ps(s1, s0), _mm_set1_ps(mu)));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+static float _pcm_rs_dot1_sse2(const float *x, const float *c, uint taps)
+{
+	__m128 s = _mm_setzero_ps();
+	for (uint k = 0;  k != taps;  k += 4) {
+		s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(c + k)));
+	}
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+#endif
+
+#ifdef PCM_AVX2
+static PCM_TARGET_AVX2 float _pcm_rs_dot_avx2(const float *x, const float *c0, const float *c1, float mu, uint taps)
+{
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+	for (uint k = 0;  k != taps;  k += 8) {
+		__m256 v = _mm256_loadu_ps(x + k);
+		s0 = _mm256_add_ps(s0, _mm256_mul_ps(v, _mm256_loadu_ps(c0 + k)));
+		s1 = _mm256_add_ps(s1, _mm256_mul_ps(v, _mm256_loadu_ps(c1 + k)));
+	}
+	__m256 s8 = _mm256_add_ps(s0, _mm256_mul_ps(_mm256_sub_ps(s1, s0), _mm256_set1_ps(mu)));
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(s8), _mm256_extractf128_ps(s8, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+static PCM_TARGET_AVX2 float _pcm_rs_dot1_avx2(const float *x, const float *c, uint taps)
+{
+	__m256 s8 = _mm256_setzero_ps();
+	for (uint k = 0;  k != taps;  k += 8) {
+		s8 = _mm256_add_ps(s8, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(c + k)));
+	}
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(s8), _mm256_extractf128_ps(s8, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+#endif
+
+static inline void pcm_resample_destroy(struct pcm_resample *r)
+{
+	if (r->f != NULL)
+		_pcm_rs_filter_release(r->f);
+	ffmem_free(r->hist);
+	r->f = NULL;
+	r->hist = NULL;
+}
+
+/** Discard buffered data */
+static inline void pcm_resample_reset(struct pcm_resample *r)
+{
+	// the first output sample is aligned with the first input sample
+	r->len = r->f->taps / 2 - 1;
+	ffmem_zero(r->hist, r->nch * r->cap * sizeof(float));
+	r->pos = 0;
+}
+
+/** Prepare resampler.
+quality: enum PCM_RESAMPLE_Q
+Return 0 on success */
+static inline int pcm_resample_init(struct pcm_resample *r, uint nch, uint irate, uint orate, uint quality)
+{
+	ffmem_zero(r, sizeof(*r));
+	if (nch == 0 || irate == 0 || orate == 0 || quality > PCM_RESAMPLE_HIGH)
+		return -1;
+
+	if (NULL == (r->f = _pcm_rs_filter_get(irate, orate, quality)))
+		return -1;
+
+	r->nch = nch;
+	r->step = ((ffuint64)irate << 32) / orate;
+	r->step0 = r->step;
+	r->cap = r->f->taps + PCM_RESAMPLE_BLOCK;
+	if (NULL == (r->hist = (float*)ffmem_alloc(nch * r->cap * sizeof(float)))) {
+		pcm_resample_destroy(r);
+		return -1;
+	}
+
+	r->dot = _pcm_rs_dot;
+	r->dot1 = _pcm_rs_dot1;
+#ifdef FF_SSE2
+	if (pcm_cpu_features() & PCM_CPU_SSE2) {
+		r->dot = _pcm_rs_dot_sse2;
+		r->dot1 = _pcm_rs_dot1_sse2;
+	}
+#endif
+#ifdef PCM_AVX2
+	if (pcm_cpu_features() & PCM_CPU_AVX2) {
+		r->dot = _pcm_rs_dot_avx2;
+		r->dot1 = _pcm_rs_dot1_avx2;
+	}
+#endif
+
+	pcm_resample_reset(r);
+	return 0;
+}
+
+/** Change the ratio of output rate to input rate without interrupting the stream.
+factor: ratio relative to the nominal one, e.g. 1.00001: output 10ppm more samples;
+ limited to 1 +/- PCM_RESAMPLE_ADJ_MAX.
+The resolution is 2^-32 of an input sample per output sample. */
+static inline void pcm_resample_adjust(struct pcm_resample *r, double factor)
+{
+	factor = ffmax(ffmin(factor, 1 + PCM_RESAMPLE_ADJ_MAX), 1 - PCM_RESAMPLE_ADJ_MAX);
+	r->step = (ffuint64)((double)r->step0 / factor + 0.5);
+}
+
+/** Maximum number of output samples per channel produced from 'n' input samples
+ (with any ratio set by pcm_resample_adjust()) */
+static inline size_t pcm_resample_out_max(const struct pcm_resample *r, size_t n)
+{
+	ffuint64 step_min = (double)r->step0 / (1 + PCM_RESAMPLE_ADJ_MAX);
+	return ((ffuint64)n << 32) / step_min + 2;
+}
+
+/** Produce output samples from the buffered data */
+static inline size_t _pcm_resample_run(struct pcm_resample *r, float **out, size_t off)
+{
+	const struct _pcm_rs_filter *f = r->f;
+	uint taps = f->taps, shift = 32 - f->phases_log2;
+	const float kmu = 1.0f / (1U << shift);
+	ffuint64 pos = r->pos;
+	size_t n = 0;
+
+	for (uint c = 0;  c != r->nch;  c++) {
+		const float *x = r->hist + c * r->cap;
+		float *o = out[c] + off;
+		n = 0;
+		for (pos = r->pos;  (pos >> 32) + taps <= r->len;  pos += r->step) {
+			uint frac = (uint)pos;
+			const float *c0 = f->coef + (frac >> shift) * taps;
+			uint m = frac & ((1U << shift) - 1);
+			if (m == 0)
+				o[n++] = r->dot1(x + (pos >> 32), c0, taps);
+			else
+				o[n++] = r->dot(x + (pos >> 32), c0, c0 + taps, m * kmu, taps);
+		}
+	}
+
+	// discard the samples that won't be used anymore
+	size_t i = pos >> 32;
+	if (i >= r->len) {
+		pos -= (ffuint64)r->len << 32;
+		r->len = 0;
+	} else {
+		for (uint c = 0;  c != r->nch;  c++) {
+			float *x = r->hist + c * r->cap;
+			memmove(x, x + i, (r->len - i) * sizeof(float));
+		}
+		pos -= (ffuint64)i << 32;
+		r->len -= i;
+	}
+	r->pos = pos;
+	return n;
+}
+
+/** Convert sample rate of non-interleaved float data.
+in: [nch][n]
+out: [nch][]: must have space for pcm_resample_out_max(n) samples per channel
+Return the number of output samples per channel */
+static inline size_t pcm_resample_process(struct pcm_resample *r, float **out, const float **in, size_t n)
+{
+	size_t off = 0, nout = 0;
+
+	while (off != n) {
+		size_t k = ffmin(n - off, r->cap - r->len);
+		for (uint c = 0;  c != r->nch;  c++) {
+			memcpy(r->hist + c * r->cap + r->len, in[c] + off, k * sizeof(float));
+		}
+		r->len += k;
+		off += k;
+
+		nout += _pcm_resample_run(r, out, nout);
+	}
+
+	return nout;
+}
+
+/** Clock drift compensation.
+When data flows between 2 devices with independent clocks through a buffer,
+ the resampler ratio is steered so that the buffer fill level (i.e. latency) stays at the target.
+The fill level is low-pass filtered and fed to a PI controller:
+ the proportional term removes the level error, the integral term converges to the actual clock drift. */
+struct pcm_drift {
+	double rate;
+	double target; // target fill level (frames)
+	double level; // filtered fill level (frames);  <0: no data yet
+	double integral; // sum(error * dt)
+	double factor; // the current ratio correction for pcm_resample_adjust()
+};
+
+/** Prepare controller.
+rate: rate of the buffer that is monitored (Hz)
+target: desired fill level (frames) */
+static inline void pcm_drift_init(struct pcm_drift *d, uint rate, uint target)
+{
+	d->rate = rate;
+	d->target = target;
+	d->level = -1;
+	d->integral = 0;
+	d->factor = 1;
+}
+
+/** Update controller with the current buffer state.
+level: frames in the buffer, written by the resampler and not yet read by the other device;
+ may also be computed from device timestamps (e.g. written frames - played frames)
+frames: frames read by the other device since the last update
+Return the ratio correction for pcm_resample_adjust() */
+static inline double pcm_drift_update(struct pcm_drift *d, double level, uint frames)
+{
+	const double t_lpf = 0.5; // s:  time constant of the level filter
+	const double kp = 0.05, ki = kp * kp / 4; // ~20s to remove an error without overshoot
+
+	double dt = frames / d->rate;
+	if (d->level < 0)
+		d->level = level;
+	d->level += (level - d->level) * ffmin(dt / t_lpf, 1);
+
+	double e = (d->level - d->target) / d->rate; // s
+	d->integral += e * dt;
+	// don't accumulate beyond the correction range
+	d->integral = ffmax(ffmin(d->integral, PCM_RESAMPLE_ADJ_MAX / ki), -PCM_RESAMPLE_ADJ_MAX / ki);
+
+	// too much data buffered:  produce less output per input
+	d->factor = 1 - (kp * e + ki * d->integral);
+	d->factor = ffmax(ffmin(d->factor, 1 + PCM_RESAMPLE_ADJ_MAX), 1 - PCM_RESAMPLE_ADJ_MAX);
+	return d->factor;
+}
@@ -0,0 +1,147 @@
+/** ffaudio: silence detection on captured data.
+2026, Simon Zolin */
+
+/*
+pcm_silence_init
+pcm_silence_span
+pcm_silence_drop
+*/
+
+/* The level is measured by analysis windows (10ms):
+ the mean square value of the loudest channel (pcm_stats_update(), vectorized for all formats).
+Hysteresis:  silence ends when the level rises above 'on' threshold;
+ silence starts when the level stays below 'off' threshold for 'hangover' time.
+The data returned by ffaudio_interface.read() is split into spans of silent and non-silent frames:
+ a window that isn't complete yet is judged by the frames measured so far,
+ so the frames are classified as soon as they're passed here, and the start of a sound isn't cut. */
+
+#pragma once
+#include <ffaudio/pcm-convert.h>
+#include <ffaudio/pcm-stats.h>
+
+struct pcm_silence {
+	struct pcm_af af;
+	double on, off; // mean square value thresholds
+	uint window; // analysis window (frames)
+	uint hangover; // frames
+	uint hang; // frames below 'off' threshold
+	uint state :1; // detector state after the measured frames:  1: silence
+	uint silent :1; // state of the span returned by pcm_silence_span()
+	uint carry; // frames that were measured, but not returned by pcm_silence_span() yet
+	ffuint64 silent_frames, total_frames; // frames returned by pcm_silence_span()
+	struct pcm_stats st; // the current window
+};
+
+/** Prepare silence detector
+on_db: level (dBFS) at which silence ends, e.g. -45
+off_db: level (dBFS) below which silence starts, e.g. -50;  must not be higher than 'on_db'
+hangover_ms: how long the level must stay below 'off_db' before silence starts, e.g. 300
+The initial state is 'silent'.
+Return 0 on success */
+static inline int pcm_silence_init(struct pcm_silence *s, const struct pcm_af *af, double on_db, double off_db, uint hangover_ms)
+{
+	ffmem_zero(s, sizeof(*s));
+	if (af->channels == 0 || af->channels > PCM_CHAN_MAX || pcm_f_bits(af->format) == 0
+		|| off_db > on_db)
+		return -1;
+
+	s->af = *af;
+	s->on = pow(10, on_db / 10);
+	s->off = pow(10, off_db / 10);
+	s->window = ffmax(af->rate / 100, 1);
+	s->hangover = (ffuint64)af->rate * hangover_ms / 1000;
+	s->state = 1;
+	return 0;
+}
+
+/** Measure the next part of the window and update the state */
+static inline void _pcm_silence_update(struct pcm_silence *s, const void *data, size_t n)
+{
+	pcm_stats_update(&s->st, &s->af, data, n);
+
+	double e = 0;
+	for (uint c = 0;  c != s->af.channels;  c++) {
+		e = ffmax(e, s->st.sum2[c]);
+	}
+	e /= s->st.frames;
+
+	if (s->state) {
+		if (e > s->on) {
+			s->state = 0;
+			s->hang = 0;
+		}
+	} else if (e < s->off) {
+		s->hang += n;
+		if (s->hang >= s->hangover)
+			s->state = 1;
+	} else {
+		s->hang = 0;
+	}
+
+	if (s->st.frames == s->window)
+		pcm_stats_reset(&s->st);
+}
+
+/** Find the span of frames with the same state at the start of data
+data: the data of the format set by pcm_silence_init();
+ the first frame must follow the last frame of the span returned by the previous call
+Return the number of frames in the span;  s->silent: the state of these frames */
+static inline size_t pcm_silence_span(struct pcm_silence *s, const void *data, size_t frames)
+{
+	void *ip[PCM_CHAN_MAX];
+	uint nch = s->af.channels;
+	uint isize = pcm_f_bits(s->af.format)/8 * ((s->af.interleaved) ? nch : 1);
+	size_t off, n;
+
+	// the frames measured by the previous call have the current state
+	off = ffmin(s->carry, frames);
+	s->carry -= off;
+	s->silent = s->state;
+
+	while (off != frames && s->carry == 0) {
+		n = ffmin(frames - off, s->window - s->st.frames);
+		_pcm_silence_update(s, _pcm_offset(ip, data, s->af.interleaved, nch, off * isize), n);
+		if (off == 0) {
+			s->silent = s->state;
+		} else if (s->state != s->silent) {
+			s->carry = n; // these frames start the next span
+			break;
+		}
+		off += n;
+	}
+
+	s->total_frames += off;
+	if (s->silent)
+		s->silent_frames += off;
+	return off;
+}
+
+/** Remove silent frames in-place
+Return the number of frames left */
+static inline size_t pcm_silence_drop(struct pcm_silence *s, void *data, size_t frames)
+{
+	void *ip[PCM_CHAN_MAX];
+	uint c, nch = s->af.channels;
+	uint ssize = pcm_f_bits(s->af.format)/8;
+	uint isize = ssize * ((s->af.interleaved) ? nch : 1);
+	size_t off, n, len = 0;
+
+	for (off = 0;  off != frames;  off += n) {
+		n = pcm_silence_span(s, _pcm_offset(ip, data, s->af.interleaved, nch, off * isize), frames - off);
+		if (s->silent)
+			continue;
+
+		if (len != off) {
+			if (s->af.interleaved) {
+				ffmem_move((char*)data + len * isize, (char*)data + off * isize, n * isize);
+			} else {
+				for (c = 0;  c != nch;  c++) {
+					char *d = ((char**)data)[c];
+					ffmem_move(d + len * ssize, d + off * ssize, n * ssize);
+				}
+			}
+		}
+		len += n;
+	}
+	return len;
+}
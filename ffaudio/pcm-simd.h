@@ -0,0 +1,1647 @@
+/** ffaudio: vectorized PCM conversion kernels.
+2026, Simon Zolin */
+
+/*
+pcm_cpu_features pcm_cpu_limit
+pcm_conv_find
+pcm_interleave pcm_deinterleave
+*/
+
+/* Kernels process contiguous arrays of samples:
+ interleaved data (frames * channels samples) or a single channel of non-interleaved data.
+The results are bit-exact with the scalar code in pcm_convert():
+ the same scaling factors are used, float->int conversion rounds to nearest-even (as int_ftoi() does with SSE2),
+ the clamping bounds are identical, NaN is converted the same way. */
+
+#pragma once
+#include <ffaudio/audio.h>
+#include <ffaudio/pcm.h>
+#include <ffbase/atomic.h>
+
+enum PCM_CPU {
+	PCM_CPU_SSE2 = 1,
+	PCM_CPU_SSSE3 = 2,
+	PCM_CPU_AVX2 = 4,
+	PCM_CPU_F16C = 8,
+};
+
+#if defined FF_SSE2 && (defined __GNUC__ || defined __clang__)
+	#define PCM_AVX2
+	#include <immintrin.h>
+	#include <cpuid.h>
+	#define PCM_TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+
+/* Process-wide state of the header-only code:
+ with GCC/clang on ELF and Mach-O targets all translation units (of the same executable or library)
+ share a single weak definition;  otherwise each translation unit has its own copy. */
+#if (defined __GNUC__ || defined __clang__) && !defined _WIN32
+	#define _PCM_SHARED  __attribute__((weak))
+#else
+	#define _PCM_SHARED  static
+#endif
+
+/** enum PCM_CPU;  -1: not detected yet */
+_PCM_SHARED ffsize _pcm_cpu = (ffsize)-1;
+
+/** Query CPUID */
+static inline uint _pcm_cpu_detect()
+{
+	uint f = 0;
+#ifdef FF_SSE2
+	f |= PCM_CPU_SSE2;
+#endif
+
+#ifdef PCM_AVX2
+	uint a, b, c, d;
+	if (__get_cpuid(1, &a, &b, &c, &d)) {
+		if (c & bit_SSSE3)
+			f |= PCM_CPU_SSSE3;
+
+		if ((c & (bit_OSXSAVE | bit_AVX)) == (bit_OSXSAVE | bit_AVX)) {
+			uint xcr0_lo, xcr0_hi;
+			__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+			if ((xcr0_lo & 6) == 6) { // OS saves XMM & YMM registers
+				if (c & bit_F16C)
+					f |= PCM_CPU_F16C;
+				if (__get_cpuid_count(7, 0, &a, &b, &c, &d)
+					&& (b & bit_AVX2))
+					f |= PCM_CPU_AVX2;
+			}
+		}
+	}
+#endif
+
+	return f;
+}
+
+/** Get CPU extensions usable by the kernels (enum PCM_CPU).
+CPUID is queried on the first call;  thread-safe. */
+static inline uint pcm_cpu_features()
+{
+	ffsize f = FFINT_READONCE(_pcm_cpu);
+	if (f != (ffsize)-1)
+		return f;
+
+	// don't overwrite the value set by a concurrent pcm_cpu_limit()
+	ffint_cmpxchg(&_pcm_cpu, (ffsize)-1, _pcm_cpu_detect());
+	return FFINT_READONCE(_pcm_cpu);
+}
+
+/** Restrict the set of CPU extensions the kernels may use.
+The setting is process-wide with GCC/clang (except on Windows), per translation unit otherwise (see _PCM_SHARED).
+The plans that are already prepared keep using their kernels.
+mask: enum PCM_CPU
+ 0: use scalar code only */
+static inline void pcm_cpu_limit(uint mask)
+{
+	FFINT_WRITEONCE(_pcm_cpu, _pcm_cpu_detect() & mask);
+}
+
+/** Convert 'n' contiguous samples */
+typedef void (*pcm_conv_func)(void *out, const void *in, size_t n);
+
+/* float16, bfloat16 <-> float32.
+The vectorized kernels produce the same results as the scalar functions in pcm.h and F16C instructions:
+ round to nearest-even, subnormal values are preserved, NaN is quieted. */
+
+static void _pcm_f16_f32(void *out, const void *in, size_t n)
+{
+	const ushort *s = (ushort*)in;
+	float *d = (float*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = pcm_flt_f16(s[i]);
+	}
+}
+
+static void _pcm_f32_f16(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	ushort *d = (ushort*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = pcm_f16_flt(s[i]);
+	}
+}
+
+static void _pcm_bf16_f32(void *out, const void *in, size_t n)
+{
+	const ushort *s = (ushort*)in;
+	float *d = (float*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = pcm_flt_bf16(s[i]);
+	}
+}
+
+static void _pcm_f32_bf16(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	ushort *d = (ushort*)out;
+	for (size_t i = 0;  i != n;  i++) {
+		d[i] = pcm_bf16_flt(s[i]);
+	}
+}
+
+#ifdef FF_SSE2
+
+/* int24 is loaded with 4-byte accesses which touch 1 byte of the next sample,
+ so the vector loops stop 1 sample before the end.
+The last sample is stored with 3 bytes, so the next sample isn't modified (in-place processing is safe). */
+
+static inline __m128i _pcm_sse2_i24_load4(const char *p)
+{
+	int a, b, c, d;
+	memcpy(&a, p, 4);
+	memcpy(&b, p + 3, 4);
+	memcpy(&c, p + 6, 4);
+	memcpy(&d, p + 9, 4);
+	__m128i v = _mm_set_epi32(d, c, b, a);
+	return _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+}
+
+static inline void _pcm_sse2_i24_store4(char *p, __m128i v)
+{
+	int a = _mm_cvtsi128_si32(v);
+	int b = _mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+	int c = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+	int d = _mm_cvtsi128_si32(_mm_srli_si128(v, 12));
+	memcpy(p, &a, 4);
+	memcpy(p + 3, &b, 4);
+	memcpy(p + 6, &c, 4);
+	pcm_i24_i32(p + 9, d);
+}
+
+/** Integer division by 2^n rounding toward zero (as C's '/' operator does) */
+#define _pcm_sse2_sdiv_pow2(v, n) \
+	_mm_srai_epi32(_mm_add_epi32(v, _mm_and_si128(_mm_srai_epi32(v, 31), _mm_set1_epi32((1 << (n)) - 1))), n)
+
+/** Scale, clamp and convert float to int32 */
+static inline __m128i _pcm_sse2_ps_epi32(__m128 f, __m128 k, __m128 lo, __m128 hi)
+{
+	f = _mm_mul_ps(f, k);
+	f = _mm_and_ps(f, _mm_cmpord_ps(f, f)); // NaN -> 0
+	f = _mm_min_ps(_mm_max_ps(f, lo), hi);
+	return _mm_cvtps_epi32(f);
+}
+
+static inline __m128i _pcm_sse2_pd_epi32(__m128d f, __m128d k, __m128d lo, __m128d hi)
+{
+	f = _mm_mul_pd(f, k);
+	f = _mm_and_pd(f, _mm_cmpord_pd(f, f));
+	f = _mm_min_pd(_mm_max_pd(f, lo), hi);
+	return _mm_cvtpd_epi32(f);
+}
+
+/** Convert float to int32 without clamping the lower bound:
+ CVTPS2DQ returns 0x80000000 for out-of-range and NaN values, which is correct for negative overflow;
+ for positive overflow we turn it into 0x7fffffff. */
+static inline __m128i _pcm_sse2_ps_i32(__m128 f)
+{
+	const __m128 k = _mm_set1_ps(pcm_max32);
+	f = _mm_mul_ps(f, k);
+	__m128i r = _mm_cvtps_epi32(f);
+	return _mm_xor_si128(r, _mm_castps_si128(_mm_cmpge_ps(f, k)));
+}
+
+static inline __m128 _pcm_sse2_i16lo_ps(__m128i v)
+{
+	return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+}
+
+static inline __m128 _pcm_sse2_i16hi_ps(__m128i v)
+{
+	return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+}
+
+// int16
+
+static void _pcm_sse2_i16_i24(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128i z = _mm_setzero_si128();
+	for (;  i + 4 < n;  i += 4) {
+		__m128i v = _mm_loadl_epi64((__m128i*)(s + i));
+		v = _mm_srai_epi32(_mm_unpacklo_epi16(z, v), 8);
+		_pcm_sse2_i24_store4(d + i * 3, v);
+	}
+	for (;  i != n;  i++) {
+		pcm_i24_i32(d + i * 3, (int)s[i] * 0x100);
+	}
+}
+
+static void _pcm_sse2_i16_i32(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128i z = _mm_setzero_si128();
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_si128((__m128i*)(d + i), _mm_unpacklo_epi16(z, v));
+		_mm_storeu_si128((__m128i*)(d + i + 4), _mm_unpackhi_epi16(z, v));
+	}
+	for (;  i != n;  i++) {
+		d[i] = (int)s[i] * 0x10000;
+	}
+}
+
+static void _pcm_sse2_i16_f32(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(1 / pcm_max16);
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_ps(d + i, _mm_mul_ps(_pcm_sse2_i16lo_ps(v), k));
+		_mm_storeu_ps(d + i + 4, _mm_mul_ps(_pcm_sse2_i16hi_ps(v), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i16(s[i]);
+	}
+}
+
+static void _pcm_sse2_i16_f64(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	const __m128d k = _mm_set1_pd(1 / pcm_max16);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_loadl_epi64((__m128i*)(s + i));
+		v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		_mm_storeu_pd(d + i, _mm_mul_pd(_mm_cvtepi32_pd(v), k));
+		_mm_storeu_pd(d + i + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i16(s[i]);
+	}
+}
+
+// int24
+
+static void _pcm_sse2_i24_i16(void *out, const void *in, size_t n)
+{
+	const char *s = (char*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	for (;  i + 8 < n;  i += 8) {
+		__m128i a = _mm_srai_epi32(_pcm_sse2_i24_load4(s + i * 3), 8);
+		__m128i b = _mm_srai_epi32(_pcm_sse2_i24_load4(s + i * 3 + 12), 8);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(a, b));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i32_i24(s + i * 3) >> 8;
+	}
+}
+
+static void _pcm_sse2_i24_i32(void *out, const void *in, size_t n)
+{
+	const char *s = (char*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	for (;  i + 4 < n;  i += 4) {
+		_mm_storeu_si128((__m128i*)(d + i), _mm_slli_epi32(_pcm_sse2_i24_load4(s + i * 3), 8));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i32_i24(s + i * 3) * 0x100;
+	}
+}
+
+static void _pcm_sse2_i24_f32(void *out, const void *in, size_t n)
+{
+	const char *s = (char*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(1 / pcm_max24);
+	for (;  i + 4 < n;  i += 4) {
+		__m128i v = _pcm_sse2_i24_load4(s + i * 3);
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i24(pcm_i32_i24(s + i * 3));
+	}
+}
+
+static void _pcm_sse2_i24_f64(void *out, const void *in, size_t n)
+{
+	const char *s = (char*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	const __m128d k = _mm_set1_pd(1 / pcm_max24);
+	for (;  i + 4 < n;  i += 4) {
+		__m128i v = _pcm_sse2_i24_load4(s + i * 3);
+		_mm_storeu_pd(d + i, _mm_mul_pd(_mm_cvtepi32_pd(v), k));
+		_mm_storeu_pd(d + i + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i24(pcm_i32_i24(s + i * 3));
+	}
+}
+
+// int32
+
+static void _pcm_sse2_i32_i16(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i a = _mm_loadu_si128((__m128i*)(s + i));
+		__m128i b = _mm_loadu_si128((__m128i*)(s + i + 4));
+		a = _pcm_sse2_sdiv_pow2(a, 16);
+		b = _pcm_sse2_sdiv_pow2(b, 16);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(a, b));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i] / 0x10000;
+	}
+}
+
+static void _pcm_sse2_i32_i24(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	for (;  i + 4 < n;  i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_pcm_sse2_i24_store4(d + i * 3, _pcm_sse2_sdiv_pow2(v, 8));
+	}
+	for (;  i != n;  i++) {
+		pcm_i24_i32(d + i * 3, s[i] / 0x100);
+	}
+}
+
+static void _pcm_sse2_i32_f32(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(1 / pcm_max32);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i32(s[i]);
+	}
+}
+
+static void _pcm_sse2_i32_f64(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	const __m128d k = _mm_set1_pd(1 / pcm_max32);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_pd(d + i, _mm_mul_pd(_mm_cvtepi32_pd(v), k));
+		_mm_storeu_pd(d + i + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i32(s[i]);
+	}
+}
+
+// int24 in 32-bit container:  the sample is in the high 3 bytes, the low byte is ignored
+
+static void _pcm_sse2_i24_4_i16(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i a = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(s + i)), 16);
+		__m128i b = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(s + i + 4)), 16);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(a, b));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i] >> 16;
+	}
+}
+
+static void _pcm_sse2_i24_4_i32(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128i m = _mm_set1_epi32(~0xff);
+	for (;  i + 4 <= n;  i += 4) {
+		_mm_storeu_si128((__m128i*)(d + i), _mm_and_si128(_mm_loadu_si128((__m128i*)(s + i)), m));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i] & ~0xff;
+	}
+}
+
+static void _pcm_sse2_i24_4_f32(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(1 / pcm_max24);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(s + i)), 8);
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(v), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i24(s[i] >> 8);
+	}
+}
+
+static void _pcm_sse2_i24_4_f64(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	const __m128d k = _mm_set1_pd(1 / pcm_max24);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(s + i)), 8);
+		_mm_storeu_pd(d + i, _mm_mul_pd(_mm_cvtepi32_pd(v), k));
+		_mm_storeu_pd(d + i + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v, 8)), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i24(s[i] >> 8);
+	}
+}
+
+static void _pcm_sse2_i16_i24_4(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128i z = _mm_setzero_si128();
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_si128((__m128i*)(d + i), _mm_unpacklo_epi16(z, v));
+		_mm_storeu_si128((__m128i*)(d + i + 4), _mm_unpackhi_epi16(z, v));
+	}
+	for (;  i != n;  i++) {
+		d[i] = (int)s[i] * 0x10000;
+	}
+}
+
+static void _pcm_sse2_i32_i24_4(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _pcm_sse2_sdiv_pow2(_mm_loadu_si128((__m128i*)(s + i)), 8);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_slli_epi32(v, 8));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i] / 0x100 * 0x100;
+	}
+}
+
+static void _pcm_sse2_f32_i24_4(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(pcm_max24)
+		, lo = _mm_set1_ps(-pcm_max24)
+		, hi = _mm_set1_ps(pcm_max24 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i v = _pcm_sse2_ps_epi32(_mm_loadu_ps(s + i), k, lo, hi);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_slli_epi32(v, 8));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i24_flt(s[i]) * 0x100;
+	}
+}
+
+static void _pcm_sse2_f64_i24_4(void *out, const void *in, size_t n)
+{
+	const double *s = (double*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128d k = _mm_set1_pd(pcm_max24)
+		, lo = _mm_set1_pd(-pcm_max24)
+		, hi = _mm_set1_pd(pcm_max24 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i a = _pcm_sse2_pd_epi32(_mm_loadu_pd(s + i), k, lo, hi);
+		__m128i b = _pcm_sse2_pd_epi32(_mm_loadu_pd(s + i + 2), k, lo, hi);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_slli_epi32(_mm_unpacklo_epi64(a, b), 8));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i24_flt(s[i]) * 0x100;
+	}
+}
+
+// float32
+
+static void _pcm_sse2_f32_i16(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(pcm_max16)
+		, lo = _mm_set1_ps(-pcm_max16)
+		, hi = _mm_set1_ps(pcm_max16 - 1);
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i a = _pcm_sse2_ps_epi32(_mm_loadu_ps(s + i), k, lo, hi);
+		__m128i b = _pcm_sse2_ps_epi32(_mm_loadu_ps(s + i + 4), k, lo, hi);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(a, b));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i16_flt(s[i]);
+	}
+}
+
+static void _pcm_sse2_f32_i24(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(pcm_max24)
+		, lo = _mm_set1_ps(-pcm_max24)
+		, hi = _mm_set1_ps(pcm_max24 - 1);
+	for (;  i + 4 < n;  i += 4) {
+		_pcm_sse2_i24_store4(d + i * 3, _pcm_sse2_ps_epi32(_mm_loadu_ps(s + i), k, lo, hi));
+	}
+	for (;  i != n;  i++) {
+		pcm_i24_i32(d + i * 3, pcm_i24_flt(s[i]));
+	}
+}
+
+static void _pcm_sse2_f32_i32(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	for (;  i + 4 <= n;  i += 4) {
+		_mm_storeu_si128((__m128i*)(d + i), _pcm_sse2_ps_i32(_mm_loadu_ps(s + i)));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i32_flt(s[i]);
+	}
+}
+
+static void _pcm_sse2_f32_f64(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 v = _mm_loadu_ps(s + i);
+		_mm_storeu_pd(d + i, _mm_cvtps_pd(v));
+		_mm_storeu_pd(d + i + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i];
+	}
+}
+
+// float64
+
+static void _pcm_sse2_f64_i16(void *out, const void *in, size_t n)
+{
+	const double *s = (double*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	const __m128d k = _mm_set1_pd(pcm_max16)
+		, lo = _mm_set1_pd(-pcm_max16)
+		, hi = _mm_set1_pd(pcm_max16 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		__m128i a = _pcm_sse2_pd_epi32(_mm_loadu_pd(s + i), k, lo, hi);
+		__m128i b = _pcm_sse2_pd_epi32(_mm_loadu_pd(s + i + 2), k, lo, hi);
+		a = _mm_unpacklo_epi64(a, b);
+		_mm_storel_epi64((__m128i*)(d + i), _mm_packs_epi32(a, a));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i16_flt(s[i]);
+	}
+}
+
+static void _pcm_sse2_f64_i24(void *out, const void *in, size_t n)
+{
+	const double *s = (double*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128d k = _mm_set1_pd(pcm_max24)
+		, lo = _mm_set1_pd(-pcm_max24)
+		, hi = _mm_set1_pd(pcm_max24 - 1);
+	for (;  i + 4 < n;  i += 4) {
+		__m128i a = _pcm_sse2_pd_epi32(_mm_loadu_pd(s + i), k, lo, hi);
+		__m128i b = _pcm_sse2_pd_epi32(_mm_loadu_pd(s + i + 2), k, lo, hi);
+		_pcm_sse2_i24_store4(d + i * 3, _mm_unpacklo_epi64(a, b));
+	}
+	for (;  i != n;  i++) {
+		pcm_i24_i32(d + i * 3, pcm_i24_flt(s[i]));
+	}
+}
+
+static void _pcm_sse2_f64_i32(void *out, const void *in, size_t n)
+{
+	const double *s = (double*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m128d k = _mm_set1_pd(pcm_max32)
+		, lo = _mm_set1_pd(-pcm_max32)
+		, hi = _mm_set1_pd(pcm_max32 - 1);
+	for (;  i + 4 <= n;  i += 4) {
+		// NaN is clamped to the lower bound, the same value int_ftoi() returns for it
+		__m128d a = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(s + i), k), lo), hi);
+		__m128d b = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(s + i + 2), k), lo), hi);
+		_mm_storeu_si128((__m128i*)(d + i), _mm_unpacklo_epi64(_mm_cvtpd_epi32(a), _mm_cvtpd_epi32(b)));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i32_flt(s[i]);
+	}
+}
+
+static void _pcm_sse2_f64_f32(void *out, const void *in, size_t n)
+{
+	const double *s = (double*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	for (;  i + 4 <= n;  i += 4) {
+		__m128 a = _mm_cvtpd_ps(_mm_loadu_pd(s + i));
+		__m128 b = _mm_cvtpd_ps(_mm_loadu_pd(s + i + 2));
+		_mm_storeu_ps(d + i, _mm_movelh_ps(a, b));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i];
+	}
+}
+
+// float16, bfloat16
+
+/** Convert 4 half-precision values (in the low 16 bits of each element) to float */
+static inline __m128 _pcm_sse2_f16_ps(__m128i h)
+{
+	__m128i em = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+	__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, em), 16);
+	__m128i x = _mm_slli_epi32(em, 13);
+
+	// normal and subnormal values:  rebias the exponent
+	__m128 f = _mm_mul_ps(_mm_castsi128_ps(x), _mm_set1_ps(0x1p112f));
+
+	// Inf, NaN:  maximum exponent, quiet NaN
+	__m128i special = _mm_cmpgt_epi32(em, _mm_set1_epi32(0x7bff));
+	__m128i nan = _mm_and_si128(_mm_cmpgt_epi32(em, _mm_set1_epi32(0x7c00)), _mm_set1_epi32(0x400000));
+	x = _mm_or_si128(x, _mm_or_si128(_mm_set1_epi32(0x7f800000), nan));
+
+	x = _mm_or_si128(_mm_and_si128(special, x), _mm_andnot_si128(special, _mm_castps_si128(f)));
+	return _mm_castsi128_ps(_mm_or_si128(x, sign));
+}
+
+/** Convert 4 floats to half precision (in the low 16 bits of each element) */
+static inline __m128i _pcm_sse2_ps_f16(__m128 f)
+{
+	__m128i b = _mm_castps_si128(f);
+	__m128i u = _mm_and_si128(b, _mm_set1_epi32(0x7fffffff));
+	__m128i sign = _mm_and_si128(_mm_srli_epi32(b, 16), _mm_set1_epi32(0x8000));
+
+	// normal:  rebias the exponent, round to nearest-even
+	__m128i lsb = _mm_and_si128(_mm_srli_epi32(u, 13), _mm_set1_epi32(1));
+	__m128i r = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(u, _mm_set1_epi32(0xc8000fff)), lsb), 13);
+
+	// subnormal:  the FPU rounds the mantissa
+	__m128i sub = _mm_cmplt_epi32(u, _mm_set1_epi32(0x38800000));
+	__m128i rs = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(u), _mm_set1_ps(0.5f)))
+		, _mm_set1_epi32(0x3f000000));
+	r = _mm_or_si128(_mm_and_si128(sub, rs), _mm_andnot_si128(sub, r));
+
+	// overflow: Inf;  NaN: quiet NaN
+	__m128i big = _mm_cmpgt_epi32(u, _mm_set1_epi32(0x477fffff));
+	__m128i nan = _mm_cmpgt_epi32(u, _mm_set1_epi32(0x7f800000));
+	__m128i rn = _mm_or_si128(_mm_set1_epi32(0x7c00)
+		, _mm_and_si128(nan, _mm_or_si128(_mm_set1_epi32(0x200), _mm_and_si128(_mm_srli_epi32(u, 13), _mm_set1_epi32(0x3ff)))));
+	r = _mm_or_si128(_mm_and_si128(big, rn), _mm_andnot_si128(big, r));
+
+	return _mm_or_si128(r, sign);
+}
+
+/** Pack the low 16 bits of 32-bit elements */
+static inline __m128i _pcm_sse2_pack16(__m128i a, __m128i b)
+{
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+	return _mm_packs_epi32(a, b);
+}
+
+static void _pcm_sse2_f16_f32(void *out, const void *in, size_t n)
+{
+	const ushort *s = (ushort*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m128i z = _mm_setzero_si128();
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_ps(d + i, _pcm_sse2_f16_ps(_mm_unpacklo_epi16(v, z)));
+		_mm_storeu_ps(d + i + 4, _pcm_sse2_f16_ps(_mm_unpackhi_epi16(v, z)));
+	}
+	_pcm_f16_f32(d + i, s + i, n - i);
+}
+
+static void _pcm_sse2_f32_f16(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	ushort *d = (ushort*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i a = _pcm_sse2_ps_f16(_mm_loadu_ps(s + i));
+		__m128i b = _pcm_sse2_ps_f16(_mm_loadu_ps(s + i + 4));
+		_mm_storeu_si128((__m128i*)(d + i), _pcm_sse2_pack16(a, b));
+	}
+	_pcm_f32_f16(d + i, s + i, n - i);
+}
+
+static void _pcm_sse2_bf16_f32(void *out, const void *in, size_t n)
+{
+	const ushort *s = (ushort*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m128i z = _mm_setzero_si128();
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+		_mm_storeu_si128((__m128i*)(d + i), _mm_unpacklo_epi16(z, v));
+		_mm_storeu_si128((__m128i*)(d + i + 4), _mm_unpackhi_epi16(z, v));
+	}
+	_pcm_bf16_f32(d + i, s + i, n - i);
+}
+
+/** Convert 4 floats to bfloat16 (in the low 16 bits of each element) */
+static inline __m128i _pcm_sse2_ps_bf16(__m128 f)
+{
+	__m128i b = _mm_castps_si128(f);
+	__m128i lsb = _mm_and_si128(_mm_srli_epi32(b, 16), _mm_set1_epi32(1));
+	__m128i r = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(b, _mm_set1_epi32(0x7fff)), lsb), 16);
+	__m128i nan = _mm_castps_si128(_mm_cmpunord_ps(f, f));
+	__m128i rn = _mm_or_si128(_mm_srli_epi32(b, 16), _mm_set1_epi32(0x40));
+	return _mm_or_si128(_mm_and_si128(nan, rn), _mm_andnot_si128(nan, r));
+}
+
+static void _pcm_sse2_f32_bf16(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	ushort *d = (ushort*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i a = _pcm_sse2_ps_bf16(_mm_loadu_ps(s + i));
+		__m128i b = _pcm_sse2_ps_bf16(_mm_loadu_ps(s + i + 4));
+		_mm_storeu_si128((__m128i*)(d + i), _pcm_sse2_pack16(a, b));
+	}
+	_pcm_f32_bf16(d + i, s + i, n - i);
+}
+
+#endif // FF_SSE2
+
+#ifdef PCM_AVX2
+
+/* Packed int24 with PSHUFB:  16 samples (48 bytes) per iteration, no access beyond the data.
+Unpacked samples are in the high 3 bytes of 32-bit elements (i.e. sample * 0x100). */
+
+#define PCM_TARGET_SSSE3  __attribute__((target("ssse3")))
+
+static inline PCM_TARGET_SSSE3 void _pcm_ssse3_i24_unpack(const char *p, __m128i r[4])
+{
+	const __m128i m = _mm_setr_epi8(-1,0,1,2, -1,3,4,5, -1,6,7,8, -1,9,10,11);
+	__m128i a = _mm_loadu_si128((__m128i*)p)
+		, b = _mm_loadu_si128((__m128i*)(p + 16))
+		, c = _mm_loadu_si128((__m128i*)(p + 32));
+	r[0] = _mm_shuffle_epi8(a, m);
+	r[1] = _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), m);
+	r[2] = _mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), m);
+	r[3] = _mm_shuffle_epi8(_mm_srli_si128(c, 4), m);
+}
+
+/** Store the high 3 bytes of each 32-bit element */
+static inline PCM_TARGET_SSSE3 void _pcm_ssse3_i24_pack(char *p, const __m128i v[4])
+{
+	const __m128i m = _mm_setr_epi8(1,2,3, 5,6,7, 9,10,11, 13,14,15, -1,-1,-1,-1);
+	__m128i a = _mm_shuffle_epi8(v[0], m)
+		, b = _mm_shuffle_epi8(v[1], m)
+		, c = _mm_shuffle_epi8(v[2], m)
+		, d = _mm_shuffle_epi8(v[3], m);
+	_mm_storeu_si128((__m128i*)p, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+	_mm_storeu_si128((__m128i*)(p + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+	_mm_storeu_si128((__m128i*)(p + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+}
+
+static PCM_TARGET_SSSE3 void _pcm_ssse3_i24_i16(void *out, const void *in, size_t n)
+{
+	const char *s = (char*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	__m128i r[4];
+	for (;  i + 16 <= n;  i += 16) {
+		_pcm_ssse3_i24_unpack(s + i * 3, r);
+		__m128i a = _mm_packs_epi32(_mm_srai_epi32(r[0], 16), _mm_srai_epi32(r[1], 16));
+		__m128i b = _mm_packs_epi32(_mm_srai_epi32(r[2], 16), _mm_srai_epi32(r[3], 16));
+		_mm_storeu_si128((__m128i*)(d + i), a);
+		_mm_storeu_si128((__m128i*)(d + i + 8), b);
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i32_i24(s + i * 3) >> 8;
+	}
+}
+
+static PCM_TARGET_SSSE3 void _pcm_ssse3_i24_i32(void *out, const void *in, size_t n)
+{
+	const char *s = (char*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	__m128i r[4];
+	for (;  i + 16 <= n;  i += 16) {
+		_pcm_ssse3_i24_unpack(s + i * 3, r);
+		_mm_storeu_si128((__m128i*)(d + i), r[0]);
+		_mm_storeu_si128((__m128i*)(d + i + 4), r[1]);
+		_mm_storeu_si128((__m128i*)(d + i + 8), r[2]);
+		_mm_storeu_si128((__m128i*)(d + i + 12), r[3]);
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i32_i24(s + i * 3) * 0x100;
+	}
+}
+
+static PCM_TARGET_SSSE3 void _pcm_ssse3_i24_f32(void *out, const void *in, size_t n)
+{
+	const char *s = (char*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(1 / pcm_max24);
+	__m128i r[4];
+	for (;  i + 16 <= n;  i += 16) {
+		_pcm_ssse3_i24_unpack(s + i * 3, r);
+		_mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(r[0], 8)), k));
+		_mm_storeu_ps(d + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(r[1], 8)), k));
+		_mm_storeu_ps(d + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(r[2], 8)), k));
+		_mm_storeu_ps(d + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(r[3], 8)), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i24(pcm_i32_i24(s + i * 3));
+	}
+}
+
+static PCM_TARGET_SSSE3 void _pcm_ssse3_i24_i24_4(void *out, const void *in, size_t n)
+{
+	const char *s = (char*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	__m128i r[4];
+	for (;  i + 16 <= n;  i += 16) {
+		_pcm_ssse3_i24_unpack(s + i * 3, r);
+		_mm_storeu_si128((__m128i*)(d + i), r[0]);
+		_mm_storeu_si128((__m128i*)(d + i + 4), r[1]);
+		_mm_storeu_si128((__m128i*)(d + i + 8), r[2]);
+		_mm_storeu_si128((__m128i*)(d + i + 12), r[3]);
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i32_i24(s + i * 3) * 0x100;
+	}
+}
+
+static PCM_TARGET_SSSE3 void _pcm_ssse3_i16_i24(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128i z = _mm_setzero_si128();
+	__m128i r[4];
+	for (;  i + 16 <= n;  i += 16) {
+		__m128i a = _mm_loadu_si128((__m128i*)(s + i));
+		__m128i b = _mm_loadu_si128((__m128i*)(s + i + 8));
+		r[0] = _mm_unpacklo_epi16(z, a);
+		r[1] = _mm_unpackhi_epi16(z, a);
+		r[2] = _mm_unpacklo_epi16(z, b);
+		r[3] = _mm_unpackhi_epi16(z, b);
+		_pcm_ssse3_i24_pack(d + i * 3, r);
+	}
+	for (;  i != n;  i++) {
+		pcm_i24_i32(d + i * 3, (int)s[i] * 0x100);
+	}
+}
+
+static PCM_TARGET_SSSE3 void _pcm_ssse3_i32_i24(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128i rnd = _mm_set1_epi32(0xff);
+	__m128i r[4];
+	for (;  i + 16 <= n;  i += 16) {
+		// round toward zero:  the low byte is dropped
+		r[0] = _mm_loadu_si128((__m128i*)(s + i));
+		r[1] = _mm_loadu_si128((__m128i*)(s + i + 4));
+		r[2] = _mm_loadu_si128((__m128i*)(s + i + 8));
+		r[3] = _mm_loadu_si128((__m128i*)(s + i + 12));
+		r[0] = _mm_add_epi32(r[0], _mm_and_si128(_mm_srai_epi32(r[0], 31), rnd));
+		r[1] = _mm_add_epi32(r[1], _mm_and_si128(_mm_srai_epi32(r[1], 31), rnd));
+		r[2] = _mm_add_epi32(r[2], _mm_and_si128(_mm_srai_epi32(r[2], 31), rnd));
+		r[3] = _mm_add_epi32(r[3], _mm_and_si128(_mm_srai_epi32(r[3], 31), rnd));
+		_pcm_ssse3_i24_pack(d + i * 3, r);
+	}
+	for (;  i != n;  i++) {
+		pcm_i24_i32(d + i * 3, s[i] / 0x100);
+	}
+}
+
+static PCM_TARGET_SSSE3 void _pcm_ssse3_f32_i24(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	const __m128 k = _mm_set1_ps(pcm_max24)
+		, lo = _mm_set1_ps(-pcm_max24)
+		, hi = _mm_set1_ps(pcm_max24 - 1);
+	__m128i r[4];
+	for (;  i + 16 <= n;  i += 16) {
+		r[0] = _mm_slli_epi32(_pcm_sse2_ps_epi32(_mm_loadu_ps(s + i), k, lo, hi), 8);
+		r[1] = _mm_slli_epi32(_pcm_sse2_ps_epi32(_mm_loadu_ps(s + i + 4), k, lo, hi), 8);
+		r[2] = _mm_slli_epi32(_pcm_sse2_ps_epi32(_mm_loadu_ps(s + i + 8), k, lo, hi), 8);
+		r[3] = _mm_slli_epi32(_pcm_sse2_ps_epi32(_mm_loadu_ps(s + i + 12), k, lo, hi), 8);
+		_pcm_ssse3_i24_pack(d + i * 3, r);
+	}
+	for (;  i != n;  i++) {
+		pcm_i24_i32(d + i * 3, pcm_i24_flt(s[i]));
+	}
+}
+
+static PCM_TARGET_SSSE3 void _pcm_ssse3_i24_4_i24(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	char *d = (char*)out;
+	size_t i = 0;
+	__m128i r[4];
+	for (;  i + 16 <= n;  i += 16) {
+		r[0] = _mm_loadu_si128((__m128i*)(s + i));
+		r[1] = _mm_loadu_si128((__m128i*)(s + i + 4));
+		r[2] = _mm_loadu_si128((__m128i*)(s + i + 8));
+		r[3] = _mm_loadu_si128((__m128i*)(s + i + 12));
+		_pcm_ssse3_i24_pack(d + i * 3, r);
+	}
+	for (;  i != n;  i++) {
+		pcm_i24_i32(d + i * 3, s[i] >> 8);
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_i16_i32(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)(s + i)));
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_slli_epi32(v, 16));
+	}
+	for (;  i != n;  i++) {
+		d[i] = (int)s[i] * 0x10000;
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_i16_f32(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m256 k = _mm256_set1_ps(1 / pcm_max16);
+	for (;  i + 8 <= n;  i += 8) {
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)(s + i)));
+		_mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i16(s[i]);
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_i32_i16(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	const __m256i rnd = _mm256_set1_epi32(0xffff);
+	for (;  i + 16 <= n;  i += 16) {
+		__m256i a = _mm256_loadu_si256((__m256i*)(s + i));
+		__m256i b = _mm256_loadu_si256((__m256i*)(s + i + 8));
+		a = _mm256_srai_epi32(_mm256_add_epi32(a, _mm256_and_si256(_mm256_srai_epi32(a, 31), rnd)), 16);
+		b = _mm256_srai_epi32(_mm256_add_epi32(b, _mm256_and_si256(_mm256_srai_epi32(b, 31), rnd)), 16);
+		__m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+		_mm256_storeu_si256((__m256i*)(d + i), r);
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i] / 0x10000;
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_i32_f32(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m256 k = _mm256_set1_ps(1 / pcm_max32);
+	for (;  i + 8 <= n;  i += 8) {
+		__m256i v = _mm256_loadu_si256((__m256i*)(s + i));
+		_mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i32(s[i]);
+	}
+}
+
+static inline PCM_TARGET_AVX2 __m256i _pcm_avx2_ps_epi32(__m256 f, __m256 k, __m256 lo, __m256 hi)
+{
+	f = _mm256_mul_ps(f, k);
+	f = _mm256_and_ps(f, _mm256_cmp_ps(f, f, _CMP_ORD_Q));
+	f = _mm256_min_ps(_mm256_max_ps(f, lo), hi);
+	return _mm256_cvtps_epi32(f);
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_f32_i16(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	short *d = (short*)out;
+	size_t i = 0;
+	const __m256 k = _mm256_set1_ps(pcm_max16)
+		, lo = _mm256_set1_ps(-pcm_max16)
+		, hi = _mm256_set1_ps(pcm_max16 - 1);
+	for (;  i + 16 <= n;  i += 16) {
+		__m256i a = _pcm_avx2_ps_epi32(_mm256_loadu_ps(s + i), k, lo, hi);
+		__m256i b = _pcm_avx2_ps_epi32(_mm256_loadu_ps(s + i + 8), k, lo, hi);
+		__m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+		_mm256_storeu_si256((__m256i*)(d + i), r);
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i16_flt(s[i]);
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_f32_i32(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m256 k = _mm256_set1_ps(pcm_max32);
+	for (;  i + 8 <= n;  i += 8) {
+		__m256 f = _mm256_mul_ps(_mm256_loadu_ps(s + i), k);
+		__m256i r = _mm256_cvtps_epi32(f);
+		r = _mm256_xor_si256(r, _mm256_castps_si256(_mm256_cmp_ps(f, k, _CMP_GE_OQ)));
+		_mm256_storeu_si256((__m256i*)(d + i), r);
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i32_flt(s[i]);
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_f32_f64(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	double *d = (double*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		_mm256_storeu_pd(d + i, _mm256_cvtps_pd(_mm_loadu_ps(s + i)));
+		_mm256_storeu_pd(d + i + 4, _mm256_cvtps_pd(_mm_loadu_ps(s + i + 4)));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i];
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_f64_f32(void *out, const void *in, size_t n)
+{
+	const double *s = (double*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		_mm_storeu_ps(d + i, _mm256_cvtpd_ps(_mm256_loadu_pd(s + i)));
+		_mm_storeu_ps(d + i + 4, _mm256_cvtpd_ps(_mm256_loadu_pd(s + i + 4)));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i];
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_i24_4_i32(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m256i m = _mm256_set1_epi32(~0xff);
+	for (;  i + 8 <= n;  i += 8) {
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_and_si256(_mm256_loadu_si256((__m256i*)(s + i)), m));
+	}
+	for (;  i != n;  i++) {
+		d[i] = s[i] & ~0xff;
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_i24_4_f32(void *out, const void *in, size_t n)
+{
+	const int *s = (int*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	const __m256 k = _mm256_set1_ps(1 / pcm_max24);
+	for (;  i + 8 <= n;  i += 8) {
+		__m256i v = _mm256_srai_epi32(_mm256_loadu_si256((__m256i*)(s + i)), 8);
+		_mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_flt_i24(s[i] >> 8);
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_i16_i24_4(void *out, const void *in, size_t n)
+{
+	const short *s = (short*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)(s + i)));
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_slli_epi32(v, 16));
+	}
+	for (;  i != n;  i++) {
+		d[i] = (int)s[i] * 0x10000;
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_f32_i24_4(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	int *d = (int*)out;
+	size_t i = 0;
+	const __m256 k = _mm256_set1_ps(pcm_max24)
+		, lo = _mm256_set1_ps(-pcm_max24)
+		, hi = _mm256_set1_ps(pcm_max24 - 1);
+	for (;  i + 8 <= n;  i += 8) {
+		__m256i v = _pcm_avx2_ps_epi32(_mm256_loadu_ps(s + i), k, lo, hi);
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_slli_epi32(v, 8));
+	}
+	for (;  i != n;  i++) {
+		d[i] = pcm_i24_flt(s[i]) * 0x100;
+	}
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_bf16_f32(void *out, const void *in, size_t n)
+{
+	const ushort *s = (ushort*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)(s + i)));
+		_mm256_storeu_si256((__m256i*)(d + i), _mm256_slli_epi32(v, 16));
+	}
+	_pcm_bf16_f32(d + i, s + i, n - i);
+}
+
+static PCM_TARGET_AVX2 void _pcm_avx2_f32_bf16(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	ushort *d = (ushort*)out;
+	size_t i = 0;
+	const __m256i one = _mm256_set1_epi32(1)
+		, rnd = _mm256_set1_epi32(0x7fff)
+		, quiet = _mm256_set1_epi32(0x40);
+	for (;  i + 16 <= n;  i += 16) {
+		__m256i r[2];
+		for (uint j = 0;  j != 2;  j++) {
+			__m256 f = _mm256_loadu_ps(s + i + j * 8);
+			__m256i b = _mm256_castps_si256(f);
+			__m256i lsb = _mm256_and_si256(_mm256_srli_epi32(b, 16), one);
+			__m256i v = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(b, rnd), lsb), 16);
+			__m256i nan = _mm256_castps_si256(_mm256_cmp_ps(f, f, _CMP_UNORD_Q));
+			r[j] = _mm256_blendv_epi8(v, _mm256_or_si256(_mm256_srli_epi32(b, 16), quiet), nan);
+		}
+		__m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi32(r[0], r[1]), 0xd8);
+		_mm256_storeu_si256((__m256i*)(d + i), v);
+	}
+	_pcm_f32_bf16(d + i, s + i, n - i);
+}
+
+#define PCM_TARGET_F16C  __attribute__((target("avx,f16c")))
+
+static PCM_TARGET_F16C void _pcm_f16c_f16_f32(void *out, const void *in, size_t n)
+{
+	const ushort *s = (ushort*)in;
+	float *d = (float*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		_mm256_storeu_ps(d + i, _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)(s + i))));
+	}
+	_pcm_f16_f32(d + i, s + i, n - i);
+}
+
+static PCM_TARGET_F16C void _pcm_f16c_f32_f16(void *out, const void *in, size_t n)
+{
+	const float *s = (float*)in;
+	ushort *d = (ushort*)out;
+	size_t i = 0;
+	for (;  i + 8 <= n;  i += 8) {
+		__m128i v = _mm256_cvtps_ph(_mm256_loadu_ps(s + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*)(d + i), v);
+	}
+	_pcm_f32_f16(d + i, s + i, n - i);
+}
+
+#endif // PCM_AVX2
+
+#ifdef FF_SSE2
+
+// SSSE3 kernels are built with the AVX2 ones (function target attributes)
+#ifdef PCM_AVX2
+	#define _PCM_AVX2_K(name)  name
+#else
+	#define _PCM_AVX2_K(name)  NULL
+#endif
+
+struct _pcm_conv_kernel {
+	ushort ifmt, ofmt;
+	pcm_conv_func sse2, ssse3, avx2;
+};
+
+static const struct _pcm_conv_kernel _pcm_conv_kernels[] = {
+	{ FFAUDIO_F_INT16, FFAUDIO_F_INT24, _pcm_sse2_i16_i24, _PCM_AVX2_K(_pcm_ssse3_i16_i24), NULL },
+	{ FFAUDIO_F_INT16, FFAUDIO_F_INT24_4, _pcm_sse2_i16_i24_4, NULL, _PCM_AVX2_K(_pcm_avx2_i16_i24_4) },
+	{ FFAUDIO_F_INT16, FFAUDIO_F_INT32, _pcm_sse2_i16_i32, NULL, _PCM_AVX2_K(_pcm_avx2_i16_i32) },
+	{ FFAUDIO_F_INT16, FFAUDIO_F_FLOAT32, _pcm_sse2_i16_f32, NULL, _PCM_AVX2_K(_pcm_avx2_i16_f32) },
+	{ FFAUDIO_F_INT16, FFAUDIO_F_FLOAT64, _pcm_sse2_i16_f64, NULL, NULL },
+
+	{ FFAUDIO_F_INT24, FFAUDIO_F_INT16, _pcm_sse2_i24_i16, _PCM_AVX2_K(_pcm_ssse3_i24_i16), NULL },
+	{ FFAUDIO_F_INT24, FFAUDIO_F_INT24_4, NULL, _PCM_AVX2_K(_pcm_ssse3_i24_i24_4), NULL },
+	{ FFAUDIO_F_INT24, FFAUDIO_F_INT32, _pcm_sse2_i24_i32, _PCM_AVX2_K(_pcm_ssse3_i24_i32), NULL },
+	{ FFAUDIO_F_INT24, FFAUDIO_F_FLOAT32, _pcm_sse2_i24_f32, _PCM_AVX2_K(_pcm_ssse3_i24_f32), NULL },
+	{ FFAUDIO_F_INT24, FFAUDIO_F_FLOAT64, _pcm_sse2_i24_f64, NULL, NULL },
+
+	{ FFAUDIO_F_INT24_4, FFAUDIO_F_INT16, _pcm_sse2_i24_4_i16, NULL, NULL },
+	{ FFAUDIO_F_INT24_4, FFAUDIO_F_INT24, NULL, _PCM_AVX2_K(_pcm_ssse3_i24_4_i24), NULL },
+	{ FFAUDIO_F_INT24_4, FFAUDIO_F_INT32, _pcm_sse2_i24_4_i32, NULL, _PCM_AVX2_K(_pcm_avx2_i24_4_i32) },
+	{ FFAUDIO_F_INT24_4, FFAUDIO_F_FLOAT32, _pcm_sse2_i24_4_f32, NULL, _PCM_AVX2_K(_pcm_avx2_i24_4_f32) },
+	{ FFAUDIO_F_INT24_4, FFAUDIO_F_FLOAT64, _pcm_sse2_i24_4_f64, NULL, NULL },
+
+	{ FFAUDIO_F_INT32, FFAUDIO_F_INT16, _pcm_sse2_i32_i16, NULL, _PCM_AVX2_K(_pcm_avx2_i32_i16) },
+	{ FFAUDIO_F_INT32, FFAUDIO_F_INT24, _pcm_sse2_i32_i24, _PCM_AVX2_K(_pcm_ssse3_i32_i24), NULL },
+	{ FFAUDIO_F_INT32, FFAUDIO_F_INT24_4, _pcm_sse2_i32_i24_4, NULL, NULL },
+	{ FFAUDIO_F_INT32, FFAUDIO_F_FLOAT32, _pcm_sse2_i32_f32, NULL, _PCM_AVX2_K(_pcm_avx2_i32_f32) },
+	{ FFAUDIO_F_INT32, FFAUDIO_F_FLOAT64, _pcm_sse2_i32_f64, NULL, NULL },
+
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_INT16, _pcm_sse2_f32_i16, NULL, _PCM_AVX2_K(_pcm_avx2_f32_i16) },
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_INT24, _pcm_sse2_f32_i24, _PCM_AVX2_K(_pcm_ssse3_f32_i24), NULL },
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_INT24_4, _pcm_sse2_f32_i24_4, NULL, _PCM_AVX2_K(_pcm_avx2_f32_i24_4) },
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_INT32, _pcm_sse2_f32_i32, NULL, _PCM_AVX2_K(_pcm_avx2_f32_i32) },
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_FLOAT64, _pcm_sse2_f32_f64, NULL, _PCM_AVX2_K(_pcm_avx2_f32_f64) },
+
+	{ FFAUDIO_F_FLOAT64, FFAUDIO_F_INT16, _pcm_sse2_f64_i16, NULL, NULL },
+	{ FFAUDIO_F_FLOAT64, FFAUDIO_F_INT24, _pcm_sse2_f64_i24, NULL, NULL },
+	{ FFAUDIO_F_FLOAT64, FFAUDIO_F_INT24_4, _pcm_sse2_f64_i24_4, NULL, NULL },
+	{ FFAUDIO_F_FLOAT64, FFAUDIO_F_INT32, _pcm_sse2_f64_i32, NULL, NULL },
+	{ FFAUDIO_F_FLOAT64, FFAUDIO_F_FLOAT32, _pcm_sse2_f64_f32, NULL, _PCM_AVX2_K(_pcm_avx2_f64_f32) },
+
+	// F16C kernels are selected by pcm_conv_find()
+	{ FFAUDIO_F_FLOAT16, FFAUDIO_F_FLOAT32, _pcm_sse2_f16_f32, NULL, NULL },
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_FLOAT16, _pcm_sse2_f32_f16, NULL, NULL },
+	{ FFAUDIO_F_BFLOAT16, FFAUDIO_F_FLOAT32, _pcm_sse2_bf16_f32, NULL, _PCM_AVX2_K(_pcm_avx2_bf16_f32) },
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_BFLOAT16, _pcm_sse2_f32_bf16, NULL, _PCM_AVX2_K(_pcm_avx2_f32_bf16) },
+};
+
+#undef _PCM_AVX2_K
+
+#endif // FF_SSE2
+
+/** Get the fastest conversion kernel for the format pair supported by CPU.
+Return NULL if there's no vectorized kernel: use the scalar code. */
+static inline pcm_conv_func pcm_conv_find(uint ifmt, uint ofmt)
+{
+#ifdef FF_SSE2
+	uint cpu = pcm_cpu_features();
+	if (!(cpu & PCM_CPU_SSE2))
+		return NULL;
+
+#ifdef PCM_AVX2
+	if (cpu & PCM_CPU_F16C) {
+		if (ifmt == FFAUDIO_F_FLOAT16 && ofmt == FFAUDIO_F_FLOAT32)
+			return _pcm_f16c_f16_f32;
+		if (ifmt == FFAUDIO_F_FLOAT32 && ofmt == FFAUDIO_F_FLOAT16)
+			return _pcm_f16c_f32_f16;
+	}
+#endif
+
+	for (uint i = 0;  i != FF_COUNT(_pcm_conv_kernels);  i++) {
+		const struct _pcm_conv_kernel *k = &_pcm_conv_kernels[i];
+		if (k->ifmt == ifmt && k->ofmt == ofmt) {
+			if ((cpu & PCM_CPU_AVX2) && k->avx2 != NULL)
+				return k->avx2;
+			if ((cpu & PCM_CPU_SSSE3) && k->ssse3 != NULL)
+				return k->ssse3;
+			return k->sse2;
+		}
+	}
+#endif
+	return NULL;
+}
+
+/** Get the kernel for float16/bfloat16 <-> float32 conversion:  vectorized or scalar.
+Return NULL if the format pair isn't one of these. */
+static inline pcm_conv_func _pcm_conv_half(uint ifmt, uint ofmt)
+{
+	pcm_conv_func f;
+	if (NULL != (f = pcm_conv_find(ifmt, ofmt)))
+		return f;
+
+	if (ofmt == FFAUDIO_F_FLOAT32) {
+		if (ifmt == FFAUDIO_F_FLOAT16)
+			return _pcm_f16_f32;
+		if (ifmt == FFAUDIO_F_BFLOAT16)
+			return _pcm_bf16_f32;
+	} else if (ifmt == FFAUDIO_F_FLOAT32) {
+		if (ofmt == FFAUDIO_F_FLOAT16)
+			return _pcm_f32_f16;
+		if (ofmt == FFAUDIO_F_BFLOAT16)
+			return _pcm_f32_bf16;
+	}
+	return NULL;
+}
+
+/* Interleave/deinterleave.
+2, 4 and 8 channels of 1, 2, 4 and 8-byte samples are transposed in SSE2 registers.
+Other layouts (incl. packed int24) are copied in blocks of frames small enough to stay in L1,
+ so that both the interleaved and the non-interleaved side are accessed sequentially. */
+
+#define _PCM_ILV_BLOCK  64 // frames
+
+/** Copy samples of 1 channel with interval 'istep' -> 'ostep' (in samples) */
+static inline void _pcm_ilv_copy(char *d, uint ostep, const char *s, uint istep, uint width, size_t n)
+{
+	size_t i;
+	switch (width) {
+	case 1:
+		for (i = 0;  i != n;  i++) {
+			d[i * ostep] = s[i * istep];
+		}
+		break;
+	case 2:
+		for (i = 0;  i != n;  i++) {
+			memcpy(d + i * ostep * 2, s + i * istep * 2, 2);
+		}
+		break;
+	case 3:
+		for (i = 0;  i != n;  i++) {
+			memcpy(d + i * ostep * 3, s + i * istep * 3, 3);
+		}
+		break;
+	case 4:
+		for (i = 0;  i != n;  i++) {
+			memcpy(d + i * ostep * 4, s + i * istep * 4, 4);
+		}
+		break;
+	case 8:
+		for (i = 0;  i != n;  i++) {
+			memcpy(d + i * ostep * 8, s + i * istep * 8, 8);
+		}
+		break;
+	}
+}
+
+#ifdef FF_SSE2
+
+/** Transpose 4x4 matrix of 32-bit elements */
+static inline void _pcm_sse2_tr4x4_32(__m128i r[4])
+{
+	__m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+	__m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+	__m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+	__m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
+	r[0] = _mm_unpacklo_epi64(t0, t1);
+	r[1] = _mm_unpackhi_epi64(t0, t1);
+	r[2] = _mm_unpacklo_epi64(t2, t3);
+	r[3] = _mm_unpackhi_epi64(t2, t3);
+}
+
+/** Transpose 8x8 matrix of 16-bit elements */
+static inline void _pcm_sse2_tr8x8_16(__m128i r[8])
+{
+	__m128i a[8], b[8];
+	for (uint i = 0;  i != 4;  i++) {
+		a[i] = _mm_unpacklo_epi16(r[i * 2], r[i * 2 + 1]);
+		a[i + 4] = _mm_unpackhi_epi16(r[i * 2], r[i * 2 + 1]);
+	}
+	for (uint i = 0;  i != 2;  i++) {
+		b[i * 4 + 0] = _mm_unpacklo_epi32(a[i * 4 + 0], a[i * 4 + 1]);
+		b[i * 4 + 1] = _mm_unpackhi_epi32(a[i * 4 + 0], a[i * 4 + 1]);
+		b[i * 4 + 2] = _mm_unpacklo_epi32(a[i * 4 + 2], a[i * 4 + 3]);
+		b[i * 4 + 3] = _mm_unpackhi_epi32(a[i * 4 + 2], a[i * 4 + 3]);
+	}
+	r[0] = _mm_unpacklo_epi64(b[0], b[2]);
+	r[1] = _mm_unpackhi_epi64(b[0], b[2]);
+	r[2] = _mm_unpacklo_epi64(b[1], b[3]);
+	r[3] = _mm_unpackhi_epi64(b[1], b[3]);
+	r[4] = _mm_unpacklo_epi64(b[4], b[6]);
+	r[5] = _mm_unpackhi_epi64(b[4], b[6]);
+	r[6] = _mm_unpacklo_epi64(b[5], b[7]);
+	r[7] = _mm_unpackhi_epi64(b[5], b[7]);
+}
+
+/** Interleave the first frames with SSE2
+Return the number of frames processed */
+static inline size_t _pcm_sse2_interleave(char *d, const char *const *in, uint width, uint nch, size_t n)
+{
+	size_t i = 0;
+	__m128i r[8];
+
+	switch (nch * 16 + width) {
+	case 2 * 16 + 1:
+		for (;  i + 16 <= n;  i += 16) {
+			__m128i a = _mm_loadu_si128((__m128i*)(in[0] + i)), b = _mm_loadu_si128((__m128i*)(in[1] + i));
+			_mm_storeu_si128((__m128i*)(d + i * 2), _mm_unpacklo_epi8(a, b));
+			_mm_storeu_si128((__m128i*)(d + i * 2 + 16), _mm_unpackhi_epi8(a, b));
+		}
+		break;
+
+	case 2 * 16 + 2:
+		for (;  i + 8 <= n;  i += 8) {
+			__m128i a = _mm_loadu_si128((__m128i*)(in[0] + i * 2)), b = _mm_loadu_si128((__m128i*)(in[1] + i * 2));
+			_mm_storeu_si128((__m128i*)(d + i * 4), _mm_unpacklo_epi16(a, b));
+			_mm_storeu_si128((__m128i*)(d + i * 4 + 16), _mm_unpackhi_epi16(a, b));
+		}
+		break;
+
+	case 2 * 16 + 4:
+		for (;  i + 4 <= n;  i += 4) {
+			__m128i a = _mm_loadu_si128((__m128i*)(in[0] + i * 4)), b = _mm_loadu_si128((__m128i*)(in[1] + i * 4));
+			_mm_storeu_si128((__m128i*)(d + i * 8), _mm_unpacklo_epi32(a, b));
+			_mm_storeu_si128((__m128i*)(d + i * 8 + 16), _mm_unpackhi_epi32(a, b));
+		}
+		break;
+
+	case 2 * 16 + 8:
+		for (;  i + 2 <= n;  i += 2) {
+			__m128i a = _mm_loadu_si128((__m128i*)(in[0] + i * 8)), b = _mm_loadu_si128((__m128i*)(in[1] + i * 8));
+			_mm_storeu_si128((__m128i*)(d + i * 16), _mm_unpacklo_epi64(a, b));
+			_mm_storeu_si128((__m128i*)(d + i * 16 + 16), _mm_unpackhi_epi64(a, b));
+		}
+		break;
+
+	case 4 * 16 + 4:
+		for (;  i + 4 <= n;  i += 4) {
+			for (uint c = 0;  c != 4;  c++) {
+				r[c] = _mm_loadu_si128((__m128i*)(in[c] + i * 4));
+			}
+			_pcm_sse2_tr4x4_32(r);
+			for (uint k = 0;  k != 4;  k++) {
+				_mm_storeu_si128((__m128i*)(d + (i + k) * 16), r[k]);
+			}
+		}
+		break;
+
+	case 8 * 16 + 2:
+		for (;  i + 8 <= n;  i += 8) {
+			for (uint c = 0;  c != 8;  c++) {
+				r[c] = _mm_loadu_si128((__m128i*)(in[c] + i * 2));
+			}
+			_pcm_sse2_tr8x8_16(r);
+			for (uint k = 0;  k != 8;  k++) {
+				_mm_storeu_si128((__m128i*)(d + (i + k) * 16), r[k]);
+			}
+		}
+		break;
+
+	case 8 * 16 + 4:
+		for (;  i + 4 <= n;  i += 4) {
+			for (uint h = 0;  h != 2;  h++) {
+				for (uint c = 0;  c != 4;  c++) {
+					r[c] = _mm_loadu_si128((__m128i*)(in[h * 4 + c] + i * 4));
+				}
+				_pcm_sse2_tr4x4_32(r);
+				for (uint k = 0;  k != 4;  k++) {
+					_mm_storeu_si128((__m128i*)(d + (i + k) * 32 + h * 16), r[k]);
+				}
+			}
+		}
+		break;
+	}
+
+	return i;
+}
+
+/** Deinterleave the first frames with SSE2
+Return the number of frames processed */
+static inline size_t _pcm_sse2_deinterleave(char **out, const char *s, uint width, uint nch, size_t n)
+{
+	size_t i = 0;
+	__m128i r[8];
+
+	switch (nch * 16 + width) {
+	case 2 * 16 + 1: {
+		const __m128i lo = _mm_set1_epi16(0xff);
+		for (;  i + 16 <= n;  i += 16) {
+			__m128i a = _mm_loadu_si128((__m128i*)(s + i * 2)), b = _mm_loadu_si128((__m128i*)(s + i * 2 + 16));
+			_mm_storeu_si128((__m128i*)(out[0] + i), _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo)));
+			_mm_storeu_si128((__m128i*)(out[1] + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+		}
+		break;
+	}
+
+	case 2 * 16 + 2:
+		for (;  i + 8 <= n;  i += 8) {
+			__m128i a = _mm_loadu_si128((__m128i*)(s + i * 4)), b = _mm_loadu_si128((__m128i*)(s + i * 4 + 16));
+			// sign-extended 16-bit values are packed back without saturation
+			__m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+			__m128i h = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+			_mm_storeu_si128((__m128i*)(out[0] + i * 2), l);
+			_mm_storeu_si128((__m128i*)(out[1] + i * 2), h);
+		}
+		break;
+
+	case 2 * 16 + 4:
+		for (;  i + 4 <= n;  i += 4) {
+			__m128 a = _mm_loadu_ps((float*)(s + i * 8)), b = _mm_loadu_ps((float*)(s + i * 8 + 16));
+			_mm_storeu_ps((float*)(out[0] + i * 4), _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+			_mm_storeu_ps((float*)(out[1] + i * 4), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		}
+		break;
+
+	case 2 * 16 + 8:
+		for (;  i + 2 <= n;  i += 2) {
+			__m128i a = _mm_loadu_si128((__m128i*)(s + i * 16)), b = _mm_loadu_si128((__m128i*)(s + i * 16 + 16));
+			_mm_storeu_si128((__m128i*)(out[0] + i * 8), _mm_unpacklo_epi64(a, b));
+			_mm_storeu_si128((__m128i*)(out[1] + i * 8), _mm_unpackhi_epi64(a, b));
+		}
+		break;
+
+	case 4 * 16 + 4:
+		for (;  i + 4 <= n;  i += 4) {
+			for (uint k = 0;  k != 4;  k++) {
+				r[k] = _mm_loadu_si128((__m128i*)(s + (i + k) * 16));
+			}
+			_pcm_sse2_tr4x4_32(r);
+			for (uint c = 0;  c != 4;  c++) {
+				_mm_storeu_si128((__m128i*)(out[c] + i * 4), r[c]);
+			}
+		}
+		break;
+
+	case 8 * 16 + 2:
+		for (;  i + 8 <= n;  i += 8) {
+			for (uint k = 0;  k != 8;  k++) {
+				r[k] = _mm_loadu_si128((__m128i*)(s + (i + k) * 16));
+			}
+			_pcm_sse2_tr8x8_16(r);
+			for (uint c = 0;  c != 8;  c++) {
+				_mm_storeu_si128((__m128i*)(out[c] + i * 2), r[c]);
+			}
+		}
+		break;
+
+	case 8 * 16 + 4:
+		for (;  i + 4 <= n;  i += 4) {
+			for (uint h = 0;  h != 2;  h++) {
+				for (uint k = 0;  k != 4;  k++) {
+					r[k] = _mm_loadu_si128((__m128i*)(s + (i + k) * 32 + h * 16));
+				}
+				_pcm_sse2_tr4x4_32(r);
+				for (uint c = 0;  c != 4;  c++) {
+					_mm_storeu_si128((__m128i*)(out[h * 4 + c] + i * 4), r[c]);
+				}
+			}
+		}
+		break;
+	}
+
+	return i;
+}
+
+#endif // FF_SSE2
+
+/** Interleave samples:  out[i * nch + c] = in[c][i]
+width: bytes per sample: 1, 2, 3, 4, 8 */
+static inline void pcm_interleave(void *out, const void *const *in, uint width, uint nch, size_t frames)
+{
+	const char *const *src = (const char *const *)in;
+	char *d = (char*)out;
+	size_t off = 0, n;
+
+#ifdef FF_SSE2
+	if (pcm_cpu_features() & PCM_CPU_SSE2)
+		off = _pcm_sse2_interleave(d, src, width, nch, frames);
+#endif
+
+	for (;  off != frames;  off += n) {
+		n = ffmin(frames - off, _PCM_ILV_BLOCK);
+		for (uint c = 0;  c != nch;  c++) {
+			_pcm_ilv_copy(d + (off * nch + c) * width, nch, src[c] + off * width, 1, width, n);
+		}
+	}
+}
+
+/** Deinterleave samples:  out[c][i] = in[i * nch + c]
+width: bytes per sample: 1, 2, 3, 4, 8 */
+static inline void pcm_deinterleave(void *const *out, const void *in, uint width, uint nch, size_t frames)
+{
+	char *const *dst = (char *const *)out;
+	const char *s = (char*)in;
+	size_t off = 0, n;
+
+#ifdef FF_SSE2
+	if (pcm_cpu_features() & PCM_CPU_SSE2)
+		off = _pcm_sse2_deinterleave((char**)dst, s, width, nch, frames);
+#endif
+
+	for (;  off != frames;  off += n) {
+		n = ffmin(frames - off, _PCM_ILV_BLOCK);
+		for (uint c = 0;  c != nch;  c++) {
+			_pcm_ilv_copy(dst[c] + off * width, 1, s + (off * nch + c) * width, nch, width, n);
+		}
+	}
+}
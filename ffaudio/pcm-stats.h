@@ -0,0 +1,643 @@
+/** ffaudio: per-channel signal level statistics.
+2026, Simon Zolin */
+
+/*
+pcm_stats_reset pcm_stats_update
+pcm_stats_rms
+*/
+
+/* Statistics are collected on normalized values (1.0: full scale).
+pcm_convert_plan_run(), pcm_convert_plan_process() and pcm_gain_process() update the statistics
+ if 'stats' pointer is set.
+int16 and float32 (SSE2):
+ plain conversion between these formats, copying and gain are performed by fused kernels:
+ each sample is measured in the register it was converted in (or multiplied in).
+Other formats and paths (mixing, channel selection, resampling, interleaving):
+ the data is processed block by block, and each block is measured in a separate pass while it's in L1 cache.
+Interleaved data: the accumulators cover lcm(channels, 4) samples (lcm(channels, 8) for AVX2 kernels),
+ so each vector lane always maps to the same channel. */
+
+#pragma once
+#include <ffaudio/audio.h>
+#include <ffaudio/pcm.h>
+#include <ffaudio/pcm-simd.h>
+#include <math.h>
+
+struct pcm_stats {
+	uint channels;
+	ffuint64 frames;
+	float peak[PCM_CHAN_MAX]; // maximum absolute value
+	double sum2[PCM_CHAN_MAX]; // sum of squares
+	ffuint64 clip[PCM_CHAN_MAX]; // samples at full scale (integer) or >= 1.0 (float)
+	ffuint64 nonfinite[PCM_CHAN_MAX]; // NaN and Inf samples;  they aren't included in 'peak' and 'sum2'
+};
+
+static inline void pcm_stats_reset(struct pcm_stats *st)
+{
+	ffmem_zero(st, sizeof(*st));
+}
+
+/** Get RMS level of a channel */
+static inline double pcm_stats_rms(const struct pcm_stats *st, uint ch)
+{
+	if (st->frames == 0)
+		return 0;
+	return sqrt(st->sum2[ch] / st->frames);
+}
+
+#define _PCM_STATS_PERIOD_MAX  (PCM_CHAN_MAX * 4) // AVX2 kernels are used if lcm(channels, 8) fits
+#define _PCM_STATS_BLOCK  2048 // samples accumulated in single precision (the block stays in L1)
+
+/** Accumulators for each sample position within a period */
+struct _pcm_stats_acc {
+	uint period;
+	float peak[_PCM_STATS_PERIOD_MAX];
+	float sum2[_PCM_STATS_PERIOD_MAX];
+	int clip[_PCM_STATS_PERIOD_MAX];
+	int nonfinite[_PCM_STATS_PERIOD_MAX];
+};
+
+/** Get normalized sample value */
+static inline float _pcm_stats_load(uint format, const void *data, size_t i)
+{
+	switch (format) {
+	case FFAUDIO_F_INT8:
+		return ((char*)data)[i] * (float)(1 / pcm_max8);
+	case FFAUDIO_F_INT16:
+		return ((short*)data)[i] * (float)(1 / pcm_max16);
+	case FFAUDIO_F_INT24:
+		return pcm_i32_i24((char*)data + i * 3) * (float)(1 / pcm_max24);
+	case FFAUDIO_F_INT24_4:
+		return (((int*)data)[i] >> 8) * (float)(1 / pcm_max24);
+	case FFAUDIO_F_INT32:
+		return ((int*)data)[i] * (float)(1 / pcm_max32);
+	case FFAUDIO_F_FLOAT32:
+		return ((float*)data)[i];
+	case FFAUDIO_F_FLOAT64:
+		return ((double*)data)[i];
+	case FFAUDIO_F_FLOAT16:
+		return pcm_flt_f16(((ushort*)data)[i]);
+	case FFAUDIO_F_BFLOAT16:
+		return pcm_flt_bf16(((ushort*)data)[i]);
+	}
+	return 0;
+}
+
+/** Get the level at which a sample is considered clipped */
+static inline float _pcm_stats_clip(uint format)
+{
+	switch (format) {
+	case FFAUDIO_F_INT8:
+		return (pcm_max8 - 1) / pcm_max8;
+	case FFAUDIO_F_INT16:
+		return (pcm_max16 - 1) / pcm_max16;
+	case FFAUDIO_F_INT24:
+	case FFAUDIO_F_INT24_4:
+		return (pcm_max24 - 1) / pcm_max24;
+	case FFAUDIO_F_INT32:
+		return 1; // (2^31 - 1) / 2^31 is 1.0 in single precision
+	case FFAUDIO_F_FLOAT32:
+	case FFAUDIO_F_FLOAT64:
+	case FFAUDIO_F_FLOAT16:
+	case FFAUDIO_F_BFLOAT16:
+		return 1;
+	}
+	return 0;
+}
+
+static inline void _pcm_stats_add(struct _pcm_stats_acc *a, uint j, float x, float clip)
+{
+	if (x - x != 0) {
+		a->nonfinite[j]++;
+		return;
+	}
+	float ax = fabsf(x);
+	a->peak[j] = ffmax(a->peak[j], ax);
+	a->sum2[j] += x * x;
+	a->clip[j] += (ax >= clip);
+}
+
+/** Measure complete periods of samples
+Return the number of samples processed */
+typedef size_t (*_pcm_stats_func)(struct _pcm_stats_acc *a, const void *data, size_t n, float clip);
+
+/** Process complete periods of samples and measure the result (or the input) in the same pass
+g: per-sample parameters (e.g. gain);  NULL: not used
+ctx: kernel's constant parameters
+Return the number of samples processed */
+typedef size_t (*_pcm_stats_fused_func)(struct _pcm_stats_acc *a, void *out, const void *in, const float *g, size_t n, float clip, const void *ctx);
+
+/** Get the number of samples covered by the accumulators
+lanes: samples per vector */
+static inline uint _pcm_stats_period(uint nch, uint lanes)
+{
+	uint P = nch;
+	while (P % lanes != 0) {
+		P += nch;
+	}
+	return P;
+}
+
+static inline void _pcm_stats_acc_zero(struct _pcm_stats_acc *a)
+{
+	uint P = a->period;
+	ffmem_zero(a->peak, P * sizeof(a->peak[0]));
+	ffmem_zero(a->sum2, P * sizeof(a->sum2[0]));
+	ffmem_zero(a->clip, P * sizeof(a->clip[0]));
+	ffmem_zero(a->nonfinite, P * sizeof(a->nonfinite[0]));
+}
+
+/** Add the accumulators to the statistics of 'nch' interleaved channels starting with channel 'ch0' */
+static inline void _pcm_stats_acc_merge(struct pcm_stats *st, const struct _pcm_stats_acc *a, uint nch, uint ch0)
+{
+	for (uint j = 0;  j != a->period;  j++) {
+		uint c = ch0 + j % nch;
+		st->peak[c] = ffmax(st->peak[c], a->peak[j]);
+		st->sum2[c] += a->sum2[j];
+		st->clip[c] += a->clip[j];
+		st->nonfinite[c] += a->nonfinite[j];
+	}
+}
+
+#ifdef FF_SSE2
+
+/* The accumulators are kept in registers:
+ the block is processed column by column (4 samples of each period), 2 rows at once.
+NaN and Inf are rare:  the fast path doesn't filter them,
+ and if the sum of squares becomes non-finite, the column is measured again with filtering. */
+
+struct _pcm_sse2_stats_reg {
+	__m128 peak, sum2;
+	__m128i clip, nonfinite;
+};
+
+static inline void _pcm_sse2_stats_zero(struct _pcm_sse2_stats_reg *r)
+{
+	r->peak = r->sum2 = _mm_setzero_ps();
+	r->clip = r->nonfinite = _mm_setzero_si128();
+}
+
+static inline void _pcm_sse2_stats_add_fast(struct _pcm_sse2_stats_reg *r, __m128 x, __m128 clip)
+{
+	__m128 ax = _mm_andnot_ps(_mm_set1_ps(-0.f), x);
+	r->peak = _mm_max_ps(r->peak, ax);
+	r->sum2 = _mm_add_ps(r->sum2, _mm_mul_ps(x, x));
+	r->clip = _mm_sub_epi32(r->clip, _mm_castps_si128(_mm_cmpge_ps(ax, clip)));
+}
+
+static inline int _pcm_sse2_stats_finite(const struct _pcm_sse2_stats_reg *r0, const struct _pcm_sse2_stats_reg *r1)
+{
+	__m128 s = _mm_add_ps(r0->sum2, r1->sum2);
+	__m128 d = _mm_sub_ps(s, s);
+	return _mm_movemask_ps(_mm_cmpunord_ps(d, d)) == 0;
+}
+
+static inline void _pcm_sse2_stats_add(struct _pcm_sse2_stats_reg *r, __m128 x, __m128 clip)
+{
+	__m128 d = _mm_sub_ps(x, x);
+	__m128 nf = _mm_cmpunord_ps(d, d); // NaN or Inf
+	x = _mm_andnot_ps(nf, x);
+	__m128 ax = _mm_andnot_ps(_mm_set1_ps(-0.f), x);
+	r->peak = _mm_max_ps(r->peak, ax);
+	r->sum2 = _mm_add_ps(r->sum2, _mm_mul_ps(x, x));
+	// mask is -1 for each matching lane
+	r->clip = _mm_sub_epi32(r->clip, _mm_castps_si128(_mm_cmpge_ps(ax, clip)));
+	r->nonfinite = _mm_sub_epi32(r->nonfinite, _mm_castps_si128(nf));
+}
+
+static inline void _pcm_sse2_stats_store(struct _pcm_stats_acc *a, uint j, const struct _pcm_sse2_stats_reg *r0, const struct _pcm_sse2_stats_reg *r1)
+{
+	_mm_storeu_ps(&a->peak[j], _mm_max_ps(r0->peak, r1->peak));
+	_mm_storeu_ps(&a->sum2[j], _mm_add_ps(r0->sum2, r1->sum2));
+	_mm_storeu_si128((__m128i*)&a->clip[j], _mm_add_epi32(r0->clip, r1->clip));
+	_mm_storeu_si128((__m128i*)&a->nonfinite[j], _mm_add_epi32(r0->nonfinite, r1->nonfinite));
+}
+
+/** Load 4 samples starting at 'i' as normalized float */
+
+static inline __m128 _pcm_sse2_stats_i8(const char *s, size_t i)
+{
+	int v4;
+	memcpy(&v4, s + i, 4);
+	__m128i v = _mm_cvtsi32_si128(v4);
+	v = _mm_unpacklo_epi8(v, v);
+	v = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 24);
+	return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1 / pcm_max8));
+}
+
+static inline __m128 _pcm_sse2_stats_i16(const short *s, size_t i)
+{
+	__m128i v = _mm_loadl_epi64((__m128i*)(s + i));
+	return _mm_mul_ps(_pcm_sse2_i16lo_ps(v), _mm_set1_ps(1 / pcm_max16));
+}
+
+static inline __m128 _pcm_sse2_stats_i24(const char *s, size_t i)
+{
+	__m128i v = _pcm_sse2_i24_load4(s + i * 3);
+	return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1 / pcm_max24));
+}
+
+static inline __m128 _pcm_sse2_stats_i24_4(const int *s, size_t i)
+{
+	__m128i v = _mm_srai_epi32(_mm_loadu_si128((__m128i*)(s + i)), 8);
+	return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1 / pcm_max24));
+}
+
+static inline __m128 _pcm_sse2_stats_i32(const int *s, size_t i)
+{
+	__m128i v = _mm_loadu_si128((__m128i*)(s + i));
+	return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1 / pcm_max32));
+}
+
+static inline __m128 _pcm_sse2_stats_f32(const float *s, size_t i)
+{
+	return _mm_loadu_ps(s + i);
+}
+
+static inline __m128 _pcm_sse2_stats_f64(const double *s, size_t i)
+{
+	__m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(s + i));
+	__m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(s + i + 2));
+	return _mm_movelh_ps(lo, hi);
+}
+
+/** Measure column 'j' of 'src' (4 samples of each of 'rows' periods) */
+#define _PCM_SSE2_STATS_COLUMN(add, name, src) \
+	_pcm_sse2_stats_zero(&r0); \
+	_pcm_sse2_stats_zero(&r1); \
+	for (r = 0;  r + 2 <= rows;  r += 2) { \
+		add(&r0, _pcm_sse2_stats_##name(src, r * P + j), c); \
+		add(&r1, _pcm_sse2_stats_##name(src, (r + 1) * P + j), c); \
+	} \
+	if (r != rows) \
+		add(&r0, _pcm_sse2_stats_##name(src, r * P + j), c);
+
+/* guard: int24 is loaded with 4-byte accesses:  stop 1 sample before the end */
+#define _PCM_SSE2_STATS_K(name, T, guard) \
+static size_t _pcm_sse2_stats_k_##name(struct _pcm_stats_acc *a, const void *data, size_t n, float clip) \
+{ \
+	const T *s = (T*)data; \
+	uint j, P = a->period; \
+	size_t r, rows = (n - guard) / P; \
+	const __m128 c = _mm_set1_ps(clip); \
+	struct _pcm_sse2_stats_reg r0, r1; \
+	for (j = 0;  j != P;  j += 4) { \
+		_PCM_SSE2_STATS_COLUMN(_pcm_sse2_stats_add_fast, name, s) \
+		if (!_pcm_sse2_stats_finite(&r0, &r1)) { \
+			_PCM_SSE2_STATS_COLUMN(_pcm_sse2_stats_add, name, s) \
+		} \
+		_pcm_sse2_stats_store(a, j, &r0, &r1); \
+	} \
+	return rows * P; \
+}
+
+_PCM_SSE2_STATS_K(i8, char, 0)
+_PCM_SSE2_STATS_K(i16, short, 0)
+_PCM_SSE2_STATS_K(i24, char, 1)
+_PCM_SSE2_STATS_K(i24_4, int, 0)
+_PCM_SSE2_STATS_K(i32, int, 0)
+_PCM_SSE2_STATS_K(f32, float, 0)
+_PCM_SSE2_STATS_K(f64, double, 0)
+
+#undef _PCM_SSE2_STATS_K
+
+/* Fused kernels process a block column by column like the measuring kernels.
+The fast path measures the values computed by the kernel (op);
+ if they contain NaN or Inf, the column is measured again from 'remeasure' array with filtering:
+ the input for conversions, the output for gain.
+op: convert (or multiply) 4 samples at index 'i', store them to 'd', return the normalized values */
+#define _PCM_SSE2_FUSED_K(kname, TI, TO, op, mname, remeasure) \
+static size_t kname(struct _pcm_stats_acc *a, void *out, const void *in, const float *g, size_t n, float clip, const void *ctx) \
+{ \
+	const TI *s = (TI*)in; \
+	TO *d = (TO*)out; \
+	uint j, P = a->period; \
+	size_t r, rows = n / P; \
+	const __m128 c = _mm_set1_ps(clip); \
+	struct _pcm_sse2_stats_reg r0, r1; \
+	for (j = 0;  j != P;  j += 4) { \
+		_pcm_sse2_stats_zero(&r0); \
+		_pcm_sse2_stats_zero(&r1); \
+		for (r = 0;  r + 2 <= rows;  r += 2) { \
+			_pcm_sse2_stats_add_fast(&r0, op(d, s, g, r * P + j, ctx), c); \
+			_pcm_sse2_stats_add_fast(&r1, op(d, s, g, (r + 1) * P + j, ctx), c); \
+		} \
+		if (r != rows) \
+			_pcm_sse2_stats_add_fast(&r0, op(d, s, g, r * P + j, ctx), c); \
+		if (!_pcm_sse2_stats_finite(&r0, &r1)) { \
+			_PCM_SSE2_STATS_COLUMN(_pcm_sse2_stats_add, mname, remeasure) \
+		} \
+		_pcm_sse2_stats_store(a, j, &r0, &r1); \
+	} \
+	return rows * P; \
+}
+
+static inline __m128 _pcm_sse2_fused_i16_f32(float *d, const short *s, const float *g, size_t i, const void *ctx)
+{
+	__m128 f = _pcm_sse2_stats_i16(s, i);
+	_mm_storeu_ps(d + i, f);
+	return f;
+}
+
+static inline __m128 _pcm_sse2_fused_f32_i16(short *d, const float *s, const float *g, size_t i, const void *ctx)
+{
+	__m128 f = _mm_loadu_ps(s + i);
+	__m128i v = _pcm_sse2_ps_epi32(f, _mm_set1_ps(pcm_max16), _mm_set1_ps(-pcm_max16), _mm_set1_ps(pcm_max16 - 1));
+	_mm_storel_epi64((__m128i*)(d + i), _mm_packs_epi32(v, v));
+	return f;
+}
+
+static inline __m128 _pcm_sse2_fused_i16_i16(short *d, const short *s, const float *g, size_t i, const void *ctx)
+{
+	_mm_storel_epi64((__m128i*)(d + i), _mm_loadl_epi64((__m128i*)(s + i)));
+	return _pcm_sse2_stats_i16(s, i);
+}
+
+static inline __m128 _pcm_sse2_fused_f32_f32(float *d, const float *s, const float *g, size_t i, const void *ctx)
+{
+	__m128 f = _mm_loadu_ps(s + i);
+	_mm_storeu_ps(d + i, f);
+	return f;
+}
+
+// conversion:  the input is measured
+_PCM_SSE2_FUSED_K(_pcm_sse2_fused_k_i16_f32, short, float, _pcm_sse2_fused_i16_f32, i16, s)
+_PCM_SSE2_FUSED_K(_pcm_sse2_fused_k_f32_i16, float, short, _pcm_sse2_fused_f32_i16, f32, s)
+_PCM_SSE2_FUSED_K(_pcm_sse2_fused_k_i16_i16, short, short, _pcm_sse2_fused_i16_i16, i16, s)
+_PCM_SSE2_FUSED_K(_pcm_sse2_fused_k_f32_f32, float, float, _pcm_sse2_fused_f32_f32, f32, s)
+
+#ifdef PCM_AVX2
+
+/* 8 samples of a column at once;
+ if the values aren't finite, the column is measured again by SSE2 code as 2 columns of 4 samples */
+
+struct _pcm_avx2_stats_reg {
+	__m256 peak, sum2;
+	__m256i clip;
+};
+
+static inline PCM_TARGET_AVX2 void _pcm_avx2_stats_zero(struct _pcm_avx2_stats_reg *r)
+{
+	r->peak = r->sum2 = _mm256_setzero_ps();
+	r->clip = _mm256_setzero_si256();
+}
+
+static inline PCM_TARGET_AVX2 void _pcm_avx2_stats_add_fast(struct _pcm_avx2_stats_reg *r, __m256 x, __m256 clip)
+{
+	__m256 ax = _mm256_andnot_ps(_mm256_set1_ps(-0.f), x);
+	r->peak = _mm256_max_ps(r->peak, ax);
+	r->sum2 = _mm256_add_ps(r->sum2, _mm256_mul_ps(x, x));
+	r->clip = _mm256_sub_epi32(r->clip, _mm256_castps_si256(_mm256_cmp_ps(ax, clip, _CMP_GE_OQ)));
+}
+
+static inline PCM_TARGET_AVX2 int _pcm_avx2_stats_finite(const struct _pcm_avx2_stats_reg *r0, const struct _pcm_avx2_stats_reg *r1)
+{
+	__m256 s = _mm256_add_ps(r0->sum2, r1->sum2);
+	__m256 d = _mm256_sub_ps(s, s);
+	return _mm256_movemask_ps(_mm256_cmp_ps(d, d, _CMP_UNORD_Q)) == 0;
+}
+
+static inline PCM_TARGET_AVX2 void _pcm_avx2_stats_store(struct _pcm_stats_acc *a, uint j, const struct _pcm_avx2_stats_reg *r0, const struct _pcm_avx2_stats_reg *r1)
+{
+	_mm256_storeu_ps(&a->peak[j], _mm256_max_ps(r0->peak, r1->peak));
+	_mm256_storeu_ps(&a->sum2[j], _mm256_add_ps(r0->sum2, r1->sum2));
+	_mm256_storeu_si256((__m256i*)&a->clip[j], _mm256_add_epi32(r0->clip, r1->clip));
+	_mm256_storeu_si256((__m256i*)&a->nonfinite[j], _mm256_setzero_si256());
+}
+
+#define _PCM_AVX2_FUSED_K(kname, TI, TO, op, mname, remeasure) \
+static PCM_TARGET_AVX2 size_t kname(struct _pcm_stats_acc *a, void *out, const void *in, const float *g, size_t n, float clip, const void *ctx) \
+{ \
+	const TI *s = (TI*)in; \
+	TO *d = (TO*)out; \
+	uint j, jj, P = a->period; \
+	size_t r, rows = n / P; \
+	const __m256 c8 = _mm256_set1_ps(clip); \
+	const __m128 c = _mm_set1_ps(clip); \
+	struct _pcm_avx2_stats_reg x0, x1; \
+	struct _pcm_sse2_stats_reg r0, r1; \
+	for (jj = 0;  jj != P;  jj += 8) { \
+		_pcm_avx2_stats_zero(&x0); \
+		_pcm_avx2_stats_zero(&x1); \
+		for (r = 0;  r + 2 <= rows;  r += 2) { \
+			_pcm_avx2_stats_add_fast(&x0, op(d, s, g, r * P + jj, ctx), c8); \
+			_pcm_avx2_stats_add_fast(&x1, op(d, s, g, (r + 1) * P + jj, ctx), c8); \
+		} \
+		if (r != rows) \
+			_pcm_avx2_stats_add_fast(&x0, op(d, s, g, r * P + jj, ctx), c8); \
+		if (_pcm_avx2_stats_finite(&x0, &x1)) { \
+			_pcm_avx2_stats_store(a, jj, &x0, &x1); \
+			continue; \
+		} \
+		for (j = jj;  j != jj + 8;  j += 4) { \
+			_PCM_SSE2_STATS_COLUMN(_pcm_sse2_stats_add, mname, remeasure) \
+			_pcm_sse2_stats_store(a, j, &r0, &r1); \
+		} \
+	} \
+	return rows * P; \
+}
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_stats_i16(const short *s, size_t i)
+{
+	__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i*)(s + i)));
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1 / pcm_max16));
+}
+
+/** Pack 8 int32 to int16 with saturation */
+static inline PCM_TARGET_AVX2 __m128i _pcm_avx2_epi32_epi16(__m256i v)
+{
+	return _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_fused_i16_f32(float *d, const short *s, const float *g, size_t i, const void *ctx)
+{
+	__m256 f = _pcm_avx2_stats_i16(s, i);
+	_mm256_storeu_ps(d + i, f);
+	return f;
+}
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_fused_f32_i16(short *d, const float *s, const float *g, size_t i, const void *ctx)
+{
+	__m256 f = _mm256_loadu_ps(s + i);
+	__m256i v = _pcm_avx2_ps_epi32(f, _mm256_set1_ps(pcm_max16), _mm256_set1_ps(-pcm_max16), _mm256_set1_ps(pcm_max16 - 1));
+	_mm_storeu_si128((__m128i*)(d + i), _pcm_avx2_epi32_epi16(v));
+	return f;
+}
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_fused_i16_i16(short *d, const short *s, const float *g, size_t i, const void *ctx)
+{
+	_mm_storeu_si128((__m128i*)(d + i), _mm_loadu_si128((__m128i*)(s + i)));
+	return _pcm_avx2_stats_i16(s, i);
+}
+
+static inline PCM_TARGET_AVX2 __m256 _pcm_avx2_fused_f32_f32(float *d, const float *s, const float *g, size_t i, const void *ctx)
+{
+	__m256 f = _mm256_loadu_ps(s + i);
+	_mm256_storeu_ps(d + i, f);
+	return f;
+}
+
+_PCM_AVX2_FUSED_K(_pcm_avx2_fused_k_i16_f32, short, float, _pcm_avx2_fused_i16_f32, i16, s)
+_PCM_AVX2_FUSED_K(_pcm_avx2_fused_k_f32_i16, float, short, _pcm_avx2_fused_f32_i16, f32, s)
+_PCM_AVX2_FUSED_K(_pcm_avx2_fused_k_i16_i16, short, short, _pcm_avx2_fused_i16_i16, i16, s)
+_PCM_AVX2_FUSED_K(_pcm_avx2_fused_k_f32_f32, float, float, _pcm_avx2_fused_f32_f32, f32, s)
+
+	#define _PCM_AVX2_K(name)  name
+#else
+	#define _PCM_AVX2_K(name)  NULL
+#endif // PCM_AVX2
+
+struct _pcm_fused_kernel {
+	ushort ifmt, ofmt;
+	_pcm_stats_fused_func sse2, avx2;
+};
+
+static const struct _pcm_fused_kernel _pcm_stats_conv_kernels[] = {
+	{ FFAUDIO_F_INT16, FFAUDIO_F_INT16, _pcm_sse2_fused_k_i16_i16, _PCM_AVX2_K(_pcm_avx2_fused_k_i16_i16) },
+	{ FFAUDIO_F_INT16, FFAUDIO_F_FLOAT32, _pcm_sse2_fused_k_i16_f32, _PCM_AVX2_K(_pcm_avx2_fused_k_i16_f32) },
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_INT16, _pcm_sse2_fused_k_f32_i16, _PCM_AVX2_K(_pcm_avx2_fused_k_f32_i16) },
+	{ FFAUDIO_F_FLOAT32, FFAUDIO_F_FLOAT32, _pcm_sse2_fused_k_f32_f32, _PCM_AVX2_K(_pcm_avx2_fused_k_f32_f32) },
+};
+
+#undef _PCM_AVX2_K
+
+/** Select the kernel for 'nch' interleaved channels
+lanes: (output) samples per vector */
+static inline _pcm_stats_fused_func _pcm_stats_fused_select(const struct _pcm_fused_kernel *k, uint nch, uint *lanes)
+{
+	uint cpu = pcm_cpu_features();
+	if ((cpu & PCM_CPU_AVX2) && k->avx2 != NULL
+		&& _pcm_stats_period(nch, 8) <= _PCM_STATS_PERIOD_MAX) {
+		*lanes = 8;
+		return k->avx2;
+	}
+	if (cpu & PCM_CPU_SSE2) {
+		*lanes = 4;
+		return k->sse2;
+	}
+	return NULL;
+}
+
+/** Get the fused kernel that converts (or copies) 'nch' interleaved channels and measures the input
+lanes: (output) samples per vector */
+static inline _pcm_stats_fused_func _pcm_stats_conv_find(uint ifmt, uint ofmt, uint nch, uint *lanes)
+{
+	for (uint i = 0;  i != FF_COUNT(_pcm_stats_conv_kernels);  i++) {
+		const struct _pcm_fused_kernel *k = &_pcm_stats_conv_kernels[i];
+		if (k->ifmt == ifmt && k->ofmt == ofmt)
+			return _pcm_stats_fused_select(k, nch, lanes);
+	}
+	return NULL;
+}
+
+static inline _pcm_stats_func _pcm_stats_find(uint format)
+{
+	if (!(pcm_cpu_features() & PCM_CPU_SSE2))
+		return NULL;
+
+	switch (format) {
+	case FFAUDIO_F_INT8:
+		return _pcm_sse2_stats_k_i8;
+	case FFAUDIO_F_INT16:
+		return _pcm_sse2_stats_k_i16;
+	case FFAUDIO_F_INT24:
+		return _pcm_sse2_stats_k_i24;
+	case FFAUDIO_F_INT24_4:
+		return _pcm_sse2_stats_k_i24_4;
+	case FFAUDIO_F_INT32:
+		return _pcm_sse2_stats_k_i32;
+	case FFAUDIO_F_FLOAT32:
+		return _pcm_sse2_stats_k_f32;
+	case FFAUDIO_F_FLOAT64:
+		return _pcm_sse2_stats_k_f64;
+	}
+	return NULL;
+}
+
+#else // FF_SSE2
+
+static inline _pcm_stats_func _pcm_stats_find(uint format)
+{
+	return NULL;
+}
+
+static inline _pcm_stats_fused_func _pcm_stats_conv_find(uint ifmt, uint ofmt, uint nch, uint *lanes)
+{
+	return NULL;
+}
+
+#endif // FF_SSE2
+
+/** Measure 'n' contiguous samples: 'nch' interleaved channels starting with channel 'ch0' */
+static inline void _pcm_stats_run(struct pcm_stats *st, uint format, const void *data, size_t n, uint nch, uint ch0)
+{
+	struct _pcm_stats_acc a;
+	_pcm_stats_func f = _pcm_stats_find(format);
+	float clip = _pcm_stats_clip(format);
+	uint P = _pcm_stats_period(nch, 4);
+	a.period = P;
+	uint block = _PCM_STATS_BLOCK / P * P;
+	uint w = pcm_f_bits(format) / 8;
+
+	for (size_t off = 0;  off != n;) {
+		size_t i = 0, k = ffmin(n - off, block);
+		const char *d = (char*)data + off * w;
+		_pcm_stats_acc_zero(&a);
+
+		if (f != NULL)
+			i = f(&a, d, k, clip);
+		for (;  i != k;  i++) {
+			_pcm_stats_add(&a, i % P, _pcm_stats_load(format, d, i), clip);
+		}
+
+		_pcm_stats_acc_merge(st, &a, nch, ch0);
+		off += k;
+	}
+}
+
+/** Process 'n' contiguous samples ('nch' interleaved channels starting with channel 'ch0') by a fused kernel.
+The samples are measured in 'format' (the input format of conversion or the format of gain).
+lanes: kernel's samples per vector
+wi, wo: input and output sample size
+g: per-sample parameters for 'n' samples;  NULL: not used
+Return the number of samples processed:  complete periods;  the caller processes and measures the rest */
+static inline size_t _pcm_stats_fused_run(struct pcm_stats *st, _pcm_stats_fused_func f, uint lanes, const void *ctx, uint format
+	, void *out, uint wo, const void *in, uint wi, const float *g, size_t n, uint nch, uint ch0)
+{
+	struct _pcm_stats_acc a;
+	float clip = _pcm_stats_clip(format);
+	uint P = _pcm_stats_period(nch, lanes);
+	a.period = P;
+	size_t block = _PCM_STATS_BLOCK / P * P;
+	size_t off = 0;
+	n = n / P * P;
+
+	while (off != n) {
+		size_t k = ffmin(n - off, block);
+		_pcm_stats_acc_zero(&a);
+		f(&a, (char*)out + off * wo, (char*)in + off * wi, (g != NULL) ? g + off : NULL, k, clip, ctx);
+		_pcm_stats_acc_merge(st, &a, nch, ch0);
+		off += k;
+	}
+	return n;
+}
+
+/** Update statistics with the next block of data
+Return 0 on success */
+static inline int pcm_stats_update(struct pcm_stats *st, const struct pcm_af *af, const void *data, size_t frames)
+{
+	uint nch = af->channels;
+	if (nch > PCM_CHAN_MAX || _pcm_stats_clip(af->format) == 0)
+		return -1;
+
+	st->channels = nch;
+	if (af->interleaved) {
+		_pcm_stats_run(st, af->format, data, frames * nch, nch, 0);
+	} else {
+		for (uint c = 0;  c != nch;  c++) {
+			_pcm_stats_run(st, af->format, ((void**)data)[c], frames, 1, c);
+		}
+	}
+	st->frames += frames;
+	return 0;
+}
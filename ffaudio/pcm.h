@@ -9,6 +9,7 @@ struct pcm_af {
 	ushort format; // enum FFAUDIO_F
 	u_char channels;
 	u_char interleaved :1;
+	u_char chan_sel :7; // output: copy only 1 input channel to mono output (input channel index + 1);  0: all channels
 	uint rate;
 };
 
@@ -25,6 +26,7 @@ union pcm_data {
 
 	char *i8;
 	short *i16;
+	ushort *u16;
 	int *i32;
 	float *f32;
 	double *f64;
@@ -32,13 +34,31 @@ union pcm_data {
 	u_char **pu8;
 	char **pi8;
 	short **pi16;
+	ushort **pu16;
 	int **pi32;
 	float **pf32;
 	double **pf64;
 };
 
-#define PCM_CHAN_MAX 8
-#define PCM_CHAN_MASK 0x0f
+#define PCM_CHAN_MAX 64
+
+/** Decode the former encoding of channel selection, used before 'chan_sel' was added:
+ channels = 1 | (input channel index + 1) << 4
+The input had up to 8 channels then, so the value is decoded only if it can't be a real channel number:
+ the input has up to 8 channels and no gain matrix is specified (the caller checks it).
+Return 'out' or 'tmp' with the decoded format */
+static inline const struct pcm_af* _pcm_af_chan_sel_compat(struct pcm_af *tmp, const struct pcm_af *out, const struct pcm_af *in)
+{
+	uint sel = out->channels >> 4;
+	if (out->chan_sel != 0 || (out->channels & 0x0f) != 1
+		|| sel == 0 || sel > in->channels || in->channels > 8)
+		return out;
+
+	*tmp = *out;
+	tmp->channels = 1;
+	tmp->chan_sel = sel;
+	return tmp;
+}
 
 #ifdef FF_SSE2
 	#include <emmintrin.h>
@@ -134,6 +154,82 @@ static inline int pcm_i32_flt(double d)
 
 #define pcm_flt_i32(i32)  ((double)(i32) * (1 / pcm_max32))
 
+/** Convert FLOAT to half precision:  round to nearest-even;  overflow: Inf;  NaN: quiet NaN with the upper bits of payload
+(the same results as F16C instructions produce) */
+static inline ushort pcm_f16_flt(float f)
+{
+	union { float f; uint u; } v;
+	v.f = f;
+	uint sign = (v.u >> 16) & 0x8000, u = v.u & 0x7fffffff;
+
+	if (u >= 0x47800000) // >= 65536.0, Inf, NaN
+		return sign | ((u > 0x7f800000) ? 0x7e00 | ((u >> 13) & 0x3ff) : 0x7c00);
+
+	if (u < 0x38800000) { // < 2^-14:  subnormal half;  the FPU rounds the mantissa
+		v.u = u;
+		v.f += 0.5f;
+		return sign | (v.u - 0x3f000000);
+	}
+
+	u += 0xc8000fff + ((u >> 13) & 1); // rebias the exponent, round to nearest-even
+	return sign | (u >> 13);
+}
+
+/** Convert half precision to FLOAT */
+static inline float pcm_flt_f16(ushort h)
+{
+	union { float f; uint u; } v;
+	uint em = h & 0x7fff;
+	if (em >= 0x7c00) {
+		v.u = 0x7f800000 | (em << 13) | ((em != 0x7c00) ? 0x400000 : 0); // Inf, quiet NaN
+	} else {
+		v.u = em << 13;
+		v.f *= 0x1p112f; // rebias the exponent;  subnormal halves become normal floats
+	}
+	v.u |= (uint)(h & 0x8000) << 16;
+	return v.f;
+}
+
+/** Convert FLOAT to bfloat16:  round to nearest-even;  NaN: quiet NaN */
+static inline ushort pcm_bf16_flt(float f)
+{
+	union { float f; uint u; } v;
+	v.f = f;
+	if ((v.u & 0x7fffffff) > 0x7f800000)
+		return (v.u >> 16) | 0x40;
+	return (v.u + 0x7fff + ((v.u >> 16) & 1)) >> 16;
+}
+
+/** Convert bfloat16 to FLOAT */
+static inline float pcm_flt_bf16(ushort b)
+{
+	union { float f; uint u; } v;
+	v.u = (uint)b << 16;
+	return v.f;
+}
+
+static inline int _pcm_f_half(uint f)
+{
+	return f == FFAUDIO_F_FLOAT16 || f == FFAUDIO_F_BFLOAT16;
+}
+
+/** Signed integer format */
+static inline int _pcm_f_int(uint f)
+{
+	switch (f) {
+	case FFAUDIO_F_INT8:
+	case FFAUDIO_F_INT16:
+	case FFAUDIO_F_INT24:
+	case FFAUDIO_F_INT24_4:
+	case FFAUDIO_F_INT32:
+		return 1;
+	}
+	return 0;
+}
+
+/** Significant bits of integer sample */
+#define _pcm_f_int_bits(f)  (((f) == FFAUDIO_F_INT24_4) ? 24 : pcm_f_bits(f))
+
 static inline double pcm_limf(double d)
 {
 	return (d > 1.0) ? 1.0
@@ -7,6 +7,9 @@
 #include <ffbase/stringz.h>
 #include <ffbase/atomic.h>
 #include <pulse/pulseaudio.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
 #include <errno.h>
 
 
@@ -361,6 +364,13 @@ struct ffaudio_buf {
 	ffuint drained;
 	pa_operation *drain_op;
 
+	ffuint frame_size;
+	void *wbuf; // the buffer from pa_stream_begin_write() for write_begin()
+
+	int evfd; // non-blocking mode:  eventfd for poll_fds();  -1: none
+	void (*on_event)(void*);
+	void *udata;
+
 	/** Remember the signals received by our PA callbacks
 	1: I/O-signal
 	2: stream-state-changed
@@ -391,6 +401,7 @@ ffaudio_buf* ffpulse_alloc()
 	if (b == NULL)
 		return NULL;
 	b->conn = gconn;
+	b->evfd = -1;
 	return b;
 }
 
@@ -416,14 +427,18 @@ void ffpulse_free(ffaudio_buf *b)
 	}
 
 	pulse_unlock(b->conn);
+	if (b->evfd >= 0)
+		close(b->evfd);
 	ffmem_free(b->errmsg);
 	ffmem_free(b);
 }
 
+// int24 in 32-bit container (the sample is in the high 3 bytes) is S32LE for Pulse
 static const ffushort afmt[] = {
 	FFAUDIO_F_UINT8,
 	FFAUDIO_F_INT16,
 	FFAUDIO_F_INT24,
+	FFAUDIO_F_INT24_4,
 	FFAUDIO_F_INT32,
 	FFAUDIO_F_FLOAT32,
 };
@@ -432,6 +447,7 @@ static const ffuint afmt_pa[] = {
 	PA_SAMPLE_S16LE,
 	PA_SAMPLE_S24LE,
 	PA_SAMPLE_S32LE,
+	PA_SAMPLE_S32LE,
 	PA_SAMPLE_FLOAT32LE,
 };
 
@@ -446,12 +462,33 @@ static int pulse_fmt(ffuint f)
 
 static void pulse_on_io(pa_stream *s, ffsize nbytes, void *udata);
 
+/** Wake up the user of a non-blocking buffer.
+Called within mainloop thread */
+static void pulse_notify(ffaudio_buf *b)
+{
+	if (b->evfd < 0)
+		return;
+	ffuint64 n = 1;
+	write(b->evfd, &n, sizeof(n));
+	if (b->on_event != NULL)
+		b->on_event(b->udata);
+}
+
+/** Reset the eventfd before returning 0 to the user of a non-blocking buffer.
+The mainloop is locked:  the next event from PA signals it again */
+static void pulse_notify_reset(ffaudio_buf *b)
+{
+	ffuint64 n;
+	read(b->evfd, &n, sizeof(n));
+}
+
 /** PA manual: "called whenever the state of the stream changes" */
 static void pulse_on_change(pa_stream *s, void *udata)
 {
 	ffaudio_buf *b = udata;
 	b->cb_signals |= 2;
 	pulse_signal(b->conn);
+	pulse_notify(b);
 }
 
 int ffpulse_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
@@ -478,6 +515,16 @@ int ffpulse_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 		return FFAUDIO_EFORMAT;
 	}
 
+	if (b->nonblock && b->evfd < 0
+		&& 0 > (b->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))) {
+		b->errfunc = "eventfd";
+		b->err = 0;
+		return FFAUDIO_ERROR;
+	}
+	b->on_event = conf->on_event;
+	b->udata = conf->udata;
+	b->frame_size = _ffau_f_bits(conf->format)/8 * conf->channels;
+
 	pulse_lock(b->conn);
 
 	pa_sample_spec spec;
@@ -541,6 +588,7 @@ static void pulse_on_op(pa_stream *s, int success, void *udata)
 	ffaudio_buf *b = udata;
 	b->cb_signals |= 4;
 	pulse_signal(b->conn);
+	pulse_notify(b);
 }
 
 int pulse_resume(ffaudio_buf *b)
@@ -597,30 +645,37 @@ int ffpulse_clear(ffaudio_buf *b)
 	return r;
 }
 
-static int pulse_writeonce(ffaudio_buf *b, const void *data, ffsize len)
+/** Get the buffer for writing
+n: [in] the maximum size;  [out] buffer size
+Return 1: success;  0: no free space */
+static int pulse_write_beginonce(ffaudio_buf *b, void **buf, ffsize *n)
 {
-	int r;
-	ffsize n;
-	void *buf;
-
-	n = pa_stream_writable_size(b->stm);
-	if (n == 0) {
+	ffsize free = pa_stream_writable_size(b->stm);
+	if (free == 0) {
 		return 0;
-	} else if (n == (ffsize)-1) {
+	} else if (free == (ffsize)-1) {
 		b->errfunc = "pa_stream_writable_size";
 		b->err = pa_context_errno(b->conn->ctx);
 		return -FFAUDIO_ERROR;
 	}
 
-	r = pa_stream_begin_write(b->stm, &buf, &n);
-	if (r < 0 || buf == NULL) {
+	int r = pa_stream_begin_write(b->stm, buf, &free);
+	if (r < 0 || *buf == NULL) {
 		b->errfunc = "pa_stream_begin_write";
 		b->err = pa_context_errno(b->conn->ctx);
 		return -FFAUDIO_ERROR;
 	}
-	n = ffmin(len, n);
+	*n = ffmin(*n, free);
+	return 1;
+}
 
-	ffmem_copy(buf, data, n);
+/** Pass the buffer from pa_stream_begin_write() to the server */
+static int pulse_write_commitonce(ffaudio_buf *b, void *buf, ffsize n)
+{
+	if (n == 0) {
+		pa_stream_cancel_write(b->stm);
+		return 0;
+	}
 
 	if (0 != pa_stream_write(b->stm, buf, n, NULL, 0, PA_SEEK_RELATIVE)) {
 		b->errfunc = "pa_stream_write";
@@ -629,7 +684,7 @@ static int pulse_writeonce(ffaudio_buf *b, const void *data, ffsize len)
 	}
 
 	b->drained = 0;
-	return n;
+	return 0;
 }
 
 static void pulse_on_io(pa_stream *s, ffsize nbytes, void *udata)
@@ -637,6 +692,7 @@ static void pulse_on_io(pa_stream *s, ffsize nbytes, void *udata)
 	ffaudio_buf *b = udata;
 	b->cb_signals |= 1;
 	pulse_signal(b->conn);
+	pulse_notify(b);
 }
 
 static int pulse_readonce(ffaudio_buf *b, const void **data)
@@ -664,28 +720,67 @@ static int pulse_readonce(ffaudio_buf *b, const void **data)
 	}
 }
 
-int ffpulse_write(ffaudio_buf *b, const void *data, ffsize len)
+/** Get the buffer for writing;  wait or resume the stream if there's no free space
+The mainloop is locked.
+Return 1: success;  0: no free space (FFAUDIO_O_NONBLOCK) */
+static int pulse_write_begin(ffaudio_buf *b, void **buf, ffsize *n)
 {
 	int r;
-	pulse_lock(b->conn);
-
 	for (;;) {
-		r = pulse_writeonce(b, data, len);
+		r = pulse_write_beginonce(b, buf, n);
 		if (r != 0)
-			goto end;
+			return r;
 
-		if (0 != (r = pulse_resume(b))) {
-			r = -r;
-			goto end;
-		}
+		if (0 != (r = pulse_resume(b)))
+			return -r;
 
-		if (b->nonblock)
-			goto end;
+		if (b->nonblock) {
+			pulse_notify_reset(b);
+			return 0;
+		}
 
 		pulse_wait(b->conn);
 	}
+}
+
+int ffpulse_write(ffaudio_buf *b, const void *data, ffsize len)
+{
+	int r;
+	void *buf;
+	ffsize n = len;
+	pulse_lock(b->conn);
+
+	if (0 < (r = pulse_write_begin(b, &buf, &n))) {
+		ffmem_copy(buf, data, n);
+		if (0 == (r = pulse_write_commitonce(b, buf, n)))
+			r = n;
+	}
 
-end:
+	pulse_unlock(b->conn);
+	return r;
+}
+
+int ffpulse_write_begin(ffaudio_buf *b, void **ptr, ffsize *frames)
+{
+	int r;
+	ffsize n = *frames * b->frame_size;
+	pulse_lock(b->conn);
+
+	if (0 < (r = pulse_write_begin(b, &b->wbuf, &n))) {
+		*ptr = b->wbuf;
+		*frames = n / b->frame_size;
+		r = *frames;
+	}
+
+	pulse_unlock(b->conn);
+	return r;
+}
+
+int ffpulse_write_commit(ffaudio_buf *b, ffsize frames)
+{
+	pulse_lock(b->conn);
+	int r = pulse_write_commitonce(b, b->wbuf, frames * b->frame_size);
+	b->wbuf = NULL;
 	pulse_unlock(b->conn);
 	return r;
 }
@@ -723,6 +818,7 @@ int ffpulse_drain(ffaudio_buf *b)
 			goto end;
 		} else if (r < 0) {
 			b->drain_op = op;
+			pulse_notify_reset(b);
 			r = 0;
 			goto end;
 		}
@@ -747,8 +843,10 @@ int ffpulse_read(ffaudio_buf *b, const void **data)
 		if (r != 0)
 			goto end;
 
-		if (b->nonblock)
+		if (b->nonblock) {
+			pulse_notify_reset(b);
 			goto end;
+		}
 
 		pulse_wait(b->conn);
 	}
@@ -758,6 +856,21 @@ end:
 	return r;
 }
 
+int ffpulse_poll_fds(ffaudio_buf *b, struct pollfd *fds, ffuint cap)
+{
+	if (b->evfd < 0) {
+		b->errfunc = "not a non-blocking buffer";
+		b->err = 0;
+		return -FFAUDIO_ERROR;
+	}
+	if (cap != 0) {
+		fds[0].fd = b->evfd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+	}
+	return 1;
+}
+
 /*
 Note: libpulse's code calls _exit() when it fails to allocate a memory buffer (/src/pulse/xmalloc.c) */
 const char* ffpulse_error(ffaudio_buf *b)
@@ -791,4 +904,7 @@ const struct ffaudio_interface ffpulse = {
 	ffpulse_drain,
 	ffpulse_read,
 	NULL,
+	ffpulse_poll_fds,
+	ffpulse_write_begin,
+	ffpulse_write_commit,
 };
@@ -1,6 +1,8 @@
 /** ffaudio: utilitary functions
 2025, Simon Zolin */
 
+#include <ffbase/base.h>
+
 /** Bits per sample */
 #define _ffau_f_bits(f)  ((f) & 0xff)
 
@@ -15,3 +17,58 @@ static inline unsigned _ffau_buf_size_to_msec(const ffaudio_conf *conf, unsigned
 static inline unsigned _ffau_buf_msec_to_size(const ffaudio_conf *conf, unsigned msec) {
 	return conf->sample_rate * _ffau_f_bits(conf->format)/8 * conf->channels * msec / 1000;
 }
+
+
+/** Fallback for write_begin()/write_commit() in the backends without a writable device region:
+ the user renders into an internal buffer, which is then passed to write() */
+typedef struct _ffau_wbuf {
+	char *ptr;
+	size_t cap;
+	size_t off, len; // pending data: ptr[off..len)
+	unsigned frame_size;
+} _ffau_wbuf;
+
+typedef int (*_ffau_write_func)(ffaudio_buf *b, const void *data, size_t len);
+
+static inline void _ffau_wbuf_free(_ffau_wbuf *w) {
+	ffmem_free(w->ptr);
+	w->ptr = NULL;
+	w->cap = w->off = w->len = 0;
+}
+
+/** Pass the pending data to write()
+Return 0: done;  1: not done yet (FFAUDIO_O_NONBLOCK);  <0: error from write() */
+static inline int _ffau_wbuf_flush(_ffau_wbuf *w, ffaudio_buf *b, _ffau_write_func write) {
+	while (w->off != w->len) {
+		int r = write(b, w->ptr + w->off, w->len - w->off);
+		if (r <= 0)
+			return (r == 0) ? 1 : r;
+		w->off += r;
+	}
+	return 0;
+}
+
+static inline int _ffau_wbuf_begin(_ffau_wbuf *w, ffaudio_buf *b, _ffau_write_func write, void **ptr, size_t *frames) {
+	int r;
+	if (0 != (r = _ffau_wbuf_flush(w, b, write)))
+		return (r > 0) ? 0 : r;
+
+	size_t n = *frames * w->frame_size;
+	if (n > w->cap) {
+		ffmem_free(w->ptr);
+		w->cap = 0;
+		if (NULL == (w->ptr = (char*)ffmem_alloc(n)))
+			return -FFAUDIO_ERROR;
+		w->cap = n;
+	}
+	w->off = w->len = 0;
+	*ptr = w->ptr;
+	return *frames;
+}
+
+static inline int _ffau_wbuf_commit(_ffau_wbuf *w, ffaudio_buf *b, _ffau_write_func write, size_t frames) {
+	w->off = 0;
+	w->len = frames * w->frame_size;
+	int r = _ffau_wbuf_flush(w, b, write);
+	return (r > 0) ? 0 : r;
+}
@@ -226,6 +226,7 @@ struct ffaudio_buf {
 	ffuint nonblock;
 	ffuint notify_unsync;
 	ffuint user_driven;
+	_ffau_wbuf wbuf;
 
 	const char *errfunc;
 	char *errmsg;
@@ -268,6 +269,7 @@ void ffwasapi_free(ffaudio_buf *b)
 		return;
 
 	wasapi_close(b);
+	_ffau_wbuf_free(&b->wbuf);
 	ffmem_free(b->errmsg);
 	ffmem_free(b);
 }
@@ -527,6 +529,12 @@ int ffwasapi_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 	b->nonblock = !!(flags & FFAUDIO_O_NONBLOCK);
 	b->notify_unsync = !!(flags & FFAUDIO_O_UNSYNC_NOTIFY);
 
+	if (flags & FFAUDIO_O_NONINTERLEAVED) {
+		b->errfunc = "non-interleaved access is not supported";
+		b->err = 0;
+		return FFAUDIO_ERROR;
+	}
+
 	if (conf->buffer_length_msec == 0)
 		conf->buffer_length_msec = 500;
 	REFERENCE_TIME dur = conf->buffer_length_msec * 1000 * 10;
@@ -686,6 +694,7 @@ int ffwasapi_open(ffaudio_buf *b, ffaudio_conf *conf, ffuint flags)
 		b->user_driven = 1;
 		conf->event_h = b->event;
 	}
+	b->wbuf.frame_size = b->frame_size;
 	rc = 0;
 
 end:
@@ -973,6 +982,16 @@ int ffwasapi_write(ffaudio_buf *b, const void *data, ffsize len)
 	}
 }
 
+int ffwasapi_write_begin(ffaudio_buf *b, void **ptr, ffsize *frames)
+{
+	return _ffau_wbuf_begin(&b->wbuf, b, ffwasapi_write, ptr, frames);
+}
+
+int ffwasapi_write_commit(ffaudio_buf *b, ffsize frames)
+{
+	return _ffau_wbuf_commit(&b->wbuf, b, ffwasapi_write, frames);
+}
+
 static int wasapi_drain_excl(ffaudio_buf *b)
 {
 	int r;
@@ -1000,10 +1019,13 @@ static int wasapi_drain_excl(ffaudio_buf *b)
 
 int ffwasapi_drain(ffaudio_buf *b)
 {
+	int r;
+	if (0 != (r = _ffau_wbuf_flush(&b->wbuf, b, ffwasapi_write)))
+		return (r > 0) ? 0 : r;
+
 	if (b->event != NULL)
 		return wasapi_drain_excl(b);
 
-	int r;
 	ffuint filled;
 	for (;;) {
 		if (0 != (r = IAudioClient_GetCurrentPadding(b->client, &filled))) {
@@ -1194,4 +1216,7 @@ const struct ffaudio_interface ffwasapi = {
 	ffwasapi_drain,
 	ffwasapi_read,
 	ffwasapi_signal,
+	NULL,
+	ffwasapi_write_begin,
+	ffwasapi_write_commit,
 };
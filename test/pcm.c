@@ -0,0 +1,1068 @@
+/** ffaudio: PCM processing tester
+2026, Simon Zolin
+*/
+
+#include <ffaudio/pcm-convert.h>
+#include <ffaudio/pcm-parallel.h>
+#include <ffaudio/pcm-gain.h>
+#include <ffaudio/pcm-loudness.h>
+#include <ffbase/stringz.h>
+#include <test/std.h>
+#include <test/test.h>
+#ifndef FF_WIN
+#include <time.h>
+#endif
+
+/** Process the whole buffer in blocks of varying size */
+static void lim_process(struct pcm_limiter *l, float *d, size_t frames, const uint *blocks, uint nblocks)
+{
+	uint nch = l->channels;
+	for (size_t off = 0, i = 0;  off != frames;  i++) {
+		size_t n = ffmin(blocks[i % nblocks], frames - off);
+		pcm_limiter_process(l, d + off * nch, n);
+		off += n;
+	}
+}
+
+/** Limiter: monotonic release stresses the sliding minimum (every new value is larger than all the previous ones) */
+static void test_limiter_release(uint lookahead_ms)
+{
+	const uint frames = 48000;
+	const float ceiling = 0.9f;
+	struct pcm_af af = {
+		.format = FFAUDIO_F_FLOAT32,
+		.channels = 1,
+		.interleaved = 1,
+		.rate = 48000,
+	};
+	static const uint blocks[] = { 1, 7, 47, 48, 49, 333, 1021, 5 };
+	static const uint whole[] = { 48000 };
+	float *a = ffmem_alloc(frames * sizeof(float));
+	float *b = ffmem_alloc(frames * sizeof(float));
+	struct pcm_limiter la, lb;
+
+	for (uint i = 0;  i != frames;  i++) {
+		a[i] = b[i] = 4 * expf(-(float)i / 2000.);
+	}
+
+	xieq(0, pcm_limiter_init(&la, &af, ceiling, 0, lookahead_ms, 50));
+	xieq(0, pcm_limiter_init(&lb, &af, ceiling, 0, lookahead_ms, 50));
+	lim_process(&la, a, frames, blocks, FF_COUNT(blocks));
+	lim_process(&lb, b, frames, whole, FF_COUNT(whole));
+
+	uint delay = pcm_limiter_latency(&la);
+	for (uint i = delay;  i != frames;  i++) {
+		x(fabsf(a[i]) <= ceiling * (1 + 1e-6f));
+		x(a[i] == b[i]);
+	}
+
+	pcm_limiter_destroy(&la);
+	pcm_limiter_destroy(&lb);
+	ffmem_free(a);
+	ffmem_free(b);
+}
+
+static void test_limiter()
+{
+	test_limiter_release(1);
+	test_limiter_release(0);
+}
+
+/** pcm_convert() doesn't resample */
+static void test_convert_rate()
+{
+	struct pcm_af in = {
+		.format = FFAUDIO_F_INT16,
+		.channels = 2,
+		.interleaved = 1,
+		.rate = 44100,
+	};
+	struct pcm_af out = in;
+	out.format = FFAUDIO_F_FLOAT32;
+	out.rate = 48000;
+	short i16[2 * 8] = {};
+	float f32[2 * 8];
+	xieq(-1, pcm_convert(&out, f32, &in, i16, 8));
+	xieq(-1, pcm_convert_mix(&out, f32, &in, i16, 8, NULL, 0.5));
+}
+
+/** Mono output from 1 input channel:  'chan_sel' and the former encoding in 'channels' */
+static void test_convert_chan_sel()
+{
+	struct pcm_af in = {
+		.format = FFAUDIO_F_INT16,
+		.channels = 2,
+		.interleaved = 1,
+		.rate = 48000,
+	};
+	struct pcm_af out = in;
+	out.channels = 1;
+	out.chan_sel = 2;
+	short i16[2 * 4] = { 1,-1, 2,-2, 3,-3, 4,-4 };
+	short o[4];
+	xieq(0, pcm_convert(&out, o, &in, i16, 4));
+	x(o[0] == -1 && o[3] == -4);
+
+	out.channels = 1 | (0 + 1) << 4;
+	out.chan_sel = 0;
+	xieq(0, pcm_convert(&out, o, &in, i16, 4));
+	x(o[0] == 1 && o[3] == 4);
+
+	out.channels = 1 | (1 + 1) << 4;
+	out.format = FFAUDIO_F_FLOAT32;
+	float f[4];
+	xieq(0, pcm_convert_mix(&out, f, &in, i16, 4, NULL, 2));
+	x(f[0] == -2 / 32768. && f[3] == -8 / 32768.);
+}
+
+/** Mixing with a dense matrix:  more coefficients than the mixer stores inside */
+static void test_convert_mix_matrix()
+{
+	enum { ICH = 10, OCH = 9, FRAMES = 333 };
+	struct pcm_af in = {
+		.format = FFAUDIO_F_FLOAT32,
+		.channels = ICH,
+		.interleaved = 1,
+		.rate = 48000,
+	};
+	struct pcm_af out = in;
+	out.channels = OCH;
+	float level[OCH * ICH], i[FRAMES * ICH], o[FRAMES * OCH];
+	for (uint k = 0;  k != OCH * ICH;  k++) {
+		level[k] = (float)(k % 7 + 1) / 64;
+	}
+	for (uint k = 0;  k != FRAMES * ICH;  k++) {
+		i[k] = (float)((int)(k * 37 % 201) - 100) / 100;
+	}
+
+	xieq(0, pcm_convert_mix(&out, o, &in, i, FRAMES, level, 1));
+	for (uint f = 0;  f != FRAMES;  f++) {
+		for (uint oc = 0;  oc != OCH;  oc++) {
+			double sum = 0;
+			for (uint ic = 0;  ic != ICH;  ic++) {
+				sum += (double)level[oc * ICH + ic] * i[f * ICH + ic];
+			}
+			sum = ffmin(ffmax(sum, -1), 1);
+			x(fabs(o[f * OCH + oc] - sum) < 1e-5);
+		}
+	}
+}
+
+/** Input with the extreme values:  full-scale integers, out-of-range floats, NaN, Inf, denormals */
+static void simd_fill(uint format, void *d, size_t n)
+{
+	static const float f32[] = { 0, -0.f, 1, -1, 1.5f, -1.5f, 0.99999994f, 1e-40f, INFINITY, -INFINITY, NAN, 0.5f / 32768 };
+	static const double f64[] = { 0, 1, -1, 2, -2, 0.9999999999, 1e-310, INFINITY, -INFINITY, NAN, 0.5 / 8388608 };
+	uint r = 1;
+	for (size_t i = 0;  i != n;  i++) {
+		r = r * 1103515245 + 12345;
+		switch (format) {
+		case FFAUDIO_F_FLOAT32:
+			((float*)d)[i] = (r & 0x10000) ? f32[(r >> 17) % FF_COUNT(f32)] : (float)(int)r / 0x7fffffff;
+			break;
+		case FFAUDIO_F_FLOAT64:
+			((double*)d)[i] = (r & 0x10000) ? f64[(r >> 17) % FF_COUNT(f64)] : (double)(int)r / 0x7fffffff;
+			break;
+		default:
+			for (uint k = 0;  k != pcm_f_bits(format) / 8;  k++) {
+				r = r * 1103515245 + 12345;
+				((char*)d)[i * pcm_f_bits(format) / 8 + k] = (r & 0x10000) ? (char)((r & 0x20000) ? 0x7f : 0x80) : (char)(r >> 16);
+			}
+		}
+	}
+}
+
+/** Convert with the kernels allowed by 'cpu' */
+static int simd_convert(uint cpu, const struct pcm_af *out, char *o, const struct pcm_af *in, const char *i, size_t frames)
+{
+	void *op[8], *ip[8];
+	for (uint c = 0;  c != in->channels;  c++) {
+		ip[c] = (char*)i + c * frames * 8;
+		op[c] = o + c * frames * 8;
+	}
+	pcm_cpu_limit(cpu);
+	int r = pcm_convert(out, (out->interleaved) ? (void*)o : op, in, (in->interleaved) ? (void*)i : ip, frames);
+	pcm_cpu_limit(~0U);
+	return r;
+}
+
+/** Every dispatched SIMD kernel gives the same data as the scalar code:  all format pairs, both layouts, odd tails */
+static void test_convert_simd()
+{
+	static const uint fmt[] = {
+		FFAUDIO_F_INT8, FFAUDIO_F_UINT8, FFAUDIO_F_INT16, FFAUDIO_F_INT24, FFAUDIO_F_INT24_4, FFAUDIO_F_INT32,
+		FFAUDIO_F_FLOAT32, FFAUDIO_F_FLOAT64, FFAUDIO_F_FLOAT16, FFAUDIO_F_BFLOAT16,
+	};
+	static const uint cpu[] = { ~0U, PCM_CPU_SSE2 | PCM_CPU_SSSE3, PCM_CPU_SSE2 };
+	static const uint chans[] = { 1, 2, 3, 8 };
+	static const uint frames[] = { 1, 3, 17, 67, 1001 };
+	const size_t cap = 1001 * 8 * 8;
+	char *i = ffmem_alloc(cap), *a = ffmem_alloc(cap), *b = ffmem_alloc(cap);
+
+	for (uint fi = 0;  fi != FF_COUNT(fmt);  fi++) {
+	for (uint fo = 0;  fo != FF_COUNT(fmt);  fo++) {
+		for (uint ich = 0;  ich != FF_COUNT(chans);  ich++) {
+		for (uint lay = 0;  lay != 4;  lay++) {
+			struct pcm_af in = {
+				.format = fmt[fi],
+				.channels = chans[ich],
+				.interleaved = lay & 1,
+				.rate = 48000,
+			}, out = in;
+			out.format = fmt[fo];
+			out.interleaved = !!(lay & 2);
+
+			for (uint ifr = 0;  ifr != FF_COUNT(frames);  ifr++) {
+				size_t n = frames[ifr];
+				simd_fill(in.format, i, cap / (pcm_f_bits(in.format) / 8));
+				ffmem_fill(a, 0xcc, cap);
+				int r = simd_convert(0, &out, a, &in, i, n);
+				for (uint k = 0;  k != FF_COUNT(cpu);  k++) {
+					ffmem_fill(b, 0xcc, cap);
+					xieq(r, simd_convert(cpu[k], &out, b, &in, i, n));
+					if (memcmp(a, b, cap)) {
+						fflog("format %u -> %u  channels:%u  layout:%u  frames:%u  cpu:%x"
+							, in.format, out.format, in.channels, lay, (uint)n, cpu[k]);
+						x(0);
+					}
+				}
+			}
+		}
+		}
+	}
+	}
+
+	ffmem_free(i);
+	ffmem_free(a);
+	ffmem_free(b);
+}
+
+/** Integer sample as Q31 */
+static int fixed_q31(uint format, const void *d, size_t i)
+{
+	switch (format) {
+	case FFAUDIO_F_INT8:
+		return (int)((const char*)d)[i] * (1 << 24);
+	case FFAUDIO_F_INT16:
+		return (int)((const short*)d)[i] * (1 << 16);
+	case FFAUDIO_F_INT24:
+		return pcm_i32_i24((const char*)d + i * 3) * (1 << 8);
+	case FFAUDIO_F_INT24_4:
+		return ((const int*)d)[i] & ~0xff;
+	}
+	return ((const int*)d)[i];
+}
+
+/** Fixed-point mixing:  the same data with any CPU extensions,
+ within 1 LSB of the mix computed in double precision with the same gain levels */
+static void test_convert_fixed()
+{
+	static const uint fmt[] = { FFAUDIO_F_INT8, FFAUDIO_F_INT16, FFAUDIO_F_INT24, FFAUDIO_F_INT24_4, FFAUDIO_F_INT32 };
+	static const struct {
+		uint ich, och;
+		float gain;
+	} mix[] = {
+		{ 1, 1, 0.5f }, { 2, 2, 0.3f }, { 2, 1, 1 }, { 6, 2, 1 }, { 1, 2, 1.5f }, { 2, 2, -1 }, { 8, 8, 3 },
+	};
+	static const uint cpu[] = { 0, PCM_CPU_SSE2, ~0U };
+	enum { FRAMES = 333 };
+	int *i = ffmem_alloc(FRAMES * 8 * 4), *o = ffmem_alloc(FRAMES * 8 * 4), *o0 = ffmem_alloc(FRAMES * 8 * 4);
+	float level[8 * 8];
+
+	for (uint k = 0;  k != FRAMES * 8;  k++) {
+		uint r = k * 2654435761U;
+		i[k] = (k % 13 == 0) ? (int)0x80000000 : (k % 17 == 0) ? 0x7fffffff : (int)(r ^ r >> 15);
+	}
+
+	for (uint fi = 0;  fi != FF_COUNT(fmt);  fi++) {
+	for (uint fo = fi;  fo != FF_COUNT(fmt);  fo++) {
+	for (uint im = 0;  im != FF_COUNT(mix);  im++) {
+	for (uint lay = 0;  lay != 4;  lay++) {
+		uint ich = mix[im].ich, och = mix[im].och;
+		struct pcm_af in = {
+			.format = fmt[fi],
+			.channels = ich,
+			.interleaved = lay & 1,
+			.rate = 48000,
+		}, out = in;
+		out.format = fmt[fo];
+		out.channels = och;
+		out.interleaved = !!(lay & 2);
+		for (uint k = 0;  k != och * ich;  k++) {
+			level[k] = (ich == och && k % (ich + 1) != 0) ? 0 : 1.f / (1 + k % 3);
+		}
+
+		uint iw = pcm_f_bits(in.format) / 8, ow = pcm_f_bits(out.format) / 8;
+		void *ip[8], *op[8];
+		for (uint c = 0;  c != 8;  c++) {
+			ip[c] = (char*)i + c * FRAMES * iw;
+			op[c] = (char*)o + c * FRAMES * ow;
+		}
+		const void *id = (in.interleaved) ? (void*)i : ip;
+		void *od = (out.interleaved) ? (void*)o : op;
+
+		for (uint k = 0;  k != FF_COUNT(cpu);  k++) {
+			pcm_cpu_limit(cpu[k]);
+			struct pcm_convert_plan p;
+			xieq(0, pcm_convert_plan_init_fixed(&p, &out, &in, level, mix[im].gain));
+			xieq(0, pcm_convert_plan_run(&p, od, id, FRAMES));
+			pcm_convert_plan_destroy(&p);
+			if (k == 0)
+				ffmem_copy(o0, o, FRAMES * 8 * 4);
+			else
+				x(!memcmp(o0, o, FRAMES * och * ow));
+		}
+		pcm_cpu_limit(~0U);
+
+		uint obits = (out.format == FFAUDIO_F_INT24_4) ? 24 : pcm_f_bits(out.format);
+		double hi = ldexp(1, obits - 1) - 1, lo = -hi - 1;
+		for (uint f = 0;  f != FRAMES;  f++) {
+			for (uint oc = 0;  oc != och;  oc++) {
+				double sum = 0;
+				for (uint ic = 0;  ic != ich;  ic++) {
+					const void *s = (in.interleaved) ? (void*)i : ip[ic];
+					size_t si = (in.interleaved) ? f * ich + ic : f;
+					sum += (double)fixed_q31(in.format, s, si) * (level[oc * ich + ic] * mix[im].gain);
+				}
+				double e = ffmin(ffmax(floor(ldexp(sum, obits - 32) + 0.5), lo), hi);
+				const void *d = (out.interleaved) ? (void*)o : op[oc];
+				size_t di = (out.interleaved) ? f * och + oc : f;
+				double r = ldexp(fixed_q31(out.format, d, di), obits - 32);
+				x(fabs(r - e) <= 1);
+			}
+		}
+	}
+	}
+	}
+	}
+
+	struct pcm_convert_plan p;
+	struct pcm_af f32 = {
+		.format = FFAUDIO_F_FLOAT32,
+		.channels = 2,
+		.interleaved = 1,
+		.rate = 48000,
+	}, i16 = f32;
+	i16.format = FFAUDIO_F_INT16;
+	xieq(-1, pcm_convert_plan_init_fixed(&p, &i16, &f32, NULL, 1));
+
+	ffmem_free(i);
+	ffmem_free(o);
+	ffmem_free(o0);
+}
+
+/** Resample a sine wave;  fit the output to a sine of the same frequency (least squares).
+Return the gain (dB);  'snr': the level of the rest of the output relative to the fitted sine (dB) */
+static double resample_sine(uint quality, uint irate, uint orate, double freq, double *snr)
+{
+	const uint n = irate / 2;
+	float *i = ffmem_alloc(n * sizeof(float));
+	float *o = ffmem_alloc((n * 2 + 64) * sizeof(float));
+	for (uint k = 0;  k != n;  k++) {
+		i[k] = 0.5 * sin(2 * M_PI * freq * k / irate);
+	}
+
+	struct pcm_resample r;
+	xieq(0, pcm_resample_init(&r, 1, irate, orate, quality));
+	const float *ip[1] = { i };
+	float *op[1] = { o };
+	size_t on = pcm_resample_process(&r, op, ip, n);
+	pcm_resample_destroy(&r);
+
+	// skip the filter's transient response at both ends
+	size_t a = on / 8, b = on - on / 8;
+	double ys = 0, yc = 0, ss = 0, cc = 0, sc = 0;
+	for (size_t k = a;  k != b;  k++) {
+		double w = 2 * M_PI * freq * k / orate, sw = sin(w), cw = cos(w);
+		ys += o[k] * sw;
+		yc += o[k] * cw;
+		ss += sw * sw;
+		cc += cw * cw;
+		sc += sw * cw;
+	}
+	double det = ss * cc - sc * sc;
+	double as = (ys * cc - yc * sc) / det, ac = (yc * ss - ys * sc) / det;
+
+	double sig = 0, noise = 0;
+	for (size_t k = a;  k != b;  k++) {
+		double w = 2 * M_PI * freq * k / orate;
+		double y = as * sin(w) + ac * cos(w);
+		sig += y * y;
+		noise += (o[k] - y) * (o[k] - y);
+	}
+	*snr = 10 * log10(sig / noise);
+
+	ffmem_free(i);
+	ffmem_free(o);
+	return 20 * log10(sqrt(as * as + ac * ac) / 0.5);
+}
+
+/** Resampler quality:  flat passband and SNR on a stepped sine sweep, stopband attenuation */
+static void test_resample_quality()
+{
+	static const struct {
+		double passband; // relative to the lower rate
+		double ripple, snr, stopband; // dB
+	} tier[] = {
+		{ 0.30, 0.05, 55, -50 }, // PCM_RESAMPLE_LOW
+		{ 0.35, 0.01, 75, -75 }, // PCM_RESAMPLE_MEDIUM
+		{ 0.40, 0.01, 95, -95 }, // PCM_RESAMPLE_HIGH
+	};
+	static const uint rates[][2] = {
+		{ 44100, 48000 },
+		{ 48000, 44100 },
+		{ 48000, 16000 },
+	};
+
+	for (uint q = 0;  q != FF_COUNT(tier);  q++) {
+		for (uint ir = 0;  ir != FF_COUNT(rates);  ir++) {
+			uint irate = rates[ir][0], orate = rates[ir][1];
+			for (double f = 0.02;  f < tier[q].passband + 1e-9;  f += 0.02) {
+				double snr, gain = resample_sine(q, irate, orate, f * ffmin(irate, orate), &snr);
+				x(fabs(gain) <= tier[q].ripple);
+				x(snr >= tier[q].snr);
+			}
+		}
+
+		// above the output Nyquist frequency
+		for (double f = 0.6;  f < 0.9;  f += 0.1) {
+			double snr, gain = resample_sine(q, 48000, 16000, f * 16000, &snr);
+			x(gain <= tier[q].stopband);
+		}
+	}
+}
+
+static float f32_from_bits(uint u)
+{
+	union { float f; uint u; } v;
+	v.u = u;
+	return v.f;
+}
+
+/** 'h' is the nearest value to 'f' (the even one on a tie) */
+static int half_nearest(double f, ushort h, float (*to_flt)(ushort))
+{
+	double d = fabs(f - to_flt(h));
+	for (int k = -1;  k <= 1;  k += 2) {
+		ushort n = h + k;
+		if ((h & 0x7fff) == 0 && k < 0)
+			n = (h ^ 0x8000) + 1; // across zero
+		double dn = fabs(f - to_flt(n));
+		if (isnan(dn) || isinf(to_flt(n)))
+			continue;
+		if (dn < d || (dn == d && (h & 1)))
+			return 0;
+	}
+	return 1;
+}
+
+/** float16, bfloat16 <-> float32:
+ all 16-bit values;  round to nearest-even at the midpoints, overflow, NaN, Inf, subnormal values;
+ vectorized kernels (incl. F16C) produce the same data as the scalar code */
+static void test_half()
+{
+	static const uint fmt[] = { FFAUDIO_F_FLOAT16, FFAUDIO_F_BFLOAT16 };
+	static const uint cpu[] = { ~0U, PCM_CPU_SSE2 };
+	const uint n = 0x10000, nf = n * 4;
+	ushort *h = ffmem_alloc(nf * sizeof(ushort)), *h2 = ffmem_alloc(nf * sizeof(ushort));
+	float *f = ffmem_alloc(nf * sizeof(float)), *f2 = ffmem_alloc(nf * sizeof(float));
+	struct pcm_af af16 = {
+		.channels = 1,
+		.interleaved = 1,
+		.rate = 48000,
+	}, af32 = af16;
+	af32.format = FFAUDIO_F_FLOAT32;
+
+	for (uint i = 0;  i != n;  i++) {
+		h[i] = i;
+	}
+
+	for (uint k = 0;  k != FF_COUNT(fmt);  k++) {
+		int bf = (fmt[k] == FFAUDIO_F_BFLOAT16);
+		float (*to_flt)(ushort) = (bf) ? pcm_flt_bf16 : pcm_flt_f16;
+		ushort (*from_flt)(float) = (bf) ? pcm_bf16_flt : pcm_f16_flt;
+		ushort qnan = (bf) ? 0x40 : 0x200, exp = (bf) ? 0x7f80 : 0x7c00;
+		af16.format = fmt[k];
+
+		// all 16-bit values -> float -> 16-bit:  the same value;  NaN is quieted
+		for (uint i = 0;  i != n;  i++) {
+			float v = to_flt(i);
+			if ((i & exp) == exp && (i & ~(exp | 0x8000)) != 0) {
+				x(isnan(v));
+				x(from_flt(v) == (i | qnan));
+			} else {
+				x(from_flt(v) == i);
+			}
+		}
+		xieq(0, simd_convert(0, &af32, (char*)f, &af16, (char*)h, n));
+		for (uint c = 0;  c != FF_COUNT(cpu);  c++) {
+			xieq(0, simd_convert(cpu[c], &af32, (char*)f2, &af16, (char*)h, n));
+			x(!memcmp(f, f2, n * sizeof(float)));
+		}
+
+		// float -> 16-bit:  each finite value, the midpoints to the next value and their neighbours
+		uint m = 0;
+		for (uint i = 0;  i != n;  i++) {
+			float v = to_flt(i), next = to_flt(i + 1);
+			if (!isfinite(v) || !isfinite(next) || (i & 0x7fff) == 0x7fff)
+				continue;
+			float mid = ((double)v + next) / 2; // exact:  float has more mantissa bits
+			x((double)mid - v == (double)next - mid);
+			f[m++] = v;
+			f[m++] = mid;
+			f[m++] = nextafterf(mid, 0);
+			f[m++] = nextafterf(mid, 2 * mid);
+		}
+		for (uint i = 0;  i != m;  i++) {
+			x(half_nearest(f[i], from_flt(f[i]), to_flt));
+		}
+		// overflow, Inf, NaN with payload, the smallest floats
+		static const uint special[] = {
+			0x7f800000, 0xff800000, 0x7fc00000, 0xffc00001, 0x7f812345, 0x477ff000, 0x477fefff, 0x7f7fffff,
+			0x00000001, 0x80000001, 0x33000000, 0x33000001, 0x337fffff, 0x00800000,
+		};
+		for (uint i = 0;  i != FF_COUNT(special);  i++) {
+			f[m++] = f32_from_bits(special[i]);
+		}
+		if (!bf) {
+			xieq(0x7c00, pcm_f16_flt(65520)); // the midpoint between 65504 and 65536 rounds up to Inf
+			xieq(0x7bff, pcm_f16_flt(65519.996f));
+			xieq(0x0000, pcm_f16_flt(0x1p-25f)); // the midpoint between 0 and the smallest subnormal
+			xieq(0x0001, pcm_f16_flt(0x1.000002p-25f));
+			xieq(0x3c00, pcm_f16_flt(1 + 0x1p-11f));
+			xieq(0x3c02, pcm_f16_flt(1 + 0x3p-11f));
+		} else {
+			xieq(0x3f80, pcm_bf16_flt(1 + 0x1p-8f));
+			xieq(0x3f82, pcm_bf16_flt(1 + 0x3p-8f));
+			xieq(0x7f80, pcm_bf16_flt(0x1.ffffp127f));
+			xieq(0x0000, pcm_bf16_flt(f32_from_bits(0x00008000))); // subnormal float
+			xieq(0x0001, pcm_bf16_flt(f32_from_bits(0x00008001)));
+			xieq(0x0002, pcm_bf16_flt(f32_from_bits(0x00018000)));
+		}
+
+		xieq(0, simd_convert(0, &af16, (char*)h2, &af32, (char*)f, m));
+		for (uint i = 0;  i != m;  i++) {
+			x(h2[i] == from_flt(f[i]));
+		}
+		for (uint c = 0;  c != FF_COUNT(cpu);  c++) {
+			ushort *h3 = h;
+			xieq(0, simd_convert(cpu[c], &af16, (char*)h3, &af32, (char*)f, m));
+			x(!memcmp(h2, h3, m * sizeof(ushort)));
+			for (uint i = 0;  i != n;  i++) {
+				h[i] = i;
+			}
+		}
+	}
+
+	ffmem_free(h);
+	ffmem_free(h2);
+	ffmem_free(f);
+	ffmem_free(f2);
+}
+
+/** Parallel conversion produces the same data as pcm_convert() */
+static void test_convert_parallel()
+{
+	const uint frames = 300000;
+	struct pcm_af in = {
+		.format = FFAUDIO_F_INT16,
+		.channels = 6,
+		.interleaved = 1,
+		.rate = 48000,
+	};
+	struct pcm_af out = in;
+	out.format = FFAUDIO_F_FLOAT32;
+	out.channels = 2;
+	short *i16 = ffmem_alloc(frames * 6 * sizeof(short));
+	float *a = ffmem_alloc(frames * 2 * sizeof(float));
+	float *b = ffmem_alloc(frames * 2 * sizeof(float));
+	for (uint i = 0;  i != frames * 6;  i++) {
+		i16[i] = (short)(i * 7919);
+	}
+
+	struct pcm_pool pool;
+	xieq(0, pcm_pool_init(&pool, 4));
+	xieq(0, pcm_convert(&out, a, &in, i16, frames));
+	for (uint k = 0;  k != 2;  k++) {
+		// the second pass reuses the plan
+		ffmem_zero(b, frames * 2 * sizeof(float));
+		xieq(0, pcm_convert_parallel(&pool, &out, b, &in, i16, frames));
+		x(!memcmp(a, b, frames * 2 * sizeof(float)));
+	}
+
+	// the former channel selection encoding:  the plan is reused
+	out.channels = 1 | (1 + 1) << 4;
+	xieq(0, pcm_convert(&out, a, &in, i16, frames));
+	xieq(0, pcm_convert_parallel(&pool, &out, b, &in, i16, frames));
+	x(!memcmp(a, b, frames * sizeof(float)));
+	struct pcm_stats mark; // the workers don't use 'stats':  it's reset only if the plan is prepared again
+	pool.plan->stats = &mark;
+	xieq(0, pcm_convert_parallel(&pool, &out, b, &in, i16, frames));
+	x(pool.plan->stats == &mark);
+	pool.plan->stats = NULL;
+
+	out.rate = 44100;
+	xieq(-1, pcm_convert_parallel(&pool, &out, b, &in, i16, frames));
+
+	pcm_pool_destroy(&pool);
+	ffmem_free(i16);
+	ffmem_free(a);
+	ffmem_free(b);
+}
+
+/** The statistics measured inside the conversion and gain kernels are the same as pcm_stats_update() gives */
+static void stats_eq(const struct pcm_stats *a, const struct pcm_stats *b)
+{
+	xieq(b->channels, a->channels);
+	x(a->frames == b->frames);
+	for (uint c = 0;  c != b->channels;  c++) {
+		x(a->peak[c] == b->peak[c]);
+		x(a->clip[c] == b->clip[c]);
+		x(a->nonfinite[c] == b->nonfinite[c]);
+		// float accumulators:  the order of summation differs
+		x(fabs(a->sum2[c] - b->sum2[c]) <= 1e-5 * (1 + b->sum2[c]));
+	}
+}
+
+static void stats_fill(uint format, void *d, size_t n)
+{
+	for (size_t k = 0;  k != n;  k++) {
+		uint r = (uint)k * 2654435761U;
+		r ^= r >> 13;
+		if (format == FFAUDIO_F_INT16) {
+			((short*)d)[k] = (k % 97 == 3) ? -0x8000 : (short)r;
+		} else {
+			float f = (float)(int)r / 0x7fffffff * 1.3f;
+			if (k % 301 == 7)
+				f = (k & 1) ? NAN : INFINITY;
+			((float*)d)[k] = f;
+		}
+	}
+}
+
+/** Pointers to non-interleaved channels inside the buffer */
+static const void* stats_data(const struct pcm_af *af, void *d, void **ptr, size_t frames)
+{
+	if (af->interleaved)
+		return d;
+	for (uint c = 0;  c != af->channels;  c++) {
+		ptr[c] = (char*)d + c * frames * 4;
+	}
+	return ptr;
+}
+
+static void test_stats_convert(const struct pcm_af *in, const struct pcm_af *out, size_t frames, uint inplace)
+{
+	size_t n = frames * in->channels;
+	char *i = ffmem_alloc(n * 4), *a = ffmem_alloc(n * 4), *b = ffmem_alloc(n * 4);
+	void *pi[8], *pa[8], *pb[8];
+	stats_fill(in->format, i, n);
+	ffmem_copy(b, i, n * 4);
+	const void *di = stats_data(in, i, pi, frames);
+	void *da = (void*)stats_data(in, a, pa, frames);
+	void *db = (void*)stats_data(in, b, pb, frames);
+
+	struct pcm_stats ref, st;
+	pcm_stats_reset(&ref);
+	pcm_stats_reset(&st);
+	pcm_stats_update(&ref, in, di, frames);
+
+	struct pcm_convert_plan p;
+	xieq(0, pcm_convert_plan_init(&p, out, in));
+	pcm_convert_plan_run(&p, da, di, frames);
+	p.stats = &st;
+	// the input is not needed anymore:  write the output there or convert in-place
+	pcm_convert_plan_run(&p, (inplace) ? db : (void*)di, db, frames);
+	pcm_convert_plan_destroy(&p);
+	stats_eq(&st, &ref);
+
+	uint w = pcm_f_bits(out->format) / 8;
+	const char *o = (inplace) ? b : i;
+	if (in->interleaved) {
+		x(!memcmp(a, o, n * w));
+	} else {
+		for (uint c = 0;  c != in->channels;  c++) {
+			x(!memcmp(a + c * frames * 4, o + c * frames * 4, frames * w));
+		}
+	}
+
+	ffmem_free(i);
+	ffmem_free(a);
+	ffmem_free(b);
+}
+
+static void test_stats_gain(const struct pcm_af *af, size_t frames, const double *gain, uint ngain, uint ramp)
+{
+	size_t n = frames * af->channels;
+	uint w = pcm_f_bits(af->format) / 8;
+	char *i = ffmem_alloc(n * 4), *a = ffmem_alloc(n * 4), *b = ffmem_alloc(n * 4);
+	void *pi[8], *pa[8], *pb[8];
+	stats_fill(af->format, i, n);
+	const void *di = stats_data(af, i, pi, frames);
+	void *da = (void*)stats_data(af, a, pa, frames);
+	void *db = (void*)stats_data(af, b, pb, frames);
+
+	struct pcm_gain_state ga, gb;
+	pcm_gain_state_init(&ga);
+	pcm_gain_state_init(&gb);
+	pcm_gain_set(&ga, gain, ngain, ramp);
+	pcm_gain_set(&gb, gain, ngain, ramp);
+	struct pcm_stats ref, st;
+	pcm_stats_reset(&ref);
+	pcm_stats_reset(&st);
+	gb.stats = &st;
+	xieq(0, pcm_gain_process(&ga, af, di, da, frames));
+	xieq(0, pcm_gain_process(&gb, af, di, db, frames));
+	pcm_stats_update(&ref, af, da, frames);
+	stats_eq(&st, &ref);
+	if (af->interleaved) {
+		x(!memcmp(a, b, n * w));
+	} else {
+		for (uint c = 0;  c != af->channels;  c++) {
+			x(!memcmp(a + c * frames * 4, b + c * frames * 4, frames * w));
+		}
+	}
+
+	ffmem_free(i);
+	ffmem_free(a);
+	ffmem_free(b);
+}
+
+static void test_stats()
+{
+	static const uint cpu[] = { ~0U, PCM_CPU_SSE2, 0 };
+	static const uint fmt[] = { FFAUDIO_F_INT16, FFAUDIO_F_FLOAT32 };
+	static const uint chans[] = { 1, 2, 3, 6, 8 };
+	static const uint frames[] = { 1, 7, 333, 4097 };
+	static const double gain[] = { 0.7, 1, 1.9, 0.3, 0.5, 1, 0.1, 2 };
+
+	for (uint ic = 0;  ic != FF_COUNT(cpu);  ic++) {
+		pcm_cpu_limit(cpu[ic]);
+		for (uint ich = 0;  ich != FF_COUNT(chans);  ich++) {
+		for (uint il = 0;  il != 2;  il++) {
+		for (uint ifr = 0;  ifr != FF_COUNT(frames);  ifr++) {
+			struct pcm_af in = {
+				.channels = chans[ich],
+				.interleaved = il,
+				.rate = 48000,
+			}, out = in;
+			for (uint a = 0;  a != 2;  a++) {
+				in.format = fmt[a];
+				for (uint b = 0;  b != 2;  b++) {
+					out.format = fmt[b];
+					test_stats_convert(&in, &out, frames[ifr], 0);
+					if (b <= a)
+						test_stats_convert(&in, &out, frames[ifr], 1);
+				}
+				test_stats_gain(&in, frames[ifr], gain, 1, 0);
+				test_stats_gain(&in, frames[ifr], gain + 1, 1, 0);
+				test_stats_gain(&in, frames[ifr], gain, FF_COUNT(gain), 0);
+				test_stats_gain(&in, frames[ifr], gain, FF_COUNT(gain), frames[ifr] / 3 + 1);
+			}
+		}
+		}
+		}
+	}
+	pcm_cpu_limit(~0U);
+}
+
+struct loud_segment {
+	double dbfs; // sine amplitude;  -HUGE_VAL: silence
+	double sec;
+};
+
+/** Feed 1kHz sine segments of different level to the meter (all channels) */
+static void loud_tones(struct pcm_loudness *m, const struct loud_segment *seg, uint nseg)
+{
+	const struct pcm_af *af = &m->af;
+	uint nch = af->channels, w = pcm_f_bits(af->format) / 8;
+	const size_t block = 4410;
+	char *d = ffmem_alloc(block * nch * w);
+	void *ptr[8];
+	for (uint c = 0;  c != nch;  c++) {
+		ptr[c] = d + c * block * w;
+	}
+	size_t pos = 0;
+
+	for (uint i = 0;  i != nseg;  i++) {
+		double a = pow(10, seg[i].dbfs / 20);
+		size_t frames = seg[i].sec * af->rate;
+		for (size_t off = 0, n;  off != frames;  off += n) {
+			n = ffmin(frames - off, block);
+			for (size_t f = 0;  f != n;  f++) {
+				double v = a * sin(2 * M_PI * 1000 * (pos + f) / af->rate);
+				for (uint c = 0;  c != nch;  c++) {
+					size_t k = (af->interleaved) ? f * nch + c : c * block + f;
+					if (af->format == FFAUDIO_F_INT16)
+						((short*)d)[k] = lrint(v * 32767);
+					else
+						((float*)d)[k] = v;
+				}
+			}
+			xieq(0, pcm_loudness_process(m, (af->interleaved) ? (void*)d : ptr, n));
+			pos += n;
+		}
+	}
+
+	ffmem_free(d);
+}
+
+/** Loudness meter:  synthesized signals with the expected results of EBU Tech 3341 */
+static void test_loudness()
+{
+	struct pcm_af af = {
+		.format = FFAUDIO_F_FLOAT32,
+		.channels = 2,
+		.interleaved = 1,
+		.rate = 48000,
+	};
+	struct pcm_loudness m;
+
+	// stereo 1kHz sine at -23 dBFS:  -23 LUFS momentary, short-term and integrated
+	static const struct loud_segment c1[] = { { -23, 20 } };
+	xieq(0, pcm_loudness_init(&m, &af, PCM_CHMAP_WAV, 0));
+	loud_tones(&m, c1, FF_COUNT(c1));
+	x(fabs(pcm_loudness_momentary(&m) + 23) <= 0.1);
+	x(fabs(pcm_loudness_shortterm(&m) + 23) <= 0.1);
+	x(fabs(pcm_loudness_integrated(&m) + 23) <= 0.1);
+	x(fabs(pcm_loudness_replaygain(&m) - 5) <= 0.1);
+	pcm_loudness_destroy(&m);
+
+	// -33 dBFS;  int16, non-interleaved, 44.1kHz
+	static const struct loud_segment c2[] = { { -33, 20 } };
+	struct pcm_af af2 = af;
+	af2.format = FFAUDIO_F_INT16;
+	af2.interleaved = 0;
+	af2.rate = 44100;
+	xieq(0, pcm_loudness_init(&m, &af2, PCM_CHMAP_WAV, 0));
+	loud_tones(&m, c2, FF_COUNT(c2));
+	x(fabs(pcm_loudness_integrated(&m) + 33) <= 0.1);
+	pcm_loudness_destroy(&m);
+
+	// the relative gate excludes the quiet parts
+	static const struct loud_segment c3[] = { { -36, 10 }, { -23, 60 }, { -36, 10 } };
+	xieq(0, pcm_loudness_init(&m, &af, PCM_CHMAP_WAV, 0));
+	loud_tones(&m, c3, FF_COUNT(c3));
+	x(fabs(pcm_loudness_integrated(&m) + 23) <= 0.1);
+	pcm_loudness_destroy(&m);
+
+	// the absolute gate excludes the blocks below -70 LUFS
+	static const struct loud_segment c4[] = { { -72, 10 }, { -36, 10 }, { -23, 60 }, { -36, 10 }, { -72, 10 } };
+	xieq(0, pcm_loudness_init(&m, &af, PCM_CHMAP_WAV, 0));
+	loud_tones(&m, c4, FF_COUNT(c4));
+	x(fabs(pcm_loudness_integrated(&m) + 23) <= 0.1);
+	pcm_loudness_destroy(&m);
+
+	// louder part in the middle:  -26, -20, -26 dBFS
+	static const struct loud_segment c5[] = { { -26, 20 }, { -20, 20.1 }, { -26, 20 } };
+	xieq(0, pcm_loudness_init(&m, &af, PCM_CHMAP_WAV, 0));
+	loud_tones(&m, c5, FF_COUNT(c5));
+	x(fabs(pcm_loudness_integrated(&m) + 23) <= 0.1);
+	pcm_loudness_destroy(&m);
+
+	// everything is below the absolute gate;  silence
+	static const struct loud_segment c6[] = { { -75, 10 }, { -HUGE_VAL, 5 } };
+	xieq(0, pcm_loudness_init(&m, &af, PCM_CHMAP_WAV, 0));
+	loud_tones(&m, c6, FF_COUNT(c6));
+	x(pcm_loudness_integrated(&m) == -HUGE_VAL);
+	x(pcm_loudness_momentary(&m) < -70);
+	x(pcm_loudness_replaygain(&m) == 0);
+	pcm_loudness_destroy(&m);
+
+	// true peak of a sine at fs/4 with 45 degree phase:  the samples are at -3 dB of the peak
+	const uint frames = 48000;
+	float *d = ffmem_alloc(frames * 2 * sizeof(float));
+	for (uint f = 0;  f != frames;  f++) {
+		d[f * 2] = d[f * 2 + 1] = 0.5 * sin(M_PI / 2 * f + M_PI / 4);
+	}
+	xieq(0, pcm_loudness_init(&m, &af, PCM_CHMAP_WAV, PCM_LOUDNESS_TRUEPEAK));
+	xieq(0, pcm_loudness_process(&m, d, frames));
+	double tp = 20 * log10(pcm_loudness_truepeak(&m, 0) / 0.5);
+	x(tp >= -0.4 && tp <= 0.2);
+	pcm_loudness_destroy(&m);
+	ffmem_free(d);
+}
+
+static double time_sec()
+{
+#ifdef FF_WIN
+	LARGE_INTEGER c, f;
+	QueryPerformanceCounter(&c);
+	QueryPerformanceFrequency(&f);
+	return (double)c.QuadPart / f.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+/** Measure pcm_convert_parallel() with 1, 2, 4, ... workers up to the number of CPUs */
+static void bench_parallel()
+{
+	const uint frames = 48000 * 60, rounds = 10;
+	struct pcm_af in = {
+		.format = FFAUDIO_F_INT24,
+		.channels = 6,
+		.interleaved = 1,
+		.rate = 48000,
+	};
+	struct pcm_af out = in;
+	out.format = FFAUDIO_F_FLOAT32;
+	out.channels = 2;
+	void *i24 = ffmem_calloc(frames * 6, 3);
+	float *f = ffmem_alloc(frames * 2 * sizeof(float));
+	double t1 = 0;
+
+	for (uint n = 1;  ;  n *= 2) {
+		n = ffmin(n, _pcm_cpus());
+		struct pcm_pool pool;
+		xieq(0, pcm_pool_init(&pool, n));
+		xieq(0, pcm_convert_parallel(&pool, &out, f, &in, i24, frames)); // warm up
+		double t = time_sec();
+		for (uint i = 0;  i != rounds;  i++) {
+			xieq(0, pcm_convert_parallel(&pool, &out, f, &in, i24, frames));
+		}
+		t = (time_sec() - t) / rounds;
+		pcm_pool_destroy(&pool);
+
+		if (n == 1)
+			t1 = t;
+		fflog("threads:%u  %.3fms  x%.2f", n, t * 1000, t1 / t);
+		if (n == _pcm_cpus())
+			break;
+	}
+
+	ffmem_free(i24);
+	ffmem_free(f);
+}
+
+/** Measure mixing in fixed-point vs floating-point arithmetic, with the scalar code and with SIMD */
+static void bench_fixed()
+{
+	const uint frames = 48000, rounds = 50;
+	static const struct {
+		uint format, ich, och;
+		float gain;
+		const char *name;
+	} cfg[] = {
+		{ FFAUDIO_F_INT16, 6, 2, 1, "int16 5.1->stereo" },
+		{ FFAUDIO_F_INT16, 2, 2, 0.5f, "int16 stereo gain" },
+		{ FFAUDIO_F_INT24, 6, 2, 1, "int24 5.1->stereo" },
+		{ FFAUDIO_F_INT32, 2, 2, 0.5f, "int32 stereo gain" },
+		{ FFAUDIO_F_INT32, 6, 2, 1, "int32 5.1->stereo" },
+	};
+	int *i = ffmem_calloc(frames * 6, 4);
+	int *o = ffmem_alloc(frames * 2 * 4);
+	for (uint k = 0;  k != frames * 6;  k++) {
+		i[k] = (int)(k * 2654435761U) >> 1;
+	}
+
+	for (uint simd = 0;  simd != 2;  simd++) {
+		pcm_cpu_limit((simd) ? ~0U : 0);
+		for (uint c = 0;  c != FF_COUNT(cfg);  c++) {
+			struct pcm_af in = {
+				.format = cfg[c].format,
+				.channels = cfg[c].ich,
+				.interleaved = 1,
+				.rate = 48000,
+			}, out = in;
+			out.channels = cfg[c].och;
+			double t[2];
+
+			for (uint fixed = 0;  fixed != 2;  fixed++) {
+				struct pcm_convert_plan p;
+				if (fixed)
+					xieq(0, pcm_convert_plan_init_fixed(&p, &out, &in, NULL, cfg[c].gain));
+				else
+					xieq(0, pcm_convert_plan_init_mix(&p, &out, &in, NULL, cfg[c].gain));
+				xieq(0, pcm_convert_plan_run(&p, o, i, frames)); // warm up
+				t[fixed] = time_sec();
+				for (uint r = 0;  r != rounds;  r++) {
+					pcm_convert_plan_run(&p, o, i, frames);
+				}
+				t[fixed] = (time_sec() - t[fixed]) / rounds;
+				pcm_convert_plan_destroy(&p);
+			}
+
+			fflog("%s  %-18s  float:%.2fns/frame  fixed:%.2fns/frame  x%.2f"
+				, (simd) ? "simd  " : "scalar", cfg[c].name
+				, t[0] * 1e9 / frames, t[1] * 1e9 / frames, t[0] / t[1]);
+		}
+	}
+	pcm_cpu_limit(~0U);
+
+	ffmem_free(i);
+	ffmem_free(o);
+}
+
+/** Measure the resampler with each quality level:  stereo, 10 seconds of audio */
+static void bench_resample()
+{
+	static const char *const names[] = { "low", "medium", "high" };
+	static const uint rates[][2] = {
+		{ 44100, 48000 },
+		{ 48000, 44100 },
+		{ 48000, 16000 },
+		{ 96000, 48000 },
+	};
+	const uint seconds = 10, block = 1024;
+
+	for (uint q = 0;  q != FF_COUNT(names);  q++) {
+		for (uint ir = 0;  ir != FF_COUNT(rates);  ir++) {
+			uint irate = rates[ir][0], orate = rates[ir][1];
+			float *i = ffmem_alloc(2 * block * sizeof(float));
+			for (uint k = 0;  k != 2 * block;  k++) {
+				i[k] = 0.5 * sin(k * 0.05);
+			}
+			struct pcm_resample r;
+			xieq(0, pcm_resample_init(&r, 2, irate, orate, q));
+			size_t omax = pcm_resample_out_max(&r, block);
+			float *o = ffmem_alloc(2 * omax * sizeof(float));
+			const float *ip[2] = { i, i + block };
+			float *op[2] = { o, o + omax };
+
+			double t = time_sec();
+			for (size_t n = 0;  n < (size_t)irate * seconds;  n += block) {
+				pcm_resample_process(&r, op, ip, block);
+			}
+			t = time_sec() - t;
+
+			fflog("quality:%-6s  %u->%u  taps:%u  %.3fms/s  x%.0f realtime"
+				, names[q], irate, orate, r.f->taps, t * 1000 / seconds, seconds / t);
+			pcm_resample_destroy(&r);
+			ffmem_free(i);
+			ffmem_free(o);
+		}
+	}
+}
+
+int main(int argc, const char **argv)
+{
+	if (argc >= 2 && ffsz_eq(argv[1], "bench-parallel")) {
+		bench_parallel();
+		return 0;
+	}
+	if (argc >= 2 && ffsz_eq(argv[1], "bench-fixed")) {
+		bench_fixed();
+		return 0;
+	}
+	if (argc >= 2 && ffsz_eq(argv[1], "bench-resample")) {
+		bench_resample();
+		return 0;
+	}
+
+	test_convert_rate();
+	test_convert_chan_sel();
+	test_convert_mix_matrix();
+	test_convert_simd();
+	test_convert_fixed();
+	test_half();
+	test_convert_parallel();
+	test_resample_quality();
+	test_limiter();
+	test_stats();
+	test_loudness();
+	fflog("pcm: all tests passed");
+	return 0;
+}
@@ -9,6 +9,7 @@
 #include <test/test.h>
 #ifdef FF_LINUX
 #include <time.h>
+#include <poll.h>
 #endif
 typedef unsigned char u_char;
 
@@ -30,6 +31,20 @@ const ffaudio_interface *audio;
 int underrun;
 int skip_wav_header;
 
+/** Non-blocking mode: wait until the buffer signals its descriptors */
+static void wait_event(ffaudio_buf *b)
+{
+#ifdef FF_LINUX
+	struct pollfd fds[8];
+	int n;
+	if (audio->poll_fds == NULL
+		|| 0 >= (n = audio->poll_fds(b, fds, FF_COUNT(fds)))
+		|| n > (int)FF_COUNT(fds))
+		return;
+	poll(fds, n, -1);
+#endif
+}
+
 void list()
 {
 	ffaudio_dev *d;
@@ -94,6 +109,10 @@ void record(ffaudio_conf *conf, ffuint until_ms, ffuint flags)
 			fflog("ffaudio.read: %s", audio->error(b));
 		x(r >= 0);
 		data.len = r;
+		if (r == 0) {
+			wait_event(b);
+			continue;
+		}
 
 		ffstderr_write(data.ptr, data.len);
 		total += r;
@@ -186,6 +205,10 @@ void play(ffaudio_conf *conf, ffuint flags)
 			else
 				fflog(" %dms", r * 1000 / sec_bytes);
 			x(r >= 0);
+			if (r == 0) {
+				wait_event(b);
+				continue;
+			}
 			ffstr_shift(&data, r);
 			total_written += r;
 
@@ -213,6 +236,7 @@ void play(ffaudio_conf *conf, ffuint flags)
 			fflog("ffaudio.drain: %s", audio->error(b));
 		if (r != 0)
 			break;
+		wait_event(b);
 	}
 	x(r == 1);
 